@@ -0,0 +1,11 @@
+call bin\clean
+mkdir build
+g++ src/test/cpp/main.cpp -o build/test -std=c++23 -fopenmp -Ilib/eigen-3.4.0 -Ilib/MiniDNN/include -Wall -Werror || goto :error
+build\test || goto :error
+goto :success
+
+:error
+call bin\clean
+exit /b 1
+
+:success
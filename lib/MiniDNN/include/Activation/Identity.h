@@ -3,6 +3,7 @@
 
 #include <Eigen/Core>
 #include "../Config.h"
+#include "../Utils/ActivationTraits.h"
 
 namespace MiniDNN
 {
@@ -20,12 +21,20 @@ namespace MiniDNN
 class Identity
 {
     private:
-        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        template <typename Scalar>
+        struct Types
+        {
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            typedef Eigen::Ref<const Matrix> ConstRefMat;
+            typedef Eigen::Ref<Matrix> RefMat;
+        };
 
     public:
         // a = activation(z) = z
         // Z = [z1, ..., zn], A = [a1, ..., an], n observations
-        static inline void activate(const Matrix& Z, Matrix& A)
+        template <typename Scalar>
+        static inline void activate(const typename Types<Scalar>::ConstRefMat& Z,
+                                    typename Types<Scalar>::RefMat A)
         {
             A.noalias() = Z;
         }
@@ -35,8 +44,11 @@ class Identity
         // g = J * f = f
         // Z = [z1, ..., zn], G = [g1, ..., gn], F = [f1, ..., fn]
         // Note: When entering this function, Z and G may point to the same matrix
-        static inline void apply_jacobian(const Matrix& Z, const Matrix& A,
-                                          const Matrix& F, Matrix& G)
+        template <typename Scalar>
+        static inline void apply_jacobian(const typename Types<Scalar>::ConstRefMat& Z,
+                                          const typename Types<Scalar>::ConstRefMat& A,
+                                          const typename Types<Scalar>::ConstRefMat& F,
+                                          typename Types<Scalar>::RefMat G)
         {
             G.noalias() = F;
         }
@@ -48,6 +60,21 @@ class Identity
 };
 
 
+namespace internal
+{
+
+
+template <>
+struct ActivationTraits<Identity>
+{
+    static const bool in_place = true;
+    static const bool identity = true;
+    static const bool fast_mode = false;
+};
+
+
+} // namespace internal
+
 } // namespace MiniDNN
 
 
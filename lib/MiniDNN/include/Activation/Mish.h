@@ -3,6 +3,8 @@
 
 #include <Eigen/Core>
 #include "../Config.h"
+#include "../Utils/ActivationTraits.h"
+#include "../Utils/FastMath.h"
 
 namespace MiniDNN
 {
@@ -18,26 +20,34 @@ namespace MiniDNN
 class Mish
 {
     private:
-        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        template <typename Scalar>
+        struct Types
+        {
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            typedef Eigen::Ref<const Matrix> ConstRefMat;
+            typedef Eigen::Ref<Matrix> RefMat;
+        };
 
     public:
         // Mish(x) = x * tanh(softplus(x))
         // softplus(x) = log(1 + exp(x))
         // a = activation(z) = Mish(z)
         // Z = [z1, ..., zn], A = [a1, ..., an], n observations
-        static inline void activate(const Matrix& Z, Matrix& A)
+        template <typename Scalar>
+        static inline void activate(const typename Types<Scalar>::ConstRefMat& Z,
+                                    typename Types<Scalar>::RefMat A)
+        {
+            // h(x) = tanh(softplus(x)) is computed from a single exp(x) in each
+            // coefficient, see Utils/FastMath.h
+            A.array() = Z.array().unaryExpr(internal::mish_op<Scalar, false>());
+        }
+
+        // Same as activate(), with the approximation of exp in Utils/FastMath.h
+        template <typename Scalar>
+        static inline void activate_fast(const typename Types<Scalar>::ConstRefMat& Z,
+                                         typename Types<Scalar>::RefMat A)
         {
-            // h(x) = tanh(softplus(x)) = (1 + exp(x))^2 - 1
-            //                            ------------------
-            //                            (1 + exp(x))^2 + 1
-            // Let s = exp(-abs(x)), t = 1 + s
-            // If x >= 0, then h(x) = (t^2 - s^2) / (t^2 + s^2)
-            // If x <= 0, then h(x) = (t^2 - 1) / (t^2 + 1)
-            Matrix S = (-Z.array().abs()).exp();
-            A.array() = (S.array() + Scalar(1)).square();  // t^2
-            S.noalias() = (Z.array() >= Scalar(0)).select(S.cwiseAbs2(), Scalar(1));  // s^2 or 1
-            A.array() = (A.array() - S.array()) / (A.array() + S.array());
-            A.array() *= Z.array();
+            A.array() = Z.array().unaryExpr(internal::mish_op<Scalar, true>());
         }
 
         // Apply the Jacobian matrix J to a vector f
@@ -45,19 +55,16 @@ class Mish
         // g = J * f = Mish'(z) .* f
         // Z = [z1, ..., zn], G = [g1, ..., gn], F = [f1, ..., fn]
         // Note: When entering this function, Z and G may point to the same matrix
-        static inline void apply_jacobian(const Matrix& Z, const Matrix& A,
-                                          const Matrix& F, Matrix& G)
+        template <typename Scalar>
+        static inline void apply_jacobian(const typename Types<Scalar>::ConstRefMat& Z,
+                                          const typename Types<Scalar>::ConstRefMat& A,
+                                          const typename Types<Scalar>::ConstRefMat& F,
+                                          typename Types<Scalar>::RefMat G)
         {
-            // Let h(x) = tanh(softplus(x))
             // Mish'(x) = h(x) + x * h'(x)
             // h'(x) = tanh'(softplus(x)) * softplus'(x)
-            //       = [1 - h(x)^2] * exp(x) / (1 + exp(x))
-            //       = [1 - h(x)^2] / (1 + exp(-x))
-            // Mish'(x) = h(x) + [x - Mish(x) * h(x)] / (1 + exp(-x))
-            // A = Mish(Z) = Z .* h(Z) => h(Z) = A ./ Z, h(0) = 0.6
-            G.noalias() = (Z.array() == Scalar(0)).select(Scalar(0.6), A.cwiseQuotient(Z));
-            G.array() += (Z.array() - A.array() * G.array()) / (Scalar(1) + (-Z).array().exp());
-            G.array() *= F.array();
+            // Each coefficient of Z is read before the same coefficient of G is written
+            G.array() = Z.array().unaryExpr(internal::mish_derivative_op<Scalar>()) * F.array();
         }
 
         static std::string return_type()
@@ -67,6 +74,21 @@ class Mish
 };
 
 
+namespace internal
+{
+
+
+template <>
+struct ActivationTraits<Mish>
+{
+    static const bool in_place = false;
+    static const bool identity = false;
+    static const bool fast_mode = true;
+};
+
+
+} // namespace internal
+
 } // namespace MiniDNN
 
 
@@ -3,6 +3,7 @@
 
 #include <Eigen/Core>
 #include "../Config.h"
+#include "../Utils/ActivationTraits.h"
 
 namespace MiniDNN
 {
@@ -16,12 +17,20 @@ namespace MiniDNN
 class ReLU
 {
     private:
-        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        template <typename Scalar>
+        struct Types
+        {
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            typedef Eigen::Ref<const Matrix> ConstRefMat;
+            typedef Eigen::Ref<Matrix> RefMat;
+        };
 
     public:
         // a = activation(z) = max(z, 0)
         // Z = [z1, ..., zn], A = [a1, ..., an], n observations
-        static inline void activate(const Matrix& Z, Matrix& A)
+        template <typename Scalar>
+        static inline void activate(const typename Types<Scalar>::ConstRefMat& Z,
+                                    typename Types<Scalar>::RefMat A)
         {
             A.array() = Z.array().cwiseMax(Scalar(0));
         }
@@ -31,8 +40,11 @@ class ReLU
         // g = J * f = (a > 0) .* f
         // Z = [z1, ..., zn], G = [g1, ..., gn], F = [f1, ..., fn]
         // Note: When entering this function, Z and G may point to the same matrix
-        static inline void apply_jacobian(const Matrix& Z, const Matrix& A,
-                                          const Matrix& F, Matrix& G)
+        template <typename Scalar>
+        static inline void apply_jacobian(const typename Types<Scalar>::ConstRefMat& Z,
+                                          const typename Types<Scalar>::ConstRefMat& A,
+                                          const typename Types<Scalar>::ConstRefMat& F,
+                                          typename Types<Scalar>::RefMat G)
         {
             G.array() = (A.array() > Scalar(0)).select(F, Scalar(0));
         }
@@ -44,6 +56,21 @@ class ReLU
 };
 
 
+namespace internal
+{
+
+
+template <>
+struct ActivationTraits<ReLU>
+{
+    static const bool in_place = true;
+    static const bool identity = false;
+    static const bool fast_mode = false;
+};
+
+
+} // namespace internal
+
 } // namespace MiniDNN
 
 
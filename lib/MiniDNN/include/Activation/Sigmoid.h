@@ -3,6 +3,8 @@
 
 #include <Eigen/Core>
 #include "../Config.h"
+#include "../Utils/ActivationTraits.h"
+#include "../Utils/FastMath.h"
 
 namespace MiniDNN
 {
@@ -16,23 +18,42 @@ namespace MiniDNN
 class Sigmoid
 {
     private:
-        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        template <typename Scalar>
+        struct Types
+        {
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            typedef Eigen::Ref<const Matrix> ConstRefMat;
+            typedef Eigen::Ref<Matrix> RefMat;
+        };
 
     public:
         // a = activation(z) = 1 / (1 + exp(-z))
         // Z = [z1, ..., zn], A = [a1, ..., an], n observations
-        static inline void activate(const Matrix& Z, Matrix& A)
+        template <typename Scalar>
+        static inline void activate(const typename Types<Scalar>::ConstRefMat& Z,
+                                    typename Types<Scalar>::RefMat A)
         {
             A.array() = Scalar(1) / (Scalar(1) + (-Z.array()).exp());
         }
 
+        // a = [1 + tanh(z / 2)] / 2, with the approximation of tanh in Utils/FastMath.h
+        template <typename Scalar>
+        static inline void activate_fast(const typename Types<Scalar>::ConstRefMat& Z,
+                                         typename Types<Scalar>::RefMat A)
+        {
+            A.array() = Z.array().unaryExpr(internal::fast_sigmoid_op<Scalar>());
+        }
+
         // Apply the Jacobian matrix J to a vector f
         // J = d_a / d_z = diag(a .* (1 - a))
         // g = J * f = a .* (1 - a) .* f
         // Z = [z1, ..., zn], G = [g1, ..., gn], F = [f1, ..., fn]
         // Note: When entering this function, Z and G may point to the same matrix
-        static inline void apply_jacobian(const Matrix& Z, const Matrix& A,
-                                          const Matrix& F, Matrix& G)
+        template <typename Scalar>
+        static inline void apply_jacobian(const typename Types<Scalar>::ConstRefMat& Z,
+                                          const typename Types<Scalar>::ConstRefMat& A,
+                                          const typename Types<Scalar>::ConstRefMat& F,
+                                          typename Types<Scalar>::RefMat G)
         {
             G.array() = A.array() * (Scalar(1) - A.array()) * F.array();
         }
@@ -44,6 +65,21 @@ class Sigmoid
 };
 
 
+namespace internal
+{
+
+
+template <>
+struct ActivationTraits<Sigmoid>
+{
+    static const bool in_place = true;
+    static const bool identity = false;
+    static const bool fast_mode = true;
+};
+
+
+} // namespace internal
+
 } // namespace MiniDNN
 
 
@@ -1,6 +1,11 @@
 #ifndef ACTIVATION_SOFTMAX_H_
 #define ACTIVATION_SOFTMAX_H_
 
+#include <Eigen/Core>
+#include "../Config.h"
+#include "../Utils/ActivationTraits.h"
+#include "../Utils/FastMath.h"
+
 namespace MiniDNN
 {
 
@@ -13,17 +18,43 @@ namespace MiniDNN
 class Softmax
 {
     private:
-        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
-        typedef Eigen::Array<Scalar, 1, Eigen::Dynamic> RowArray;
+        template <typename Scalar>
+        struct Types
+        {
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            typedef Eigen::Ref<const Matrix> ConstRefMat;
+            typedef Eigen::Ref<Matrix> RefMat;
+        };
 
     public:
         // a = activation(z) = softmax(z)
         // Z = [z1, ..., zn], A = [a1, ..., an], n observations
-        static inline void activate(const Matrix& Z, Matrix& A)
+        template <typename Scalar>
+        static inline void activate(const typename Types<Scalar>::ConstRefMat& Z,
+                                    typename Types<Scalar>::RefMat A)
+        {
+            // Normalize each column in place, so that no temporary is needed
+            const int nobs = A.cols();
+
+            for (int i = 0; i < nobs; i++)
+            {
+                A.col(i).array() = (Z.col(i).array() - Z.col(i).maxCoeff()).exp();
+                A.col(i) /= A.col(i).sum();
+            }
+        }
+
+        // Same as activate(), with the approximation of exp in Utils/FastMath.h
+        template <typename Scalar>
+        static inline void activate_fast(const typename Types<Scalar>::ConstRefMat& Z,
+                                         typename Types<Scalar>::RefMat A)
         {
-            A.array() = (Z.rowwise() - Z.colwise().maxCoeff()).array().exp();
-            RowArray colsums = A.colwise().sum();
-            A.array().rowwise() /= colsums;
+            const int nobs = A.cols();
+
+            for (int i = 0; i < nobs; i++)
+            {
+                A.col(i).array() = (Z.col(i).array() - Z.col(i).maxCoeff()).unaryExpr(internal::fast_exp_op<Scalar>());
+                A.col(i) /= A.col(i).sum();
+            }
         }
 
         // Apply the Jacobian matrix J to a vector f
@@ -31,11 +62,19 @@ class Softmax
         // g = J * f = a .* f - a * (a' * f) = a .* (f - a'f)
         // Z = [z1, ..., zn], G = [g1, ..., gn], F = [f1, ..., fn]
         // Note: When entering this function, Z and G may point to the same matrix
-        static inline void apply_jacobian(const Matrix& Z, const Matrix& A,
-                                          const Matrix& F, Matrix& G)
+        template <typename Scalar>
+        static inline void apply_jacobian(const typename Types<Scalar>::ConstRefMat& Z,
+                                          const typename Types<Scalar>::ConstRefMat& A,
+                                          const typename Types<Scalar>::ConstRefMat& F,
+                                          typename Types<Scalar>::RefMat G)
         {
-            RowArray a_dot_f = A.cwiseProduct(F).colwise().sum();
-            G.array() = A.array() * (F.array().rowwise() - a_dot_f);
+            const int nobs = A.cols();
+
+            for (int i = 0; i < nobs; i++)
+            {
+                const Scalar a_dot_f = A.col(i).dot(F.col(i));
+                G.col(i).array() = A.col(i).array() * (F.col(i).array() - a_dot_f);
+            }
         }
 
         static std::string return_type()
@@ -45,6 +84,21 @@ class Softmax
 };
 
 
+namespace internal
+{
+
+
+template <>
+struct ActivationTraits<Softmax>
+{
+    static const bool in_place = true;
+    static const bool identity = false;
+    static const bool fast_mode = true;
+};
+
+
+} // namespace internal
+
 } // namespace MiniDNN
 
 
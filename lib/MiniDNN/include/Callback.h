@@ -8,6 +8,7 @@ namespace MiniDNN
 {
 
 
+template <typename Scalar>
 class Network;
 
 ///
@@ -26,6 +27,9 @@ class Network;
 /// that basically does nothing. See the VerboseCallback class for a verbose
 /// version that prints the loss function value in each mini-batch.
 ///
+/// \tparam Scalar Scalar type of the network, see the Network class.
+///
+template <typename Scalar = MiniDNN::Scalar>
 class Callback
 {
     protected:
@@ -38,23 +42,26 @@ class Callback
         int m_batch_id; // The index for the current mini-batch (0, 1, ..., m_nbatch-1)
         int m_nepoch;   // Total number of epochs (one run on the whole data set) in the training process
         int m_epoch_id; // The index for the current epoch (0, 1, ..., m_nepoch-1)
+        int m_queue_depth;   // Number of prefetched batches that were ready when the current batch was requested
+        double m_stall_time; // Time in seconds that training was blocked preparing the current batch
 
         Callback() :
-            m_nbatch(0), m_batch_id(0), m_nepoch(0), m_epoch_id(0)
+            m_nbatch(0), m_batch_id(0), m_nepoch(0), m_epoch_id(0),
+            m_queue_depth(0), m_stall_time(0)
         {}
 
         virtual ~Callback() {}
 
         // Before training a mini-batch
-        virtual void pre_training_batch(const Network* net, const Matrix& x,
+        virtual void pre_training_batch(const Network<Scalar>* net, const Matrix& x,
                                         const Matrix& y) {}
-        virtual void pre_training_batch(const Network* net, const Matrix& x,
+        virtual void pre_training_batch(const Network<Scalar>* net, const Matrix& x,
                                         const IntegerVector& y) {}
 
         // After a mini-batch is trained
-        virtual void post_training_batch(const Network* net, const Matrix& x,
+        virtual void post_training_batch(const Network<Scalar>* net, const Matrix& x,
                                          const Matrix& y) {}
-        virtual void post_training_batch(const Network* net, const Matrix& x,
+        virtual void post_training_batch(const Network<Scalar>* net, const Matrix& x,
                                          const IntegerVector& y) {}
 };
 
@@ -16,21 +16,26 @@ namespace MiniDNN
 ///
 /// Callback function that prints the loss function value in each mini-batch training
 ///
-class VerboseCallback: public Callback
+template <typename Scalar = MiniDNN::Scalar>
+class VerboseCallback: public Callback<Scalar>
 {
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::RowVectorXi IntegerVector;
+
     public:
-        void post_training_batch(const Network* net, const Matrix& x, const Matrix& y)
+        void post_training_batch(const Network<Scalar>* net, const Matrix& x, const Matrix& y)
         {
-            const Scalar loss = net->get_output()->loss();
-            std::cout << "[Epoch " << m_epoch_id << ", batch " << m_batch_id << "] Loss = "
+            const Scalar loss = net->training_loss();
+            std::cout << "[Epoch " << this->m_epoch_id << ", batch " << this->m_batch_id << "] Loss = "
                       << loss << std::endl;
         }
 
-        void post_training_batch(const Network* net, const Matrix& x,
+        void post_training_batch(const Network<Scalar>* net, const Matrix& x,
                                  const IntegerVector& y)
         {
-            Scalar loss = net->get_output()->loss();
-            std::cout << "[Epoch " << m_epoch_id << ", batch " << m_batch_id << "] Loss = "
+            Scalar loss = net->training_loss();
+            std::cout << "[Epoch " << this->m_epoch_id << ", batch " << this->m_batch_id << "] Loss = "
                       << loss << std::endl;
         }
 };
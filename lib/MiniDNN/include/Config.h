@@ -5,13 +5,22 @@ namespace MiniDNN
 {
 
 
-// Floating-point number type
+// Default floating-point number type of the models, i.e., the type used by
+// Network<>, Layer<>, etc. when no type is given. Models of another type can
+// be created by an explicit template argument, e.g. Network<float>, and models
+// of different types can be used in the same program
 #ifndef MDNN_SCALAR
 typedef double Scalar;
 #else
 typedef MDNN_SCALAR Scalar;
 #endif
 
+// The Eigen Tensor backend of Convolutional, see Convolutional::use_tensor_device(), is
+// only compiled when MINIDNN_USE_EIGEN_TENSOR is defined. It requires C++11, and
+// EIGEN_USE_THREADS must be defined before Eigen is first included, e.g. by compiling
+// with -DMINIDNN_USE_EIGEN_TENSOR -DEIGEN_USE_THREADS. The Tensor module takes much
+// longer to compile than the rest of the library
+
 
 } // namespace MiniDNN
 
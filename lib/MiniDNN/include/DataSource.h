@@ -0,0 +1,111 @@
+#ifndef DATASOURCE_H_
+#define DATASOURCE_H_
+
+#include <Eigen/Core>
+#include "Config.h"
+#include "RNG.h"
+#include "Utils/BatchSampler.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// \defgroup DataSources Data Sources
+///
+
+///
+/// \ingroup DataSources
+///
+/// The interface of data sources that feed mini-batches to Network::fit().
+///
+/// A data source reads the data set one mini-batch at a time, so the data
+/// set does not need to fit in memory as a whole. In each epoch the network
+/// calls reset() once, and then next_batch() until it returns `false`.
+///
+/// \tparam Scalar Scalar type of the network, see the Network class.
+///
+template <typename Scalar = MiniDNN::Scalar>
+class DataSource
+{
+    protected:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+    public:
+        virtual ~DataSource() {}
+
+        ///
+        /// Total number of observations in the data set, or a negative
+        /// value if it is unknown. Used to report the number of batches
+        /// to the callback function.
+        ///
+        virtual int size_hint() const
+        {
+            return -1;
+        }
+
+        ///
+        /// The largest number of observations in a mini-batch
+        ///
+        virtual int batch_size() const = 0;
+
+        ///
+        /// Rewind to the beginning of the data set
+        ///
+        /// \param rng The random number generator of the network, which can be used
+        ///            to reorder the observations in the new epoch.
+        ///
+        virtual void reset(RNG& rng) = 0;
+
+        ///
+        /// Read the next mini-batch
+        ///
+        /// \param x Predictors of the batch, with each column an observation.
+        ///          Will be resized if necessary.
+        /// \param y Response variables of the batch, with each column an observation.
+        ///          Will be resized if necessary.
+        /// \return  `false` if the end of the data set has been reached, in which
+        ///          case `x` and `y` are unspecified.
+        ///
+        virtual bool next_batch(Matrix& x, Matrix& y) = 0;
+};
+
+
+namespace internal
+{
+
+
+// Adapter that lets BatchPrefetcher read from a DataSource
+template <typename Scalar>
+class DataSourceReader
+{
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+        DataSource<Scalar>& m_data;
+
+    public:
+        typedef BatchBuffer<Matrix, Matrix> Buffer;
+
+        DataSourceReader(DataSource<Scalar>& data) :
+            m_data(data)
+        {}
+
+        void reset(RNG& rng)
+        {
+            m_data.reset(rng);
+        }
+
+        bool next_batch(Buffer& buf)
+        {
+            return m_data.next_batch(buf.x_batch(), buf.y_batch());
+        }
+};
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* DATASOURCE_H_ */
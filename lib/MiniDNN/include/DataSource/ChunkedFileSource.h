@@ -0,0 +1,215 @@
+#ifndef DATASOURCE_CHUNKEDFILESOURCE_H_
+#define DATASOURCE_CHUNKEDFILESOURCE_H_
+
+#include <Eigen/Core>
+#include <string>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include "../Config.h"
+#include "../RNG.h"
+#include "../DataSource.h"
+#include "../Utils/Random.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// \ingroup DataSources
+///
+/// Data source that reads binary files in chunks of observations
+///
+/// The files have the same format as in MappedFileSource: the raw `Scalar`
+/// values of the `x` and `y` matrices in column-major order. The data set is
+/// read one chunk at a time into a buffer of `chunk_size` observations, and
+/// mini-batches are drawn from the current chunk, so the memory usage only
+/// depends on the chunk size.
+///
+/// The chunks are read sequentially, and if shuffling is enabled, the
+/// observations are shuffled within each chunk. A larger chunk gives
+/// a better mixing of the data at the cost of more memory.
+///
+template <typename Scalar = MiniDNN::Scalar>
+class ChunkedFileSource: public DataSource<Scalar>
+{
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+        std::ifstream   m_xstream;
+        std::ifstream   m_ystream;
+        const int       m_dimx;
+        const int       m_dimy;
+        const int       m_nobs;
+        const int       m_batch_size;
+        const int       m_chunk_size;  // Number of observations in a chunk, a multiple of m_batch_size
+        const bool      m_shuffle;     // Whether to shuffle the observations within a chunk
+        RNG*            m_rng;         // RNG passed to reset(), used to shuffle the chunks
+        Matrix          m_xchunk;      // Observations of the current chunk
+        Matrix          m_ychunk;
+        Eigen::VectorXi m_id;          // Order of the observations in the current chunk
+        int             m_nread;       // Number of observations read from the files
+        int             m_chunk_nobs;  // Number of observations in the current chunk
+        int             m_pos;         // Position of the next batch in the chunk
+
+        // Open a file and return the number of observations in it
+        static int open(std::ifstream& stream, const std::string& filename, int dim)
+        {
+            stream.open(filename.c_str(), std::ios::in | std::ios::binary);
+
+            if (stream.fail())
+            {
+                throw std::runtime_error("Error while opening file " + filename);
+            }
+
+            stream.seekg(0, std::ios::end);
+            const std::streamoff bytes = stream.tellg();
+            const std::streamoff obs_bytes = std::streamoff(dim) * sizeof(Scalar);
+            stream.seekg(0, std::ios::beg);
+
+            if (dim <= 0 || bytes % obs_bytes != 0)
+            {
+                throw std::invalid_argument("[class ChunkedFileSource]: File size does not match the data dimension");
+            }
+
+            return bytes / obs_bytes;
+        }
+
+        static int check_batch_size(int batch_size)
+        {
+            if (batch_size <= 0)
+            {
+                throw std::invalid_argument("[class ChunkedFileSource]: Batch size must be positive");
+            }
+
+            return batch_size;
+        }
+
+        // Round the chunk size up to a multiple of the batch size, but do not
+        // allocate more than the whole data set
+        static int round_chunk_size(int chunk_size, int batch_size, int nobs)
+        {
+            const int nbatch = std::max(1, (chunk_size - 1) / batch_size + 1);
+            const int max_nbatch = std::max(1, (nobs - 1) / batch_size + 1);
+            return std::min(nbatch, max_nbatch) * batch_size;
+        }
+
+        static void read(std::ifstream& stream, Matrix& dest, int n)
+        {
+            stream.read(reinterpret_cast<char*>(dest.data()), std::streamsize(n) * dest.rows() * sizeof(Scalar));
+
+            if (stream.fail())
+            {
+                throw std::runtime_error("[class ChunkedFileSource]: Error while reading file");
+            }
+        }
+
+        // Read the next chunk of observations
+        void load_chunk()
+        {
+            m_chunk_nobs = std::min(m_chunk_size, m_nobs - m_nread);
+            m_pos = 0;
+
+            if (m_chunk_nobs <= 0)
+            {
+                return;
+            }
+
+            read(m_xstream, m_xchunk, m_chunk_nobs);
+            read(m_ystream, m_ychunk, m_chunk_nobs);
+            m_nread += m_chunk_nobs;
+            m_id.head(m_chunk_nobs).setLinSpaced(m_chunk_nobs, 0, m_chunk_nobs - 1);
+
+            if (m_shuffle && m_rng != NULL)
+            {
+                internal::shuffle(m_id.data(), m_chunk_nobs, *m_rng);
+            }
+        }
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param x_file     File of the predictors.
+        /// \param y_file     File of the response variables.
+        /// \param dimx       Number of predictors, i.e., rows of the `x` matrix.
+        /// \param dimy       Number of response variables, i.e., rows of the `y` matrix.
+        /// \param batch_size Mini-batch size.
+        /// \param chunk_size Number of observations held in memory. Rounded up to
+        ///                   a multiple of `batch_size`.
+        /// \param shuffle    Whether to shuffle the observations within each chunk.
+        ///
+        ChunkedFileSource(const std::string& x_file, const std::string& y_file,
+                          int dimx, int dimy, int batch_size, int chunk_size,
+                          bool shuffle = true) :
+            m_dimx(dimx), m_dimy(dimy),
+            m_nobs(open(m_xstream, x_file, dimx)),
+            m_batch_size(check_batch_size(batch_size)),
+            m_chunk_size(round_chunk_size(chunk_size, m_batch_size, m_nobs)),
+            m_shuffle(shuffle),
+            m_rng(NULL),
+            m_xchunk(dimx, m_chunk_size),
+            m_ychunk(dimy, m_chunk_size),
+            m_id(m_chunk_size),
+            m_nread(0), m_chunk_nobs(0), m_pos(0)
+        {
+            if (open(m_ystream, y_file, dimy) != m_nobs)
+            {
+                throw std::invalid_argument("[class ChunkedFileSource]: Input X and Y have different number of observations");
+            }
+        }
+
+        int size_hint() const
+        {
+            return m_nobs;
+        }
+
+        int batch_size() const
+        {
+            return std::min(m_batch_size, m_nobs);
+        }
+
+        void reset(RNG& rng)
+        {
+            m_rng = &rng;
+            m_xstream.clear();
+            m_ystream.clear();
+            m_xstream.seekg(0, std::ios::beg);
+            m_ystream.seekg(0, std::ios::beg);
+            m_nread = 0;
+            m_chunk_nobs = 0;
+            m_pos = 0;
+        }
+
+        bool next_batch(Matrix& x, Matrix& y)
+        {
+            if (m_pos >= m_chunk_nobs)
+            {
+                load_chunk();
+
+                if (m_chunk_nobs <= 0)
+                {
+                    return false;
+                }
+            }
+
+            const int n = std::min(m_batch_size, m_chunk_nobs - m_pos);
+            x.resize(m_dimx, n);
+            y.resize(m_dimy, n);
+
+            for (int j = 0; j < n; j++)
+            {
+                x.col(j).noalias() = m_xchunk.col(m_id[m_pos + j]);
+                y.col(j).noalias() = m_ychunk.col(m_id[m_pos + j]);
+            }
+
+            m_pos += n;
+            return true;
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* DATASOURCE_CHUNKEDFILESOURCE_H_ */
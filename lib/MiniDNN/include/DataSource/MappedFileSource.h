@@ -0,0 +1,245 @@
+#ifndef DATASOURCE_MAPPEDFILESOURCE_H_
+#define DATASOURCE_MAPPEDFILESOURCE_H_
+
+// Memory mapping is only implemented with the POSIX interface
+#ifndef _WIN32
+
+#include <Eigen/Core>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <cstddef>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../Config.h"
+#include "../RNG.h"
+#include "../DataSource.h"
+#include "../Utils/Random.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Read-only mapping of a whole file into memory
+class FileMapping
+{
+    private:
+        void*       m_addr;
+        std::size_t m_bytes;
+
+        FileMapping(const FileMapping&);
+        FileMapping& operator=(const FileMapping&);
+
+    public:
+        FileMapping(const std::string& filename) :
+            m_addr(NULL), m_bytes(0)
+        {
+            const int fd = open(filename.c_str(), O_RDONLY);
+
+            if (fd < 0)
+            {
+                throw std::runtime_error("Error while opening file " + filename);
+            }
+
+            struct stat st;
+
+            if (fstat(fd, &st) != 0)
+            {
+                close(fd);
+                throw std::runtime_error("Error while reading the size of file " + filename);
+            }
+
+            m_bytes = st.st_size;
+
+            if (m_bytes > 0)
+            {
+                m_addr = mmap(NULL, m_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+            }
+
+            // The mapping stays valid after the file is closed
+            close(fd);
+
+            if (m_addr == MAP_FAILED)
+            {
+                throw std::runtime_error("Error while mapping file " + filename);
+            }
+        }
+
+        ~FileMapping()
+        {
+            if (m_addr != NULL)
+            {
+                munmap(m_addr, m_bytes);
+            }
+        }
+
+        const unsigned char* data() const
+        {
+            return static_cast<const unsigned char*>(m_addr);
+        }
+
+        std::size_t size() const
+        {
+            return m_bytes;
+        }
+
+        // Tell the operating system that the given bytes are not needed for now,
+        // so that their pages can be dropped from the resident memory
+        // They are read again from the file if they are accessed later
+        void release_pages(std::size_t offset, std::size_t len) const
+        {
+            const std::size_t page = sysconf(_SC_PAGESIZE);
+            const std::size_t begin = offset / page * page;
+            madvise(static_cast<unsigned char*>(m_addr) + begin, offset + len - begin, MADV_DONTNEED);
+        }
+};
+
+
+} // namespace internal
+
+
+///
+/// \ingroup DataSources
+///
+/// Data source that reads mini-batches from memory-mapped binary files
+///
+/// The predictors and the response variables are stored in two files that
+/// contain the raw `Scalar` values of the matrices in column-major order,
+/// i.e., the bytes of `mat.data()`, so that each observation is contiguous.
+/// The files are mapped into memory rather than read, and the pages of a batch
+/// are handed back to the operating system after the batch has been copied,
+/// so the resident memory stays bounded for data sets of any size.
+///
+/// In each epoch the order of the batches is shuffled, but the observations of a
+/// batch are contiguous in the files, so that reads remain sequential.
+///
+/// This class is only available on POSIX systems. See ChunkedFileSource for a
+/// portable alternative that reads the same files.
+///
+template <typename Scalar = MiniDNN::Scalar>
+class MappedFileSource: public DataSource<Scalar>
+{
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+        const internal::FileMapping m_xfile;
+        const internal::FileMapping m_yfile;
+        const int       m_dimx;
+        const int       m_dimy;
+        const int       m_nobs;
+        const int       m_batch_size;
+        const int       m_nbatch;
+        const bool      m_shuffle;     // Whether to shuffle the batches in each epoch
+        Eigen::VectorXi m_order;       // Order of the batches in the current epoch
+        int             m_next;        // Position of the next batch in m_order
+
+        static int num_obs(const internal::FileMapping& file, int dim)
+        {
+            const std::size_t obs_bytes = std::size_t(dim) * sizeof(Scalar);
+
+            if (dim <= 0 || file.size() % obs_bytes != 0)
+            {
+                throw std::invalid_argument("[class MappedFileSource]: File size does not match the data dimension");
+            }
+
+            return file.size() / obs_bytes;
+        }
+
+        static int clamp_batch_size(int batch_size, int nobs)
+        {
+            if (batch_size <= 0)
+            {
+                throw std::invalid_argument("[class MappedFileSource]: Batch size must be positive");
+            }
+
+            return std::min(batch_size, nobs);
+        }
+
+        // Copy observations [start, start + n) of a file and release its pages
+        static void read_obs(const internal::FileMapping& file, int dim, int start, int n,
+                             Matrix& dest)
+        {
+            typedef Eigen::Map<const Matrix> ConstMapMat;
+            const std::size_t offset = std::size_t(start) * dim * sizeof(Scalar);
+            dest.noalias() = ConstMapMat(reinterpret_cast<const Scalar*>(file.data() + offset), dim, n);
+            file.release_pages(offset, std::size_t(n) * dim * sizeof(Scalar));
+        }
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param x_file     File of the predictors.
+        /// \param y_file     File of the response variables.
+        /// \param dimx       Number of predictors, i.e., rows of the `x` matrix.
+        /// \param dimy       Number of response variables, i.e., rows of the `y` matrix.
+        /// \param batch_size Mini-batch size.
+        /// \param shuffle    Whether to shuffle the order of the batches in each epoch.
+        ///
+        MappedFileSource(const std::string& x_file, const std::string& y_file,
+                         int dimx, int dimy, int batch_size, bool shuffle = true) :
+            m_xfile(x_file), m_yfile(y_file),
+            m_dimx(dimx), m_dimy(dimy),
+            m_nobs(num_obs(m_xfile, dimx)),
+            m_batch_size(clamp_batch_size(batch_size, m_nobs)),
+            m_nbatch(m_nobs > 0 ? (m_nobs - 1) / m_batch_size + 1 : 0),
+            m_shuffle(shuffle),
+            m_order(Eigen::VectorXi::LinSpaced(m_nbatch, 0, m_nbatch - 1)),
+            m_next(0)
+        {
+            if (num_obs(m_yfile, dimy) != m_nobs)
+            {
+                throw std::invalid_argument("[class MappedFileSource]: Input X and Y have different number of observations");
+            }
+        }
+
+        int size_hint() const
+        {
+            return m_nobs;
+        }
+
+        int batch_size() const
+        {
+            return m_batch_size;
+        }
+
+        void reset(RNG& rng)
+        {
+            if (m_shuffle)
+            {
+                internal::shuffle(m_order.data(), m_nbatch, rng);
+            }
+
+            m_next = 0;
+        }
+
+        bool next_batch(Matrix& x, Matrix& y)
+        {
+            if (m_next >= m_nbatch)
+            {
+                return false;
+            }
+
+            const int start = m_order[m_next] * m_batch_size;
+            const int n = std::min(m_batch_size, m_nobs - start);
+            x.resize(m_dimx, n);
+            y.resize(m_dimy, n);
+            read_obs(m_xfile, m_dimx, start, n, x);
+            read_obs(m_yfile, m_dimy, start, n, y);
+            m_next++;
+            return true;
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* _WIN32 */
+
+#endif /* DATASOURCE_MAPPEDFILESOURCE_H_ */
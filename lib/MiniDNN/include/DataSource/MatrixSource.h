@@ -0,0 +1,86 @@
+#ifndef DATASOURCE_MATRIXSOURCE_H_
+#define DATASOURCE_MATRIXSOURCE_H_
+
+#include <Eigen/Core>
+#include "../Config.h"
+#include "../RNG.h"
+#include "../DataSource.h"
+#include "../Utils/BatchSampler.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// \ingroup DataSources
+///
+/// Data source that draws mini-batches from matrices held in memory
+///
+/// The matrices are referenced rather than copied, so they must outlive
+/// this object. Fitting the network on this source is equivalent to
+/// calling Network::fit() on the matrices directly.
+///
+template <typename Scalar = MiniDNN::Scalar>
+class MatrixSource: public DataSource<Scalar>
+{
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef internal::BatchSampler<Matrix, Matrix, Matrix, Matrix> Sampler;
+
+        Sampler    m_sampler;
+        const bool m_shuffle;     // Whether to reshuffle the observations in each epoch
+        int        m_next;        // Index of the next batch in the epoch
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param x          The predictors. Each column is an observation.
+        /// \param y          The response variable. Each column is an observation.
+        /// \param batch_size Mini-batch size.
+        /// \param shuffle    Whether to reshuffle the observations in each epoch.
+        ///
+        MatrixSource(const Matrix& x, const Matrix& y, int batch_size, bool shuffle = true) :
+            m_sampler(x, y, batch_size),
+            m_shuffle(shuffle),
+            m_next(0)
+        {}
+
+        int size_hint() const
+        {
+            return m_sampler.num_obs();
+        }
+
+        int batch_size() const
+        {
+            return m_sampler.max_batch_size();
+        }
+
+        void reset(RNG& rng)
+        {
+            if (m_shuffle)
+            {
+                m_sampler.reset(rng);
+            }
+
+            m_next = 0;
+        }
+
+        bool next_batch(Matrix& x, Matrix& y)
+        {
+            if (m_next >= m_sampler.num_batches())
+            {
+                return false;
+            }
+
+            m_sampler.gather(m_next, x, y);
+            m_next++;
+            return true;
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* DATASOURCE_MATRIXSOURCE_H_ */
@@ -0,0 +1,116 @@
+#ifndef INFERENCESESSION_H_
+#define INFERENCESESSION_H_
+
+#include <Eigen/Core>
+#include <vector>
+#include <new>
+#include <stdexcept>
+#include "Config.h"
+#include "Layer.h"
+#include "Network.h"
+#include "Utils/Workspace.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// \ingroup Network
+///
+/// Per-thread state for making predictions with a shared network
+///
+/// Network::predict() writes into buffers owned by the layers, so one network
+/// can only make one prediction at a time. An InferenceSession refers to the
+/// parameters of a network, and only owns the memory of the intermediate
+/// results, which is reused across calls. Each thread can create its own session
+/// on the same network and call predict() concurrently, as long as the network
+/// itself is not modified (e.g. trained or given new parameters) at the same time.
+///
+/// \code
+/// // In each serving thread
+/// InferenceSession session(net);
+/// Matrix pred = session.predict(x);
+/// \endcode
+///
+template <typename Scalar = MiniDNN::Scalar>
+class InferenceSession
+{
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef typename Matrix::AlignedMapType AlignedMapMat;
+
+        const Network<Scalar>& m_net;
+        internal::Workspace    m_workspace;  // Memory of the intermediate results
+
+        // Copying a session would share the workspace
+        InferenceSession(const InferenceSession&);
+        InferenceSession& operator=(const InferenceSession&);
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param net The network to make predictions with. It must outlive the session.
+        ///
+        explicit InferenceSession(const Network<Scalar>& net) :
+            m_net(net)
+        {}
+
+        ///
+        /// Use the fitted model to make predictions
+        ///
+        /// \param x The predictors. Each column is an observation.
+        ///
+        Matrix predict(const Matrix& x)
+        {
+            const std::vector<Layer<Scalar>*>& layers = m_net.m_layers;
+            const int nlayer = layers.size();
+
+            if (nlayer <= 0)
+            {
+                return Matrix();
+            }
+
+            if (x.rows() != layers[0]->in_size())
+            {
+                throw std::invalid_argument("[class InferenceSession]: Input data have incorrect dimension");
+            }
+
+            // The output of each layer is kept until the end, while the temporaries
+            // of a layer are released before the next layer
+            const int nobs = x.cols();
+            std::size_t size = 0;
+
+            for (int i = 0; i < nlayer; i++)
+            {
+                size += layers[i]->inference_size(nobs);
+            }
+
+            m_workspace.reset();
+            m_workspace.reserve(size);
+            AlignedMapMat out = layers[0]->infer(x, m_workspace);
+
+            for (int i = 1; i < nlayer; i++)
+            {
+                AlignedMapMat next = layers[i]->infer(out, m_workspace);
+                new (&out) AlignedMapMat(next.data(), next.rows(), next.cols());
+            }
+
+            return out;
+        }
+
+        ///
+        /// Number of times that the memory of the intermediate results has been
+        /// (re)allocated. The memory grows with the largest batch seen so far.
+        ///
+        int num_workspace_allocations() const
+        {
+            return m_workspace.num_allocations();
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* INFERENCESESSION_H_ */
@@ -4,9 +4,12 @@
 #include <Eigen/Core>
 #include <vector>
 #include <map>
+#include <algorithm>
 #include "Config.h"
 #include "RNG.h"
 #include "Optimizer.h"
+#include "Utils/Workspace.h"
+#include "Utils/BlockedLayout.h"
 
 namespace MiniDNN
 {
@@ -23,15 +26,92 @@ namespace MiniDNN
 /// operations of hidden layers such as initialization, forward and backward
 /// propogation, and also functions to get/set parameters of the layer.
 ///
+/// \tparam Scalar Type of the parameters and of the data flowing through the layer,
+///                `float` or `double`.
+///
+template <typename Scalar = MiniDNN::Scalar>
 class Layer
 {
     protected:
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
+        typedef typename Matrix::AlignedMapType AlignedMapMat;
+        typedef typename Vector::AlignedMapType AlignedMapVec;
         typedef std::map<std::string, int> MetaInfo;
 
         const int m_in_size;  // Size of input units
         const int m_out_size; // Size of output units
+        bool m_input_grad;    // Whether backprop() computes the gradient of input units
+        bool m_fast_act;      // Whether the activation function uses its fast approximation
+        bool m_defer_act;     // Whether the activation function is left to the output layer
+        bool m_blocked_in;    // Whether the input images are in the blocked layout
+        bool m_blocked_out;   // Whether the output images are in the blocked layout
+
+        Vector      m_param_store; // Own storage of the parameters followed by their gradients, unless
+                                   // they were moved elsewhere by relocate_parameters()
+        Scalar*     m_param;       // Beginning of the parameter blocks, or NULL before they are allocated
+        Scalar*     m_deriv;       // Beginning of the gradient blocks
+        std::size_t m_param_len;   // Length of the parameter blocks, see parameter_size()
+        std::size_t m_param_version; // Number of changes of the parameters, see parameters_changed()
+
+        // Number of scalars taken by a parameter block of n values, so that the
+        // next block is aligned
+        static std::size_t block_length(std::size_t n)
+        {
+            return internal::Workspace::block_size<Scalar>(n) / sizeof(Scalar);
+        }
+
+        // Let the parameter blocks of this layer refer to 'param', and the gradient
+        // blocks to 'deriv', in the layout given by parameter_size()
+        // The values are not copied
+        virtual void bind_parameters(Scalar* param, Scalar* deriv) {}
+
+        // Allocate the parameters and the gradients with zero values, when the
+        // layer is initialized. If the size has not changed, the existing blocks
+        // are reused, so that the layer stays in the arena of its network
+        void allocate_parameters()
+        {
+            const std::size_t len = parameter_size();
+
+            if (m_param == NULL || m_param_len != len)
+            {
+                m_param_store.resize(2 * len);
+                m_param = m_param_store.data();
+                m_deriv = m_param + len;
+                m_param_len = len;
+            }
+
+            std::fill(m_param, m_param + len, Scalar(0));
+            std::fill(m_deriv, m_deriv + len, Scalar(0));
+            bind_parameters(m_param, m_deriv);
+        }
+
+        // Copy the parameters to the own storage of this layer. The copy constructor
+        // leaves the blocks of a copy referring to the original layer, so this is
+        // called by clone()
+        void own_parameters()
+        {
+            if (m_param == NULL)
+            {
+                return;
+            }
+
+            Vector store(2 * m_param_len);
+            std::copy(m_param, m_param + m_param_len, store.data());
+            std::copy(m_deriv, m_deriv + m_param_len, store.data() + m_param_len);
+            m_param_store.swap(store);
+            m_param = m_param_store.data();
+            m_deriv = m_param + m_param_len;
+            bind_parameters(m_param, m_deriv);
+        }
+
+        // Whether the parameters are in the own storage of this layer, rather
+        // than in memory that can be written outside of the layer
+        bool owns_parameters() const
+        {
+            return m_param != NULL && m_param == m_param_store.data();
+        }
 
     public:
         ///
@@ -43,7 +123,9 @@ class Layer
         ///                 equal to the number of input units of the next layer.
         ///
         Layer(const int in_size, const int out_size) :
-            m_in_size(in_size), m_out_size(out_size)
+            m_in_size(in_size), m_out_size(out_size), m_input_grad(true), m_fast_act(false),
+            m_defer_act(false), m_blocked_in(false), m_blocked_out(false),
+            m_param(NULL), m_deriv(NULL), m_param_len(0), m_param_version(0)
         {}
 
         ///
@@ -81,6 +163,39 @@ class Layer
         ///
         virtual void init() = 0;
 
+        ///
+        /// Size of the workspace memory, in bytes, that this layer keeps between
+        /// Layer::forward() and Layer::backprop() for a batch of `nobs`
+        /// observations, typically the output values and the gradient of the input.
+        /// Use internal::Workspace::block_size() to compute the size of each block.
+        ///
+        virtual std::size_t workspace_size(int nobs) const
+        {
+            return 0;
+        }
+
+        ///
+        /// Size of the temporary workspace memory, in bytes, that this layer needs
+        /// within one call of Layer::forward() or Layer::backprop() for a batch of
+        /// `nobs` observations. Temporary memory is shared by all layers.
+        ///
+        virtual std::size_t scratch_size(int nobs) const
+        {
+            return 0;
+        }
+
+        ///
+        /// Carve the buffers of this layer from the workspace before a batch of
+        /// `nobs` observations is processed. The workspace has been reserved with
+        /// at least the sizes reported by Layer::workspace_size() and
+        /// Layer::scratch_size(), and temporary memory should be obtained from it
+        /// between internal::Workspace::mark() and internal::Workspace::release().
+        ///
+        /// \param ws   The workspace shared by all layers of the network.
+        /// \param nobs Number of observations in the next Layer::forward() call.
+        ///
+        virtual void bind_workspace(internal::Workspace& ws, int nobs) {}
+
         ///
         /// Compute the output of this layer.
         ///
@@ -94,8 +209,33 @@ class Layer
         ///                        input of this layer. `prev_layer_data` should have
         ///                        `in_size` rows as in the constructor, and each
         ///                        column of `prev_layer_data` is an observation.
+        ///                        The columns are stored contiguously.
         ///
-        virtual void forward(const Matrix& prev_layer_data) = 0;
+        virtual void forward(const ConstRefMat& prev_layer_data) = 0;
+
+        ///
+        /// Size of the workspace memory, in bytes, that Layer::infer() needs for a
+        /// batch of `nobs` observations, including the block of the output values.
+        ///
+        virtual std::size_t inference_size(int nobs) const = 0;
+
+        ///
+        /// Compute the output of this layer without changing the state of the layer
+        ///
+        /// Unlike Layer::forward(), this function only reads the parameters of the
+        /// layer and takes all buffers from the given workspace, so several threads
+        /// can call it concurrently on the same layer, each with its own workspace.
+        ///
+        /// \param prev_layer_data The output of previous layer, as in Layer::forward().
+        /// \param ws              The workspace of the caller, which has at least
+        ///                        Layer::inference_size() bytes available. The output
+        ///                        is the first block allocated from it, and the
+        ///                        temporary blocks are released before returning.
+        /// \return                A map of the output values in `ws`, with
+        ///                        `out_size` rows and one column per observation.
+        ///
+        virtual AlignedMapMat infer(const ConstRefMat& prev_layer_data,
+                                    internal::Workspace& ws) const = 0;
 
         ///
         /// Obtain the output values of this layer
@@ -110,7 +250,7 @@ class Layer
         ///         and have number of columns equal to that of `prev_layer_data` in the
         ///         Layer::forward() function. Each column represents an observation.
         ///
-        virtual const Matrix& output() const = 0;
+        virtual const AlignedMapMat& output() const = 0;
 
         ///
         /// Compute the gradients of parameters and input units using back-propagation
@@ -129,8 +269,130 @@ class Layer
         ///                        `out_size` rows as in the constructor, and the same
         ///                        number of columns as `prev_layer_data`.
         ///
-        virtual void backprop(const Matrix& prev_layer_data,
-                              const Matrix& next_layer_data) = 0;
+        virtual void backprop(const ConstRefMat& prev_layer_data,
+                              const ConstRefMat& next_layer_data) = 0;
+
+        ///
+        /// Set whether Layer::backprop() computes the gradient of input units.
+        /// Network::add_layer() turns it off for the first layer, whose input
+        /// gradient is the gradient of the input data and is not used in training.
+        /// When it is off, the content of Layer::backprop_data() is unspecified.
+        ///
+        void set_input_gradient(bool enabled)
+        {
+            m_input_grad = enabled;
+        }
+        ///
+        /// Whether Layer::backprop() computes the gradient of input units.
+        ///
+        bool input_gradient() const
+        {
+            return m_input_grad;
+        }
+
+        ///
+        /// Set whether the activation function of this layer is evaluated with a fast
+        /// approximation. Sigmoid, Tanh, Softmax and Mish then use vectorized polynomial
+        /// or rational approximations of `exp()` and `tanh()`, with about the accuracy of
+        /// single precision (see Utils/FastMath.h), and the other activations are exact.
+        /// It is off by default, and is usually set for the whole network with
+        /// Network::set_fast_activation().
+        ///
+        void set_fast_activation(bool enabled)
+        {
+            m_fast_act = enabled;
+        }
+        ///
+        /// Whether the activation function of this layer uses its fast approximation.
+        ///
+        bool fast_activation() const
+        {
+            return m_fast_act;
+        }
+
+        ///
+        /// Whether this layer can leave its activation function to the output layer,
+        /// see Layer::set_deferred_activation().
+        ///
+        virtual bool can_defer_activation() const
+        {
+            return false;
+        }
+
+        ///
+        /// Set whether the activation function of this layer is left to the output
+        /// layer. When it is on, Layer::forward() only computes the linear term `z`,
+        /// which is then returned by Layer::output(), and Layer::backprop() receives
+        /// the derivative of the loss with respect to `z` and skips the Jacobian of
+        /// the activation. Layer::infer() is not affected. The network sets it on
+        /// the last hidden layer in training when the output layer fuses the
+        /// activation with the loss, see Output::fuse_activation().
+        ///
+        void set_deferred_activation(bool enabled)
+        {
+            m_defer_act = enabled && can_defer_activation();
+        }
+        ///
+        /// Whether the activation function of this layer is left to the output layer.
+        ///
+        bool deferred_activation() const
+        {
+            return m_defer_act;
+        }
+
+        ///
+        /// Number of channels of the input images if this layer can read them in the
+        /// blocked layout, see Layer::set_blocked_layout(), or 0 otherwise.
+        ///
+        virtual int blocked_in_channels() const
+        {
+            return 0;
+        }
+        ///
+        /// Number of channels of the output images if this layer can write them in the
+        /// blocked layout, see Layer::set_blocked_layout(), or 0 otherwise.
+        ///
+        virtual int blocked_out_channels() const
+        {
+            return 0;
+        }
+
+        ///
+        /// Set whether the images exchanged with the previous and the next layers are
+        /// in the blocked channel-interleaved layout (NCHWc) instead of the planar
+        /// layout, where each channel is stored after the previous one. In the blocked
+        /// layout, the channels are grouped by the number of scalars of a SIMD packet,
+        /// and the values of a group at each pixel are adjacent, see Utils/BlockedLayout.h.
+        /// This applies to the input and its gradient, and to the output and its
+        /// gradient, in Layer::forward(), Layer::backprop() and Layer::infer().
+        ///
+        /// A side is only switched to the blocked layout if the layer supports it and its
+        /// number of channels is a multiple of the packet size, so that both layouts have
+        /// the same size. The network sets it between the convolutional and pooling
+        /// layers when it is enabled by Network::set_blocked_layout().
+        ///
+        /// \param input  Whether the input images are in the blocked layout.
+        /// \param output Whether the output images are in the blocked layout.
+        ///
+        void set_blocked_layout(bool input, bool output)
+        {
+            m_blocked_in = input && internal::blocked_layout_exact<Scalar>(blocked_in_channels());
+            m_blocked_out = output && internal::blocked_layout_exact<Scalar>(blocked_out_channels());
+        }
+        ///
+        /// Whether the input images are in the blocked layout.
+        ///
+        bool blocked_input() const
+        {
+            return m_blocked_in;
+        }
+        ///
+        /// Whether the output images are in the blocked layout.
+        ///
+        bool blocked_output() const
+        {
+            return m_blocked_out;
+        }
 
         ///
         /// Obtain the gradient of input units of this layer
@@ -139,14 +401,14 @@ class Layer
         /// of the previous layer, since the derivative of the input of this layer is also the derivative
         /// of the output of previous layer.
         ///
-        virtual const Matrix& backprop_data() const = 0;
+        virtual const AlignedMapMat& backprop_data() const = 0;
 
         ///
         /// Update parameters after back-propagation
         ///
         /// \param opt The optimization algorithm to be used. See the Optimizer class.
         ///
-        virtual void update(Optimizer& opt) = 0;
+        virtual void update(Optimizer<Scalar>& opt) = 0;
 
         ///
         /// Get serialized values of parameters
@@ -162,6 +424,107 @@ class Layer
         ///
         virtual std::vector<Scalar> get_derivatives() const = 0;
 
+        ///
+        /// Create a copy of this layer, including its parameters. It is used to
+        /// build the worker replicas in data-parallel training.
+        ///
+        virtual Layer* clone() const = 0;
+
+        ///
+        /// Number of scalars taken by the parameters of this layer. The parameter
+        /// blocks are stored one after another in the order of Layer::get_parameters(),
+        /// each padded with zeros to a multiple of 64 bytes so that all the blocks
+        /// are aligned. The gradient blocks have the same layout.
+        ///
+        virtual std::size_t parameter_size() const
+        {
+            return 0;
+        }
+
+        ///
+        /// Move the parameters and the gradients of this layer to external memory,
+        /// keeping their values. The network uses it to place the parameters of all
+        /// its layers in one contiguous buffer.
+        ///
+        /// \param param Memory of `parameter_size()` scalars, aligned like the data of
+        ///              an Eigen vector, that receives the parameter blocks.
+        /// \param deriv Memory of the same size that receives the gradient blocks.
+        ///
+        /// Both must outlive the layer, or the next call to this function or to
+        /// `init()`. The parameters are set to zero if they were not allocated yet.
+        ///
+        void relocate_parameters(Scalar* param, Scalar* deriv)
+        {
+            const std::size_t len = parameter_size();
+
+            if (param == m_param && deriv == m_deriv && len == m_param_len)
+            {
+                return;
+            }
+
+            if (m_param != NULL && len == m_param_len)
+            {
+                std::copy(m_param, m_param + len, param);
+                std::copy(m_deriv, m_deriv + len, deriv);
+            }
+            else
+            {
+                std::fill(param, param + len, Scalar(0));
+                std::fill(deriv, deriv + len, Scalar(0));
+            }
+
+            m_param = param;
+            m_deriv = deriv;
+            m_param_len = len;
+            m_param_store.resize(0);
+            bind_parameters(param, deriv);
+        }
+
+        ///
+        /// Beginning of the parameter blocks of this layer, or NULL if they are not
+        /// allocated. See Layer::parameter_size().
+        ///
+        const Scalar* parameter_data() const
+        {
+            return m_param;
+        }
+
+        ///
+        /// Notify the layer that its parameters have changed outside of Layer::update()
+        /// and Layer::set_parameters(), which account for their own changes. The network
+        /// calls it after each optimizer step on its arena, and it must be called after
+        /// writing to the blocks of Layer::parameter_blocks(). It increments
+        /// Layer::parameter_version(), and layers that keep data derived from their
+        /// parameters, such as the transformed filters of Convolutional, recompute them.
+        ///
+        virtual void parameters_changed()
+        {
+            m_param_version++;
+        }
+
+        ///
+        /// Number of changes of the parameters notified by Layer::parameters_changed().
+        /// Data derived from the parameters are up to date if they were computed with
+        /// the current version.
+        ///
+        std::size_t parameter_version() const
+        {
+            return m_param_version;
+        }
+
+        ///
+        /// Append the parameter blocks of this layer to `params`, and the
+        /// gradient blocks to `derivs` in the same order. Layers without
+        /// parameters append nothing.
+        ///
+        /// The blocks are views of the parameters of the layer, wherever they are stored
+        /// (see Layer::relocate_parameters()), so they can be used to
+        /// reduce gradients or synchronize parameters without copying. Call
+        /// Layer::parameters_changed() after writing to the parameter blocks.
+        ///
+        virtual void parameter_blocks(std::vector<AlignedMapVec>& params,
+                                      std::vector<AlignedMapVec>& derivs) {}
+
         ///
         /// Return the layer type. It is used to export the NN model.
         ///
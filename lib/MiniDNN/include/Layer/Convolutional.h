@@ -3,10 +3,20 @@
 
 #include <Eigen/Core>
 #include <vector>
+#include <complex>
+#include <new>
+#include <algorithm>
 #include <stdexcept>
 #include "../Config.h"
 #include "../Layer.h"
+#include "../Utils/ActivationTraits.h"
 #include "../Utils/Convolution.h"
+#include "../Utils/Winograd.h"
+#include "../Utils/FFTConvolution.h"
+#include "../Utils/BlockedConvolution.h"
+#ifdef MINIDNN_USE_EIGEN_TENSOR
+#include "../Utils/TensorConvolution.h"
+#endif
 #include "../Utils/Random.h"
 #include "../Utils/IO.h"
 #include "../Utils/Enum.h"
@@ -21,35 +31,383 @@ namespace MiniDNN
 ///
 /// Convolutional hidden layer
 ///
-/// Currently only supports the "valid" rule of convolution.
+/// The filter moves by a given stride, and the input channels can be padded with
+/// zeros on each side. The default is the "valid" rule of convolution, with stride
+/// 1 and no padding. For a window of odd size, a padding of (window - 1) / 2 with
+/// stride 1 gives the "same" rule, where the output has the size of the input.
 ///
-template <typename Activation>
-class Convolutional: public Layer
+/// The forward pass of layers with 3x3 filters, stride 1, and at least 32 input
+/// and output channels uses the Winograd algorithm, which needs 2.25 to 4 times
+/// fewer multiplications, see use_winograd(). Layers with filters of 5x5 or larger
+/// and stride 1 use the fast Fourier transform (FFT) in the forward and backward
+/// passes when it is estimated to be faster, see use_fft().
+///
+/// When MINIDNN_USE_EIGEN_TENSOR is defined (see Config.h), the convolutions can
+/// instead be computed by the Eigen Tensor module on a thread pool device, see
+/// use_tensor_device(). Which backend is faster depends on the shape of the layer and
+/// the machine, and can be measured for each layer.
+///
+/// When the layer exchanges images in the blocked layout with an adjacent layer (see
+/// Network::set_blocked_layout()), the forward and backward passes use the direct
+/// convolution on blocked images instead, which takes precedence over the other
+/// algorithms and backends.
+///
+template <typename Activation, typename Scalar = MiniDNN::Scalar>
+class Convolutional: public Layer<Scalar>
 {
     private:
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
-        typedef Matrix::ConstAlignedMapType ConstAlignedMapMat;
-        typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
-        typedef Vector::AlignedMapType AlignedMapVec;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
+        typedef typename Matrix::AlignedMapType AlignedMapMat;
+        typedef typename Matrix::ConstAlignedMapType ConstAlignedMapMat;
+        typedef typename Vector::ConstAlignedMapType ConstAlignedMapVec;
+        typedef typename Vector::AlignedMapType AlignedMapVec;
         typedef std::map<std::string, int> MetaInfo;
+        typedef std::complex<Scalar> Complex;
+        typedef Eigen::Matrix<Complex, Eigen::Dynamic, 1> ComplexVector;
+        typedef std::vector< internal::FFTBuffers<Scalar> > FFTBufferList;
 
         const internal::ConvDims m_dim; // Various dimensions of convolution
 
 
-        Vector m_filter_data;  // Filter parameters. Total length is
-                               // (in_channels x out_channels x filter_rows x filter_cols)
-                               // See Utils/Convolution.h for its layout
+        // The parameters refer to the storage of the layer or to the arena of the network
+        AlignedMapVec m_filter_data; // Filter parameters. Total length is
+                                     // (in_channels x out_channels x filter_rows x filter_cols)
+                                     // See Utils/Convolution.h for its layout
+
+        AlignedMapVec m_df_data;     // Derivative of filters, same dimension as m_filter_data
+
+        AlignedMapVec m_bias;        // Bias term for the output channels, out_channels x 1. (One bias term per channel)
+        AlignedMapVec m_db;          // Derivative of bias, same dimension as m_bias
+
+        int    m_wino_tile;    // Output tile size of the Winograd algorithm, or 0 if it is not used
+        Vector m_wino_filter;  // Filters transformed for the Winograd algorithm
+        int    m_fft_rows;     // Size of the FFT grid, or 0 if the FFT convolution is not used
+        int    m_fft_cols;
+        ComplexVector m_fft_filter; // Spectra of the filters for the FFT convolution
+        FFTBufferList m_fft_bufs;   // FFT plans and buffers of the threads
+        bool   m_trans_valid;  // Whether m_wino_filter or m_fft_filter was computed for the current algorithm
+        std::size_t m_trans_version; // Parameter version of m_wino_filter and m_fft_filter
+        int    m_trans_count;  // Number of times the filters were transformed by refresh_transforms()
+#ifdef MINIDNN_USE_EIGEN_TENSOR
+        const Eigen::ThreadPoolDevice* m_device; // Device of the Eigen Tensor backend, or NULL
+                                                 // for the built-in convolutions
+#endif
+
+        // The following buffers are carved from the workspace of the network
+        AlignedMapMat m_z;     // Linear term, z = conv(in, w) + b. Each column is an observation
+        AlignedMapMat m_a;     // Output of this layer, a = act(z)
+        AlignedMapMat m_din;   // Derivative of the input of this layer
+                               // Note that input of this layer is also the output of previous layer
+        internal::Workspace* m_workspace; // Workspace for temporary matrices
 
-        Vector m_df_data;      // Derivative of filters, same dimension as m_filter_data
+        std::size_t filter_size() const
+        {
+            return std::size_t(m_dim.in_channels) * m_dim.out_channels *
+                   m_dim.filter_rows * m_dim.filter_cols;
+        }
 
-        Vector m_bias;         // Bias term for the output channels, out_channels x 1. (One bias term per channel)
-        Vector m_db;           // Derivative of bias, same dimension as m_bias
+        void bind_parameters(Scalar* param, Scalar* deriv)
+        {
+            const std::size_t flen = this->block_length(filter_size());
+            new (&m_filter_data) AlignedMapVec(param, filter_size());
+            new (&m_bias) AlignedMapVec(param + flen, m_dim.out_channels);
+            new (&m_df_data) AlignedMapVec(deriv, filter_size());
+            new (&m_db) AlignedMapVec(deriv + flen, m_dim.out_channels);
+        }
 
-        Matrix m_z;            // Linear term, z = conv(in, w) + b. Each column is an observation
-        Matrix m_a;            // Output of this layer, a = act(z)
-        Matrix m_din;          // Derivative of the input of this layer
-                               // Note that input of this layer is also the output of previous layer
+        // Whether the transformed filters match the current parameters
+        bool transforms_valid() const
+        {
+            return m_trans_valid && m_trans_version == this->m_param_version;
+        }
+
+        // Whether the convolutions are computed by the Eigen Tensor module
+        bool tensor_backend() const
+        {
+#ifdef MINIDNN_USE_EIGEN_TENSOR
+            return m_device != NULL;
+#else
+            return false;
+#endif
+        }
+
+        // Whether the convolutions are computed on images in the blocked layout
+        bool blocked() const
+        {
+            return this->m_blocked_in || this->m_blocked_out;
+        }
+
+        // Transform the filters for the Winograd algorithm or the FFT after they are changed
+        void refresh_transforms()
+        {
+            // The Tensor backend and the blocked convolution use the filters directly
+            if (m_filter_data.size() <= 0 || tensor_backend() || blocked())
+            {
+                return;
+            }
+
+            m_trans_version = this->m_param_version;
+
+            if (m_wino_tile > 0)
+            {
+                m_trans_count++;
+                m_wino_filter.resize(internal::winograd_filter_size(m_dim, m_wino_tile));
+                internal::winograd_transform_filters(m_dim, m_wino_tile, m_filter_data.data(),
+                                                     m_wino_filter.data());
+                m_trans_valid = true;
+            }
+
+            if (m_fft_rows > 0)
+            {
+                m_trans_count++;
+                const internal::FFTConvDims fdim(m_dim, m_fft_rows, m_fft_cols);
+                m_fft_filter.resize(internal::fft_filter_size(m_dim, fdim));
+                internal::fft_prepare_buffers(fdim, 1, m_fft_bufs);
+                internal::fft_transform_filters(m_dim, fdim, m_filter_data.data(), m_fft_filter.data(),
+                                                m_fft_bufs[0]);
+                m_trans_valid = true;
+            }
+        }
+
+        // Size of the temporary memory of the blocked convolution, in the forward pass,
+        // or in the backward pass if 'backward' is true
+        // The sides of the layer in the planar layout are converted in temporary memory
+        std::size_t blocked_size(int nobs, bool backward) const
+        {
+            const std::size_t in_len = this->m_blocked_in ? 0 :
+                internal::blocked_image_size<Scalar>(m_dim.in_channels, m_dim.channel_rows * m_dim.channel_cols) * nobs;
+            const std::size_t out_len = this->m_blocked_out ? 0 :
+                internal::blocked_image_size<Scalar>(m_dim.out_channels, m_dim.conv_rows * m_dim.conv_cols) * nobs;
+            const std::size_t in_size = in_len > 0 ? internal::Workspace::block_size<Scalar>(in_len) : 0;
+            const std::size_t out_size = out_len > 0 ? internal::Workspace::block_size<Scalar>(out_len) : 0;
+            const std::size_t filter_size = internal::Workspace::block_size<Scalar>(
+                internal::blocked_filter_size<Scalar>(m_dim));
+            // The backward pass also needs the gradient of the blocked input, and the
+            // transposed filters next to the gradient of the filters
+            return backward ? 2 * in_size + out_size + 2 * filter_size :
+                   in_size + out_size + filter_size;
+        }
+
+        // Size of the temporary memory of the convolution
+        std::size_t convolve_size(int nobs) const
+        {
+            if (blocked())
+            {
+                return blocked_size(nobs, false);
+            }
+
+            if (tensor_backend())
+            {
+                // The Tensor module allocates its temporary memory from the device
+                return 0;
+            }
+
+            const std::size_t direct = internal::convolve_valid_workspace_size<Scalar>(m_dim, nobs);
+
+            if (m_fft_rows > 0)
+            {
+                // The spectra of the filters are computed in the workspace if they are outdated
+                const internal::FFTConvDims fdim(m_dim, m_fft_rows, m_fft_cols);
+                return internal::fft_workspace_size<Scalar>(m_dim, fdim, nobs, false) +
+                       internal::Workspace::block_size<Complex>(internal::fft_filter_size(m_dim, fdim));
+            }
+
+            if (m_wino_tile <= 0)
+            {
+                return direct;
+            }
+
+            // The transformed filters are computed in the workspace if they are outdated
+            const std::size_t wino = internal::winograd_workspace_size<Scalar>(m_dim, m_wino_tile, nobs) +
+                                     internal::Workspace::block_size<Scalar>(
+                                         internal::winograd_filter_size(m_dim, m_wino_tile));
+            return std::max(direct, wino);
+        }
+
+        // Convolution of the input on images in the blocked layout, z = conv(in, w)
+        // The filters are packed in temporary memory
+        void convolve_blocked(const ConstRefMat& prev_layer_data, AlignedMapMat& z, internal::Workspace& ws) const
+        {
+            const int nobs = prev_layer_data.cols();
+            const int in_npix = m_dim.channel_rows * m_dim.channel_cols;
+            const int out_npix = m_dim.conv_rows * m_dim.conv_cols;
+            const std::size_t pos = ws.mark();
+            const Scalar* in = prev_layer_data.data();
+            Scalar* out = z.data();
+
+            if (!this->m_blocked_in)
+            {
+                Scalar* buf = ws.allocate<Scalar>(internal::blocked_image_size<Scalar>(m_dim.in_channels, in_npix) * nobs);
+                internal::to_blocked_layout(in, m_dim.in_channels, in_npix, nobs, buf);
+                in = buf;
+            }
+
+            if (!this->m_blocked_out)
+            {
+                out = ws.allocate<Scalar>(internal::blocked_image_size<Scalar>(m_dim.out_channels, out_npix) * nobs);
+            }
+
+            Scalar* filter = ws.allocate<Scalar>(internal::blocked_filter_size<Scalar>(m_dim));
+            internal::pack_blocked_filters(m_dim, m_filter_data.data(), false, filter);
+            internal::convolve_blocked(m_dim, in, nobs, filter, out);
+
+            if (!this->m_blocked_out)
+            {
+                internal::to_planar_layout(out, m_dim.out_channels, out_npix, nobs, z.data());
+            }
+
+            ws.release(pos);
+        }
+
+        // Derivatives of the filters, and of the input if 'din' is not NULL, with the
+        // blocked convolution, given the derivative of z
+        void convolve_blocked_backward(const ConstRefMat& prev_layer_data, const AlignedMapMat& dLz,
+                                       Scalar* din, internal::Workspace& ws)
+        {
+            const int nobs = prev_layer_data.cols();
+            const int in_npix = m_dim.channel_rows * m_dim.channel_cols;
+            const int out_npix = m_dim.conv_rows * m_dim.conv_cols;
+            const std::size_t in_len = internal::blocked_image_size<Scalar>(m_dim.in_channels, in_npix) * nobs;
+            const std::size_t filter_size = internal::blocked_filter_size<Scalar>(m_dim);
+            const std::size_t pos = ws.mark();
+            const Scalar* in = prev_layer_data.data();
+            const Scalar* grad = dLz.data();
+
+            if (!this->m_blocked_in)
+            {
+                Scalar* buf = ws.allocate<Scalar>(in_len);
+                internal::to_blocked_layout(in, m_dim.in_channels, in_npix, nobs, buf);
+                in = buf;
+            }
+
+            if (!this->m_blocked_out)
+            {
+                Scalar* buf = ws.allocate<Scalar>(internal::blocked_image_size<Scalar>(m_dim.out_channels, out_npix) * nobs);
+                internal::to_blocked_layout(grad, m_dim.out_channels, out_npix, nobs, buf);
+                grad = buf;
+            }
+
+            Scalar* dw = ws.allocate<Scalar>(filter_size);
+            Scalar* filter_t = NULL;
+            Scalar* dx = NULL;
+
+            if (din != NULL)
+            {
+                filter_t = ws.allocate<Scalar>(filter_size);
+                internal::pack_blocked_filters(m_dim, m_filter_data.data(), true, filter_t);
+                dx = this->m_blocked_in ? din : ws.allocate<Scalar>(in_len);
+            }
+
+            internal::convolve_blocked_backward(m_dim, in, nobs, grad, filter_t, dw, dx);
+            internal::unpack_blocked_filters(m_dim, dw, m_df_data.data());
+
+            if (din != NULL && !this->m_blocked_in)
+            {
+                internal::to_planar_layout(dx, m_dim.in_channels, in_npix, nobs, din);
+            }
+
+            ws.release(pos);
+        }
+
+        // Convolution of the input, z = conv(in, w)
+        // The FFT convolution uses the plans and buffers in 'bufs'
+        // If trans_valid is false, the filters are transformed in temporary memory
+        void convolve(const ConstRefMat& prev_layer_data, AlignedMapMat& z, internal::Workspace& ws,
+                      FFTBufferList& bufs, const bool trans_valid) const
+        {
+            const int nobs = prev_layer_data.cols();
+
+            if (blocked())
+            {
+                convolve_blocked(prev_layer_data, z, ws);
+                return;
+            }
+
+#ifdef MINIDNN_USE_EIGEN_TENSOR
+            if (m_device != NULL)
+            {
+                internal::convolve_tensor(m_dim, prev_layer_data.data(), nobs, m_filter_data.data(),
+                                          z.data(), *m_device);
+                return;
+            }
+#endif
+
+            if (m_fft_rows > 0)
+            {
+                const internal::FFTConvDims fdim(m_dim, m_fft_rows, m_fft_cols);
+                const std::size_t pos = ws.mark();
+                const Complex* spec = m_fft_filter.data();
+
+                if (!trans_valid)
+                {
+                    Complex* trans = ws.allocate<Complex>(internal::fft_filter_size(m_dim, fdim));
+                    internal::fft_prepare_buffers(fdim, 1, bufs);
+                    internal::fft_transform_filters(m_dim, fdim, m_filter_data.data(), trans, bufs[0]);
+                    spec = trans;
+                }
+
+                internal::convolve_fft(m_dim, fdim, prev_layer_data.data(), nobs, spec, z.data(), bufs, ws);
+                ws.release(pos);
+                return;
+            }
+
+            if (m_wino_tile <= 0)
+            {
+                internal::convolve_valid(m_dim, prev_layer_data.data(), true, nobs,
+                                         m_filter_data.data(), z.data(), ws
+                                        );
+                return;
+            }
+
+            const std::size_t pos = ws.mark();
+            const Scalar* filter = m_wino_filter.data();
+
+            if (!trans_valid)
+            {
+                Scalar* trans = ws.allocate<Scalar>(internal::winograd_filter_size(m_dim, m_wino_tile));
+                internal::winograd_transform_filters(m_dim, m_wino_tile, m_filter_data.data(), trans);
+                filter = trans;
+            }
+
+            internal::convolve_winograd(m_dim, m_wino_tile, prev_layer_data.data(), nobs,
+                                        filter, z.data(), ws
+                                       );
+            ws.release(pos);
+        }
+
+        // Compute the linear term z and the output a, using only the parameters
+        // Temporary memory of the convolution is taken from ws
+        void compute(const ConstRefMat& prev_layer_data, AlignedMapMat& z, AlignedMapMat& a,
+                     internal::Workspace& ws, FFTBufferList& bufs, const bool trans_valid) const
+        {
+            // Each column is an observation
+            const int nobs = prev_layer_data.cols();
+            // Linear term, z = conv(in, w) + b
+            // Convolution
+            convolve(prev_layer_data, z, ws, bufs, trans_valid);
+            // Add bias terms
+            // Each column of z contains m_dim.out_channels channels, and each channel has
+            // m_dim.conv_rows * m_dim.conv_cols elements
+            int channel_start_row = 0;
+            const int channel_nelem = m_dim.conv_rows * m_dim.conv_cols;
+
+            if (this->m_blocked_out)
+            {
+                internal::add_blocked_bias(m_bias.data(), m_dim.out_channels, channel_nelem, nobs, z.data());
+            }
+            else
+            {
+                for (int i = 0; i < m_dim.out_channels; i++, channel_start_row += channel_nelem)
+                {
+                    z.block(channel_start_row, 0, channel_nelem, nobs).array() += m_bias[i];
+                }
+            }
+
+            // Apply activation function
+            internal::ActivationKernel<Activation>::template activate<Scalar>(z, a, this->m_fast_act);
+        }
 
     public:
         ///
@@ -61,15 +419,58 @@ class Convolutional: public Layer
         /// \param out_channels  Number of output channels.
         /// \param window_width  Width of the filter.
         /// \param window_height Height of the filter.
+        /// \param stride_width  Horizontal distance between two positions of the filter.
+        /// \param stride_height Vertical distance between two positions of the filter.
+        /// \param pad_width     Number of zero columns added on the left and the right
+        ///                      of each input channel.
+        /// \param pad_height    Number of zero rows added on the top and the bottom
+        ///                      of each input channel.
         ///
         Convolutional(const int in_width, const int in_height,
                       const int in_channels, const int out_channels,
-                      const int window_width, const int window_height) :
-            Layer(in_width * in_height * in_channels,
-                  (in_width - window_width + 1) * (in_height - window_height + 1) * out_channels),
+                      const int window_width, const int window_height,
+                      const int stride_width = 1, const int stride_height = 1,
+                      const int pad_width = 0, const int pad_height = 0) :
+            Layer<Scalar>(in_width * in_height * in_channels,
+                          internal::conv_output_size(in_width, window_width, stride_width, pad_width) *
+                          internal::conv_output_size(in_height, window_height, stride_height, pad_height) *
+                          out_channels),
             m_dim(in_channels, out_channels, in_height, in_width, window_height,
-                  window_width)
-        {}
+                  window_width, stride_height, stride_width, pad_height, pad_width),
+            m_filter_data(NULL, 0), m_df_data(NULL, 0), m_bias(NULL, 0), m_db(NULL, 0),
+            m_wino_tile(0), m_fft_rows(0), m_fft_cols(0), m_trans_valid(false),
+            m_trans_version(0), m_trans_count(0),
+            m_z(NULL, 0, 0), m_a(NULL, 0, 0), m_din(NULL, 0, 0),
+            m_workspace(NULL)
+        {
+            if (stride_width < 1 || stride_height < 1)
+            {
+                throw std::invalid_argument("[class Convolutional]: Stride must be positive");
+            }
+
+            if (pad_width < 0 || pad_width >= window_width || pad_height < 0 || pad_height >= window_height)
+            {
+                throw std::invalid_argument("[class Convolutional]: Padding must be nonnegative and smaller than the window");
+            }
+
+            if (window_width > in_width + 2 * pad_width || window_height > in_height + 2 * pad_height)
+            {
+                throw std::invalid_argument("[class Convolutional]: Window is larger than the padded input");
+            }
+
+#ifdef MINIDNN_USE_EIGEN_TENSOR
+            m_device = NULL;
+#endif
+
+            if (internal::winograd_preferred(m_dim))
+            {
+                m_wino_tile = internal::winograd_tile_size(m_dim);
+            }
+            else if (internal::fft_preferred(m_dim))
+            {
+                internal::fft_conv_size(m_dim, m_fft_rows, m_fft_cols);
+            }
+        }
 
         void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
         {
@@ -82,49 +483,246 @@ class Convolutional: public Layer
                                         sigma);
             // Bias term
             internal::set_normal_random(m_bias.data(), m_dim.out_channels, rng, mu, sigma);
+            this->parameters_changed();
         }
 
         void init()
         {
-            // Set parameter dimension
-            const int filter_data_size = m_dim.in_channels * m_dim.out_channels *
-                                         m_dim.filter_rows * m_dim.filter_cols;
-            // Filter parameters
-            m_filter_data.resize(filter_data_size);
-            m_df_data.resize(filter_data_size);
-            // Bias term
-            m_bias.resize(m_dim.out_channels);
-            m_db.resize(m_dim.out_channels);
+            // Set parameter dimension, filters followed by the bias term
+            this->allocate_parameters();
+            m_trans_valid = false;
         }
 
-        // http://cs231n.github.io/convolutional-networks/
-        void forward(const Matrix& prev_layer_data)
+        std::size_t parameter_size() const
         {
-            // Each column is an observation
+            return this->block_length(filter_size()) + this->block_length(m_dim.out_channels);
+        }
+
+        ///
+        /// Enable or disable the Winograd algorithm in the forward pass
+        ///
+        /// It is enabled by default for 3x3 filters with stride 1 and at least 32 input
+        /// and output channels, where it is usually faster than the direct convolution.
+        /// The output differs from the direct convolution by rounding errors, which can
+        /// be measured with winograd_error(). The gradients are always computed with the
+        /// direct convolution. This function should be called before training or prediction.
+        ///
+        /// \param enable Whether to use the Winograd algorithm. It can only be enabled
+        ///               for 3x3 filters with stride 1.
+        ///
+        void use_winograd(bool enable)
+        {
+            const int tile = internal::winograd_tile_size(m_dim);
+
+            if (enable && tile <= 0)
+            {
+                throw std::invalid_argument("[class Convolutional]: Winograd algorithm requires 3x3 filters with stride 1");
+            }
+
+            m_wino_tile = enable ? tile : 0;
+
+            if (enable)
+            {
+                m_fft_rows = m_fft_cols = 0;
+            }
+
+            m_trans_valid = false;
+            refresh_transforms();
+        }
+
+        ///
+        /// Whether the forward pass uses the Winograd algorithm
+        ///
+        bool winograd_enabled() const
+        {
+            return m_wino_tile > 0;
+        }
+
+        ///
+        /// Enable or disable the FFT convolution in the forward and backward passes
+        ///
+        /// It is enabled by default for filters of 5x5 or larger with stride 1 when it
+        /// is estimated to be faster than the direct convolution, which is typically
+        /// the case for windows of 9x9 or larger, or 5x5 with many channels. The
+        /// channels are split into overlapping tiles whose size is chosen for each layer,
+        /// and the spectra of the filters are kept until the next parameter update.
+        /// The results differ from the direct convolution by rounding errors. Enabling
+        /// the FFT convolution disables the Winograd algorithm, and vice versa. This
+        /// function should be called before training or prediction.
+        ///
+        /// \param enable Whether to use the FFT convolution. It can only be enabled
+        ///               for filters with stride 1.
+        ///
+        void use_fft(bool enable)
+        {
+            int rows, cols;
+            internal::fft_conv_size(m_dim, rows, cols);
+
+            if (enable && rows <= 0)
+            {
+                throw std::invalid_argument("[class Convolutional]: FFT convolution requires stride 1");
+            }
+
+            m_fft_rows = enable ? rows : 0;
+            m_fft_cols = enable ? cols : 0;
+
+            if (enable)
+            {
+                m_wino_tile = 0;
+            }
+
+            m_trans_valid = false;
+            refresh_transforms();
+        }
+
+        ///
+        /// Whether the forward and backward passes use the FFT convolution
+        ///
+        bool fft_enabled() const
+        {
+            return m_fft_rows > 0;
+        }
+
+#ifdef MINIDNN_USE_EIGEN_TENSOR
+        ///
+        /// Compute the convolutions with the Eigen Tensor module
+        ///
+        /// The forward and backward passes are contractions of the image patches with
+        /// the filters, evaluated on the given thread pool device, which can be shared
+        /// by several layers and networks. The Tensor backend takes precedence over the
+        /// Winograd algorithm and the FFT convolution, and the results differ from them
+        /// by rounding errors. This function should be called before training or prediction.
+        ///
+        /// \param device Device whose thread pool computes the convolutions, or NULL to
+        ///               use the built-in convolutions again. It must outlive the layer
+        ///               and its copies.
+        ///
+        void use_tensor_device(const Eigen::ThreadPoolDevice* device)
+        {
+            m_device = device;
+            m_trans_valid = false;
+            refresh_transforms();
+        }
+
+        ///
+        /// Device of the Eigen Tensor backend, or NULL if the built-in convolutions are used
+        ///
+        const Eigen::ThreadPoolDevice* tensor_device() const
+        {
+            return m_device;
+        }
+#endif
+
+        ///
+        /// Compare the Winograd algorithm with the direct convolution on sample data
+        ///
+        /// \param prev_layer_data Sample input of this layer. Each column is an observation.
+        ///
+        /// \return The largest absolute difference of the convolution results, relative
+        ///         to the largest absolute value of the direct convolution.
+        ///
+        Scalar winograd_error(const Matrix& prev_layer_data) const
+        {
+            const int tile = internal::winograd_tile_size(m_dim);
+
+            if (tile <= 0)
+            {
+                throw std::logic_error("[class Convolutional]: Winograd algorithm requires 3x3 filters with stride 1");
+            }
+
+            if (prev_layer_data.rows() != this->m_in_size)
+            {
+                throw std::invalid_argument("[class Convolutional]: Input data have incorrect dimension");
+            }
+
             const int nobs = prev_layer_data.cols();
-            // Linear term, z = conv(in, w) + b
-            m_z.resize(this->m_out_size, nobs);
-            // Convolution
+            const std::size_t filter_size = internal::winograd_filter_size(m_dim, tile);
+            internal::Workspace ws;
+            ws.reserve(internal::Workspace::block_size<Scalar>(filter_size) +
+                       std::max(internal::convolve_valid_workspace_size<Scalar>(m_dim, nobs),
+                                internal::winograd_workspace_size<Scalar>(m_dim, tile, nobs)));
+            Scalar* trans = ws.allocate<Scalar>(filter_size);
+            internal::winograd_transform_filters(m_dim, tile, m_filter_data.data(), trans);
+            Matrix direct(this->m_out_size, nobs), wino(this->m_out_size, nobs);
             internal::convolve_valid(m_dim, prev_layer_data.data(), true, nobs,
-                                     m_filter_data.data(), m_z.data()
-                                    );
-            // Add bias terms
-            // Each column of m_z contains m_dim.out_channels channels, and each channel has
-            // m_dim.conv_rows * m_dim.conv_cols elements
-            int channel_start_row = 0;
-            const int channel_nelem = m_dim.conv_rows * m_dim.conv_cols;
+                                     m_filter_data.data(), direct.data(), ws);
+            internal::convolve_winograd(m_dim, tile, prev_layer_data.data(), nobs, trans, wino.data(), ws);
 
-            for (int i = 0; i < m_dim.out_channels; i++, channel_start_row += channel_nelem)
+            if (direct.size() <= 0)
             {
-                m_z.block(channel_start_row, 0, channel_nelem, nobs).array() += m_bias[i];
+                return Scalar(0);
             }
 
-            // Apply activation function
-            m_a.resize(this->m_out_size, nobs);
-            Activation::activate(m_z, m_a);
+            const Scalar scale = direct.cwiseAbs().maxCoeff();
+            const Scalar diff = (wino - direct).cwiseAbs().maxCoeff();
+            return (scale > Scalar(0)) ? diff / scale : diff;
+        }
+
+        std::size_t workspace_size(int nobs) const
+        {
+            return 2 * internal::Workspace::block_size<Scalar>(std::size_t(this->m_out_size) * nobs) +
+                   internal::Workspace::block_size<Scalar>(std::size_t(this->m_in_size) * nobs);
+        }
+
+        std::size_t scratch_size(int nobs) const
+        {
+            // Forward convolution, bias gradient, and the other derivatives
+            // are computed one after another, so they can share the same memory
+            const std::size_t backward_size = blocked() ? blocked_size(nobs, true) :
+                                              tensor_backend() ? 0 :
+                                              (m_fft_rows > 0) ?
+                internal::fft_workspace_size<Scalar>(m_dim, internal::FFTConvDims(m_dim, m_fft_rows, m_fft_cols),
+                                                     nobs, true) :
+                internal::convolve_backward_workspace_size<Scalar>(m_dim, nobs);
+            const std::size_t conv_size = std::max(convolve_size(nobs), backward_size);
+            const std::size_t db_size = internal::Workspace::block_size<Scalar>(
+                std::size_t(m_dim.out_channels) * nobs);
+            return std::max(conv_size, db_size);
         }
 
-        const Matrix& output() const
+        void bind_workspace(internal::Workspace& ws, int nobs)
+        {
+            const std::size_t out_len = std::size_t(this->m_out_size) * nobs;
+            new (&m_z) AlignedMapMat(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            new (&m_a) AlignedMapMat(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            new (&m_din) AlignedMapMat(ws.allocate<Scalar>(std::size_t(this->m_in_size) * nobs),
+                                       this->m_in_size, nobs);
+            m_workspace = &ws;
+        }
+
+        // http://cs231n.github.io/convolutional-networks/
+        void forward(const ConstRefMat& prev_layer_data)
+        {
+            if ((m_wino_tile > 0 || m_fft_rows > 0) && !blocked() && !transforms_valid())
+            {
+                refresh_transforms();
+            }
+
+            compute(prev_layer_data, m_z, m_a, *m_workspace, m_fft_bufs, transforms_valid());
+        }
+
+        std::size_t inference_size(int nobs) const
+        {
+            return 2 * internal::Workspace::block_size<Scalar>(std::size_t(this->m_out_size) * nobs) +
+                   convolve_size(nobs);
+        }
+
+        AlignedMapMat infer(const ConstRefMat& prev_layer_data, internal::Workspace& ws) const
+        {
+            const int nobs = prev_layer_data.cols();
+            const std::size_t out_len = std::size_t(this->m_out_size) * nobs;
+            AlignedMapMat a(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            const std::size_t pos = ws.mark();
+            AlignedMapMat z(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            // The FFT plans of the layer are not shared by concurrent calls
+            FFTBufferList bufs;
+            // Outdated filters are transformed in temporary memory
+            compute(prev_layer_data, z, a, ws, bufs, transforms_valid());
+            ws.release(pos);
+            return a;
+        }
+
+        const AlignedMapMat& output() const
         {
             return m_a;
         }
@@ -132,15 +730,15 @@ class Convolutional: public Layer
         // prev_layer_data: in_size x nobs
         // next_layer_data: out_size x nobs
         // https://grzegorzgwardys.wordpress.com/2016/04/22/8/
-        void backprop(const Matrix& prev_layer_data, const Matrix& next_layer_data)
+        void backprop(const ConstRefMat& prev_layer_data, const ConstRefMat& next_layer_data)
         {
             const int nobs = prev_layer_data.cols();
             // After forward stage, m_z contains z = conv(in, w) + b
             // Now we need to calculate d(L) / d(z) = [d(a) / d(z)] * [d(L) / d(a)]
             // d(L) / d(a) is computed in the next layer, contained in next_layer_data
             // The Jacobian matrix J = d(a) / d(z) is determined by the activation function
-            Matrix& dLz = m_z;
-            Activation::apply_jacobian(m_z, m_a, next_layer_data, dLz);
+            AlignedMapMat& dLz = m_z;
+            Activation::template apply_jacobian<Scalar>(m_z, m_a, next_layer_data, dLz);
             // z_j = sum_i(conv(in_i, w_ij)) + b_j
             //
             // d(z_k) / d(w_ij) = 0, if k != j
@@ -153,38 +751,70 @@ class Convolutional: public Layer
             //
             // d(z_j) / d(in_i) = conv_full_op(w_ij_rotate)
             // d(L) / d(in_i) = sum_j((d(z_j) / d(in_i)) * (d(L) / d(z_j))) = sum_j(conv_full(d(L) / d(z_j), w_ij_rotate))
-            // Derivative for weights
-            internal::ConvDims back_conv_dim(nobs, m_dim.out_channels, m_dim.channel_rows,
-                                             m_dim.channel_cols,
-                                             m_dim.conv_rows, m_dim.conv_cols);
-            internal::convolve_valid(back_conv_dim, prev_layer_data.data(), false,
-                                     m_dim.in_channels,
-                                     dLz.data(), m_df_data.data()
-                                    );
-            m_df_data /= nobs;
+            //
+            // Both derivatives are computed as the transpose of the forward convolution,
+            // which handles strides and padding, see Utils/Convolution.h
             // Derivative for bias
             // Aggregate d(L) / d(z) in each output channel
-            ConstAlignedMapMat dLz_by_channel(dLz.data(), m_dim.conv_rows * m_dim.conv_cols,
-                                              m_dim.out_channels * nobs);
-            Vector dLb = dLz_by_channel.colwise().sum();
-            // Average over observations
-            ConstAlignedMapMat dLb_by_obs(dLb.data(), m_dim.out_channels, nobs);
-            m_db.noalias() = dLb_by_obs.rowwise().mean();
-            // Compute d(L) / d_in = conv_full(d(L) / d(z), w_rotate)
-            m_din.resize(this->m_in_size, nobs);
-            internal::ConvDims conv_full_dim(m_dim.out_channels, m_dim.in_channels,
-                                             m_dim.conv_rows, m_dim.conv_cols, m_dim.filter_rows, m_dim.filter_cols);
-            internal::convolve_full(conv_full_dim, dLz.data(), nobs,
-                                    m_filter_data.data(), m_din.data()
-                                   );
-        }
-
-        const Matrix& backprop_data() const
+            if (this->m_blocked_out)
+            {
+                internal::blocked_channel_sums(dLz.data(), m_dim.out_channels, m_dim.conv_rows * m_dim.conv_cols,
+                                               nobs, m_db.data());
+                // Average over observations
+                m_db /= Scalar(nobs);
+            }
+            else
+            {
+                ConstAlignedMapMat dLz_by_channel(dLz.data(), m_dim.conv_rows * m_dim.conv_cols,
+                                                  m_dim.out_channels * nobs);
+                const std::size_t ws_mark = m_workspace->mark();
+                AlignedMapMat dLb(m_workspace->allocate<Scalar>(std::size_t(m_dim.out_channels) * nobs),
+                                  1, m_dim.out_channels * nobs);
+                dLb.noalias() = dLz_by_channel.colwise().sum();
+                // Average over observations
+                ConstAlignedMapMat dLb_by_obs(dLb.data(), m_dim.out_channels, nobs);
+                m_db.noalias() = dLb_by_obs.rowwise().mean();
+                m_workspace->release(ws_mark);
+            }
+
+            // Derivative for weights, and d(L) / d_in = conv_full(d(L) / d(z), w_rotate)
+            Scalar* din = this->m_input_grad ? m_din.data() : NULL;
+
+            if (blocked())
+            {
+                convolve_blocked_backward(prev_layer_data, dLz, din, *m_workspace);
+            }
+            else
+#ifdef MINIDNN_USE_EIGEN_TENSOR
+            if (m_device != NULL)
+            {
+                internal::convolve_tensor_backward(m_dim, prev_layer_data.data(), nobs, dLz.data(),
+                                                   m_filter_data.data(), m_df_data.data(), din, *m_device);
+            }
+            else
+#endif
+            if (m_fft_rows > 0)
+            {
+                // The spectra of the filters were refreshed in forward()
+                internal::convolve_fft_backward(m_dim, internal::FFTConvDims(m_dim, m_fft_rows, m_fft_cols),
+                                                prev_layer_data.data(), nobs, dLz.data(), m_fft_filter.data(),
+                                                m_df_data.data(), din, m_fft_bufs, *m_workspace);
+            }
+            else
+            {
+                internal::convolve_backward(m_dim, prev_layer_data.data(), nobs, dLz.data(),
+                                            m_filter_data.data(), m_df_data.data(), din, *m_workspace);
+            }
+
+            m_df_data /= nobs;
+        }
+
+        const AlignedMapMat& backprop_data() const
         {
             return m_din;
         }
 
-        void update(Optimizer& opt)
+        void update(Optimizer<Scalar>& opt)
         {
             ConstAlignedMapVec dw(m_df_data.data(), m_df_data.size());
             ConstAlignedMapVec db(m_db.data(), m_db.size());
@@ -192,6 +822,7 @@ class Convolutional: public Layer
             AlignedMapVec      b(m_bias.data(), m_bias.size());
             opt.update(dw, w);
             opt.update(db, b);
+            this->parameters_changed();
         }
 
         std::vector<Scalar> get_parameters() const
@@ -215,6 +846,7 @@ class Convolutional: public Layer
             std::copy(param.begin(), param.begin() + m_filter_data.size(),
                       m_filter_data.data());
             std::copy(param.begin() + m_filter_data.size(), param.end(), m_bias.data());
+            this->parameters_changed();
         }
 
         std::vector<Scalar> get_derivatives() const
@@ -227,6 +859,48 @@ class Convolutional: public Layer
             return res;
         }
 
+        Layer<Scalar>* clone() const
+        {
+            Convolutional<Activation, Scalar>* res = new Convolutional<Activation, Scalar>(*this);
+            res->own_parameters();
+            return res;
+        }
+
+        void parameter_blocks(std::vector<AlignedMapVec>& params,
+                              std::vector<AlignedMapVec>& derivs)
+        {
+            params.push_back(AlignedMapVec(m_filter_data.data(), m_filter_data.size()));
+            params.push_back(AlignedMapVec(m_bias.data(), m_bias.size()));
+            derivs.push_back(AlignedMapVec(m_df_data.data(), m_df_data.size()));
+            derivs.push_back(AlignedMapVec(m_db.data(), m_db.size()));
+        }
+
+        void parameters_changed()
+        {
+            Layer<Scalar>::parameters_changed();
+            refresh_transforms();
+        }
+
+        ///
+        /// Number of times the filters were transformed for the Winograd algorithm or
+        /// the FFT convolution and kept in the layer. They are transformed once for each
+        /// change of the parameters, see Layer::parameters_changed().
+        ///
+        int num_transforms() const
+        {
+            return m_trans_count;
+        }
+
+        int blocked_in_channels() const
+        {
+            return m_dim.in_channels;
+        }
+
+        int blocked_out_channels() const
+        {
+            return m_dim.out_channels;
+        }
+
         std::string layer_type() const
         {
             return "Convolutional";
@@ -248,6 +922,10 @@ class Convolutional: public Layer
             map.insert(std::make_pair("in_width" + ind, m_dim.channel_cols));
             map.insert(std::make_pair("window_width" + ind, m_dim.filter_cols));
             map.insert(std::make_pair("window_height" + ind, m_dim.filter_rows));
+            map.insert(std::make_pair("stride_width" + ind, m_dim.stride_cols));
+            map.insert(std::make_pair("stride_height" + ind, m_dim.stride_rows));
+            map.insert(std::make_pair("pad_width" + ind, m_dim.pad_cols));
+            map.insert(std::make_pair("pad_height" + ind, m_dim.pad_rows));
         }
 };
 
@@ -3,12 +3,15 @@
 
 #include <Eigen/Core>
 #include <vector>
+#include <new>
+#include <algorithm>
 #include <stdexcept>
 #include "../Config.h"
 #include "../Layer.h"
 #include "../Utils/Random.h"
 #include "../Utils/IO.h"
 #include "../Utils/Enum.h"
+#include "../Utils/ActivationTraits.h"
 
 namespace MiniDNN
 {
@@ -19,24 +22,80 @@ namespace MiniDNN
 ///
 /// Fully connected hidden layer
 ///
-template <typename Activation>
-class FullyConnected: public Layer
+template <typename Activation, typename Scalar = MiniDNN::Scalar>
+class FullyConnected: public Layer<Scalar>
 {
     private:
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
-        typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
-        typedef Vector::AlignedMapType AlignedMapVec;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
+        typedef typename Matrix::AlignedMapType AlignedMapMat;
+        typedef typename Vector::ConstAlignedMapType ConstAlignedMapVec;
+        typedef typename Vector::AlignedMapType AlignedMapVec;
         typedef std::map<std::string, int> MetaInfo;
+        typedef internal::ActivationTraits<Activation> Traits;
 
-        Matrix m_weight;  // Weight parameters, W(in_size x out_size)
-        Vector m_bias;    // Bias parameters, b(out_size x 1)
-        Matrix m_dw;      // Derivative of weights
-        Vector m_db;      // Derivative of bias
-        Matrix m_z;       // Linear term, z = W' * in + b
-        Matrix m_a;       // Output of this layer, a = act(z)
-        Matrix m_din;     // Derivative of the input of this layer.
-                          // Note that input of this layer is also the output of previous layer
+        // The parameters refer to the storage of the layer or to the arena of the network
+        AlignedMapMat m_weight; // Weight parameters, W(in_size x out_size)
+        AlignedMapVec m_bias;   // Bias parameters, b(out_size x 1)
+        AlignedMapMat m_dw;     // Derivative of weights
+        AlignedMapVec m_db;     // Derivative of bias
+        // The following buffers are carved from the workspace of the network
+        AlignedMapMat m_z;   // Linear term, z = W' * in + b
+        AlignedMapMat m_a;   // Output of this layer, a = act(z)
+        AlignedMapMat m_din; // Derivative of the input of this layer.
+                             // Note that input of this layer is also the output of previous layer
+
+        // Number of observations processed together in the fused epilogues,
+        // chosen such that a tile of the linear term and of the output fits in
+        // the L1 cache, and is read from memory only once
+        int tile_cols(int nobs) const
+        {
+            const std::ptrdiff_t col_bytes = 2 * sizeof(Scalar) * this->m_out_size;
+            const int cols = Eigen::l1CacheSize() / col_bytes;
+            return std::max(std::min(cols, nobs), 1);
+        }
+
+        void bind_parameters(Scalar* param, Scalar* deriv)
+        {
+            const std::size_t wlen = this->block_length(std::size_t(this->m_in_size) * this->m_out_size);
+            new (&m_weight) AlignedMapMat(param, this->m_in_size, this->m_out_size);
+            new (&m_bias) AlignedMapVec(param + wlen, this->m_out_size);
+            new (&m_dw) AlignedMapMat(deriv, this->m_in_size, this->m_out_size);
+            new (&m_db) AlignedMapVec(deriv + wlen, this->m_out_size);
+        }
+
+        // Compute the linear term z and the output a, using only the parameters
+        // If the activation can be applied in place, z is not written and may
+        // refer to the same memory as a
+        // If activate is false, a receives the linear term and z is not written
+        void compute(const ConstRefMat& prev_layer_data, AlignedMapMat& z, AlignedMapMat& a,
+                     const bool activate) const
+        {
+            const int nobs = prev_layer_data.cols();
+            const int tile = tile_cols(nobs);
+            const bool direct = Traits::in_place || !activate;
+            AlignedMapMat& out = direct ? a : z;
+            // Linear term z = W' * in + b
+            out.noalias() = m_weight.transpose() * prev_layer_data;
+
+            // Add the bias and apply the activation function in one sweep
+            for (int c = 0; c < nobs; c += tile)
+            {
+                const int nb = std::min(tile, nobs - c);
+                out.middleCols(c, nb).colwise() += m_bias;
+
+                if (activate && !Traits::identity)
+                {
+                    internal::ActivationKernel<Activation>::template activate<Scalar>(out.middleCols(c, nb), a.middleCols(c, nb),
+                                                                                      this->m_fast_act);
+                }
+                else if (!direct)
+                {
+                    a.middleCols(c, nb).noalias() = out.middleCols(c, nb);
+                }
+            }
+        }
 
     public:
         ///
@@ -46,7 +105,9 @@ class FullyConnected: public Layer
         /// \param out_size Number of output units.
         ///
         FullyConnected(const int in_size, const int out_size) :
-            Layer(in_size, out_size)
+            Layer<Scalar>(in_size, out_size),
+            m_weight(NULL, 0, 0), m_bias(NULL, 0), m_dw(NULL, 0, 0), m_db(NULL, 0),
+            m_z(NULL, 0, 0), m_a(NULL, 0, 0), m_din(NULL, 0, 0)
         {}
 
         void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
@@ -61,57 +122,108 @@ class FullyConnected: public Layer
         void init()
         {
             // Set parameter dimension
-            m_weight.resize(this->m_in_size, this->m_out_size);
-            m_bias.resize(this->m_out_size);
-            m_dw.resize(this->m_in_size, this->m_out_size);
-            m_db.resize(this->m_out_size);
+            this->allocate_parameters();
+        }
+
+        std::size_t parameter_size() const
+        {
+            return this->block_length(std::size_t(this->m_in_size) * this->m_out_size) +
+                   this->block_length(this->m_out_size);
+        }
+
+        std::size_t workspace_size(int nobs) const
+        {
+            return 2 * internal::Workspace::block_size<Scalar>(std::size_t(this->m_out_size) * nobs) +
+                   internal::Workspace::block_size<Scalar>(std::size_t(this->m_in_size) * nobs);
+        }
+
+        void bind_workspace(internal::Workspace& ws, int nobs)
+        {
+            const std::size_t out_len = std::size_t(this->m_out_size) * nobs;
+            new (&m_z) AlignedMapMat(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            new (&m_a) AlignedMapMat(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            new (&m_din) AlignedMapMat(ws.allocate<Scalar>(std::size_t(this->m_in_size) * nobs),
+                                       this->m_in_size, nobs);
         }
 
         // prev_layer_data: in_size x nobs
-        void forward(const Matrix& prev_layer_data)
+        void forward(const ConstRefMat& prev_layer_data)
+        {
+            compute(prev_layer_data, m_z, m_a, !this->m_defer_act);
+        }
+
+        std::size_t inference_size(int nobs) const
+        {
+            const int nbuf = Traits::in_place ? 1 : 2;
+            return nbuf * internal::Workspace::block_size<Scalar>(std::size_t(this->m_out_size) * nobs);
+        }
+
+        AlignedMapMat infer(const ConstRefMat& prev_layer_data, internal::Workspace& ws) const
         {
             const int nobs = prev_layer_data.cols();
-            // Linear term z = W' * in + b
-            m_z.resize(this->m_out_size, nobs);
-            m_z.noalias() = m_weight.transpose() * prev_layer_data;
-            m_z.colwise() += m_bias;
-            // Apply activation function
-            m_a.resize(this->m_out_size, nobs);
-            Activation::activate(m_z, m_a);
+            const std::size_t out_len = std::size_t(this->m_out_size) * nobs;
+            AlignedMapMat a(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            const std::size_t pos = ws.mark();
+            AlignedMapMat z(Traits::in_place ? a.data() : ws.allocate<Scalar>(out_len),
+                            this->m_out_size, nobs);
+            compute(prev_layer_data, z, a, true);
+            ws.release(pos);
+            return a;
         }
 
-        const Matrix& output() const
+        const AlignedMapMat& output() const
         {
             return m_a;
         }
 
         // prev_layer_data: in_size x nobs
         // next_layer_data: out_size x nobs
-        void backprop(const Matrix& prev_layer_data, const Matrix& next_layer_data)
+        void backprop(const ConstRefMat& prev_layer_data, const ConstRefMat& next_layer_data)
         {
             const int nobs = prev_layer_data.cols();
-            // After forward stage, m_z contains z = W' * in + b
-            // Now we need to calculate d(L) / d(z) = [d(a) / d(z)] * [d(L) / d(a)]
+            const int tile = tile_cols(nobs);
+            // The linear term is not kept if the Jacobian does not depend on it
+            const AlignedMapMat& z = Traits::in_place ? m_a : m_z;
+            // We need to calculate d(L) / d(z) = [d(a) / d(z)] * [d(L) / d(a)]
             // d(L) / d(a) is computed in the next layer, contained in next_layer_data
             // The Jacobian matrix J = d(a) / d(z) is determined by the activation function
-            Matrix& dLz = m_z;
-            Activation::apply_jacobian(m_z, m_a, next_layer_data, dLz);
-            // Now dLz contains d(L) / d(z)
+            // d(L) / d(z) is written to m_z, or is d(L) / d(a) itself for the identity
+            // If the activation is deferred, the output layer has given d(L) / d(z)
+            const bool jacobian = !Traits::identity && !this->m_defer_act;
+            const ConstRefMat dLz = jacobian ? ConstRefMat(m_z) : next_layer_data;
+            m_db.setZero();
+
+            // Apply the Jacobian and reduce the result for the bias in one sweep
+            for (int c = 0; c < nobs; c += tile)
+            {
+                const int nb = std::min(tile, nobs - c);
+
+                if (jacobian)
+                {
+                    Activation::template apply_jacobian<Scalar>(z.middleCols(c, nb), m_a.middleCols(c, nb),
+                                                                next_layer_data.middleCols(c, nb), m_z.middleCols(c, nb));
+                }
+
+                // Derivative for bias, d(L) / d(b) = d(L) / d(z)
+                m_db.noalias() += dLz.middleCols(c, nb).rowwise().sum();
+            }
+
+            m_db /= Scalar(nobs);
             // Derivative for weights, d(L) / d(W) = [d(L) / d(z)] * in'
-            m_dw.noalias() = prev_layer_data * dLz.transpose() / nobs;
-            // Derivative for bias, d(L) / d(b) = d(L) / d(z)
-            m_db.noalias() = dLz.rowwise().mean();
+            m_dw.noalias() = (Scalar(1) / Scalar(nobs)) * prev_layer_data * dLz.transpose();
             // Compute d(L) / d_in = W * [d(L) / d(z)]
-            m_din.resize(this->m_in_size, nobs);
-            m_din.noalias() = m_weight * dLz;
+            if (this->m_input_grad)
+            {
+                m_din.noalias() = m_weight * dLz;
+            }
         }
 
-        const Matrix& backprop_data() const
+        const AlignedMapMat& backprop_data() const
         {
             return m_din;
         }
 
-        void update(Optimizer& opt)
+        void update(Optimizer<Scalar>& opt)
         {
             ConstAlignedMapVec dw(m_dw.data(), m_dw.size());
             ConstAlignedMapVec db(m_db.data(), m_db.size());
@@ -151,6 +263,27 @@ class FullyConnected: public Layer
             return res;
         }
 
+        Layer<Scalar>* clone() const
+        {
+            FullyConnected<Activation, Scalar>* res = new FullyConnected<Activation, Scalar>(*this);
+            res->own_parameters();
+            return res;
+        }
+
+        void parameter_blocks(std::vector<AlignedMapVec>& params,
+                              std::vector<AlignedMapVec>& derivs)
+        {
+            params.push_back(AlignedMapVec(m_weight.data(), m_weight.size()));
+            params.push_back(AlignedMapVec(m_bias.data(), m_bias.size()));
+            derivs.push_back(AlignedMapVec(m_dw.data(), m_dw.size()));
+            derivs.push_back(AlignedMapVec(m_db.data(), m_db.size()));
+        }
+
+        bool can_defer_activation() const
+        {
+            return true;
+        }
+
         std::string layer_type() const
         {
             return "FullyConnected";
@@ -166,8 +299,8 @@ class FullyConnected: public Layer
             std::string ind = internal::to_string(index);
             map.insert(std::make_pair("Layer" + ind, internal::layer_id(layer_type())));
             map.insert(std::make_pair("Activation" + ind, internal::activation_id(activation_type())));
-            map.insert(std::make_pair("in_size" + ind, in_size()));
-            map.insert(std::make_pair("out_size" + ind, out_size()));
+            map.insert(std::make_pair("in_size" + ind, this->in_size()));
+            map.insert(std::make_pair("out_size" + ind, this->out_size()));
         }
 };
 
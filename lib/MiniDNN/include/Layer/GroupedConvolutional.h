@@ -0,0 +1,367 @@
+#ifndef LAYER_GROUPEDCONVOLUTIONAL_H_
+#define LAYER_GROUPEDCONVOLUTIONAL_H_
+
+#include <Eigen/Core>
+#include <vector>
+#include <new>
+#include <algorithm>
+#include <stdexcept>
+#include "../Config.h"
+#include "../Layer.h"
+#include "../Utils/ActivationTraits.h"
+#include "../Utils/Convolution.h"
+#include "../Utils/SeparableConvolution.h"
+#include "../Utils/Random.h"
+#include "../Utils/IO.h"
+#include "../Utils/Enum.h"
+
+
+namespace MiniDNN
+{
+
+
+///
+/// \ingroup Layers
+///
+/// Grouped convolutional hidden layer
+///
+/// The input and output channels are split into groups of consecutive channels, and
+/// each output channel is the convolution of the input channels of its group only.
+/// With one group per input channel, this is the depthwise convolution, whose cost
+/// is proportional to in_channels x filter area instead of in_channels x out_channels
+/// x filter area. A depthwise 3x3 layer followed by a PointwiseConvolutional layer
+/// is a depthwise separable convolution, which needs about 8 to 9 times fewer
+/// multiplications than a dense 3x3 Convolutional layer with many channels.
+///
+/// The strides and padding work as in Convolutional. With one group, the results are
+/// the same as Convolutional, and the parameters have the same layout.
+///
+template <typename Activation, typename Scalar = MiniDNN::Scalar>
+class GroupedConvolutional: public Layer<Scalar>
+{
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
+        typedef typename Matrix::AlignedMapType AlignedMapMat;
+        typedef typename Matrix::ConstAlignedMapType ConstAlignedMapMat;
+        typedef typename Vector::ConstAlignedMapType ConstAlignedMapVec;
+        typedef typename Vector::AlignedMapType AlignedMapVec;
+        typedef std::map<std::string, int> MetaInfo;
+
+        const internal::ConvDims m_dim; // Dimensions of the equivalent dense convolution
+        const int m_groups;             // Number of groups of channels
+
+        // The parameters refer to the storage of the layer or to the arena of the network
+        AlignedMapVec m_filter_data; // Filter parameters. Total length is (in_channels / groups x
+                                     // out_channels x filter_rows x filter_cols), see Utils/SeparableConvolution.h
+        AlignedMapVec m_df_data;     // Derivative of filters, same dimension as m_filter_data
+
+        AlignedMapVec m_bias;        // Bias term for the output channels, out_channels x 1
+        AlignedMapVec m_db;          // Derivative of bias, same dimension as m_bias
+
+        // The following buffers are carved from the workspace of the network
+        AlignedMapMat m_z;     // Linear term, z = conv(in, w) + b. Each column is an observation
+        AlignedMapMat m_a;     // Output of this layer, a = act(z)
+        AlignedMapMat m_din;   // Derivative of the input of this layer
+                               // Note that input of this layer is also the output of previous layer
+        internal::Workspace* m_workspace; // Workspace for temporary matrices
+
+        std::size_t filter_size() const
+        {
+            return std::size_t(m_dim.in_channels / m_groups) * m_dim.out_channels *
+                   m_dim.filter_rows * m_dim.filter_cols;
+        }
+
+        void bind_parameters(Scalar* param, Scalar* deriv)
+        {
+            const std::size_t flen = this->block_length(filter_size());
+            new (&m_filter_data) AlignedMapVec(param, filter_size());
+            new (&m_bias) AlignedMapVec(param + flen, m_dim.out_channels);
+            new (&m_df_data) AlignedMapVec(deriv, filter_size());
+            new (&m_db) AlignedMapVec(deriv + flen, m_dim.out_channels);
+        }
+
+        // Compute the linear term z and the output a, using only the parameters
+        // Temporary memory of the convolution is taken from ws
+        void compute(const ConstRefMat& prev_layer_data, AlignedMapMat& z, AlignedMapMat& a,
+                     internal::Workspace& ws) const
+        {
+            const int nobs = prev_layer_data.cols();
+            internal::convolve_grouped(m_dim, m_groups, prev_layer_data.data(), nobs,
+                                       m_filter_data.data(), z.data(), ws);
+            // Add bias terms
+            int channel_start_row = 0;
+            const int channel_nelem = m_dim.conv_rows * m_dim.conv_cols;
+
+            for (int i = 0; i < m_dim.out_channels; i++, channel_start_row += channel_nelem)
+            {
+                z.block(channel_start_row, 0, channel_nelem, nobs).array() += m_bias[i];
+            }
+
+            // Apply activation function
+            internal::ActivationKernel<Activation>::template activate<Scalar>(z, a, this->m_fast_act);
+        }
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param in_width      Width of the input image in each channel.
+        /// \param in_height     Height of the input image in each channel.
+        /// \param in_channels   Number of input channels.
+        /// \param out_channels  Number of output channels.
+        /// \param window_width  Width of the filter.
+        /// \param window_height Height of the filter.
+        /// \param groups        Number of groups of channels, which must divide both
+        ///                      in_channels and out_channels. Use in_channels for the
+        ///                      depthwise convolution.
+        /// \param stride_width  Horizontal distance between two positions of the filter.
+        /// \param stride_height Vertical distance between two positions of the filter.
+        /// \param pad_width     Number of zero columns added on the left and the right
+        ///                      of each input channel.
+        /// \param pad_height    Number of zero rows added on the top and the bottom
+        ///                      of each input channel.
+        ///
+        GroupedConvolutional(const int in_width, const int in_height,
+                             const int in_channels, const int out_channels,
+                             const int window_width, const int window_height, const int groups,
+                             const int stride_width = 1, const int stride_height = 1,
+                             const int pad_width = 0, const int pad_height = 0) :
+            Layer<Scalar>(in_width * in_height * in_channels,
+                          internal::conv_output_size(in_width, window_width, stride_width, pad_width) *
+                          internal::conv_output_size(in_height, window_height, stride_height, pad_height) *
+                          out_channels),
+            m_dim(in_channels, out_channels, in_height, in_width, window_height,
+                  window_width, stride_height, stride_width, pad_height, pad_width),
+            m_groups(groups),
+            m_filter_data(NULL, 0), m_df_data(NULL, 0), m_bias(NULL, 0), m_db(NULL, 0),
+            m_z(NULL, 0, 0), m_a(NULL, 0, 0), m_din(NULL, 0, 0),
+            m_workspace(NULL)
+        {
+            if (groups < 1 || in_channels % groups != 0 || out_channels % groups != 0)
+            {
+                throw std::invalid_argument("[class GroupedConvolutional]: Number of groups must divide the numbers of channels");
+            }
+
+            if (stride_width < 1 || stride_height < 1)
+            {
+                throw std::invalid_argument("[class GroupedConvolutional]: Stride must be positive");
+            }
+
+            if (pad_width < 0 || pad_width >= window_width || pad_height < 0 || pad_height >= window_height)
+            {
+                throw std::invalid_argument("[class GroupedConvolutional]: Padding must be nonnegative and smaller than the window");
+            }
+
+            if (window_width > in_width + 2 * pad_width || window_height > in_height + 2 * pad_height)
+            {
+                throw std::invalid_argument("[class GroupedConvolutional]: Window is larger than the padded input");
+            }
+        }
+
+        void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
+        {
+            init();
+            internal::set_normal_random(m_filter_data.data(), m_filter_data.size(), rng, mu, sigma);
+            internal::set_normal_random(m_bias.data(), m_dim.out_channels, rng, mu, sigma);
+        }
+
+        void init()
+        {
+            this->allocate_parameters();
+        }
+
+        std::size_t parameter_size() const
+        {
+            return this->block_length(filter_size()) + this->block_length(m_dim.out_channels);
+        }
+
+        ///
+        /// Number of groups of channels
+        ///
+        int groups() const
+        {
+            return m_groups;
+        }
+
+        std::size_t workspace_size(int nobs) const
+        {
+            return 2 * internal::Workspace::block_size<Scalar>(std::size_t(this->m_out_size) * nobs) +
+                   internal::Workspace::block_size<Scalar>(std::size_t(this->m_in_size) * nobs);
+        }
+
+        std::size_t scratch_size(int nobs) const
+        {
+            // Forward convolution, bias gradient, and the other derivatives
+            // are computed one after another, so they can share the same memory
+            const std::size_t conv_size = internal::separable_workspace_size(
+                internal::grouped_thread_size<Scalar>(m_dim, m_groups, true), nobs);
+            const std::size_t db_size = internal::Workspace::block_size<Scalar>(
+                std::size_t(m_dim.out_channels) * nobs);
+            return std::max(conv_size, db_size);
+        }
+
+        void bind_workspace(internal::Workspace& ws, int nobs)
+        {
+            const std::size_t out_len = std::size_t(this->m_out_size) * nobs;
+            new (&m_z) AlignedMapMat(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            new (&m_a) AlignedMapMat(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            new (&m_din) AlignedMapMat(ws.allocate<Scalar>(std::size_t(this->m_in_size) * nobs),
+                                       this->m_in_size, nobs);
+            m_workspace = &ws;
+        }
+
+        void forward(const ConstRefMat& prev_layer_data)
+        {
+            compute(prev_layer_data, m_z, m_a, *m_workspace);
+        }
+
+        std::size_t inference_size(int nobs) const
+        {
+            return 2 * internal::Workspace::block_size<Scalar>(std::size_t(this->m_out_size) * nobs) +
+                   internal::separable_workspace_size(internal::grouped_thread_size<Scalar>(m_dim, m_groups, false),
+                                                      nobs);
+        }
+
+        AlignedMapMat infer(const ConstRefMat& prev_layer_data, internal::Workspace& ws) const
+        {
+            const int nobs = prev_layer_data.cols();
+            const std::size_t out_len = std::size_t(this->m_out_size) * nobs;
+            AlignedMapMat a(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            const std::size_t pos = ws.mark();
+            AlignedMapMat z(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            compute(prev_layer_data, z, a, ws);
+            ws.release(pos);
+            return a;
+        }
+
+        const AlignedMapMat& output() const
+        {
+            return m_a;
+        }
+
+        // prev_layer_data: in_size x nobs
+        // next_layer_data: out_size x nobs
+        void backprop(const ConstRefMat& prev_layer_data, const ConstRefMat& next_layer_data)
+        {
+            const int nobs = prev_layer_data.cols();
+            // d(L) / d(z) = [d(a) / d(z)] * [d(L) / d(a)]
+            AlignedMapMat& dLz = m_z;
+            Activation::template apply_jacobian<Scalar>(m_z, m_a, next_layer_data, dLz);
+            // Derivative for bias, d(L) / d(z) aggregated in each output channel
+            ConstAlignedMapMat dLz_by_channel(dLz.data(), m_dim.conv_rows * m_dim.conv_cols,
+                                              m_dim.out_channels * nobs);
+            const std::size_t ws_mark = m_workspace->mark();
+            AlignedMapMat dLb(m_workspace->allocate<Scalar>(std::size_t(m_dim.out_channels) * nobs),
+                              1, m_dim.out_channels * nobs);
+            dLb.noalias() = dLz_by_channel.colwise().sum();
+            // Average over observations
+            ConstAlignedMapMat dLb_by_obs(dLb.data(), m_dim.out_channels, nobs);
+            m_db.noalias() = dLb_by_obs.rowwise().mean();
+            m_workspace->release(ws_mark);
+            // Derivative for weights and input, restricted to the channels of each group
+            internal::convolve_grouped_backward(m_dim, m_groups, prev_layer_data.data(), nobs, dLz.data(),
+                                                m_filter_data.data(), m_df_data.data(),
+                                                this->m_input_grad ? m_din.data() : NULL, *m_workspace);
+            m_df_data /= nobs;
+        }
+
+        const AlignedMapMat& backprop_data() const
+        {
+            return m_din;
+        }
+
+        void update(Optimizer<Scalar>& opt)
+        {
+            ConstAlignedMapVec dw(m_df_data.data(), m_df_data.size());
+            ConstAlignedMapVec db(m_db.data(), m_db.size());
+            AlignedMapVec      w(m_filter_data.data(), m_filter_data.size());
+            AlignedMapVec      b(m_bias.data(), m_bias.size());
+            opt.update(dw, w);
+            opt.update(db, b);
+        }
+
+        std::vector<Scalar> get_parameters() const
+        {
+            std::vector<Scalar> res(m_filter_data.size() + m_bias.size());
+            // Copy the data of filters and bias to a long vector
+            std::copy(m_filter_data.data(), m_filter_data.data() + m_filter_data.size(),
+                      res.begin());
+            std::copy(m_bias.data(), m_bias.data() + m_bias.size(),
+                      res.begin() + m_filter_data.size());
+            return res;
+        }
+
+        void set_parameters(const std::vector<Scalar>& param)
+        {
+            if (static_cast<int>(param.size()) != m_filter_data.size() + m_bias.size())
+            {
+                throw std::invalid_argument("[class GroupedConvolutional]: Parameter size does not match");
+            }
+
+            std::copy(param.begin(), param.begin() + m_filter_data.size(),
+                      m_filter_data.data());
+            std::copy(param.begin() + m_filter_data.size(), param.end(), m_bias.data());
+        }
+
+        std::vector<Scalar> get_derivatives() const
+        {
+            std::vector<Scalar> res(m_df_data.size() + m_db.size());
+            // Copy the data of filters and bias to a long vector
+            std::copy(m_df_data.data(), m_df_data.data() + m_df_data.size(), res.begin());
+            std::copy(m_db.data(), m_db.data() + m_db.size(),
+                      res.begin() + m_df_data.size());
+            return res;
+        }
+
+        Layer<Scalar>* clone() const
+        {
+            GroupedConvolutional<Activation, Scalar>* res = new GroupedConvolutional<Activation, Scalar>(*this);
+            res->own_parameters();
+            return res;
+        }
+
+        void parameter_blocks(std::vector<AlignedMapVec>& params,
+                              std::vector<AlignedMapVec>& derivs)
+        {
+            params.push_back(AlignedMapVec(m_filter_data.data(), m_filter_data.size()));
+            params.push_back(AlignedMapVec(m_bias.data(), m_bias.size()));
+            derivs.push_back(AlignedMapVec(m_df_data.data(), m_df_data.size()));
+            derivs.push_back(AlignedMapVec(m_db.data(), m_db.size()));
+        }
+
+        std::string layer_type() const
+        {
+            return "GroupedConvolutional";
+        }
+
+        std::string activation_type() const
+        {
+            return Activation::return_type();
+        }
+
+        void fill_meta_info(MetaInfo& map, int index) const
+        {
+            std::string ind = internal::to_string(index);
+            map.insert(std::make_pair("Layer" + ind, internal::layer_id(layer_type())));
+            map.insert(std::make_pair("Activation" + ind, internal::activation_id(activation_type())));
+            map.insert(std::make_pair("in_channels" + ind, m_dim.in_channels));
+            map.insert(std::make_pair("out_channels" + ind, m_dim.out_channels));
+            map.insert(std::make_pair("in_height" + ind, m_dim.channel_rows));
+            map.insert(std::make_pair("in_width" + ind, m_dim.channel_cols));
+            map.insert(std::make_pair("window_width" + ind, m_dim.filter_cols));
+            map.insert(std::make_pair("window_height" + ind, m_dim.filter_rows));
+            map.insert(std::make_pair("groups" + ind, m_groups));
+            map.insert(std::make_pair("stride_width" + ind, m_dim.stride_cols));
+            map.insert(std::make_pair("stride_height" + ind, m_dim.stride_rows));
+            map.insert(std::make_pair("pad_width" + ind, m_dim.pad_cols));
+            map.insert(std::make_pair("pad_height" + ind, m_dim.pad_rows));
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* LAYER_GROUPEDCONVOLUTIONAL_H_ */
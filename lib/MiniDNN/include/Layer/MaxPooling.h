@@ -3,10 +3,12 @@
 
 #include <Eigen/Core>
 #include <vector>
+#include <new>
 #include <stdexcept>
 #include "../Config.h"
 #include "../Layer.h"
-#include "../Utils/FindMax.h"
+#include "../Utils/ActivationTraits.h"
+#include "../Utils/Pooling.h"
 #include "../Utils/IO.h"
 #include "../Utils/Enum.h"
 
@@ -19,14 +21,18 @@ namespace MiniDNN
 ///
 /// Max-pooling hidden layer
 ///
-/// Currently only supports the "valid" rule of pooling.
+/// Currently only supports the "valid" rule of pooling. The input and the output can
+/// be in the blocked layout of images, see Network::set_blocked_layout().
 ///
-template <typename Activation>
-class MaxPooling: public Layer
+template <typename Activation, typename Scalar = MiniDNN::Scalar>
+class MaxPooling: public Layer<Scalar>
 {
     private:
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
+        typedef typename Matrix::AlignedMapType AlignedMapMat;
         typedef Eigen::MatrixXi IntMatrix;
+        typedef IntMatrix::AlignedMapType AlignedMapIntMat;
         typedef std::map<std::string, int> MetaInfo;
 
         const int m_channel_rows;
@@ -35,14 +41,72 @@ class MaxPooling: public Layer
         const int m_pool_rows;
         const int m_pool_cols;
 
-        const int m_out_rows;
-        const int m_out_cols;
+        const internal::PoolDims m_dim;
 
-        IntMatrix m_loc;             // Record the locations of maximums
-        Matrix m_z;                  // Max pooling results
-        Matrix m_a;                  // Output of this layer, a = act(z)
-        Matrix m_din;                // Derivative of the input of this layer.
+        // The following buffers are carved from the workspace of the network
+        AlignedMapIntMat m_loc;      // Record the locations of maximums in each channel
+        AlignedMapMat m_z;           // Max pooling results
+        AlignedMapMat m_a;           // Output of this layer, a = act(z)
+        AlignedMapMat m_din;         // Derivative of the input of this layer.
                                      // Note that input of this layer is also the output of previous layer
+        internal::Workspace* m_workspace; // Workspace for temporary matrices
+
+        // Whether the images are pooled in the blocked layout
+        bool blocked() const
+        {
+            return this->m_blocked_in || this->m_blocked_out;
+        }
+
+        // Number of blocks of channels of nobs images in the blocked layout
+        int num_blocks(int nobs) const
+        {
+            return internal::channel_blocks<Scalar>(m_in_channels) * nobs;
+        }
+
+        // Compute the pooling results z, the locations of the maximums, and the output a,
+        // using only the dimensions of the layer
+        // The locations are not computed if loc is NULL
+        // The sides of the layer in the planar layout are converted in temporary memory of ws
+        void compute(const ConstRefMat& prev_layer_data, int* loc,
+                     AlignedMapMat& z, AlignedMapMat& a, internal::Workspace& ws) const
+        {
+            const int nobs = prev_layer_data.cols();
+
+            if (blocked())
+            {
+                const std::size_t pos = ws.mark();
+                const Scalar* in = prev_layer_data.data();
+                Scalar* out = z.data();
+
+                if (!this->m_blocked_in)
+                {
+                    Scalar* buf = ws.allocate<Scalar>(std::size_t(this->m_in_size) * nobs);
+                    internal::to_blocked_layout(in, m_in_channels, m_dim.channel_size(), nobs, buf);
+                    in = buf;
+                }
+
+                if (!this->m_blocked_out)
+                {
+                    out = ws.allocate<Scalar>(std::size_t(this->m_out_size) * nobs);
+                }
+
+                internal::max_pool_blocked(m_dim, in, num_blocks(nobs), out, loc);
+
+                if (!this->m_blocked_out)
+                {
+                    internal::to_planar_layout(out, m_in_channels, m_dim.out_size(), nobs, z.data());
+                }
+
+                ws.release(pos);
+            }
+            else
+            {
+                internal::max_pool(m_dim, prev_layer_data.data(), m_in_channels * nobs, z.data(), loc);
+            }
+
+            // Apply activation function
+            internal::ActivationKernel<Activation>::template activate<Scalar>(z, a, this->m_fast_act);
+        }
 
     public:
         // Currently we only implement the "valid" rule
@@ -58,108 +122,140 @@ class MaxPooling: public Layer
         ///
         MaxPooling(const int in_width_, const int in_height_, const int in_channels_,
                    const int pooling_width_, const int pooling_height_) :
-            Layer(in_width_ * in_height_ * in_channels_,
-                  (in_width_ / pooling_width_) * (in_height_ / pooling_height_) * in_channels_),
+            Layer<Scalar>(in_width_ * in_height_ * in_channels_,
+                          (in_width_ / pooling_width_) * (in_height_ / pooling_height_) * in_channels_),
             m_channel_rows(in_height_), m_channel_cols(in_width_),
             m_in_channels(in_channels_),
             m_pool_rows(pooling_height_), m_pool_cols(pooling_width_),
-            m_out_rows(m_channel_rows / m_pool_rows),
-            m_out_cols(m_channel_cols / m_pool_cols)
+            m_dim(in_height_, in_width_, pooling_height_, pooling_width_),
+            m_loc(NULL, 0, 0), m_z(NULL, 0, 0), m_a(NULL, 0, 0), m_din(NULL, 0, 0),
+            m_workspace(NULL)
         {}
 
         void init(const Scalar& mu, const Scalar& sigma, RNG& rng) {}
 
         void init() {}
 
-        void forward(const Matrix& prev_layer_data)
+        std::size_t workspace_size(int nobs) const
         {
-            // Each column is an observation
-            const int nobs = prev_layer_data.cols();
-            m_loc.resize(this->m_out_size, nobs);
-            m_z.resize(this->m_out_size, nobs);
-            // Use m_loc to store the address of each pooling block relative to the beginning of the data
-            int* loc_data = m_loc.data();
-            const int channel_end = prev_layer_data.size();
-            const int channel_stride = m_channel_rows * m_channel_cols;
-            const int col_end_gap = m_channel_rows * m_pool_cols * m_out_cols;
-            const int col_stride = m_channel_rows * m_pool_cols;
-            const int row_end_gap = m_out_rows * m_pool_rows;
-
-            for (int channel_start = 0; channel_start < channel_end;
-                    channel_start += channel_stride)
+            const std::size_t out_len = std::size_t(this->m_out_size) * nobs;
+            return internal::Workspace::block_size<int>(out_len) +
+                   2 * internal::Workspace::block_size<Scalar>(out_len) +
+                   internal::Workspace::block_size<Scalar>(std::size_t(this->m_in_size) * nobs);
+        }
+
+        std::size_t scratch_size(int nobs) const
+        {
+            // The sides in the planar layout are converted in the forward and backward passes
+            if (!blocked())
             {
-                const int col_end = channel_start + col_end_gap;
+                return 0;
+            }
 
-                for (int col_start = channel_start; col_start < col_end;
-                        col_start += col_stride)
-                {
-                    const int row_end = col_start + row_end_gap;
+            return (this->m_blocked_in ? 0 : internal::Workspace::block_size<Scalar>(std::size_t(this->m_in_size) * nobs)) +
+                   (this->m_blocked_out ? 0 : internal::Workspace::block_size<Scalar>(std::size_t(this->m_out_size) * nobs));
+        }
 
-                    for (int row_start = col_start; row_start < row_end;
-                            row_start += m_pool_rows, loc_data++)
-                    {
-                        *loc_data = row_start;
-                    }
-                }
-            }
+        void bind_workspace(internal::Workspace& ws, int nobs)
+        {
+            const std::size_t out_len = std::size_t(this->m_out_size) * nobs;
+            new (&m_loc) AlignedMapIntMat(ws.allocate<int>(out_len), this->m_out_size, nobs);
+            new (&m_z) AlignedMapMat(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            new (&m_a) AlignedMapMat(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            new (&m_din) AlignedMapMat(ws.allocate<Scalar>(std::size_t(this->m_in_size) * nobs),
+                                       this->m_in_size, nobs);
+            m_workspace = &ws;
+        }
 
-            // Find the location of the max value in each block
-            loc_data = m_loc.data();
-            const int* const loc_end = loc_data + m_loc.size();
-            Scalar* z_data = m_z.data();
-            const Scalar* src = prev_layer_data.data();
+        void forward(const ConstRefMat& prev_layer_data)
+        {
+            compute(prev_layer_data, m_loc.data(), m_z, m_a, *m_workspace);
+        }
 
-            for (; loc_data < loc_end; loc_data++, z_data++)
-            {
-                const int offset = *loc_data;
-                *z_data = internal::find_block_max(src + offset, m_pool_rows, m_pool_cols,
-                                                   m_channel_rows, *loc_data);
-                *loc_data += offset;
-            }
+        std::size_t inference_size(int nobs) const
+        {
+            return 2 * internal::Workspace::block_size<Scalar>(std::size_t(this->m_out_size) * nobs) +
+                   scratch_size(nobs);
+        }
 
-            // Apply activation function
-            m_a.resize(this->m_out_size, nobs);
-            Activation::activate(m_z, m_a);
+        AlignedMapMat infer(const ConstRefMat& prev_layer_data, internal::Workspace& ws) const
+        {
+            const int nobs = prev_layer_data.cols();
+            const std::size_t out_len = std::size_t(this->m_out_size) * nobs;
+            AlignedMapMat a(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            const std::size_t pos = ws.mark();
+            AlignedMapMat z(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            // Inference does not need the locations of the maximums
+            compute(prev_layer_data, NULL, z, a, ws);
+            ws.release(pos);
+            return a;
         }
 
-        const Matrix& output() const
+        const AlignedMapMat& output() const
         {
             return m_a;
         }
 
         // prev_layer_data: in_size x nobs
         // next_layer_data: out_size x nobs
-        void backprop(const Matrix& prev_layer_data, const Matrix& next_layer_data)
+        void backprop(const ConstRefMat& prev_layer_data, const ConstRefMat& next_layer_data)
         {
-            const int nobs = prev_layer_data.cols();
             // After forward stage, m_z contains z = max_pooling(in)
             // Now we need to calculate d(L) / d(z) = [d(a) / d(z)] * [d(L) / d(a)]
             // d(L) / d(z) is computed in the next layer, contained in next_layer_data
             // The Jacobian matrix J = d(a) / d(z) is determined by the activation function
-            Matrix& dLz = m_z;
-            Activation::apply_jacobian(m_z, m_a, next_layer_data, dLz);
+            if (!this->m_input_grad)
+            {
+                return;
+            }
+
+            AlignedMapMat& dLz = m_z;
+            Activation::template apply_jacobian<Scalar>(m_z, m_a, next_layer_data, dLz);
             // d(L) / d(in_i) = sum_j{ [d(z_j) / d(in_i)] * [d(L) / d(z_j)] }
             // d(z_j) / d(in_i) = 1 if in_i is used to compute z_j and is the maximum
             //                  = 0 otherwise
-            m_din.resize(this->m_in_size, nobs);
-            m_din.setZero();
-            const int dLz_size = dLz.size();
-            const Scalar* dLz_data = dLz.data();
-            const int* loc_data = m_loc.data();
-            Scalar* din_data = m_din.data();
-
-            for (int i = 0; i < dLz_size; i++)
+            // Each channel of m_din is filled by a single thread
+            const int nobs = prev_layer_data.cols();
+
+            if (!blocked())
             {
-                din_data[loc_data[i]] += dLz_data[i];
+                internal::max_pool_backward(m_dim, dLz.data(), m_loc.data(), m_in_channels * nobs, m_din.data());
+                return;
             }
+
+            // The locations of the maximums refer to the blocked input
+            const std::size_t pos = m_workspace->mark();
+            const Scalar* grad = dLz.data();
+            Scalar* din = m_din.data();
+
+            if (!this->m_blocked_out)
+            {
+                Scalar* buf = m_workspace->allocate<Scalar>(std::size_t(this->m_out_size) * nobs);
+                internal::to_blocked_layout(grad, m_in_channels, m_dim.out_size(), nobs, buf);
+                grad = buf;
+            }
+
+            if (!this->m_blocked_in)
+            {
+                din = m_workspace->allocate<Scalar>(std::size_t(this->m_in_size) * nobs);
+            }
+
+            internal::max_pool_blocked_backward(m_dim, grad, m_loc.data(), num_blocks(nobs), din);
+
+            if (!this->m_blocked_in)
+            {
+                internal::to_planar_layout(din, m_in_channels, m_dim.channel_size(), nobs, m_din.data());
+            }
+
+            m_workspace->release(pos);
         }
 
-        const Matrix& backprop_data() const
+        const AlignedMapMat& backprop_data() const
         {
             return m_din;
         }
 
-        void update(Optimizer& opt) {}
+        void update(Optimizer<Scalar>& opt) {}
 
         std::vector<Scalar> get_parameters() const
         {
@@ -173,6 +269,21 @@ class MaxPooling: public Layer
             return std::vector<Scalar>();
         }
 
+        Layer<Scalar>* clone() const
+        {
+            return new MaxPooling<Activation, Scalar>(*this);
+        }
+
+        int blocked_in_channels() const
+        {
+            return m_in_channels;
+        }
+
+        int blocked_out_channels() const
+        {
+            return m_in_channels;
+        }
+
         std::string layer_type() const
         {
             return "MaxPooling";
@@ -0,0 +1,300 @@
+#ifndef LAYER_POINTWISECONVOLUTIONAL_H_
+#define LAYER_POINTWISECONVOLUTIONAL_H_
+
+#include <Eigen/Core>
+#include <vector>
+#include <new>
+#include <algorithm>
+#include <stdexcept>
+#include "../Config.h"
+#include "../Layer.h"
+#include "../Utils/ActivationTraits.h"
+#include "../Utils/SeparableConvolution.h"
+#include "../Utils/Random.h"
+#include "../Utils/IO.h"
+#include "../Utils/Enum.h"
+
+
+namespace MiniDNN
+{
+
+
+///
+/// \ingroup Layers
+///
+/// Pointwise convolutional hidden layer, with 1x1 filters
+///
+/// Each output channel is a linear combination of the input channels at the same
+/// position, computed for each observation by a single matrix product on the input
+/// channels. It gives the same results as a Convolutional layer with a 1x1 window,
+/// whose parameters have the same layout. Together with a GroupedConvolutional
+/// layer with one group per input channel, it forms a depthwise separable convolution.
+///
+template <typename Activation, typename Scalar = MiniDNN::Scalar>
+class PointwiseConvolutional: public Layer<Scalar>
+{
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
+        typedef typename Matrix::AlignedMapType AlignedMapMat;
+        typedef typename Matrix::ConstAlignedMapType ConstAlignedMapMat;
+        typedef typename Vector::ConstAlignedMapType ConstAlignedMapVec;
+        typedef typename Vector::AlignedMapType AlignedMapVec;
+        typedef std::map<std::string, int> MetaInfo;
+
+        const int m_channel_rows;
+        const int m_channel_cols;
+        const int m_in_channels;
+        const int m_out_channels;
+
+        // The parameters refer to the storage of the layer or to the arena of the network
+        AlignedMapVec m_filter_data; // Filter parameters, an out_channels x in_channels matrix
+        AlignedMapVec m_df_data;     // Derivative of filters, same dimension as m_filter_data
+
+        AlignedMapVec m_bias;        // Bias term for the output channels, out_channels x 1
+        AlignedMapVec m_db;          // Derivative of bias, same dimension as m_bias
+
+        // The following buffers are carved from the workspace of the network
+        AlignedMapMat m_z;     // Linear term, z = conv(in, w) + b. Each column is an observation
+        AlignedMapMat m_a;     // Output of this layer, a = act(z)
+        AlignedMapMat m_din;   // Derivative of the input of this layer
+                               // Note that input of this layer is also the output of previous layer
+        internal::Workspace* m_workspace; // Workspace for temporary matrices
+
+        void bind_parameters(Scalar* param, Scalar* deriv)
+        {
+            const std::size_t flen = this->block_length(std::size_t(m_in_channels) * m_out_channels);
+            new (&m_filter_data) AlignedMapVec(param, m_in_channels * m_out_channels);
+            new (&m_bias) AlignedMapVec(param + flen, m_out_channels);
+            new (&m_df_data) AlignedMapVec(deriv, m_in_channels * m_out_channels);
+            new (&m_db) AlignedMapVec(deriv + flen, m_out_channels);
+        }
+
+        // Compute the linear term z and the output a, using only the parameters
+        void compute(const ConstRefMat& prev_layer_data, AlignedMapMat& z, AlignedMapMat& a) const
+        {
+            const int nobs = prev_layer_data.cols();
+            const int channel_nelem = m_channel_rows * m_channel_cols;
+            internal::convolve_pointwise(channel_nelem, m_in_channels, m_out_channels,
+                                         prev_layer_data.data(), nobs, m_filter_data.data(), z.data());
+            // Add bias terms
+            int channel_start_row = 0;
+
+            for (int i = 0; i < m_out_channels; i++, channel_start_row += channel_nelem)
+            {
+                z.block(channel_start_row, 0, channel_nelem, nobs).array() += m_bias[i];
+            }
+
+            // Apply activation function
+            internal::ActivationKernel<Activation>::template activate<Scalar>(z, a, this->m_fast_act);
+        }
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param in_width      Width of the input image in each channel.
+        /// \param in_height     Height of the input image in each channel.
+        /// \param in_channels   Number of input channels.
+        /// \param out_channels  Number of output channels.
+        ///
+        PointwiseConvolutional(const int in_width, const int in_height,
+                               const int in_channels, const int out_channels) :
+            Layer<Scalar>(in_width * in_height * in_channels,
+                          in_width * in_height * out_channels),
+            m_channel_rows(in_height), m_channel_cols(in_width),
+            m_in_channels(in_channels), m_out_channels(out_channels),
+            m_filter_data(NULL, 0), m_df_data(NULL, 0), m_bias(NULL, 0), m_db(NULL, 0),
+            m_z(NULL, 0, 0), m_a(NULL, 0, 0), m_din(NULL, 0, 0),
+            m_workspace(NULL)
+        {}
+
+        void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
+        {
+            init();
+            internal::set_normal_random(m_filter_data.data(), m_filter_data.size(), rng, mu, sigma);
+            internal::set_normal_random(m_bias.data(), m_out_channels, rng, mu, sigma);
+        }
+
+        void init()
+        {
+            this->allocate_parameters();
+        }
+
+        std::size_t parameter_size() const
+        {
+            return this->block_length(std::size_t(m_in_channels) * m_out_channels) +
+                   this->block_length(m_out_channels);
+        }
+
+        std::size_t workspace_size(int nobs) const
+        {
+            return 2 * internal::Workspace::block_size<Scalar>(std::size_t(this->m_out_size) * nobs) +
+                   internal::Workspace::block_size<Scalar>(std::size_t(this->m_in_size) * nobs);
+        }
+
+        std::size_t scratch_size(int nobs) const
+        {
+            // The bias gradient and the other derivatives are computed one after another
+            const std::size_t filter_size = std::size_t(m_in_channels) * m_out_channels;
+            return std::max(internal::separable_workspace_size(
+                                internal::Workspace::block_size<Scalar>(filter_size), nobs),
+                            internal::Workspace::block_size<Scalar>(std::size_t(m_out_channels) * nobs));
+        }
+
+        void bind_workspace(internal::Workspace& ws, int nobs)
+        {
+            const std::size_t out_len = std::size_t(this->m_out_size) * nobs;
+            new (&m_z) AlignedMapMat(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            new (&m_a) AlignedMapMat(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            new (&m_din) AlignedMapMat(ws.allocate<Scalar>(std::size_t(this->m_in_size) * nobs),
+                                       this->m_in_size, nobs);
+            m_workspace = &ws;
+        }
+
+        void forward(const ConstRefMat& prev_layer_data)
+        {
+            compute(prev_layer_data, m_z, m_a);
+        }
+
+        std::size_t inference_size(int nobs) const
+        {
+            return 2 * internal::Workspace::block_size<Scalar>(std::size_t(this->m_out_size) * nobs);
+        }
+
+        AlignedMapMat infer(const ConstRefMat& prev_layer_data, internal::Workspace& ws) const
+        {
+            const int nobs = prev_layer_data.cols();
+            const std::size_t out_len = std::size_t(this->m_out_size) * nobs;
+            AlignedMapMat a(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            const std::size_t pos = ws.mark();
+            AlignedMapMat z(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            compute(prev_layer_data, z, a);
+            ws.release(pos);
+            return a;
+        }
+
+        const AlignedMapMat& output() const
+        {
+            return m_a;
+        }
+
+        // prev_layer_data: in_size x nobs
+        // next_layer_data: out_size x nobs
+        void backprop(const ConstRefMat& prev_layer_data, const ConstRefMat& next_layer_data)
+        {
+            const int nobs = prev_layer_data.cols();
+            // d(L) / d(z) = [d(a) / d(z)] * [d(L) / d(a)]
+            AlignedMapMat& dLz = m_z;
+            Activation::template apply_jacobian<Scalar>(m_z, m_a, next_layer_data, dLz);
+            // Derivative for bias, d(L) / d(z) aggregated in each output channel
+            const int channel_nelem = m_channel_rows * m_channel_cols;
+            ConstAlignedMapMat dLz_by_channel(dLz.data(), channel_nelem, m_out_channels * nobs);
+            const std::size_t ws_mark = m_workspace->mark();
+            AlignedMapMat dLb(m_workspace->allocate<Scalar>(std::size_t(m_out_channels) * nobs),
+                              1, m_out_channels * nobs);
+            dLb.noalias() = dLz_by_channel.colwise().sum();
+            // Average over observations
+            ConstAlignedMapMat dLb_by_obs(dLb.data(), m_out_channels, nobs);
+            m_db.noalias() = dLb_by_obs.rowwise().mean();
+            m_workspace->release(ws_mark);
+            // Derivative for weights, and d(L) / d(in) = d(L) / d(z) * w for each observation
+            internal::convolve_pointwise_backward(channel_nelem, m_in_channels, m_out_channels,
+                                                  prev_layer_data.data(), nobs, dLz.data(),
+                                                  m_filter_data.data(), m_df_data.data(),
+                                                  this->m_input_grad ? m_din.data() : NULL, *m_workspace);
+            m_df_data /= nobs;
+        }
+
+        const AlignedMapMat& backprop_data() const
+        {
+            return m_din;
+        }
+
+        void update(Optimizer<Scalar>& opt)
+        {
+            ConstAlignedMapVec dw(m_df_data.data(), m_df_data.size());
+            ConstAlignedMapVec db(m_db.data(), m_db.size());
+            AlignedMapVec      w(m_filter_data.data(), m_filter_data.size());
+            AlignedMapVec      b(m_bias.data(), m_bias.size());
+            opt.update(dw, w);
+            opt.update(db, b);
+        }
+
+        std::vector<Scalar> get_parameters() const
+        {
+            std::vector<Scalar> res(m_filter_data.size() + m_bias.size());
+            // Copy the data of filters and bias to a long vector
+            std::copy(m_filter_data.data(), m_filter_data.data() + m_filter_data.size(),
+                      res.begin());
+            std::copy(m_bias.data(), m_bias.data() + m_bias.size(),
+                      res.begin() + m_filter_data.size());
+            return res;
+        }
+
+        void set_parameters(const std::vector<Scalar>& param)
+        {
+            if (static_cast<int>(param.size()) != m_filter_data.size() + m_bias.size())
+            {
+                throw std::invalid_argument("[class PointwiseConvolutional]: Parameter size does not match");
+            }
+
+            std::copy(param.begin(), param.begin() + m_filter_data.size(),
+                      m_filter_data.data());
+            std::copy(param.begin() + m_filter_data.size(), param.end(), m_bias.data());
+        }
+
+        std::vector<Scalar> get_derivatives() const
+        {
+            std::vector<Scalar> res(m_df_data.size() + m_db.size());
+            // Copy the data of filters and bias to a long vector
+            std::copy(m_df_data.data(), m_df_data.data() + m_df_data.size(), res.begin());
+            std::copy(m_db.data(), m_db.data() + m_db.size(),
+                      res.begin() + m_df_data.size());
+            return res;
+        }
+
+        Layer<Scalar>* clone() const
+        {
+            PointwiseConvolutional<Activation, Scalar>* res = new PointwiseConvolutional<Activation, Scalar>(*this);
+            res->own_parameters();
+            return res;
+        }
+
+        void parameter_blocks(std::vector<AlignedMapVec>& params,
+                              std::vector<AlignedMapVec>& derivs)
+        {
+            params.push_back(AlignedMapVec(m_filter_data.data(), m_filter_data.size()));
+            params.push_back(AlignedMapVec(m_bias.data(), m_bias.size()));
+            derivs.push_back(AlignedMapVec(m_df_data.data(), m_df_data.size()));
+            derivs.push_back(AlignedMapVec(m_db.data(), m_db.size()));
+        }
+
+        std::string layer_type() const
+        {
+            return "PointwiseConvolutional";
+        }
+
+        std::string activation_type() const
+        {
+            return Activation::return_type();
+        }
+
+        void fill_meta_info(MetaInfo& map, int index) const
+        {
+            std::string ind = internal::to_string(index);
+            map.insert(std::make_pair("Layer" + ind, internal::layer_id(layer_type())));
+            map.insert(std::make_pair("Activation" + ind, internal::activation_id(activation_type())));
+            map.insert(std::make_pair("in_channels" + ind, m_in_channels));
+            map.insert(std::make_pair("out_channels" + ind, m_out_channels));
+            map.insert(std::make_pair("in_height" + ind, m_channel_rows));
+            map.insert(std::make_pair("in_width" + ind, m_channel_cols));
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* LAYER_POINTWISECONVOLUTIONAL_H_ */
@@ -0,0 +1,374 @@
+#ifndef LAYER_QUANTIZEDCONVOLUTIONAL_H_
+#define LAYER_QUANTIZEDCONVOLUTIONAL_H_
+
+#include <Eigen/Core>
+#include <vector>
+#include <new>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+#include "../Config.h"
+#include "QuantizedLayer.h"
+#include "../Utils/Convolution.h"
+#include "../Utils/Quantization.h"
+#include "../Utils/Random.h"
+#include "../Utils/IO.h"
+#include "../Utils/Enum.h"
+#include "../Utils/ActivationTraits.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// \ingroup Layers
+///
+/// Convolutional hidden layer with int8 filters, for inference
+///
+/// The filters of each output channel have their own scale, and the input is
+/// quantized with one scale for the whole layer. See QuantizedLayer.
+/// Strides and padding are the same as in Convolutional.
+///
+template <typename Activation, typename Scalar = MiniDNN::Scalar>
+class QuantizedConvolutional: public QuantizedLayer<Scalar>
+{
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        typedef Eigen::Matrix<int8_t, Eigen::Dynamic, Eigen::Dynamic> QMatrix;
+        typedef Eigen::Matrix<int32_t, Eigen::Dynamic, Eigen::Dynamic> AccMatrix;
+        typedef Eigen::Matrix<int32_t, Eigen::Dynamic, 1> IntVector;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
+        typedef typename Matrix::AlignedMapType AlignedMapMat;
+        typedef typename AccMatrix::AlignedMapType AlignedMapAcc;
+        typedef std::map<std::string, int> MetaInfo;
+        typedef internal::ActivationTraits<Activation> Traits;
+
+        const internal::ConvDims m_dim; // Various dimensions of convolution
+        const int m_patch_size;         // Number of input values seen by one output value,
+                                        // in_channels x filter_rows x filter_cols
+        const int m_depth;              // m_patch_size padded for the int8 kernel
+
+        QMatrix   m_filter;     // Quantized filters, patch_size x out_channels. Column j holds
+                                // the filters of output channel j for all input channels, in
+                                // the same order as the patches built by build_patches(),
+                                // with zero rows appended, see internal::padded_depth()
+        IntVector m_filter_sum; // Sum of the quantized filters of each output channel
+        Vector    m_scale;      // Scale of the filters of each output channel
+        Vector    m_bias;       // Bias term for the output channels
+        Scalar    m_in_scale;   // Scale of the input
+        Vector    m_out_scale;  // Scale of the integer products, m_in_scale * m_scale
+        // The following buffers are carved from the workspace of the network
+        AlignedMapMat        m_a;          // Output of this layer, a = act(z)
+        internal::Workspace* m_workspace;  // Workspace for temporary matrices
+
+        // Temporary memory needed by compute()
+        std::size_t compute_size(int nobs) const
+        {
+            const std::size_t out_len = std::size_t(this->m_out_size) * nobs;
+            const std::size_t npatch = std::size_t(m_dim.conv_rows) * m_dim.conv_cols;
+            return internal::Workspace::block_size<uint8_t>(std::size_t(this->m_in_size) * nobs) +
+                   internal::Workspace::block_size<uint8_t>(npatch * m_depth) +
+                   internal::Workspace::block_size<int32_t>(out_len) +
+                   (Traits::in_place ? 0 : internal::Workspace::block_size<Scalar>(out_len));
+        }
+
+        // Copy the input values seen by each output position of one observation
+        // into a column of 'patches' (im2col), with the same layout as the filters
+        // Values in the zero padding of the input are the quantized zero
+        // The padding of the columns is not written
+        void build_patches(const uint8_t* src, uint8_t* patches) const
+        {
+            const int channel_size = m_dim.channel_rows * m_dim.channel_cols;
+            const int segment_size = m_dim.filter_rows;
+            const uint8_t zero = internal::ZeroPoint;
+
+            // Output positions are in column-major order, as in the output channels
+            for (int c = 0; c < m_dim.conv_cols; c++)
+            {
+                const int col = c * m_dim.stride_cols - m_dim.pad_cols;
+
+                for (int r = 0; r < m_dim.conv_rows; r++)
+                {
+                    // First row of the window, and the number of its rows that
+                    // fall in the top and bottom padding
+                    const int row = r * m_dim.stride_rows - m_dim.pad_rows;
+                    const int head = std::max(0, -row);
+                    const int tail = std::max(0, row + segment_size - m_dim.channel_rows);
+                    const int len = segment_size - head - tail;
+                    const uint8_t* channel = src + row + head;
+                    uint8_t* patch = patches + std::size_t(c * m_dim.conv_rows + r) * m_depth;
+
+                    for (int i = 0; i < m_dim.in_channels; i++, channel += channel_size)
+                    {
+                        // Each column of the window is contiguous in the input
+                        for (int q = col; q < col + m_dim.filter_cols; q++, patch += segment_size)
+                        {
+                            if (q < 0 || q >= m_dim.channel_cols)
+                            {
+                                std::memset(patch, zero, segment_size);
+                                continue;
+                            }
+
+                            std::memset(patch, zero, head);
+                            std::memcpy(patch + head, channel + q * m_dim.channel_rows, len);
+                            std::memset(patch + head + len, zero, tail);
+                        }
+                    }
+                }
+            }
+        }
+
+        // Compute the output a, using only the parameters
+        // Temporary memory is taken from ws and released before returning
+        void compute(const ConstRefMat& prev_layer_data, AlignedMapMat& a, internal::Workspace& ws) const
+        {
+            const int nobs = prev_layer_data.cols();
+            const int npatch = m_dim.conv_rows * m_dim.conv_cols;
+            const std::size_t in_len = std::size_t(this->m_in_size) * nobs;
+            const std::size_t out_len = std::size_t(this->m_out_size) * nobs;
+            const std::size_t pos = ws.mark();
+            // Quantize the input
+            uint8_t* in = ws.allocate<uint8_t>(in_len);
+            internal::quantize_unsigned(prev_layer_data.data(), in_len, m_in_scale, in);
+            // The padding of the patches is the same for all observations
+            uint8_t* patches = ws.allocate<uint8_t>(std::size_t(npatch) * m_depth);
+            std::fill(patches, patches + std::size_t(npatch) * m_depth, uint8_t(internal::ZeroPoint));
+            AlignedMapAcc acc(ws.allocate<int32_t>(out_len), this->m_out_size, nobs);
+
+            // The integer products of each observation are patches' * filters, an
+            // npatch x out_channels matrix, which is the layout of the output channels
+            for (int k = 0; k < nobs; k++)
+            {
+                build_patches(in + std::size_t(k) * this->m_in_size, patches);
+                internal::gemm_u8s8(npatch, m_dim.out_channels, m_depth, patches, m_filter.data(),
+                                    m_filter_sum.data(), acc.col(k).data(), 1, npatch);
+            }
+
+            // The linear term is not kept if the activation can be applied in place
+            AlignedMapMat z(Traits::in_place ? a.data() : ws.allocate<Scalar>(out_len),
+                            this->m_out_size, nobs);
+
+            // Requantize the products and add the bias of each output channel
+            for (int j = 0; j < m_dim.out_channels; j++)
+            {
+                z.middleRows(j * npatch, npatch).array() =
+                    acc.middleRows(j * npatch, npatch).template cast<Scalar>().array() * m_out_scale[j] + m_bias[j];
+            }
+
+            // Apply activation function
+            if (!Traits::identity)
+            {
+                internal::ActivationKernel<Activation>::template activate<Scalar>(z, a, this->m_fast_act);
+            }
+            else if (!Traits::in_place)
+            {
+                a.noalias() = z;
+            }
+
+            ws.release(pos);
+        }
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param in_width      Width of the input image in each channel.
+        /// \param in_height     Height of the input image in each channel.
+        /// \param in_channels   Number of input channels.
+        /// \param out_channels  Number of output channels.
+        /// \param window_width  Width of the filter.
+        /// \param window_height Height of the filter.
+        /// \param stride_width  Horizontal distance between two positions of the filter.
+        /// \param stride_height Vertical distance between two positions of the filter.
+        /// \param pad_width     Number of zero columns added on the left and the right
+        ///                      of each input channel.
+        /// \param pad_height    Number of zero rows added on the top and the bottom
+        ///                      of each input channel.
+        ///
+        QuantizedConvolutional(const int in_width, const int in_height,
+                               const int in_channels, const int out_channels,
+                               const int window_width, const int window_height,
+                               const int stride_width = 1, const int stride_height = 1,
+                               const int pad_width = 0, const int pad_height = 0) :
+            QuantizedLayer<Scalar>(in_width * in_height * in_channels,
+                                   internal::conv_output_size(in_width, window_width, stride_width, pad_width) *
+                                   internal::conv_output_size(in_height, window_height, stride_height, pad_height) *
+                                   out_channels),
+            m_dim(in_channels, out_channels, in_height, in_width, window_height,
+                  window_width, stride_height, stride_width, pad_height, pad_width),
+            m_patch_size(in_channels * window_height * window_width),
+            m_depth(internal::padded_depth(m_patch_size)),
+            m_in_scale(1),
+            m_a(NULL, 0, 0), m_workspace(NULL)
+        {}
+
+        void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
+        {
+            // Quantize random floating-point parameters, for inputs in [-1, 1]
+            init();
+            std::vector<Scalar> param(std::size_t(m_patch_size + 1) * m_dim.out_channels);
+            internal::set_normal_random(&param[0], int(param.size()), rng, mu, sigma);
+            quantize(param, Scalar(1));
+        }
+
+        void init()
+        {
+            // Set parameter dimension
+            m_filter.setZero(m_depth, m_dim.out_channels);
+            m_filter_sum.resize(m_dim.out_channels);
+            m_scale.resize(m_dim.out_channels);
+            m_bias.resize(m_dim.out_channels);
+            m_out_scale.resize(m_dim.out_channels);
+        }
+
+        void quantize(const std::vector<Scalar>& param, const Scalar& in_range)
+        {
+            // The parameters of Convolutional are the filters followed by the bias
+            if (static_cast<int>(param.size()) != (m_patch_size + 1) * m_dim.out_channels)
+            {
+                throw std::invalid_argument("[class QuantizedConvolutional]: Parameter size does not match");
+            }
+
+            // In Convolutional the filter of input channel i and output channel j
+            // starts at (i * out_channels + j) * filter_size, see Utils/Convolution.h
+            const int filter_size = m_dim.filter_rows * m_dim.filter_cols;
+            Vector filter(m_patch_size);
+
+            for (int j = 0; j < m_dim.out_channels; j++)
+            {
+                for (int i = 0; i < m_dim.in_channels; i++)
+                {
+                    const Scalar* src = &param[0] + std::size_t(i * m_dim.out_channels + j) * filter_size;
+                    std::copy(src, src + filter_size, filter.data() + i * filter_size);
+                }
+
+                m_scale[j] = internal::quantize(filter.data(), m_patch_size, m_filter.col(j).data());
+            }
+
+            internal::column_sums(m_filter.data(), m_depth, m_dim.out_channels, m_filter_sum.data());
+            std::copy(param.end() - m_bias.size(), param.end(), m_bias.data());
+            m_in_scale = internal::quantization_scale(in_range);
+            m_out_scale.noalias() = m_in_scale * m_scale;
+        }
+
+        std::size_t workspace_size(int nobs) const
+        {
+            return internal::Workspace::block_size<Scalar>(std::size_t(this->m_out_size) * nobs);
+        }
+
+        std::size_t scratch_size(int nobs) const
+        {
+            return compute_size(nobs);
+        }
+
+        void bind_workspace(internal::Workspace& ws, int nobs)
+        {
+            new (&m_a) AlignedMapMat(ws.allocate<Scalar>(std::size_t(this->m_out_size) * nobs),
+                                     this->m_out_size, nobs);
+            m_workspace = &ws;
+        }
+
+        void forward(const ConstRefMat& prev_layer_data)
+        {
+            compute(prev_layer_data, m_a, *m_workspace);
+        }
+
+        std::size_t inference_size(int nobs) const
+        {
+            return workspace_size(nobs) + compute_size(nobs);
+        }
+
+        AlignedMapMat infer(const ConstRefMat& prev_layer_data, internal::Workspace& ws) const
+        {
+            const int nobs = prev_layer_data.cols();
+            AlignedMapMat a(ws.allocate<Scalar>(std::size_t(this->m_out_size) * nobs),
+                            this->m_out_size, nobs);
+            compute(prev_layer_data, a, ws);
+            return a;
+        }
+
+        const AlignedMapMat& output() const
+        {
+            return m_a;
+        }
+
+        // The parameters are the quantized filters, the scales of the filters,
+        // the bias, and the scale of the input
+        std::vector<Scalar> get_parameters() const
+        {
+            std::vector<Scalar> res;
+            res.reserve(std::size_t(m_patch_size + 2) * m_dim.out_channels + 1);
+
+            for (int j = 0; j < m_dim.out_channels; j++)
+            {
+                res.insert(res.end(), m_filter.col(j).data(), m_filter.col(j).data() + m_patch_size);
+            }
+
+            res.insert(res.end(), m_scale.data(), m_scale.data() + m_scale.size());
+            res.insert(res.end(), m_bias.data(), m_bias.data() + m_bias.size());
+            res.push_back(m_in_scale);
+            return res;
+        }
+
+        void set_parameters(const std::vector<Scalar>& param)
+        {
+            if (static_cast<int>(param.size()) != (m_patch_size + 2) * m_dim.out_channels + 1)
+            {
+                throw std::invalid_argument("[class QuantizedConvolutional]: Parameter size does not match");
+            }
+
+            typename std::vector<Scalar>::const_iterator it = param.begin();
+
+            for (int j = 0; j < m_dim.out_channels; j++, it += m_patch_size)
+            {
+                std::copy(it, it + m_patch_size, m_filter.col(j).data());
+            }
+
+            internal::column_sums(m_filter.data(), m_depth, m_dim.out_channels, m_filter_sum.data());
+            std::copy(it, it + m_scale.size(), m_scale.data());
+            it += m_scale.size();
+            std::copy(it, it + m_bias.size(), m_bias.data());
+            m_in_scale = param.back();
+            m_out_scale.noalias() = m_in_scale * m_scale;
+        }
+
+        Layer<Scalar>* clone() const
+        {
+            return new QuantizedConvolutional<Activation, Scalar>(*this);
+        }
+
+        std::string layer_type() const
+        {
+            return "QuantizedConvolutional";
+        }
+
+        std::string activation_type() const
+        {
+            return Activation::return_type();
+        }
+
+        void fill_meta_info(MetaInfo& map, int index) const
+        {
+            std::string ind = internal::to_string(index);
+            map.insert(std::make_pair("Layer" + ind, internal::layer_id(layer_type())));
+            map.insert(std::make_pair("Activation" + ind, internal::activation_id(activation_type())));
+            map.insert(std::make_pair("in_channels" + ind, m_dim.in_channels));
+            map.insert(std::make_pair("out_channels" + ind, m_dim.out_channels));
+            map.insert(std::make_pair("in_height" + ind, m_dim.channel_rows));
+            map.insert(std::make_pair("in_width" + ind, m_dim.channel_cols));
+            map.insert(std::make_pair("window_width" + ind, m_dim.filter_cols));
+            map.insert(std::make_pair("window_height" + ind, m_dim.filter_rows));
+            map.insert(std::make_pair("stride_width" + ind, m_dim.stride_cols));
+            map.insert(std::make_pair("stride_height" + ind, m_dim.stride_rows));
+            map.insert(std::make_pair("pad_width" + ind, m_dim.pad_cols));
+            map.insert(std::make_pair("pad_height" + ind, m_dim.pad_rows));
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* LAYER_QUANTIZEDCONVOLUTIONAL_H_ */
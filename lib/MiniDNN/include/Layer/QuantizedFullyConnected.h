@@ -0,0 +1,294 @@
+#ifndef LAYER_QUANTIZEDFULLYCONNECTED_H_
+#define LAYER_QUANTIZEDFULLYCONNECTED_H_
+
+#include <Eigen/Core>
+#include <vector>
+#include <new>
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+#include "../Config.h"
+#include "QuantizedLayer.h"
+#include "../Utils/Quantization.h"
+#include "../Utils/Random.h"
+#include "../Utils/IO.h"
+#include "../Utils/Enum.h"
+#include "../Utils/ActivationTraits.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// \ingroup Layers
+///
+/// Fully connected hidden layer with int8 weights, for inference
+///
+/// The weights of each output unit have their own scale, and the input is
+/// quantized with one scale for the whole layer. See QuantizedLayer.
+///
+template <typename Activation, typename Scalar = MiniDNN::Scalar>
+class QuantizedFullyConnected: public QuantizedLayer<Scalar>
+{
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        typedef Eigen::Matrix<int8_t, Eigen::Dynamic, Eigen::Dynamic> QMatrix;
+        typedef Eigen::Matrix<int32_t, Eigen::Dynamic, Eigen::Dynamic> AccMatrix;
+        typedef Eigen::Matrix<int32_t, Eigen::Dynamic, 1> IntVector;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
+        typedef typename Matrix::AlignedMapType AlignedMapMat;
+        typedef typename AccMatrix::AlignedMapType AlignedMapAcc;
+        typedef std::map<std::string, int> MetaInfo;
+        typedef internal::ActivationTraits<Activation> Traits;
+
+        const int m_depth;      // Number of rows of m_weight, in_size padded for the int8 kernel
+        QMatrix   m_weight;     // Quantized weights, W(in_size x out_size), stored with
+                                // zero rows appended, see internal::padded_depth()
+        IntVector m_weight_sum; // Sum of the quantized weights of each output unit
+        Vector    m_scale;      // Scale of the weights of each output unit
+        Vector    m_bias;       // Bias parameters, b(out_size x 1)
+        Scalar    m_in_scale;   // Scale of the input
+        Vector    m_out_scale;  // Scale of the integer products, m_in_scale * m_scale
+        // The following buffers are carved from the workspace of the network
+        AlignedMapMat        m_a;          // Output of this layer, a = act(z)
+        internal::Workspace* m_workspace;  // Workspace for temporary matrices
+
+        // Number of observations processed together when the integer products
+        // are converted, chosen such that the tiles fit in the L1 cache
+        int tile_cols(int nobs) const
+        {
+            const std::ptrdiff_t col_bytes = (sizeof(int32_t) + 2 * sizeof(Scalar)) * this->m_out_size;
+            const int cols = Eigen::l1CacheSize() / col_bytes;
+            return std::max(std::min(cols, nobs), 1);
+        }
+
+        // Temporary memory needed by compute()
+        std::size_t compute_size(int nobs) const
+        {
+            const std::size_t out_len = std::size_t(this->m_out_size) * nobs;
+            return internal::Workspace::block_size<uint8_t>(std::size_t(m_depth) * nobs) +
+                   internal::Workspace::block_size<int32_t>(out_len) +
+                   (Traits::in_place ? 0 : internal::Workspace::block_size<Scalar>(out_len));
+        }
+
+        // Compute the output a, using only the parameters
+        // Temporary memory is taken from ws and released before returning
+        void compute(const ConstRefMat& prev_layer_data, AlignedMapMat& a, internal::Workspace& ws) const
+        {
+            const int nobs = prev_layer_data.cols();
+            const int tile = tile_cols(nobs);
+            const std::size_t out_len = std::size_t(this->m_out_size) * nobs;
+            const std::size_t pos = ws.mark();
+            // Quantize the input, with the columns padded like those of the weights
+            uint8_t* in = ws.allocate<uint8_t>(std::size_t(m_depth) * nobs);
+
+            if (m_depth == this->m_in_size)
+            {
+                internal::quantize_unsigned(prev_layer_data.data(), std::size_t(m_depth) * nobs, m_in_scale, in);
+            }
+            else
+            {
+                for (int j = 0; j < nobs; j++)
+                {
+                    uint8_t* col = in + std::size_t(j) * m_depth;
+                    internal::quantize_unsigned(prev_layer_data.col(j).data(), this->m_in_size, m_in_scale, col);
+                    std::fill(col + this->m_in_size, col + m_depth, uint8_t(internal::ZeroPoint));
+                }
+            }
+
+            // The kernel computes in' * W, which is stored transposed
+            AlignedMapAcc acc(ws.allocate<int32_t>(out_len), this->m_out_size, nobs);
+            internal::gemm_u8s8(nobs, this->m_out_size, m_depth, in, m_weight.data(),
+                                m_weight_sum.data(), acc.data(), this->m_out_size, 1);
+            // The linear term is not kept if the activation can be applied in place
+            AlignedMapMat z(Traits::in_place ? a.data() : ws.allocate<Scalar>(out_len),
+                            this->m_out_size, nobs);
+
+            // Requantize the products, add the bias and apply the activation
+            // function in one sweep
+            for (int c = 0; c < nobs; c += tile)
+            {
+                const int nb = std::min(tile, nobs - c);
+                z.middleCols(c, nb).array() = (acc.middleCols(c, nb).template cast<Scalar>().array().colwise() *
+                                               m_out_scale.array()).colwise() + m_bias.array();
+
+                if (!Traits::identity)
+                {
+                    internal::ActivationKernel<Activation>::template activate<Scalar>(z.middleCols(c, nb), a.middleCols(c, nb),
+                                                                                      this->m_fast_act);
+                }
+                else if (!Traits::in_place)
+                {
+                    a.middleCols(c, nb).noalias() = z.middleCols(c, nb);
+                }
+            }
+
+            ws.release(pos);
+        }
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param in_size  Number of input units.
+        /// \param out_size Number of output units.
+        ///
+        QuantizedFullyConnected(const int in_size, const int out_size) :
+            QuantizedLayer<Scalar>(in_size, out_size),
+            m_depth(internal::padded_depth(in_size)),
+            m_in_scale(1),
+            m_a(NULL, 0, 0), m_workspace(NULL)
+        {}
+
+        void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
+        {
+            // Quantize random floating-point parameters, for inputs in [-1, 1]
+            init();
+            std::vector<Scalar> param(std::size_t(this->m_in_size + 1) * this->m_out_size);
+            internal::set_normal_random(&param[0], int(param.size()), rng, mu, sigma);
+            quantize(param, Scalar(1));
+        }
+
+        void init()
+        {
+            // Set parameter dimension
+            m_weight.setZero(m_depth, this->m_out_size);
+            m_weight_sum.resize(this->m_out_size);
+            m_scale.resize(this->m_out_size);
+            m_bias.resize(this->m_out_size);
+            m_out_scale.resize(this->m_out_size);
+        }
+
+        void quantize(const std::vector<Scalar>& param, const Scalar& in_range)
+        {
+            // The parameters of FullyConnected are the weights followed by the bias
+            if (static_cast<int>(param.size()) != this->m_in_size * this->m_out_size + m_bias.size())
+            {
+                throw std::invalid_argument("[class QuantizedFullyConnected]: Parameter size does not match");
+            }
+
+            for (int j = 0; j < this->m_out_size; j++)
+            {
+                m_scale[j] = internal::quantize(&param[0] + std::size_t(j) * this->m_in_size,
+                                                this->m_in_size, m_weight.col(j).data());
+            }
+
+            internal::column_sums(m_weight.data(), m_depth, this->m_out_size, m_weight_sum.data());
+            std::copy(param.end() - m_bias.size(), param.end(), m_bias.data());
+            m_in_scale = internal::quantization_scale(in_range);
+            m_out_scale.noalias() = m_in_scale * m_scale;
+        }
+
+        std::size_t workspace_size(int nobs) const
+        {
+            return internal::Workspace::block_size<Scalar>(std::size_t(this->m_out_size) * nobs);
+        }
+
+        std::size_t scratch_size(int nobs) const
+        {
+            return compute_size(nobs);
+        }
+
+        void bind_workspace(internal::Workspace& ws, int nobs)
+        {
+            new (&m_a) AlignedMapMat(ws.allocate<Scalar>(std::size_t(this->m_out_size) * nobs),
+                                     this->m_out_size, nobs);
+            m_workspace = &ws;
+        }
+
+        // prev_layer_data: in_size x nobs
+        void forward(const ConstRefMat& prev_layer_data)
+        {
+            compute(prev_layer_data, m_a, *m_workspace);
+        }
+
+        std::size_t inference_size(int nobs) const
+        {
+            return workspace_size(nobs) + compute_size(nobs);
+        }
+
+        AlignedMapMat infer(const ConstRefMat& prev_layer_data, internal::Workspace& ws) const
+        {
+            const int nobs = prev_layer_data.cols();
+            AlignedMapMat a(ws.allocate<Scalar>(std::size_t(this->m_out_size) * nobs),
+                            this->m_out_size, nobs);
+            compute(prev_layer_data, a, ws);
+            return a;
+        }
+
+        const AlignedMapMat& output() const
+        {
+            return m_a;
+        }
+
+        // The parameters are the quantized weights, the scales of the weights,
+        // the bias, and the scale of the input
+        std::vector<Scalar> get_parameters() const
+        {
+            std::vector<Scalar> res;
+            res.reserve(this->m_in_size * this->m_out_size + 2 * m_bias.size() + 1);
+
+            for (int j = 0; j < this->m_out_size; j++)
+            {
+                res.insert(res.end(), m_weight.col(j).data(), m_weight.col(j).data() + this->m_in_size);
+            }
+
+            res.insert(res.end(), m_scale.data(), m_scale.data() + m_scale.size());
+            res.insert(res.end(), m_bias.data(), m_bias.data() + m_bias.size());
+            res.push_back(m_in_scale);
+            return res;
+        }
+
+        void set_parameters(const std::vector<Scalar>& param)
+        {
+            if (static_cast<int>(param.size()) != this->m_in_size * this->m_out_size + 2 * m_bias.size() + 1)
+            {
+                throw std::invalid_argument("[class QuantizedFullyConnected]: Parameter size does not match");
+            }
+
+            typename std::vector<Scalar>::const_iterator it = param.begin();
+
+            for (int j = 0; j < this->m_out_size; j++, it += this->m_in_size)
+            {
+                std::copy(it, it + this->m_in_size, m_weight.col(j).data());
+            }
+
+            internal::column_sums(m_weight.data(), m_depth, this->m_out_size, m_weight_sum.data());
+            std::copy(it, it + m_scale.size(), m_scale.data());
+            it += m_scale.size();
+            std::copy(it, it + m_bias.size(), m_bias.data());
+            m_in_scale = param.back();
+            m_out_scale.noalias() = m_in_scale * m_scale;
+        }
+
+        Layer<Scalar>* clone() const
+        {
+            return new QuantizedFullyConnected<Activation, Scalar>(*this);
+        }
+
+        std::string layer_type() const
+        {
+            return "QuantizedFullyConnected";
+        }
+
+        std::string activation_type() const
+        {
+            return Activation::return_type();
+        }
+
+        void fill_meta_info(MetaInfo& map, int index) const
+        {
+            std::string ind = internal::to_string(index);
+            map.insert(std::make_pair("Layer" + ind, internal::layer_id(layer_type())));
+            map.insert(std::make_pair("Activation" + ind, internal::activation_id(activation_type())));
+            map.insert(std::make_pair("in_size" + ind, this->in_size()));
+            map.insert(std::make_pair("out_size" + ind, this->out_size()));
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* LAYER_QUANTIZEDFULLYCONNECTED_H_ */
@@ -0,0 +1,78 @@
+#ifndef LAYER_QUANTIZEDLAYER_H_
+#define LAYER_QUANTIZEDLAYER_H_
+
+#include <Eigen/Core>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "../Config.h"
+#include "../Layer.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// \ingroup Layers
+///
+/// The interface of hidden layers that compute with 8-bit integer parameters
+///
+/// A quantized layer replaces a trained floating-point layer of the same
+/// shape for inference. Its weights are stored as int8 values with one scale
+/// per output channel, and its input is quantized with a scale calibrated on
+/// sample data, so the matrix products run on int8 values with int32
+/// accumulation. The results are converted back to `Scalar` together with the
+/// bias and the activation function.
+///
+/// Quantized layers do not support training, and Layer::backprop() throws an
+/// exception. See the Quantizer class for how to create them from a trained network.
+///
+template <typename Scalar = MiniDNN::Scalar>
+class QuantizedLayer: public Layer<Scalar>
+{
+    protected:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
+        typedef typename Matrix::AlignedMapType AlignedMapMat;
+
+        AlignedMapMat m_din;  // Always empty, as the layer is not trained
+
+    public:
+        QuantizedLayer(const int in_size, const int out_size) :
+            Layer<Scalar>(in_size, out_size),
+            m_din(NULL, 0, 0)
+        {}
+
+        ///
+        /// Set the parameters of this layer by quantizing those of a trained layer
+        ///
+        /// \param param    The parameters of the floating-point layer that this layer
+        ///                 replaces, as returned by its Layer::get_parameters().
+        /// \param in_range The largest magnitude of the input of the layer, as observed
+        ///                 on sample data. Larger inputs are clipped.
+        ///
+        virtual void quantize(const std::vector<Scalar>& param, const Scalar& in_range) = 0;
+
+        void backprop(const ConstRefMat& prev_layer_data, const ConstRefMat& next_layer_data)
+        {
+            throw std::logic_error("[class QuantizedLayer]: Quantized layers only support inference");
+        }
+
+        const AlignedMapMat& backprop_data() const
+        {
+            return m_din;
+        }
+
+        void update(Optimizer<Scalar>& opt) {}
+
+        std::vector<Scalar> get_derivatives() const
+        {
+            return std::vector<Scalar>();
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* LAYER_QUANTIZEDLAYER_H_ */
@@ -0,0 +1,484 @@
+#ifndef LAYER_SPARSEFULLYCONNECTED_H_
+#define LAYER_SPARSEFULLYCONNECTED_H_
+
+#include <Eigen/Core>
+#include <Eigen/SparseCore>
+#include <vector>
+#include <new>
+#include <algorithm>
+#include <stdexcept>
+#include "../Config.h"
+#include "../Layer.h"
+#include "../Utils/Random.h"
+#include "../Utils/Pruning.h"
+#include "../Utils/IO.h"
+#include "../Utils/Enum.h"
+#include "../Utils/ActivationTraits.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// \ingroup Layers
+///
+/// Fully connected hidden layer with a sparse weight matrix
+///
+/// The weights are stored in the compressed column format of `Eigen::SparseMatrix`,
+/// where column j contains the nonzero weights of output unit j. Only the
+/// nonzero weights are trained, so the sparsity pattern is kept during training.
+///
+/// A newly initialized layer is dense. Weights are removed with prune(), or by
+/// setting parameters that contain zeros, see set_parameters(). The Pruner class
+/// creates sparse layers from the FullyConnected layers of a trained network.
+///
+/// The parameters are serialized in the same dense format as FullyConnected,
+/// with zeros for the pruned weights.
+///
+template <typename Activation, typename Scalar = MiniDNN::Scalar>
+class SparseFullyConnected: public Layer<Scalar>
+{
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        typedef Eigen::Matrix<int, Eigen::Dynamic, 1> IntVector;
+        typedef Eigen::SparseMatrix<Scalar, Eigen::ColMajor, int> SparseMatrix;
+        typedef Eigen::Map<const SparseMatrix> ConstSparseMap;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
+        typedef typename Matrix::AlignedMapType AlignedMapMat;
+        typedef typename Vector::ConstAlignedMapType ConstAlignedMapVec;
+        typedef typename Vector::AlignedMapType AlignedMapVec;
+        typedef std::map<std::string, int> MetaInfo;
+        typedef internal::ActivationTraits<Activation> Traits;
+
+        // Nonzero weights W(in_size x out_size) in compressed column format. The
+        // values are parameter blocks like the bias, so that they can be updated by
+        // the optimizers like other parameters
+        IntVector     m_outer; // Position of the first nonzero weight of each output unit, (out_size + 1)
+        IntVector     m_inner; // Input unit of each nonzero weight
+        AlignedMapVec m_value; // Nonzero weights
+        AlignedMapVec m_bias;  // Bias parameters, b(out_size x 1)
+        AlignedMapVec m_dw;    // Derivative of the nonzero weights
+        AlignedMapVec m_db;    // Derivative of bias
+        // The following buffers are carved from the workspace of the network
+        AlignedMapMat        m_z;         // Linear term, z = W' * in + b
+        AlignedMapMat        m_a;         // Output of this layer, a = act(z)
+        AlignedMapMat        m_din;       // Derivative of the input of this layer.
+                                          // Note that input of this layer is also the output of previous layer
+        internal::Workspace* m_workspace; // Workspace for temporary matrices
+
+        // Number of observations processed together in the fused epilogues,
+        // see FullyConnected
+        int tile_cols(int nobs) const
+        {
+            const std::ptrdiff_t col_bytes = 2 * sizeof(Scalar) * this->m_out_size;
+            const int cols = Eigen::l1CacheSize() / col_bytes;
+            return std::max(std::min(cols, nobs), 1);
+        }
+
+        void bind_parameters(Scalar* param, Scalar* deriv)
+        {
+            const int nnz = m_inner.size();
+            const std::size_t vlen = this->block_length(nnz);
+            new (&m_value) AlignedMapVec(param, nnz);
+            new (&m_bias) AlignedMapVec(param + vlen, this->m_out_size);
+            new (&m_dw) AlignedMapVec(deriv, nnz);
+            new (&m_db) AlignedMapVec(deriv + vlen, this->m_out_size);
+        }
+
+        // Set the sparsity pattern from the nonzero coefficients of a dense matrix
+        // The number of parameters changes, so they are allocated again, and the
+        // bias is kept
+        void set_pattern(const Matrix& weight)
+        {
+            const SparseMatrix sp = weight.sparseView();
+            const int nnz = sp.nonZeros();
+            const Vector bias = m_bias;
+            m_outer = Eigen::Map<const IntVector>(sp.outerIndexPtr(), this->m_out_size + 1);
+            m_inner = Eigen::Map<const IntVector>(sp.innerIndexPtr(), nnz);
+            this->allocate_parameters();
+            m_value = Eigen::Map<const Vector>(sp.valuePtr(), nnz);
+
+            if (bias.size() == m_bias.size())
+            {
+                m_bias = bias;
+            }
+        }
+
+        // The input, the linear term, and their derivatives are transposed in the
+        // computations, so that each nonzero weight multiplies a contiguous vector
+        // of observations. The sparse products are then vectorized over observations
+        std::size_t transposed_size(int rows, int nobs) const
+        {
+            return internal::Workspace::block_size<Scalar>(std::size_t(rows) * nobs);
+        }
+
+        // Compute the linear term z and the output a, using only the parameters
+        // If the activation can be applied in place, z is not written and may
+        // refer to the same memory as a
+        // Temporary memory is taken from ws and released before returning
+        void compute(const ConstRefMat& prev_layer_data, AlignedMapMat& z, AlignedMapMat& a,
+                     internal::Workspace& ws, const bool activate) const
+        {
+            const int nobs = prev_layer_data.cols();
+            const int tile = tile_cols(nobs);
+            const bool direct = Traits::in_place || !activate;
+            AlignedMapMat& out = direct ? a : z;
+            const std::size_t pos = ws.mark();
+            AlignedMapMat in_t(ws.allocate<Scalar>(std::size_t(this->m_in_size) * nobs), nobs, this->m_in_size);
+            AlignedMapMat out_t(ws.allocate<Scalar>(std::size_t(this->m_out_size) * nobs), nobs, this->m_out_size);
+            in_t.noalias() = prev_layer_data.transpose();
+
+            // Linear term z' = in' * W
+            for (int j = 0; j < this->m_out_size; j++)
+            {
+                out_t.col(j).setZero();
+
+                for (int p = m_outer[j]; p < m_outer[j + 1]; p++)
+                {
+                    out_t.col(j).noalias() += m_value[p] * in_t.col(m_inner[p]);
+                }
+            }
+
+            out.noalias() = out_t.transpose();
+            ws.release(pos);
+
+            // Add the bias and apply the activation function in one sweep
+            for (int c = 0; c < nobs; c += tile)
+            {
+                const int nb = std::min(tile, nobs - c);
+                out.middleCols(c, nb).colwise() += m_bias;
+
+                if (activate && !Traits::identity)
+                {
+                    internal::ActivationKernel<Activation>::template activate<Scalar>(out.middleCols(c, nb), a.middleCols(c, nb),
+                                                                                      this->m_fast_act);
+                }
+                else if (!direct)
+                {
+                    a.middleCols(c, nb).noalias() = out.middleCols(c, nb);
+                }
+            }
+        }
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param in_size  Number of input units.
+        /// \param out_size Number of output units.
+        ///
+        SparseFullyConnected(const int in_size, const int out_size) :
+            Layer<Scalar>(in_size, out_size),
+            m_value(NULL, 0), m_bias(NULL, 0), m_dw(NULL, 0), m_db(NULL, 0),
+            m_z(NULL, 0, 0), m_a(NULL, 0, 0), m_din(NULL, 0, 0), m_workspace(NULL)
+        {}
+
+        void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
+        {
+            // Set parameter dimension, with all weights nonzero
+            init();
+            // Set random coefficients
+            internal::set_normal_random(m_value.data(), m_value.size(), rng, mu, sigma);
+            internal::set_normal_random(m_bias.data(), m_bias.size(), rng, mu, sigma);
+        }
+
+        void init()
+        {
+            // Set parameter dimension, with all weights nonzero
+            set_pattern(Matrix::Ones(this->m_in_size, this->m_out_size));
+            m_bias.setZero();
+        }
+
+        std::size_t parameter_size() const
+        {
+            return this->block_length(m_inner.size()) + this->block_length(this->m_out_size);
+        }
+
+        ///
+        /// The weight matrix W(in_size x out_size), which is valid until the
+        /// sparsity pattern changes
+        ///
+        ConstSparseMap weight() const
+        {
+            return ConstSparseMap(this->m_in_size, this->m_out_size, m_value.size(),
+                                  m_outer.data(), m_inner.data(), m_value.data());
+        }
+
+        ///
+        /// Number of nonzero weights
+        ///
+        int num_nonzeros() const
+        {
+            return m_value.size();
+        }
+
+        ///
+        /// Fraction of the weights that are zero
+        ///
+        double sparsity() const
+        {
+            const double size = double(this->m_in_size) * double(this->m_out_size);
+            return (size > 0) ? 1.0 - double(m_value.size()) / size : 0.0;
+        }
+
+        ///
+        /// Remove the weights with the smallest magnitudes
+        ///
+        /// The storage of the parameters changes, so this function should be called
+        /// before the layer is trained. The bias is not pruned.
+        ///
+        /// \param sparsity Fraction of all the weights, including those already removed,
+        ///                 that should be zero, in [0, 1]. Weights are never added back.
+        ///
+        void prune(const double sparsity)
+        {
+            const std::size_t nkeep = internal::num_kept(std::size_t(this->m_in_size) * this->m_out_size, sparsity);
+
+            if (nkeep >= std::size_t(m_value.size()))
+            {
+                return;
+            }
+
+            Matrix dense = weight();
+            internal::prune_by_magnitude(dense.data(), dense.size(), nkeep);
+            set_pattern(dense);
+        }
+
+        std::size_t workspace_size(int nobs) const
+        {
+            return 2 * internal::Workspace::block_size<Scalar>(std::size_t(this->m_out_size) * nobs) +
+                   internal::Workspace::block_size<Scalar>(std::size_t(this->m_in_size) * nobs);
+        }
+
+        std::size_t scratch_size(int nobs) const
+        {
+            // The transposed input and output in forward(), and the transposed input,
+            // output derivative, and input derivative in backprop()
+            return 2 * transposed_size(this->m_in_size, nobs) + transposed_size(this->m_out_size, nobs);
+        }
+
+        void bind_workspace(internal::Workspace& ws, int nobs)
+        {
+            const std::size_t out_len = std::size_t(this->m_out_size) * nobs;
+            new (&m_z) AlignedMapMat(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            new (&m_a) AlignedMapMat(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            new (&m_din) AlignedMapMat(ws.allocate<Scalar>(std::size_t(this->m_in_size) * nobs),
+                                       this->m_in_size, nobs);
+            m_workspace = &ws;
+        }
+
+        // prev_layer_data: in_size x nobs
+        void forward(const ConstRefMat& prev_layer_data)
+        {
+            compute(prev_layer_data, m_z, m_a, *m_workspace, !this->m_defer_act);
+        }
+
+        std::size_t inference_size(int nobs) const
+        {
+            const int nbuf = Traits::in_place ? 1 : 2;
+            return nbuf * internal::Workspace::block_size<Scalar>(std::size_t(this->m_out_size) * nobs) +
+                   transposed_size(this->m_in_size, nobs) + transposed_size(this->m_out_size, nobs);
+        }
+
+        AlignedMapMat infer(const ConstRefMat& prev_layer_data, internal::Workspace& ws) const
+        {
+            const int nobs = prev_layer_data.cols();
+            const std::size_t out_len = std::size_t(this->m_out_size) * nobs;
+            AlignedMapMat a(ws.allocate<Scalar>(out_len), this->m_out_size, nobs);
+            const std::size_t pos = ws.mark();
+            AlignedMapMat z(Traits::in_place ? a.data() : ws.allocate<Scalar>(out_len),
+                            this->m_out_size, nobs);
+            compute(prev_layer_data, z, a, ws, true);
+            ws.release(pos);
+            return a;
+        }
+
+        const AlignedMapMat& output() const
+        {
+            return m_a;
+        }
+
+        // prev_layer_data: in_size x nobs
+        // next_layer_data: out_size x nobs
+        void backprop(const ConstRefMat& prev_layer_data, const ConstRefMat& next_layer_data)
+        {
+            const int nobs = prev_layer_data.cols();
+            const int tile = tile_cols(nobs);
+            // The linear term is not kept if the Jacobian does not depend on it
+            const AlignedMapMat& z = Traits::in_place ? m_a : m_z;
+            // d(L) / d(z) is computed as in FullyConnected
+            const bool jacobian = !Traits::identity && !this->m_defer_act;
+            const ConstRefMat dLz = jacobian ? ConstRefMat(m_z) : next_layer_data;
+            m_db.setZero();
+
+            // Apply the Jacobian and reduce the result for the bias in one sweep
+            for (int c = 0; c < nobs; c += tile)
+            {
+                const int nb = std::min(tile, nobs - c);
+
+                if (jacobian)
+                {
+                    Activation::template apply_jacobian<Scalar>(z.middleCols(c, nb), m_a.middleCols(c, nb),
+                                                                next_layer_data.middleCols(c, nb), m_z.middleCols(c, nb));
+                }
+
+                // Derivative for bias, d(L) / d(b) = d(L) / d(z)
+                m_db.noalias() += dLz.middleCols(c, nb).rowwise().sum();
+            }
+
+            m_db /= Scalar(nobs);
+
+            const std::size_t pos = m_workspace->mark();
+            AlignedMapMat in_t(m_workspace->allocate<Scalar>(std::size_t(this->m_in_size) * nobs),
+                               nobs, this->m_in_size);
+            AlignedMapMat dLz_t(m_workspace->allocate<Scalar>(std::size_t(this->m_out_size) * nobs),
+                                nobs, this->m_out_size);
+            AlignedMapMat din_t(m_workspace->allocate<Scalar>(std::size_t(this->m_in_size) * nobs),
+                                nobs, this->m_in_size);
+            in_t.noalias() = prev_layer_data.transpose();
+            dLz_t.noalias() = dLz.transpose();
+            din_t.setZero();
+
+            // Derivative for the nonzero weights, d(L) / d(W) = [d(L) / d(z)] * in',
+            // which is not computed for the pruned weights so that they stay zero.
+            // d(L) / d_in = W * [d(L) / d(z)] is accumulated in the same loop
+            const bool input_grad = this->m_input_grad;
+
+            for (int j = 0; j < this->m_out_size; j++)
+            {
+                for (int p = m_outer[j]; p < m_outer[j + 1]; p++)
+                {
+                    const int i = m_inner[p];
+                    m_dw[p] = in_t.col(i).dot(dLz_t.col(j)) / Scalar(nobs);
+
+                    if (input_grad)
+                    {
+                        din_t.col(i).noalias() += m_value[p] * dLz_t.col(j);
+                    }
+                }
+            }
+
+            if (input_grad)
+            {
+                m_din.noalias() = din_t.transpose();
+            }
+            m_workspace->release(pos);
+        }
+
+        const AlignedMapMat& backprop_data() const
+        {
+            return m_din;
+        }
+
+        void update(Optimizer<Scalar>& opt)
+        {
+            ConstAlignedMapVec dw(m_dw.data(), m_dw.size());
+            ConstAlignedMapVec db(m_db.data(), m_db.size());
+            AlignedMapVec      w(m_value.data(), m_value.size());
+            AlignedMapVec      b(m_bias.data(), m_bias.size());
+            opt.update(dw, w);
+            opt.update(db, b);
+        }
+
+        // The weights are serialized as a dense matrix, with zeros for the pruned weights
+        std::vector<Scalar> get_parameters() const
+        {
+            const std::size_t wsize = std::size_t(this->m_in_size) * this->m_out_size;
+            std::vector<Scalar> res(wsize + m_bias.size(), Scalar(0));
+            Eigen::Map<Matrix>(&res[0], this->m_in_size, this->m_out_size) = weight();
+            std::copy(m_bias.data(), m_bias.data() + m_bias.size(), res.begin() + wsize);
+            return res;
+        }
+
+        // The sparsity pattern is given by the nonzero weights in param. If the
+        // pattern does not change, the parameters keep their storage, so that the
+        // layer can continue to be trained
+        void set_parameters(const std::vector<Scalar>& param)
+        {
+            const std::size_t wsize = std::size_t(this->m_in_size) * this->m_out_size;
+
+            if (param.size() != wsize + m_bias.size())
+            {
+                throw std::invalid_argument("[class SparseFullyConnected]: Parameter size does not match");
+            }
+
+            Eigen::Map<const Matrix> weight(&param[0], this->m_in_size, this->m_out_size);
+            const int nnz = m_value.size();
+            bool same_pattern = (weight.array() != Scalar(0)).count() == nnz;
+
+            for (int j = 0; same_pattern && j < this->m_out_size; j++)
+            {
+                for (int p = m_outer[j]; p < m_outer[j + 1]; p++)
+                {
+                    m_value[p] = weight(m_inner[p], j);
+                    same_pattern = same_pattern && (m_value[p] != Scalar(0));
+                }
+            }
+
+            if (!same_pattern)
+            {
+                set_pattern(weight);
+            }
+
+            std::copy(param.begin() + wsize, param.end(), m_bias.data());
+        }
+
+        // The derivatives are serialized in the same format as the parameters
+        std::vector<Scalar> get_derivatives() const
+        {
+            const std::size_t wsize = std::size_t(this->m_in_size) * this->m_out_size;
+            std::vector<Scalar> res(wsize + m_db.size(), Scalar(0));
+            Eigen::Map<Matrix>(&res[0], this->m_in_size, this->m_out_size) =
+                ConstSparseMap(this->m_in_size, this->m_out_size, m_dw.size(),
+                               m_outer.data(), m_inner.data(), m_dw.data());
+            std::copy(m_db.data(), m_db.data() + m_db.size(), res.begin() + wsize);
+            return res;
+        }
+
+        Layer<Scalar>* clone() const
+        {
+            SparseFullyConnected<Activation, Scalar>* res = new SparseFullyConnected<Activation, Scalar>(*this);
+            res->own_parameters();
+            return res;
+        }
+
+        void parameter_blocks(std::vector<AlignedMapVec>& params,
+                              std::vector<AlignedMapVec>& derivs)
+        {
+            params.push_back(AlignedMapVec(m_value.data(), m_value.size()));
+            params.push_back(AlignedMapVec(m_bias.data(), m_bias.size()));
+            derivs.push_back(AlignedMapVec(m_dw.data(), m_dw.size()));
+            derivs.push_back(AlignedMapVec(m_db.data(), m_db.size()));
+        }
+
+        bool can_defer_activation() const
+        {
+            return true;
+        }
+
+        std::string layer_type() const
+        {
+            return "SparseFullyConnected";
+        }
+
+        std::string activation_type() const
+        {
+            return Activation::return_type();
+        }
+
+        void fill_meta_info(MetaInfo& map, int index) const
+        {
+            std::string ind = internal::to_string(index);
+            map.insert(std::make_pair("Layer" + ind, internal::layer_id(layer_type())));
+            map.insert(std::make_pair("Activation" + ind, internal::activation_id(activation_type())));
+            map.insert(std::make_pair("in_size" + ind, this->in_size()));
+            map.insert(std::make_pair("out_size" + ind, this->out_size()));
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* LAYER_SPARSEFULLYCONNECTED_H_ */
@@ -11,6 +11,12 @@
 #include "Layer/FullyConnected.h"
 #include "Layer/Convolutional.h"
 #include "Layer/MaxPooling.h"
+#include "Layer/QuantizedLayer.h"
+#include "Layer/QuantizedFullyConnected.h"
+#include "Layer/QuantizedConvolutional.h"
+#include "Layer/SparseFullyConnected.h"
+#include "Layer/PointwiseConvolutional.h"
+#include "Layer/GroupedConvolutional.h"
 
 #include "Activation/Identity.h"
 #include "Activation/ReLU.h"
@@ -33,7 +39,18 @@
 #include "Callback.h"
 #include "Callback/VerboseCallback.h"
 
+#include "DataSource.h"
+#include "DataSource/MatrixSource.h"
+#include "DataSource/MappedFileSource.h"
+#include "DataSource/ChunkedFileSource.h"
+
 #include "Network.h"
+#include "InferenceSession.h"
+#include "Quantizer.h"
+#include "Pruner.h"
+
+#include "Serving/RequestBatcher.h"
+#include "Serving/SocketServer.h"
 
 
 #endif /* MINIDNN_H_ */
@@ -4,20 +4,29 @@
 #include <Eigen/Core>
 #include <vector>
 #include <map>
+#include <algorithm>
 #include <stdexcept>
 #include "Config.h"
 #include "RNG.h"
 #include "Layer.h"
 #include "Output.h"
 #include "Callback.h"
+#include "DataSource.h"
 #include "Utils/Random.h"
+#include "Utils/BatchSampler.h"
+#include "Utils/BatchPrefetcher.h"
 #include "Utils/IO.h"
 #include "Utils/Factory.h"
+#include "Utils/Workspace.h"
+#include "Utils/ParallelError.h"
 
 namespace MiniDNN
 {
 
 
+template <typename Scalar>
+class InferenceSession;
+
 ///
 /// \defgroup Network Neural Network Model
 ///
@@ -29,21 +38,64 @@ namespace MiniDNN
 /// number of hidden layers and an output layer. It provides functions for
 /// network building, model fitting, and prediction, etc.
 ///
+/// \tparam Scalar Type of the parameters and of the data, `float` or `double`.
+///                Networks of different types can be used in the same program.
+///
+template <typename Scalar = MiniDNN::Scalar>
 class Network
 {
+    // Makes predictions on the layers of the network without modifying them
+    friend class InferenceSession<Scalar>;
+
     private:
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
+        typedef typename Vector::ConstAlignedMapType ConstAlignedMapVec;
+        typedef typename Vector::AlignedMapType AlignedMapVec;
         typedef Eigen::RowVectorXi IntegerVector;
         typedef std::map<std::string, int> MetaInfo;
 
-        RNG                 m_default_rng;      // Built-in RNG
-        RNG&                m_rng;              // Reference to the RNG provided by the user,
-                                                // otherwise reference to m_default_rng
-        std::vector<Layer*> m_layers;           // Pointers to hidden layers
-        Output*             m_output;           // The output layer
-        Callback            m_default_callback; // Default callback function
-        Callback*           m_callback;         // Points to user-provided callback function,
-                                                // otherwise points to m_default_callback
+        RNG                         m_default_rng;      // Built-in RNG
+        RNG&                        m_rng;              // Reference to the RNG provided by the user,
+                                                        // otherwise reference to m_default_rng
+        std::vector<Layer<Scalar>*> m_layers;           // Pointers to hidden layers
+        Output<Scalar>*             m_output;           // The output layer
+        Callback<Scalar>            m_default_callback; // Default callback function
+        Callback<Scalar>*           m_callback;         // Points to user-provided callback function,
+                                                        // otherwise points to m_default_callback
+        internal::Workspace         m_workspace;        // Memory arena of layer buffers and temporaries
+        internal::Workspace         m_predict_workspace;// Arena used by predict(), so that prediction
+                                                        // does not overwrite the state of training
+        int                         m_nthread;          // Number of workers in data-parallel training
+        int                         m_prefetch_depth;   // Number of mini-batches prepared in the background
+        bool                        m_fast_act;         // Whether the layers use fast activation functions
+        bool                        m_blocked;          // Whether adjacent convolutional and pooling layers
+                                                        // exchange images in the blocked layout
+        Vector                      m_param_arena;      // Parameters of all the layers in one contiguous
+                                                        // buffer, followed by their gradients
+        const Scalar*               m_update_grad;      // Gradients in m_param_arena at the last update(),
+                                                        // or NULL
+
+        // Worker replicas used in data-parallel training. Worker 0 is the network itself,
+        // and worker k (k >= 1) owns the layers m_worker_layers[k - 1], the output
+        // layer m_worker_outputs[k - 1], and the workspace m_worker_workspaces[k - 1]
+        std::vector< std::vector<Layer<Scalar>*> > m_worker_layers;
+        std::vector<Output<Scalar>*>               m_worker_outputs;
+        std::vector<internal::Workspace*>          m_worker_workspaces;
+        std::vector<Vector*>                       m_worker_arenas;
+        int                                        m_worker_nalloc; // Allocations of the workspaces of
+                                                                    // the workers already destroyed
+        // Parameters and gradients of each worker, including worker 0, which are the
+        // parameter arenas viewed as flat vectors
+        std::vector<AlignedMapVec> m_worker_params;
+        std::vector<AlignedMapVec> m_worker_derivs;
+        // Loss of each worker on its slice of the last mini-batch, and their mean
+        // over the whole batch
+        std::vector<Scalar>        m_worker_losses;
+        Scalar                     m_parallel_loss;
+        bool                       m_parallel_batch; // Whether the last mini-batch was trained
+                                                     // by several workers
 
         // Check dimensions of layers
         void check_unit_sizes() const
@@ -64,10 +116,163 @@ class Network
             }
         }
 
-        // Let each layer compute its output
-        void forward(const Matrix& input)
+        // Total length of the parameter blocks of the layers
+        static std::size_t parameter_size(const std::vector<Layer<Scalar>*>& layers)
+        {
+            const int nlayer = layers.size();
+            std::size_t len = 0;
+
+            for (int i = 0; i < nlayer; i++)
+            {
+                len += layers[i]->parameter_size();
+            }
+
+            return len;
+        }
+
+        // Move the parameters of the layers to a new arena, in which the parameter
+        // blocks of all the layers are followed by the gradient blocks in the same order
+        static void relocate_parameters(const std::vector<Layer<Scalar>*>& layers, Vector& arena)
+        {
+            const int nlayer = layers.size();
+            const std::size_t len = parameter_size(layers);
+            Vector buffer = Vector::Zero(2 * len);
+            Scalar* param = buffer.data();
+            Scalar* deriv = param + len;
+
+            for (int i = 0; i < nlayer; i++)
+            {
+                const std::size_t n = layers[i]->parameter_size();
+
+                if (n > 0)
+                {
+                    layers[i]->relocate_parameters(param, deriv);
+                    param += n;
+                    deriv += n;
+                }
+            }
+
+            // The previous arena is only freed after the layers have left it
+            arena.swap(buffer);
+        }
+
+        // Notify the layers with parameters that the arena holding them has been written
+        static void notify_parameters(const std::vector<Layer<Scalar>*>& layers)
+        {
+            const int nlayer = layers.size();
+
+            for (int i = 0; i < nlayer; i++)
+            {
+                if (layers[i]->parameter_size() > 0)
+                {
+                    layers[i]->parameters_changed();
+                }
+            }
+        }
+
+        // Whether the parameters of the layers are the blocks of m_param_arena
+        // Layers can move their parameters when they are initialized or when their
+        // number of parameters changes, e.g. by pruning
+        bool parameters_in_arena() const
         {
             const int nlayer = num_layers();
+            const Scalar* param = m_param_arena.data();
+            std::size_t offset = 0;
+
+            for (int i = 0; i < nlayer; i++)
+            {
+                const std::size_t n = m_layers[i]->parameter_size();
+
+                if (n > 0 && m_layers[i]->parameter_data() != param + offset)
+                {
+                    return false;
+                }
+
+                offset += n;
+            }
+
+            return 2 * offset == std::size_t(m_param_arena.size());
+        }
+
+        // Place the parameters of the layers in m_param_arena, unless they are already there
+        void bind_parameter_arena()
+        {
+            if (!parameters_in_arena())
+            {
+                relocate_parameters(m_layers, m_param_arena);
+            }
+        }
+
+        // The parameter and gradient blocks of each layer, in the arena
+        void parameter_views(std::vector< std::vector<AlignedMapVec> >& params,
+                             std::vector< std::vector<AlignedMapVec> >& derivs)
+        {
+            bind_parameter_arena();
+            const int nlayer = num_layers();
+            params.resize(nlayer);
+            derivs.resize(nlayer);
+
+            for (int i = 0; i < nlayer; i++)
+            {
+                m_layers[i]->parameter_blocks(params[i], derivs[i]);
+            }
+        }
+
+        // Total size of the workspace memory needed to process a batch of nobs observations
+        static std::size_t workspace_size(const std::vector<Layer<Scalar>*>& layers, const Output<Scalar>* output,
+                                          int nobs)
+        {
+            const int nlayer = layers.size();
+            std::size_t size = 0, scratch = 0;
+
+            for (int i = 0; i < nlayer; i++)
+            {
+                size += layers[i]->workspace_size(nobs);
+                scratch = std::max(scratch, layers[i]->scratch_size(nobs));
+            }
+
+            if (output && nlayer > 0)
+            {
+                size += output->workspace_size(layers[nlayer - 1]->out_size(), nobs);
+            }
+
+            return size + scratch;
+        }
+
+        // Let each layer carve its buffers from the workspace, which is reserved to a
+        // sufficient size first. After the first batch of the largest size, this does
+        // not allocate memory
+        static void bind_workspace(const std::vector<Layer<Scalar>*>& layers, Output<Scalar>* output,
+                                   internal::Workspace& ws, int nobs)
+        {
+            const int nlayer = layers.size();
+            ws.reset();
+            ws.reserve(workspace_size(layers, output, nobs));
+
+            for (int i = 0; i < nlayer; i++)
+            {
+                layers[i]->bind_workspace(ws, nobs);
+            }
+
+            if (output && nlayer > 0)
+            {
+                output->bind_workspace(ws, layers[nlayer - 1]->out_size(), nobs);
+            }
+        }
+
+        // Let each layer compute its output
+        void forward(const ConstRefMat& input)
+        {
+            forward(m_layers, m_output, m_workspace, input);
+        }
+
+        // The version that runs on a given list of layers, e.g. a worker replica
+        // If output is NULL, the buffers of the output layer are left untouched, and
+        // the last layer computes its activation
+        static void forward(const std::vector<Layer<Scalar>*>& layers, Output<Scalar>* output,
+                            internal::Workspace& ws, const ConstRefMat& input)
+        {
+            const int nlayer = layers.size();
 
             if (nlayer <= 0)
             {
@@ -75,17 +280,24 @@ class Network
             }
 
             // First layer
-            if (input.rows() != m_layers[0]->in_size())
+            if (input.rows() != layers[0]->in_size())
             {
                 throw std::invalid_argument("[class Network]: Input data have incorrect dimension");
             }
 
-            m_layers[0]->forward(input);
+            // In training, the output layer may take over the activation of the last
+            // hidden layer, which then gives its linear term
+            Layer<Scalar>* last_layer = layers[nlayer - 1];
+            const bool fused = output != NULL && last_layer->can_defer_activation() &&
+                               output->fuse_activation(last_layer->activation_type());
+            last_layer->set_deferred_activation(fused);
+            bind_workspace(layers, output, ws, input.cols());
+            layers[0]->forward(input);
 
             // The following layers
             for (int i = 1; i < nlayer; i++)
             {
-                m_layers[i]->forward(m_layers[i - 1]->output());
+                layers[i]->forward(layers[i - 1]->output());
             }
         }
 
@@ -94,44 +306,55 @@ class Network
         // The RowVectorXi version is used in classification problems where each
         // element is a class label
         template <typename TargetType>
-        void backprop(const Matrix& input, const TargetType& target)
+        void backprop(const ConstRefMat& input, const TargetType& target)
         {
-            const int nlayer = num_layers();
+            backprop(m_layers, m_output, input, target);
+        }
+
+        // The version that runs on a given list of layers and output layer
+        template <typename TargetType>
+        static void backprop(const std::vector<Layer<Scalar>*>& layers, Output<Scalar>* output,
+                             const ConstRefMat& input, const TargetType& target)
+        {
+            const int nlayer = layers.size();
 
             if (nlayer <= 0)
             {
                 return;
             }
 
-            Layer* first_layer = m_layers[0];
-            Layer* last_layer = m_layers[nlayer - 1];
+            Layer<Scalar>* first_layer = layers[0];
+            Layer<Scalar>* last_layer = layers[nlayer - 1];
             // Let output layer compute back-propagation data
-            m_output->check_target_data(target);
-            m_output->evaluate(last_layer->output(), target);
+            output->check_target_data(target);
+            output->evaluate(last_layer->output(), target);
 
             // If there is only one hidden layer, "prev_layer_data" will be the input data
             if (nlayer == 1)
             {
-                first_layer->backprop(input, m_output->backprop_data());
+                first_layer->backprop(input, output->backprop_data());
                 return;
             }
 
             // Compute gradients for the last hidden layer
-            last_layer->backprop(m_layers[nlayer - 2]->output(), m_output->backprop_data());
+            last_layer->backprop(layers[nlayer - 2]->output(), output->backprop_data());
 
             // Compute gradients for all the hidden layers except for the first one and the last one
             for (int i = nlayer - 2; i > 0; i--)
             {
-                m_layers[i]->backprop(m_layers[i - 1]->output(),
-                                      m_layers[i + 1]->backprop_data());
+                layers[i]->backprop(layers[i - 1]->output(),
+                                    layers[i + 1]->backprop_data());
             }
 
             // Compute gradients for the first layer
-            first_layer->backprop(input, m_layers[1]->backprop_data());
+            first_layer->backprop(input, layers[1]->backprop_data());
         }
 
         // Update parameters
-        void update(Optimizer& opt)
+        // The parameters in the arena are updated in one call of the optimizer, whose
+        // padding between the blocks stays zero since its gradient is zero. Layers that
+        // keep their parameters elsewhere, e.g. user-defined layers, update themselves
+        void update(Optimizer<Scalar>& opt)
         {
             const int nlayer = num_layers();
 
@@ -140,9 +363,33 @@ class Network
                 return;
             }
 
+            const bool in_arena = parameters_in_arena();
+
+            if (in_arena && m_param_arena.size() > 0)
+            {
+                const int len = m_param_arena.size() / 2;
+                const Scalar* grad = m_param_arena.data() + len;
+
+                // The arena has been rebuilt since the last update, so the statistics
+                // of the optimizer for the previous arena are dropped
+                if (m_update_grad != NULL && m_update_grad != grad)
+                {
+                    opt.forget(m_update_grad);
+                }
+
+                m_update_grad = grad;
+                ConstAlignedMapVec dvec(grad, len);
+                AlignedMapVec vec(m_param_arena.data(), len);
+                opt.update(dvec, vec);
+                notify_parameters(m_layers);
+            }
+
             for (int i = 0; i < nlayer; i++)
             {
-                m_layers[i]->update(opt);
+                if (!in_arena || m_layers[i]->parameter_size() == 0)
+                {
+                    m_layers[i]->update(opt);
+                }
             }
         }
 
@@ -159,9 +406,333 @@ class Network
             }
 
             map.insert(std::make_pair("OutputLayer", internal::output_id(m_output->output_type())));
+            map.insert(std::make_pair("ScalarSize", int(sizeof(Scalar))));
             return map;
         }
 
+        // Index of the first observation of slice k when nobs observations are split
+        // into nworker slices
+        static int slice_start(int k, int nworker, int nobs)
+        {
+            return int((long long)(k) * nobs / nworker);
+        }
+
+        // Fraction of the observations in slice k
+        static Scalar slice_weight(int k, int nworker, int nobs)
+        {
+            return Scalar(slice_start(k + 1, nworker, nobs) - slice_start(k, nworker, nobs)) / Scalar(nobs);
+        }
+
+        // In data-parallel training only the parameters in the arena are averaged and
+        // copied to the replicas, so a layer that keeps its parameters elsewhere
+        // would let the replicas drift apart
+        void check_parallel_layers() const
+        {
+            const int nlayer = num_layers();
+
+            for (int i = 0; i < nlayer; i++)
+            {
+                if (m_layers[i]->parameter_size() == 0 && !m_layers[i]->get_parameters().empty())
+                {
+                    throw std::invalid_argument("[class Network]: Layers that keep their parameters outside of the parameter arena do not support data-parallel training");
+                }
+            }
+        }
+
+        // Create nworker - 1 replicas of the hidden layers and the output layer,
+        // each with its own parameter arena laid out as the arena of the network,
+        // and record the parameters and gradients of all workers
+        void create_workers(int nworker)
+        {
+            destroy_workers();
+            bind_parameter_arena();
+            const int nlayer = num_layers();
+            const std::size_t len = m_param_arena.size() / 2;
+            m_worker_params.push_back(AlignedMapVec(m_param_arena.data(), len));
+            m_worker_derivs.push_back(AlignedMapVec(m_param_arena.data() + len, len));
+
+            // Each part of a replica is recorded as soon as it is allocated, so that
+            // destroy_workers() also frees a partially created set of workers
+            m_worker_arenas.reserve(nworker - 1);
+            m_worker_layers.reserve(nworker - 1);
+            m_worker_outputs.reserve(nworker - 1);
+            m_worker_workspaces.reserve(nworker - 1);
+
+            for (int k = 1; k < nworker; k++)
+            {
+                m_worker_arenas.push_back(new Vector());
+                m_worker_layers.push_back(std::vector<Layer<Scalar>*>());
+                std::vector<Layer<Scalar>*>& layers = m_worker_layers.back();
+                layers.reserve(nlayer);
+
+                for (int i = 0; i < nlayer; i++)
+                {
+                    layers.push_back(m_layers[i]->clone());
+                }
+
+                m_worker_outputs.push_back(m_output->clone());
+                m_worker_workspaces.push_back(new internal::Workspace());
+                Vector& arena = *m_worker_arenas.back();
+                relocate_parameters(layers, arena);
+                m_worker_params.push_back(AlignedMapVec(arena.data(), len));
+                m_worker_derivs.push_back(AlignedMapVec(arena.data() + len, len));
+            }
+        }
+
+        // Let adjacent layers exchange images in the blocked layout if it is enabled and
+        // both sides support it with the same number of channels, see set_blocked_layout()
+        void link_blocked_layout()
+        {
+            const int nlayer = num_layers();
+
+            for (int i = 0; i < nlayer; i++)
+            {
+                const bool input = m_blocked && i > 0 &&
+                                   m_layers[i]->blocked_in_channels() > 0 &&
+                                   m_layers[i]->blocked_in_channels() == m_layers[i - 1]->blocked_out_channels();
+                const bool output = m_blocked && i < nlayer - 1 &&
+                                    m_layers[i]->blocked_out_channels() > 0 &&
+                                    m_layers[i]->blocked_out_channels() == m_layers[i + 1]->blocked_in_channels();
+                m_layers[i]->set_blocked_layout(input, output);
+            }
+        }
+
+        // Free the worker replicas
+        void destroy_workers()
+        {
+            for (std::size_t k = 0; k < m_worker_layers.size(); k++)
+            {
+                for (std::size_t i = 0; i < m_worker_layers[k].size(); i++)
+                {
+                    delete m_worker_layers[k][i];
+                }
+            }
+
+            for (std::size_t k = 0; k < m_worker_outputs.size(); k++)
+            {
+                delete m_worker_outputs[k];
+            }
+
+            for (std::size_t k = 0; k < m_worker_workspaces.size(); k++)
+            {
+                m_worker_nalloc += m_worker_workspaces[k]->num_allocations();
+                delete m_worker_workspaces[k];
+            }
+
+            for (std::size_t k = 0; k < m_worker_arenas.size(); k++)
+            {
+                delete m_worker_arenas[k];
+            }
+
+            m_worker_layers.clear();
+            m_worker_outputs.clear();
+            m_worker_workspaces.clear();
+            m_worker_arenas.clear();
+            m_worker_params.clear();
+            m_worker_derivs.clear();
+        }
+
+        // Frees the worker replicas when fit_batches() returns, also when training is
+        // interrupted by an exception
+        class WorkerGuard
+        {
+            private:
+                Network& m_net;
+
+            public:
+                explicit WorkerGuard(Network& net) : m_net(net) {}
+                ~WorkerGuard() { m_net.destroy_workers(); }
+        };
+
+        // Train one mini-batch in the data-parallel mode
+        // The batch is split into contiguous slices, one for each worker, and each
+        // worker runs forward() and backprop() on its own slice. The gradients of
+        // the workers are then averaged into the network's own layers, which are
+        // updated once and copied back to the replicas
+        template <typename XType, typename YType>
+        void parallel_train_batch(Optimizer<Scalar>& opt, const XType& x, const YType& y)
+        {
+            const int nobs = x.cols();
+            const int nworker = std::min(int(m_worker_params.size()), nobs);
+
+            // Validate the data before the parallel region, so that the error does not
+            // depend on the slice that detects it
+            if (x.rows() != m_layers[0]->in_size())
+            {
+                throw std::invalid_argument("[class Network]: Input data have incorrect dimension");
+            }
+
+            m_output->check_target_data(y);
+            m_worker_losses.resize(nworker);
+            // Exceptions cannot leave the parallel regions, and are thrown after them
+            internal::ParallelError error;
+
+#ifdef _OPENMP
+            #pragma omp parallel for num_threads(nworker) schedule(static, 1)
+#endif
+            for (int k = 0; k < nworker; k++)
+            {
+                try
+                {
+                    const int start = slice_start(k, nworker, nobs);
+                    const int n = slice_start(k + 1, nworker, nobs) - start;
+                    const std::vector<Layer<Scalar>*>& layers = (k == 0) ? m_layers : m_worker_layers[k - 1];
+                    Output<Scalar>* output = (k == 0) ? m_output : m_worker_outputs[k - 1];
+                    internal::Workspace& ws = (k == 0) ? m_workspace : *m_worker_workspaces[k - 1];
+                    // Columns are contiguous, so the slices are views of x and y
+                    const ConstRefMat x_slice = x.middleCols(start, n);
+                    forward(layers, output, ws, x_slice);
+                    backprop(layers, output, x_slice, y.middleCols(start, n));
+                    m_worker_losses[k] = output->loss();
+                }
+                catch (...)
+                {
+                    error.capture();
+                }
+            }
+
+            error.rethrow();
+
+            // The loss of each worker is the mean over its slice
+            m_parallel_loss = Scalar(0);
+
+            for (int k = 0; k < nworker; k++)
+            {
+                m_parallel_loss += slice_weight(k, nworker, nobs) * m_worker_losses[k];
+            }
+
+            m_parallel_batch = true;
+
+            // Each worker computes the mean gradient over its slice, so the mean over
+            // the whole batch is the slice means weighted by the slice sizes
+            // The gradients of each worker are one contiguous vector, whose padding
+            // between the blocks stays zero
+            AlignedMapVec& dest = m_worker_derivs[0];
+            const int len = dest.size();
+            const int chunk_size = 4096;
+            const int nchunk = (len + chunk_size - 1) / chunk_size;
+
+#ifdef _OPENMP
+            #pragma omp parallel for num_threads(nworker) if(nchunk > 1)
+#endif
+            for (int c = 0; c < nchunk; c++)
+            {
+                try
+                {
+                    const int start = c * chunk_size;
+                    const int n = std::min(chunk_size, len - start);
+                    dest.segment(start, n) *= slice_weight(0, nworker, nobs);
+
+                    for (int k = 1; k < nworker; k++)
+                    {
+                        const Scalar weight = slice_weight(k, nworker, nobs);
+                        dest.segment(start, n) += weight * m_worker_derivs[k].segment(start, n);
+                    }
+                }
+                catch (...)
+                {
+                    error.capture();
+                }
+            }
+
+            error.rethrow();
+            this->update(opt);
+            // Synchronize the parameters of all the replicas, including the ones that
+            // were idle in this batch
+            const int nreplica = m_worker_layers.size();
+
+#ifdef _OPENMP
+            #pragma omp parallel for num_threads(nworker)
+#endif
+            for (int k = 1; k <= nreplica; k++)
+            {
+                try
+                {
+                    m_worker_params[k] = m_worker_params[0];
+                    notify_parameters(m_worker_layers[k - 1]);
+                }
+                catch (...)
+                {
+                    error.capture();
+                }
+            }
+
+            error.rethrow();
+        }
+
+        // Run the training loop on the mini-batches drawn from source, which is an
+        // internal::BatchSampler or an adapter of a DataSource
+        // nbatch is the number of batches in each epoch, or 0 if unknown
+        template <typename XType, typename YType, typename Source>
+        void fit_batches(Optimizer<Scalar>& opt, Source& source, int nbatch, int max_batch_size, int epoch)
+        {
+            // Set up callback parameters
+            m_callback->m_nbatch = nbatch;
+            m_callback->m_nepoch = epoch;
+            // Set up the worker replicas for data-parallel training
+            const int nworker = std::min(m_nthread, max_batch_size);
+
+            // Size the workspaces for the largest slice of a batch, so that training
+            // does not allocate memory after this point
+            const int max_slice_size = (max_batch_size - 1) / nworker + 1;
+            m_workspace.reserve(workspace_size(m_layers, m_output, max_slice_size));
+            bind_parameter_arena();
+            WorkerGuard worker_guard(*this);
+
+            if (nworker > 1)
+            {
+                check_parallel_layers();
+                create_workers(nworker);
+
+                for (int k = 1; k < nworker; k++)
+                {
+                    m_worker_workspaces[k - 1]->reserve(workspace_size(
+                        m_worker_layers[k - 1], m_worker_outputs[k - 1], max_slice_size));
+                }
+            }
+
+            // Batches are prepared in the background if m_prefetch_depth > 0
+            internal::BatchPrefetcher<Source> prefetcher(source, m_rng, epoch, m_prefetch_depth);
+
+            // Iterations on the whole data set
+            for (int k = 0; k < epoch; k++)
+            {
+                m_callback->m_epoch_id = k;
+
+                // Train on each mini-batch until the end of the epoch
+                for (int i = 0; ; i++)
+                {
+                    const typename Source::Buffer* batch = prefetcher.acquire(
+                        m_callback->m_queue_depth, m_callback->m_stall_time);
+
+                    if (batch == NULL)
+                    {
+                        break;
+                    }
+
+                    const XType& x_batch = batch->x_batch();
+                    const YType& y_batch = batch->y_batch();
+                    m_callback->m_batch_id = i;
+                    m_callback->pre_training_batch(this, x_batch, y_batch);
+
+                    if (nworker > 1)
+                    {
+                        parallel_train_batch(opt, x_batch, y_batch);
+                    }
+                    else
+                    {
+                        this->forward(x_batch);
+                        this->backprop(x_batch, y_batch);
+                        this->update(opt);
+                        m_parallel_batch = false;
+                    }
+
+                    m_callback->post_training_batch(this, x_batch, y_batch);
+                    prefetcher.release();
+                }
+            }
+        }
+
     public:
         ///
         /// Default constructor that creates an empty neural network
@@ -171,7 +742,15 @@ class Network
             m_rng(m_default_rng),
             m_output(NULL),
             m_default_callback(),
-            m_callback(&m_default_callback)
+            m_callback(&m_default_callback),
+            m_nthread(1),
+            m_prefetch_depth(0),
+            m_fast_act(false),
+            m_blocked(false),
+            m_update_grad(NULL),
+            m_worker_nalloc(0),
+            m_parallel_loss(0),
+            m_parallel_batch(false)
         {}
 
         ///
@@ -185,7 +764,15 @@ class Network
             m_rng(rng),
             m_output(NULL),
             m_default_callback(),
-            m_callback(&m_default_callback)
+            m_callback(&m_default_callback),
+            m_nthread(1),
+            m_prefetch_depth(0),
+            m_fast_act(false),
+            m_blocked(false),
+            m_update_grad(NULL),
+            m_worker_nalloc(0),
+            m_parallel_loss(0),
+            m_parallel_batch(false)
         {}
 
         ///
@@ -193,6 +780,7 @@ class Network
         ///
         ~Network()
         {
+            destroy_workers();
             const int nlayer = num_layers();
 
             for (int i = 0; i < nlayer; i++)
@@ -214,9 +802,18 @@ class Network
         ///              **NOTE**: the pointer will be handled and freed by the
         ///              network object, so do not delete it manually.
         ///
-        void add_layer(Layer* layer)
+        /// The first layer does not compute the gradient of the input data in
+        /// back-propagation, see Layer::set_input_gradient(). The layer uses the
+        /// activation mode of the network, see Network::set_fast_activation(), and
+        /// its layout of images, see Network::set_blocked_layout().
+        ///
+        void add_layer(Layer<Scalar>* layer)
         {
+            // The gradient of the input data is not needed
+            layer->set_input_gradient(!m_layers.empty());
+            layer->set_fast_activation(m_fast_act);
             m_layers.push_back(layer);
+            link_blocked_layout();
         }
 
         ///
@@ -227,7 +824,7 @@ class Network
         ///               **NOTE**: the pointer will be handled and freed by the
         ///               network object, so do not delete it manually.
         ///
-        void set_output(Output* output)
+        void set_output(Output<Scalar>* output)
         {
             if (m_output)
             {
@@ -248,10 +845,10 @@ class Network
         ///
         /// Get the list of hidden layers of the network
         ///
-        std::vector<const Layer*> get_layers() const
+        std::vector<const Layer<Scalar>*> get_layers() const
         {
             const int nlayer = num_layers();
-            std::vector<const Layer*> layers(nlayer);
+            std::vector<const Layer<Scalar>*> layers(nlayer);
             std::copy(m_layers.begin(), m_layers.end(), layers.begin());
             return layers;
         }
@@ -259,18 +856,57 @@ class Network
         ///
         /// Get the output layer
         ///
-        const Output* get_output() const
+        const Output<Scalar>* get_output() const
         {
             return m_output;
         }
 
+        ///
+        /// Loss function value of the last mini-batch trained in model fitting
+        ///
+        /// This is typically called by the callback function after each mini-batch.
+        /// In data-parallel training (see set_num_threads()) the output layer only
+        /// evaluates the first slice of each mini-batch, and this function returns the
+        /// loss over the whole batch instead.
+        ///
+        Scalar training_loss() const
+        {
+            return m_parallel_batch ? m_parallel_loss : m_output->loss();
+        }
+
+        ///
+        /// Number of times that the memory arenas used in training have been
+        /// (re)allocated, including the arenas of the workers during data-parallel
+        /// training, which are counted after the workers are released at the end of
+        /// Network::fit(). The arenas are sized for the largest batch, so this number
+        /// does not change once the first mini-batch in Network::fit() has been
+        /// processed.
+        ///
+        /// Only the growth of the arenas is counted. The other buffers used in
+        /// training, such as the packing buffers of the convolution kernels, are carved
+        /// from the arenas, but the heap allocations made outside of them, for
+        /// example by the layers or by the optimizer, are not reported here.
+        ///
+        int num_workspace_allocations() const
+        {
+            int res = m_workspace.num_allocations() + m_worker_nalloc;
+            const int nreplica = m_worker_workspaces.size();
+
+            for (int k = 0; k < nreplica; k++)
+            {
+                res += m_worker_workspaces[k]->num_allocations();
+            }
+
+            return res;
+        }
+
         ///
         /// Set the callback function that can be called during model fitting
         ///
         /// \param callback A user-provided callback function object that inherits
         ///                 from the default Callback class.
         ///
-        void set_callback(Callback& callback)
+        void set_callback(Callback<Scalar>& callback)
         {
             m_callback = &callback;
         }
@@ -282,6 +918,122 @@ class Network
             m_callback = &m_default_callback;
         }
 
+        ///
+        /// Set the number of workers used in model fitting
+        ///
+        /// When `nthread > 1`, each mini-batch is split into `nthread` slices that are
+        /// processed concurrently by replicas of the hidden layers, each with its
+        /// own activation buffers. The gradients are averaged over the whole batch
+        /// before a single parameter update, so the result is equivalent to serial
+        /// training up to rounding errors. The workers run in parallel only if OpenMP
+        /// is enabled (e.g. `-fopenmp`), otherwise they run sequentially.
+        ///
+        /// With serial training, the convolutional layers instead split each
+        /// mini-batch over the OpenMP threads (see `omp_set_num_threads()`) inside
+        /// their kernels, which is usually preferable for convolutional networks.
+        ///
+        /// Only the parameters that layers place in the parameter arena of the network
+        /// (see Layer::parameter_size()) are averaged and copied to the replicas, so
+        /// model fitting throws `std::invalid_argument` in this mode if a layer has
+        /// parameters but Layer::parameter_size() returns 0, e.g. a quantized layer.
+        ///
+        /// **NOTE**: in this mode the output layer of the network only evaluates the
+        /// first slice of each mini-batch, so the callback function should call
+        /// training_loss() rather than `get_output()->loss()` to get the loss over the
+        /// whole batch.
+        ///
+        /// \param nthread Number of workers. The default value 1 means serial training.
+        ///
+        void set_num_threads(int nthread)
+        {
+            if (nthread < 1)
+            {
+                throw std::invalid_argument("[class Network]: Number of threads must be positive");
+            }
+
+            m_nthread = nthread;
+        }
+
+        ///
+        /// Set the number of mini-batches that are prepared in advance during model fitting
+        ///
+        /// When `depth > 0`, a background thread gathers the upcoming mini-batches
+        /// into a ring of `depth + 1` buffers while the current one is being trained,
+        /// so that data preparation overlaps with computation. The batches and the
+        /// result of training are the same as with `depth = 0`. The number of ready
+        /// batches and the time spent waiting for each batch are reported to the
+        /// callback function through Callback::m_queue_depth and Callback::m_stall_time.
+        ///
+        /// Background preparation requires C++11, and is disabled otherwise.
+        ///
+        /// **NOTE**: the background thread draws from the random number generator of
+        /// the network, which should not be used by other threads during the fitting.
+        ///
+        /// \param depth Number of batches prepared in advance. The default value 0
+        ///              means that each batch is prepared when it is needed.
+        ///
+        void set_prefetch_depth(int depth)
+        {
+            if (depth < 0)
+            {
+                throw std::invalid_argument("[class Network]: Prefetch depth must be non-negative");
+            }
+
+            m_prefetch_depth = depth;
+        }
+
+        ///
+        /// Set whether the activation functions of the hidden layers are evaluated with
+        /// fast approximations, in training and in prediction
+        ///
+        /// In the fast mode, Sigmoid, Tanh, Softmax and Mish use vectorized polynomial or
+        /// rational approximations of `exp()` and `tanh()` evaluated in a single pass,
+        /// whose errors are below 3e-7 (see Utils/FastMath.h). The precise mode, which is
+        /// the default, uses the exact functions of %Eigen. The mode applies to the layers
+        /// already added and to those added later.
+        ///
+        /// \param enabled Whether the fast approximations are used.
+        ///
+        void set_fast_activation(bool enabled)
+        {
+            m_fast_act = enabled;
+            const int nlayer = num_layers();
+
+            for (int i = 0; i < nlayer; i++)
+            {
+                m_layers[i]->set_fast_activation(enabled);
+            }
+        }
+
+        ///
+        /// Set whether adjacent convolutional and pooling layers exchange images in the
+        /// blocked channel-interleaved layout (NCHWc)
+        ///
+        /// In this layout, the channels are grouped by the number of scalars of a SIMD
+        /// packet, and the values of a group at each pixel are adjacent, so the
+        /// convolution kernels update the output channels of a group with one vector
+        /// operation and go through the pixels with unit stride, see Utils/BlockedLayout.h.
+        /// Two adjacent layers use it when both support it (Convolutional and MaxPooling)
+        /// and the number of channels between them is a multiple of the packet size, e.g.
+        /// 4 for `double` and 8 for `float` with AVX. The input of the network and the
+        /// output of the last hidden layer keep the planar layout, and the images are
+        /// converted at the ends of each chain of blocked layers, so the results are the
+        /// same up to rounding errors.
+        ///
+        /// The outputs of the hidden layers inside a chain (see Layer::output()) are in
+        /// the blocked layout. A convolutional layer with a blocked side computes its
+        /// convolutions with the direct blocked kernels instead of the Winograd
+        /// algorithm, the FFT or the Eigen Tensor backend. The mode applies to the layers
+        /// already added and to those added later, and is off by default.
+        ///
+        /// \param enabled Whether the blocked layout is used.
+        ///
+        void set_blocked_layout(bool enabled)
+        {
+            m_blocked = enabled;
+            link_blocked_layout();
+        }
+
         ///
         /// Initialize layer parameters in the network using normal distribution
         ///
@@ -306,6 +1058,8 @@ class Network
             {
                 m_layers[i]->init(mu, sigma, m_rng);
             }
+
+            bind_parameter_arena();
         }
 
         ///
@@ -343,6 +1097,8 @@ class Network
             {
                 m_layers[i]->set_parameters(param[i]);
             }
+
+            bind_parameter_arena();
         }
 
         ///
@@ -362,6 +1118,47 @@ class Network
             return res;
         }
 
+        ///
+        /// Get views of the layer parameters, without copying them
+        ///
+        /// The parameters of all the layers are stored in one contiguous buffer. The
+        /// i-th element of the result contains the parameter blocks of layer i, as given
+        /// by Layer::parameter_blocks(), e.g. the weights and the bias of a FullyConnected
+        /// layer, and is empty for layers without parameters. Writing to the views
+        /// changes the parameters of the network, and Network::parameters_changed()
+        /// must be called afterwards.
+        ///
+        /// The views are valid until the layers are changed, e.g. by adding a layer or
+        /// by setting parameters with a different sparsity pattern.
+        ///
+        std::vector< std::vector<AlignedMapVec> > get_parameters_view()
+        {
+            std::vector< std::vector<AlignedMapVec> > params, derivs;
+            parameter_views(params, derivs);
+            return params;
+        }
+
+        ///
+        /// Notify the layers that their parameters have been written through the views
+        /// of Network::get_parameters_view(), see Layer::parameters_changed()
+        ///
+        void parameters_changed()
+        {
+            notify_parameters(m_layers);
+        }
+
+        ///
+        /// Get views of the derivatives of layer parameters, without copying them
+        ///
+        /// The blocks have the same layout as in Network::get_parameters_view().
+        ///
+        std::vector< std::vector<AlignedMapVec> > get_derivatives_view()
+        {
+            std::vector< std::vector<AlignedMapVec> > params, derivs;
+            parameter_views(params, derivs);
+            return derivs;
+        }
+
         ///
         /// Debugging tool to check parameter gradients
         ///
@@ -429,7 +1226,7 @@ class Network
         ///                   use the current random state.
         ///
         template <typename DerivedX, typename DerivedY>
-        bool fit(Optimizer& opt, const Eigen::MatrixBase<DerivedX>& x,
+        bool fit(Optimizer<Scalar>& opt, const Eigen::MatrixBase<DerivedX>& x,
                  const Eigen::MatrixBase<DerivedY>& y,
                  int batch_size, int epoch, int seed = -1)
         {
@@ -451,37 +1248,61 @@ class Network
             // Reset optimizer
             opt.reset();
 
-            // Create shuffled mini-batches
+            // Mini-batches are drawn from a permutation of the data, which is
+            // reshuffled in each epoch
             if (seed > 0)
             {
                 m_rng.seed(seed);
             }
 
-            std::vector<XType> x_batches;
-            std::vector<YType> y_batches;
-            const int nbatch = internal::create_shuffled_batches(x, y, batch_size, m_rng,
-                               x_batches, y_batches);
-            // Set up callback parameters
-            m_callback->m_nbatch = nbatch;
-            m_callback->m_nepoch = epoch;
+            internal::BatchSampler<DerivedX, DerivedY, XType, YType> sampler(x, y, batch_size);
+            fit_batches<XType, YType>(opt, sampler, sampler.num_batches(), sampler.max_batch_size(), epoch);
+            return true;
+        }
 
-            // Iterations on the whole data set
-            for (int k = 0; k < epoch; k++)
+        ///
+        /// Fit the model on mini-batches read from a data source
+        ///
+        /// This version does not require the whole data set to be held in memory,
+        /// see the classes derived from DataSource.
+        ///
+        /// \param opt        An object that inherits from the Optimizer class, indicating the optimization algorithm to use.
+        /// \param data       An object that inherits from the DataSource class, which reads
+        ///                   the mini-batches in each epoch.
+        /// \param epoch      Number of epochs of training.
+        /// \param seed       Set the random seed of the %RNG if `seed > 0`, otherwise
+        ///                   use the current random state.
+        ///
+        bool fit(Optimizer<Scalar>& opt, DataSource<Scalar>& data, int epoch, int seed = -1)
+        {
+            const int nlayer = num_layers();
+
+            if (nlayer <= 0)
             {
-                m_callback->m_epoch_id = k;
+                return false;
+            }
 
-                // Train on each mini-batch
-                for (int i = 0; i < nbatch; i++)
-                {
-                    m_callback->m_batch_id = i;
-                    m_callback->pre_training_batch(this, x_batches[i], y_batches[i]);
-                    this->forward(x_batches[i]);
-                    this->backprop(x_batches[i], y_batches[i]);
-                    this->update(opt);
-                    m_callback->post_training_batch(this, x_batches[i], y_batches[i]);
-                }
+            // Reset optimizer
+            opt.reset();
+
+            // The RNG is passed to the data source to reorder the data in each epoch
+            if (seed > 0)
+            {
+                m_rng.seed(seed);
             }
 
+            const int max_batch_size = data.batch_size();
+
+            if (max_batch_size <= 0)
+            {
+                throw std::invalid_argument("[class Network]: Batch size of the data source must be positive");
+            }
+
+            // The number of batches is only known if the data source reports its size
+            const int nobs = data.size_hint();
+            const int nbatch = (nobs > 0) ? ((nobs - 1) / max_batch_size + 1) : 0;
+            internal::DataSourceReader<Scalar> reader(data);
+            fit_batches<Matrix, Matrix>(opt, reader, nbatch, max_batch_size, epoch);
             return true;
         }
 
@@ -499,7 +1320,7 @@ class Network
                 return Matrix();
             }
 
-            this->forward(x);
+            forward(m_layers, NULL, m_predict_workspace, x);
             return m_layers[nlayer - 1]->output();
         }
 
@@ -524,6 +1345,9 @@ class Network
         ///
         /// Read in a network from files.
         ///
+        /// The parameters are converted if the network was exported with another
+        /// scalar type, e.g. a `double` model can be read into a `Network<float>`.
+        ///
         /// \param folder   The folder where the network is saved.
         /// \param fileName The filename for the network.
         ///
@@ -532,16 +1356,19 @@ class Network
             MetaInfo map;
             internal::read_map(folder + "/" + filename, map);
             int nlayer = map.find("Nlayers")->second;
-            std::vector< std::vector<Scalar> > params = internal::read_parameters(folder, filename, nlayer);
+            // Models exported before the key was added use the default scalar type
+            MetaInfo::const_iterator size_it = map.find("ScalarSize");
+            const int scalar_size = (size_it != map.end()) ? size_it->second : int(sizeof(MiniDNN::Scalar));
+            std::vector< std::vector<Scalar> > params = internal::read_parameters<Scalar>(folder, filename, nlayer, scalar_size);
             m_layers.clear();
 
             for (int i = 0; i < nlayer; i++)
             {
-                this->add_layer(internal::create_layer(map, i));
+                this->add_layer(internal::create_layer<Scalar>(map, i));
             }
 
             this->set_parameters(params);
-            this->set_output(internal::create_output(map));
+            this->set_output(internal::create_output<Scalar>(map));
         }
 };
 
@@ -2,8 +2,13 @@
 #define OPTIMIZER_H_
 
 #include <Eigen/Core>
+#include <algorithm>
 #include "Config.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace MiniDNN
 {
 
@@ -17,12 +22,47 @@ namespace MiniDNN
 ///
 /// The interface of optimization algorithms
 ///
+/// \tparam Scalar Type of the parameters and gradients that are updated.
+///
+template <typename Scalar = MiniDNN::Scalar>
 class Optimizer
 {
     protected:
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
-        typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
-        typedef Vector::AlignedMapType AlignedMapVec;
+        typedef typename Vector::ConstAlignedMapType ConstAlignedMapVec;
+        typedef typename Vector::AlignedMapType AlignedMapVec;
+
+        // Number of parameters updated at once by update_block()
+        // The vectors read and written by an update stay in the cache during a block,
+        // so a kernel written as several Eigen expressions still makes a single pass
+        // over the memory
+        static const int BlockSize = 1024;
+
+        // Update 'n' parameters, given their gradient, where 'state' is the position of
+        // the first parameter in the statistics of the optimizer
+        virtual void update_block(const Scalar* grad, Scalar* param, const int n, const int state) {}
+
+        // Run update_block() on consecutive blocks of the vectors, in parallel when the
+        // vectors are long enough, where 'state' is the position of the first parameter
+        // in the statistics of the optimizer
+        void update_blocks(ConstAlignedMapVec& dvec, AlignedMapVec& vec, const int state)
+        {
+            const Scalar* grad = dvec.data();
+            Scalar* param = vec.data();
+            const int len = dvec.size();
+            const int nblock = (len + BlockSize - 1) / BlockSize;
+
+#ifdef _OPENMP
+            // Each thread gets at least 16 blocks, which amortizes the start of the threads
+            const int nthread = std::max(1, std::min(omp_in_parallel() ? 1 : omp_get_max_threads(), nblock / 16));
+            #pragma omp parallel for num_threads(nthread) schedule(static) if(nthread > 1)
+#endif
+            for (int b = 0; b < nblock; b++)
+            {
+                const int start = b * BlockSize;
+                update_block(grad + start, param + start, std::min(int(BlockSize), len - start), state + start);
+            }
+        }
 
     public:
         virtual ~Optimizer() {}
@@ -32,6 +72,13 @@ class Optimizer
         ///
         virtual void reset() {};
 
+        ///
+        /// Forget the historical information of the parameters whose gradient is
+        /// stored at `dvec`, e.g. after the parameters have been moved elsewhere.
+        /// Network calls it when the buffer of its parameters has been rebuilt.
+        ///
+        virtual void forget(const Scalar* dvec) {}
+
         ///
         /// Update the parameter vector using its gradient
         ///
@@ -39,6 +86,11 @@ class Optimizer
         /// change during the training process. This is used to implement optimization
         /// algorithms that have "memories". See the AdaGrad algorithm for an example.
         ///
+        /// Network calls this function once in each training step, on the vector that
+        /// contains the parameters of all the layers (see Network::get_parameters_view()),
+        /// so an optimizer sees a single group of parameters. Layer::update() calls it on
+        /// each block of parameters of a layer instead.
+        ///
         /// \param dvec The gradient of the parameter. Read-only
         /// \param vec  On entering, the current parameter vector. On exit, the
         ///             updated parameters.
@@ -2,9 +2,9 @@
 #define OPTIMIZER_ADAGRAD_H_
 
 #include <Eigen/Core>
-#include <map>
 #include "../Config.h"
 #include "../Optimizer.h"
+#include "../Utils/OptimizerState.h"
 
 namespace MiniDNN
 {
@@ -15,22 +15,42 @@ namespace MiniDNN
 ///
 /// The AdaGrad algorithm
 ///
-class AdaGrad: public Optimizer
+/// \tparam Scalar      Type of the parameters and gradients.
+/// \tparam StateScalar Type of the accumulated statistics and of the update
+///                     computation. With `float` parameters, `double` avoids the
+///                     loss of precision in the running averages.
+///
+template <typename Scalar = MiniDNN::Scalar, typename StateScalar = Scalar>
+class AdaGrad: public Optimizer<Scalar>
 {
     private:
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
-        typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> Array;
-        typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
-        typedef Vector::AlignedMapType AlignedMapVec;
+        typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> ParamArray;
+        typedef Eigen::Array<StateScalar, Eigen::Dynamic, 1> Array;
+        typedef typename Vector::ConstAlignedMapType ConstAlignedMapVec;
+        typedef typename Vector::AlignedMapType AlignedMapVec;
 
-        std::map<const Scalar*, Array> m_history;
+        // The accumulated squared gradients of all the parameters
+        internal::OptimizerState<Scalar, StateScalar> m_history;
+
+        void update_block(const Scalar* grad, Scalar* param, const int n, const int state)
+        {
+            const Eigen::Map<const ParamArray> g(grad, n);
+            Eigen::Map<ParamArray> p(param, n);
+            Eigen::Map<Array> grad_square(m_history.data(0) + state, n);
+            // Update accumulated squared gradient
+            grad_square += g.template cast<StateScalar>().square();
+            // Update parameters
+            p -= (m_lrate * g.template cast<StateScalar>() /
+                  (grad_square.sqrt() + m_eps)).template cast<Scalar>();
+        }
 
     public:
-        Scalar m_lrate;
-        Scalar m_eps;
+        StateScalar m_lrate;
+        StateScalar m_eps;
 
-        AdaGrad(const Scalar& lrate = Scalar(0.001), const Scalar& eps = Scalar(1e-6)) :
-            m_lrate(lrate), m_eps(eps)
+        AdaGrad(const StateScalar& lrate = StateScalar(0.001), const StateScalar& eps = StateScalar(1e-6)) :
+            m_history(1), m_lrate(lrate), m_eps(eps)
         {}
 
         void reset()
@@ -38,22 +58,15 @@ class AdaGrad: public Optimizer
             m_history.clear();
         }
 
-        void update(ConstAlignedMapVec& dvec, AlignedMapVec& vec)
+        void forget(const Scalar* dvec)
         {
-            // Get the accumulated squared gradient associated with this gradient
-            Array& grad_square = m_history[dvec.data()];
-
-            // If length is zero, initialize it
-            if (grad_square.size() == 0)
-            {
-                grad_square.resize(dvec.size());
-                grad_square.setZero();
-            }
+            m_history.remove(dvec);
+        }
 
-            // Update accumulated squared gradient
-            grad_square += dvec.array().square();
-            // Update parameters
-            vec.array() -= m_lrate * dvec.array() / (grad_square.sqrt() + m_eps);
+        void update(ConstAlignedMapVec& dvec, AlignedMapVec& vec)
+        {
+            // Get the position of the accumulated squared gradient associated with this gradient
+            this->update_blocks(dvec, vec, m_history.find(dvec.data(), dvec.size()));
         }
 };
 
@@ -2,9 +2,10 @@
 #define OPTIMIZER_ADAM_H_
 
 #include <Eigen/Core>
-#include <map>
+#include <cmath>
 #include "../Config.h"
 #include "../Optimizer.h"
+#include "../Utils/OptimizerState.h"
 
 namespace MiniDNN
 {
@@ -15,71 +16,80 @@ namespace MiniDNN
 ///
 /// The Adam algorithm
 ///
-class Adam: public Optimizer
+/// The bias corrections advance once in each update of a group of parameters, i.e.
+/// once in each training step, whether the parameters of the model are updated as a
+/// whole by Network or block by block by the layers.
+///
+/// \tparam Scalar      Type of the parameters and gradients.
+/// \tparam StateScalar Type of the accumulated statistics and of the update
+///                     computation. With `float` parameters, `double` avoids the
+///                     loss of precision in the running averages.
+///
+template <typename Scalar = MiniDNN::Scalar, typename StateScalar = Scalar>
+class Adam: public Optimizer<Scalar>
 {
     private:
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
-        typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> Array;
-        typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
-        typedef Vector::AlignedMapType AlignedMapVec;
+        typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> ParamArray;
+        typedef Eigen::Array<StateScalar, Eigen::Dynamic, 1> Array;
+        typedef typename Vector::ConstAlignedMapType ConstAlignedMapVec;
+        typedef typename Vector::AlignedMapType AlignedMapVec;
 
-        std::map<const Scalar*, Array> m_history_m;
-        std::map<const Scalar*, Array> m_history_v;
-        Scalar m_beta1t;
-        Scalar m_beta2t;
+        // The m and v vectors of all the parameters, in columns 0 and 1
+        internal::OptimizerState<Scalar, StateScalar> m_state;
+        StateScalar m_step;     // Learning rate with the correction of m
+        StateScalar m_correct2; // Correction of v
 
-    public:
-        Scalar m_lrate;
-        Scalar m_eps;
-        Scalar m_beta1;
-        Scalar m_beta2;
+        void update_block(const Scalar* grad, Scalar* param, const int n, const int state)
+        {
+            const Eigen::Map<const ParamArray> g(grad, n);
+            Eigen::Map<ParamArray> p(param, n);
+            Eigen::Map<Array> mvec(m_state.data(0) + state, n);
+            Eigen::Map<Array> vvec(m_state.data(1) + state, n);
+            // Update m and v vectors
+            mvec = m_beta1 * mvec + (StateScalar(1) - m_beta1) * g.template cast<StateScalar>();
+            vvec = m_beta2 * vvec + (StateScalar(1) - m_beta2) * g.template cast<StateScalar>().square();
+            // Update parameters
+            p -= (m_step * mvec / (m_correct2 * vvec.sqrt() + m_eps)).template cast<Scalar>();
+        }
 
-        Adam(const Scalar& lrate = Scalar(0.001), const Scalar& eps = Scalar(1e-6),
-             const Scalar& beta1 = Scalar(0.9), const Scalar& beta2 = Scalar(0.999)) :
-            m_beta1t(beta1), m_beta2t(beta2),
-            m_lrate(lrate), m_eps(eps),
+    public:
+        StateScalar m_lrate;
+        StateScalar m_eps;
+        StateScalar m_beta1;
+        StateScalar m_beta2;
+
+        Adam(const StateScalar& lrate = StateScalar(0.001), const StateScalar& eps = StateScalar(1e-6),
+             const StateScalar& beta1 = StateScalar(0.9), const StateScalar& beta2 = StateScalar(0.999)) :
+            m_state(2), m_step(0), m_correct2(0), m_lrate(lrate), m_eps(eps),
             m_beta1(beta1), m_beta2(beta2)
         {}
 
         void reset()
         {
-            m_history_m.clear();
-            m_history_v.clear();
-            m_beta1t = m_beta1;
-            m_beta2t = m_beta2;
+            m_state.clear();
+        }
+
+        void forget(const Scalar* dvec)
+        {
+            m_state.remove(dvec);
         }
 
         // https://ruder.io/optimizing-gradient-descent/index.html
         void update(ConstAlignedMapVec& dvec, AlignedMapVec& vec)
         {
             using std::sqrt;
-            // Get the m and v vectors associated with this gradient
-            Array& mvec = m_history_m[dvec.data()];
-            Array& vvec = m_history_v[dvec.data()];
-
-            // If length is zero, initialize it
-            if (mvec.size() == 0)
-            {
-                mvec.resize(dvec.size());
-                mvec.setZero();
-            }
-
-            if (vvec.size() == 0)
-            {
-                vvec.resize(dvec.size());
-                vvec.setZero();
-            }
-
-            // Update m and v vectors
-            mvec = m_beta1 * mvec + (Scalar(1) - m_beta1) * dvec.array();
-            vvec = m_beta2 * vvec + (Scalar(1) - m_beta2) * dvec.array().square();
+            using std::pow;
+            // Get the position of the m and v vectors associated with this gradient,
+            // and the number of updates of the group
+            int t;
+            const int state = m_state.find(dvec.data(), dvec.size(), t);
             // Correction coefficients
-            const Scalar correct1 = Scalar(1) / (Scalar(1) - m_beta1t);
-            const Scalar correct2 = Scalar(1) / sqrt(Scalar(1) - m_beta2t);
-            // Update parameters
-            vec.array() -= (m_lrate * correct1) * mvec / (correct2 * vvec.sqrt() + m_eps);
-            m_beta1t *= m_beta1;
-            m_beta2t *= m_beta2;
+            const StateScalar beta1t = pow(m_beta1, StateScalar(t));
+            const StateScalar beta2t = pow(m_beta2, StateScalar(t));
+            m_step = m_lrate * (StateScalar(1) / (StateScalar(1) - beta1t));
+            m_correct2 = StateScalar(1) / sqrt(StateScalar(1) - beta2t);
+            this->update_blocks(dvec, vec, state);
         }
 };
 
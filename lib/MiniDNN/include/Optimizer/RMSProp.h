@@ -2,9 +2,9 @@
 #define OPTIMIZER_RMSPROP_H_
 
 #include <Eigen/Core>
-#include <map>
 #include "../Config.h"
 #include "../Optimizer.h"
+#include "../Utils/OptimizerState.h"
 
 namespace MiniDNN
 {
@@ -15,24 +15,45 @@ namespace MiniDNN
 ///
 /// The RMSProp algorithm
 ///
-class RMSProp: public Optimizer
+/// \tparam Scalar      Type of the parameters and gradients.
+/// \tparam StateScalar Type of the accumulated statistics and of the update
+///                     computation. With `float` parameters, `double` avoids the
+///                     loss of precision in the running averages.
+///
+template <typename Scalar = MiniDNN::Scalar, typename StateScalar = Scalar>
+class RMSProp: public Optimizer<Scalar>
 {
     private:
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
-        typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> Array;
-        typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
-        typedef Vector::AlignedMapType AlignedMapVec;
+        typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> ParamArray;
+        typedef Eigen::Array<StateScalar, Eigen::Dynamic, 1> Array;
+        typedef typename Vector::ConstAlignedMapType ConstAlignedMapVec;
+        typedef typename Vector::AlignedMapType AlignedMapVec;
 
-        std::map<const Scalar*, Array> m_history;
+        // The accumulated squared gradients of all the parameters
+        internal::OptimizerState<Scalar, StateScalar> m_history;
+
+        void update_block(const Scalar* grad, Scalar* param, const int n, const int state)
+        {
+            const Eigen::Map<const ParamArray> g(grad, n);
+            Eigen::Map<ParamArray> p(param, n);
+            Eigen::Map<Array> grad_square(m_history.data(0) + state, n);
+            // Update accumulated squared gradient
+            grad_square = m_gamma * grad_square + (StateScalar(1) - m_gamma) *
+                          g.template cast<StateScalar>().square();
+            // Update parameters
+            p -= (m_lrate * g.template cast<StateScalar>() /
+                  (grad_square + m_eps).sqrt()).template cast<Scalar>();
+        }
 
     public:
-        Scalar m_lrate;
-        Scalar m_eps;
-        Scalar m_gamma;
+        StateScalar m_lrate;
+        StateScalar m_eps;
+        StateScalar m_gamma;
 
-        RMSProp(const Scalar& lrate = Scalar(0.001), const Scalar& eps = Scalar(1e-6),
-                const Scalar& gamma = Scalar(0.9)) :
-            m_lrate(lrate), m_eps(eps), m_gamma(gamma)
+        RMSProp(const StateScalar& lrate = StateScalar(0.001), const StateScalar& eps = StateScalar(1e-6),
+                const StateScalar& gamma = StateScalar(0.9)) :
+            m_history(1), m_lrate(lrate), m_eps(eps), m_gamma(gamma)
         {}
 
         void reset()
@@ -40,23 +61,15 @@ class RMSProp: public Optimizer
             m_history.clear();
         }
 
-        void update(ConstAlignedMapVec& dvec, AlignedMapVec& vec)
+        void forget(const Scalar* dvec)
         {
-            // Get the accumulated squared gradient associated with this gradient
-            Array& grad_square = m_history[dvec.data()];
-
-            // If length is zero, initialize it
-            if (grad_square.size() == 0)
-            {
-                grad_square.resize(dvec.size());
-                grad_square.setZero();
-            }
+            m_history.remove(dvec);
+        }
 
-            // Update accumulated squared gradient
-            grad_square = m_gamma * grad_square + (Scalar(1) - m_gamma) *
-                          dvec.array().square();
-            // Update parameters
-            vec.array() -= m_lrate * dvec.array() / (grad_square + m_eps).sqrt();
+        void update(ConstAlignedMapVec& dvec, AlignedMapVec& vec)
+        {
+            // Get the position of the accumulated squared gradient associated with this gradient
+            this->update_blocks(dvec, vec, m_history.find(dvec.data(), dvec.size()));
         }
 };
 
@@ -14,12 +14,21 @@ namespace MiniDNN
 ///
 /// The Stochastic Gradient Descent (SGD) algorithm
 ///
-class SGD: public Optimizer
+template <typename Scalar = MiniDNN::Scalar>
+class SGD: public Optimizer<Scalar>
 {
     private:
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
-        typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
-        typedef Vector::AlignedMapType AlignedMapVec;
+        typedef typename Vector::ConstAlignedMapType ConstAlignedMapVec;
+        typedef typename Vector::AlignedMapType AlignedMapVec;
+        typedef Eigen::Map<const Vector> ConstMapVec;
+        typedef Eigen::Map<Vector> MapVec;
+
+        void update_block(const Scalar* grad, Scalar* param, const int n, const int state)
+        {
+            MapVec p(param, n);
+            p.noalias() -= m_lrate * (ConstMapVec(grad, n) + m_decay * p);
+        }
 
     public:
         Scalar m_lrate;
@@ -31,7 +40,7 @@ class SGD: public Optimizer
 
         void update(ConstAlignedMapVec& dvec, AlignedMapVec& vec)
         {
-            vec.noalias() -= m_lrate * (dvec + m_decay * vec);
+            this->update_blocks(dvec, vec, 0);
         }
 };
 
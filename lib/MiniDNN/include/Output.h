@@ -4,6 +4,7 @@
 #include <Eigen/Core>
 #include <stdexcept>
 #include "Config.h"
+#include "Utils/Workspace.h"
 
 namespace MiniDNN
 {
@@ -20,53 +21,83 @@ namespace MiniDNN
 /// layer is a special layer that associates the last hidden layer with the
 /// target response variable.
 ///
+/// \tparam Scalar Type of the data, `float` or `double`.
+///
+template <typename Scalar = MiniDNN::Scalar>
 class Output
 {
     protected:
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
+        typedef typename Matrix::AlignedMapType AlignedMapMat;
         typedef Eigen::RowVectorXi IntegerVector;
+        typedef Eigen::Ref<const IntegerVector> ConstRefIntVec;
 
     public:
         virtual ~Output() {}
 
         // Check the format of target data, e.g. in classification problems the
         // target data should be binary (either 0 or 1)
-        virtual void check_target_data(const Matrix& target) {}
+        virtual void check_target_data(const ConstRefMat& target) {}
 
         // Another type of target data where each element is a class label
         // This version may not be sensible for regression tasks, so by default
         // we raise an exception
-        virtual void check_target_data(const IntegerVector& target)
+        virtual void check_target_data(const ConstRefIntVec& target)
         {
             throw std::invalid_argument("[class Output]: This output type cannot take class labels as target data");
         }
 
+        // Size of the workspace memory, in bytes, needed to evaluate a batch of
+        // 'nobs' observations with 'nvar' variables
+        virtual std::size_t workspace_size(int nvar, int nobs) const
+        {
+            return 0;
+        }
+
+        // Carve the buffers of this layer from the workspace before a batch is evaluated
+        virtual void bind_workspace(internal::Workspace& ws, int nvar, int nobs) {}
+
+        // Whether this layer evaluates the activation function of the last hidden layer
+        // together with the loss, given the type of that activation. If it returns true,
+        // evaluate() receives the linear term of the last hidden layer, and backprop_data()
+        // is the derivative of the loss with respect to that linear term
+        virtual bool fuse_activation(const std::string& activation_type)
+        {
+            return false;
+        }
+
         // A combination of the forward stage and the back-propagation stage for the output layer
         // The computed derivative of the input should be stored in this layer, and can be retrieved by
         // the backprop_data() function
-        virtual void evaluate(const Matrix& prev_layer_data, const Matrix& target) = 0;
+        virtual void evaluate(const ConstRefMat& prev_layer_data, const ConstRefMat& target) = 0;
 
         // Another type of target data where each element is a class label
         // This version may not be sensible for regression tasks, so by default
         // we raise an exception
-        virtual void evaluate(const Matrix& prev_layer_data,
-                              const IntegerVector& target)
+        virtual void evaluate(const ConstRefMat& prev_layer_data,
+                              const ConstRefIntVec& target)
         {
             throw std::invalid_argument("[class Output]: This output type cannot take class labels as target data");
         }
 
         // The derivative of the input of this layer, which is also the derivative
         // of the output of previous layer
-        virtual const Matrix& backprop_data() const = 0;
+        virtual const AlignedMapMat& backprop_data() const = 0;
 
         // Return the loss function value after the evaluation
         // This function can be assumed to be called after evaluate(), so that it can make use of the
         // intermediate result to save some computation
+        // The reduction is accumulated in double precision regardless of Scalar
         virtual Scalar loss() const = 0;
 
         // Return the output layer type. It is used to export the NN model.
         virtual std::string output_type() const = 0;
+
+        // Create a copy of this output layer. It is used to build the worker
+        // replicas in data-parallel training.
+        virtual Output* clone() const = 0;
 };
 
 
@@ -2,6 +2,8 @@
 #define OUTPUT_BINARYCLASSENTROPY_H_
 
 #include <Eigen/Core>
+#include <string>
+#include <new>
 #include <stdexcept>
 #include "../Config.h"
 
@@ -14,29 +16,82 @@ namespace MiniDNN
 ///
 /// Binary classification output layer using cross-entropy criterion
 ///
-class BinaryClassEntropy: public Output
+/// In the fused mode, the Sigmoid activation of the last hidden layer is evaluated
+/// by this layer together with the loss. It then receives the linear term `z` of
+/// the last hidden layer, and computes the derivative `sigmoid(z) - y` with respect
+/// to `z` and the loss `softplus(z) - y * z`, which stay finite when the Sigmoid
+/// saturates. The predictions of the network are not affected.
+///
+template <typename Scalar = MiniDNN::Scalar>
+class BinaryClassEntropy: public Output<Scalar>
 {
     private:
-        Matrix m_din;  // Derivative of the input of this layer.
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
+        typedef typename Matrix::AlignedMapType AlignedMapMat;
+        typedef Eigen::RowVectorXi IntegerVector;
+        typedef Eigen::Ref<const IntegerVector> ConstRefIntVec;
+
+        AlignedMapMat m_din;  // Derivative of the input of this layer.
         // Note that input of this layer is also the output of previous layer
+        const bool m_fused_mode;  // Whether the Sigmoid activation may be fused with the loss
+        bool m_fused;             // Whether the input is the linear term of a Sigmoid layer
+        double m_loss;            // Sum of the losses of the observations in the fused mode
+
+        // The fused derivative and loss, given the linear term z and the target y
+        // With e = exp(-|z|),
+        // sigmoid(z) = 1 / (1 + e) if z >= 0, and e / (1 + e) otherwise
+        // softplus(z) = log(1 + exp(z)) = max(z, 0) + log(1 + e)
+        // so exp() is never evaluated on a positive argument
+        template <typename Target>
+        void evaluate_logits(const ConstRefMat& z, const Target& y)
+        {
+            m_din.array() = (-z.array().abs()).exp();
+            m_loss = (z.array().max(Scalar(0)) - y * z.array() + m_din.array().log1p()).
+                     template cast<double>().sum();
+            m_din.array() = (z.array() >= Scalar(0)).select(Scalar(1), m_din.array()) /
+                            (Scalar(1) + m_din.array()) - y;
+        }
 
     public:
-        void check_target_data(const Matrix& target)
+        ///
+        /// Constructor
+        ///
+        /// \param fused_sigmoid Whether the Sigmoid activation of the last hidden layer
+        ///                      is evaluated together with the loss in training, see
+        ///                      Output::fuse_activation(). Only FullyConnected and
+        ///                      SparseFullyConnected layers are fused.
+        ///
+        explicit BinaryClassEntropy(bool fused_sigmoid = false) :
+            m_din(NULL, 0, 0), m_fused_mode(fused_sigmoid), m_fused(false), m_loss(0.0)
+        {}
+
+        bool fuse_activation(const std::string& activation_type)
         {
-            // Each element should be either 0 or 1
-            const int nelem = target.size();
-            const Scalar* target_data = target.data();
+            m_fused = m_fused_mode && activation_type == "Sigmoid";
+            return m_fused;
+        }
 
-            for (int i = 0; i < nelem; i++)
+        std::size_t workspace_size(int nvar, int nobs) const
+        {
+            return internal::Workspace::block_size<Scalar>(std::size_t(nvar) * nobs);
+        }
+
+        void bind_workspace(internal::Workspace& ws, int nvar, int nobs)
+        {
+            new (&m_din) AlignedMapMat(ws.allocate<Scalar>(std::size_t(nvar) * nobs), nvar, nobs);
+        }
+
+        void check_target_data(const ConstRefMat& target)
+        {
+            // Each element should be either 0 or 1
+            if (((target.array() != Scalar(0)) && (target.array() != Scalar(1))).any())
             {
-                if ((target_data[i] != Scalar(0)) && (target_data[i] != Scalar(1)))
-                {
-                    throw std::invalid_argument("[class BinaryClassEntropy]: Target data should only contain zero or one");
-                }
+                throw std::invalid_argument("[class BinaryClassEntropy]: Target data should only contain zero or one");
             }
         }
 
-        void check_target_data(const IntegerVector& target)
+        void check_target_data(const ConstRefIntVec& target)
         {
             // Each element should be either 0 or 1
             const int nobs = target.size();
@@ -50,7 +105,7 @@ class BinaryClassEntropy: public Output
             }
         }
 
-        void evaluate(const Matrix& prev_layer_data, const Matrix& target)
+        void evaluate(const ConstRefMat& prev_layer_data, const ConstRefMat& target)
         {
             // Check dimension
             const int nobs = prev_layer_data.cols();
@@ -61,17 +116,25 @@ class BinaryClassEntropy: public Output
                 throw std::invalid_argument("[class BinaryClassEntropy]: Target data have incorrect dimension");
             }
 
+            if (m_fused)
+            {
+                // in = z, phat = sigmoid(z)
+                // L = -y * log(phat) - (1 - y) * log(1 - phat) = softplus(z) - y * z
+                // d(L) / d(in) = phat - y
+                evaluate_logits(prev_layer_data, target.array());
+                return;
+            }
+
             // Compute the derivative of the input of this layer
             // L = -y * log(phat) - (1 - y) * log(1 - phat)
             // in = phat
             // d（L） / d（in） = -y / phat + (1 - y) / (1 - phat), y is either 0 or 1
-            m_din.resize(nvar, nobs);
             m_din.array() = (target.array() < Scalar(0.5)).select((Scalar(
                                 1) - prev_layer_data.array()).cwiseInverse(),
                             -prev_layer_data.cwiseInverse());
         }
 
-        void evaluate(const Matrix& prev_layer_data, const IntegerVector& target)
+        void evaluate(const ConstRefMat& prev_layer_data, const ConstRefIntVec& target)
         {
             // Only when the last hidden layer has only one unit can we use this version
             const int nvar = prev_layer_data.rows();
@@ -89,32 +152,47 @@ class BinaryClassEntropy: public Output
                 throw std::invalid_argument("[class BinaryClassEntropy]: Target data have incorrect dimension");
             }
 
+            if (m_fused)
+            {
+                evaluate_logits(prev_layer_data, target.array().template cast<Scalar>());
+                return;
+            }
+
             // Same as above
-            m_din.resize(1, nobs);
             m_din.array() = (target.array() == 0).select((Scalar(1) -
                             prev_layer_data.array()).cwiseInverse(),
                             -prev_layer_data.cwiseInverse());
         }
 
-        const Matrix& backprop_data() const
+        const AlignedMapMat& backprop_data() const
         {
             return m_din;
         }
 
         Scalar loss() const
         {
+            if (m_fused)
+            {
+                return Scalar(m_loss / m_din.cols());
+            }
+
             // L = -y * log(phat) - (1 - y) * log(1 - phat)
             // y = 0 => L = -log(1 - phat)
             // y = 1 => L = -log(phat)
             // m_din contains 1/(1 - phat) if y = 0, and -1/phat if y = 1, so
             // L = log(abs(m_din)).sum()
-            return m_din.array().abs().log().sum() / m_din.cols();
+            return Scalar(m_din.array().abs().log().template cast<double>().sum() / m_din.cols());
         }
 
         std::string output_type() const
         {
             return "BinaryClassEntropy";
         }
+
+        Output<Scalar>* clone() const
+        {
+            return new BinaryClassEntropy(*this);
+        }
 };
 
 
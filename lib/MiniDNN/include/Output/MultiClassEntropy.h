@@ -2,6 +2,9 @@
 #define OUTPUT_MULTICLASSENTROPY_H_
 
 #include <Eigen/Core>
+#include <cmath>
+#include <string>
+#include <new>
 #include <stdexcept>
 #include "../Config.h"
 
@@ -14,14 +17,91 @@ namespace MiniDNN
 ///
 /// Multi-class classification output layer using cross-entropy criterion
 ///
-class MultiClassEntropy: public Output
+/// In the fused mode, the Softmax activation of the last hidden layer is evaluated
+/// by this layer together with the loss. It then receives the linear term `z` of
+/// the last hidden layer, and computes the loss and the derivative `phat - y` with
+/// respect to `z` directly from the log-sum-exp of each observation, which avoids
+/// the division by `phat` and the Jacobian of Softmax. The predictions of the
+/// network are not affected.
+///
+template <typename Scalar = MiniDNN::Scalar>
+class MultiClassEntropy: public Output<Scalar>
 {
     private:
-        Matrix m_din;  // Derivative of the input of this layer.
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
+        typedef typename Matrix::AlignedMapType AlignedMapMat;
+        typedef Eigen::Matrix<Scalar, 1, Eigen::Dynamic> RowVector;
+        typedef typename RowVector::AlignedMapType AlignedMapRowVec;
+        typedef Eigen::RowVectorXi IntegerVector;
+        typedef Eigen::Ref<const IntegerVector> ConstRefIntVec;
+
+        AlignedMapMat m_din;  // Derivative of the input of this layer.
         // Note that input of this layer is also the output of previous layer
+        const bool m_fused_mode;  // Whether the Softmax activation may be fused with the loss
+        bool m_fused;             // Whether the input is the linear term of a Softmax layer
+        double m_loss;            // Sum of the losses of the observations in the fused mode
+        AlignedMapRowVec m_ysum;  // Column sums of the target matrix in the fused mode
+
+        // Write softmax(z) of each observation to m_din, and return the sum of
+        // the log-sum-exp of the observations weighted by w
+        // The maximum is subtracted before the exponential, so that exp() cannot
+        // overflow and the log-sum-exp is exact for large logits
+        template <typename Weight>
+        double softmax_logsumexp(const ConstRefMat& z, const Weight& w)
+        {
+            const int nobs = z.cols();
+            double res = 0.0;
+
+            for (int i = 0; i < nobs; i++)
+            {
+                const Scalar m = z.col(i).maxCoeff();
+                m_din.col(i).array() = (z.col(i).array() - m).exp();
+                const Scalar s = m_din.col(i).sum();
+                m_din.col(i) *= Scalar(1) / s;
+                res += w(i) * (double(std::log(s)) + double(m));
+            }
+
+            return res;
+        }
 
     public:
-        void check_target_data(const Matrix& target)
+        ///
+        /// Constructor
+        ///
+        /// \param fused_softmax Whether the Softmax activation of the last hidden layer
+        ///                      is evaluated together with the loss in training, see
+        ///                      Output::fuse_activation(). Only FullyConnected and
+        ///                      SparseFullyConnected layers are fused.
+        ///
+        explicit MultiClassEntropy(bool fused_softmax = false) :
+            m_din(NULL, 0, 0), m_fused_mode(fused_softmax), m_fused(false), m_loss(0.0),
+            m_ysum(NULL, 0)
+        {}
+
+        bool fuse_activation(const std::string& activation_type)
+        {
+            m_fused = m_fused_mode && activation_type == "Softmax";
+            return m_fused;
+        }
+
+        std::size_t workspace_size(int nvar, int nobs) const
+        {
+            const std::size_t ysum_size = m_fused_mode ? internal::Workspace::block_size<Scalar>(nobs) : 0;
+            return internal::Workspace::block_size<Scalar>(std::size_t(nvar) * nobs) + ysum_size;
+        }
+
+        void bind_workspace(internal::Workspace& ws, int nvar, int nobs)
+        {
+            new (&m_din) AlignedMapMat(ws.allocate<Scalar>(std::size_t(nvar) * nobs), nvar, nobs);
+
+            if (m_fused_mode)
+            {
+                new (&m_ysum) AlignedMapRowVec(ws.allocate<Scalar>(nobs), nobs);
+            }
+        }
+
+        void check_target_data(const ConstRefMat& target)
         {
             // Each element should be either 0 or 1
             // Each column has and only has one 1
@@ -53,7 +133,7 @@ class MultiClassEntropy: public Output
             }
         }
 
-        void check_target_data(const IntegerVector& target)
+        void check_target_data(const ConstRefIntVec& target)
         {
             // All elements must be non-negative
             const int nobs = target.size();
@@ -69,7 +149,7 @@ class MultiClassEntropy: public Output
 
         // target is a matrix with each column representing an observation
         // Each column is a vector that has a one at some location and has zeros elsewhere
-        void evaluate(const Matrix& prev_layer_data, const Matrix& target)
+        void evaluate(const ConstRefMat& prev_layer_data, const ConstRefMat& target)
         {
             // Check dimension
             const int nobs = prev_layer_data.cols();
@@ -80,17 +160,28 @@ class MultiClassEntropy: public Output
                 throw std::invalid_argument("[class MultiClassEntropy]: Target data have incorrect dimension");
             }
 
+            if (m_fused)
+            {
+                // in = z, phat = softmax(z)
+                // L = -sum(log(phat) * y) = logsumexp(z) * sum(y) - sum(z * y)
+                // d(L) / d(in) = phat * sum(y) - y = phat - y
+                m_ysum.noalias() = target.colwise().sum();
+                m_loss = softmax_logsumexp(prev_layer_data, m_ysum) -
+                         double(prev_layer_data.cwiseProduct(target).sum());
+                m_din -= target;
+                return;
+            }
+
             // Compute the derivative of the input of this layer
             // L = -sum(log(phat) * y)
             // in = phat
             // d(L) / d(in) = -y / phat
-            m_din.resize(nclass, nobs);
             m_din.noalias() = -target.cwiseQuotient(prev_layer_data);
         }
 
         // target is a vector of class labels that take values from [0, 1, ..., nclass - 1]
         // The i-th element of target is the class label for observation i
-        void evaluate(const Matrix& prev_layer_data, const IntegerVector& target)
+        void evaluate(const ConstRefMat& prev_layer_data, const ConstRefIntVec& target)
         {
             // Check dimension
             const int nobs = prev_layer_data.cols();
@@ -101,11 +192,33 @@ class MultiClassEntropy: public Output
                 throw std::invalid_argument("[class MultiClassEntropy]: Target data have incorrect dimension");
             }
 
+            // The labels index the rows of the input, whose number is not known
+            // to check_target_data()
+            if ((target.array() >= nclass).any())
+            {
+                throw std::invalid_argument("[class MultiClassEntropy]: Target data must be less than the number of classes");
+            }
+
+            if (m_fused)
+            {
+                // in = z, phat = softmax(z)
+                // L = logsumexp(z) - z[y]
+                // d(L) / d(in) = phat - [0, 0, ..., 1, 0, ..., 0]
+                m_loss = softmax_logsumexp(prev_layer_data, RowVector::Ones(nobs));
+
+                for (int i = 0; i < nobs; i++)
+                {
+                    m_loss -= double(prev_layer_data(target[i], i));
+                    m_din(target[i], i) -= Scalar(1);
+                }
+
+                return;
+            }
+
             // Compute the derivative of the input of this layer
             // L = -log(phat[y])
             // in = phat
             // d(L) / d(in) = [0, 0, ..., -1/phat[y], 0, ..., 0]
-            m_din.resize(nclass, nobs);
             m_din.setZero();
 
             for (int i = 0; i < nobs; i++)
@@ -114,18 +227,23 @@ class MultiClassEntropy: public Output
             }
         }
 
-        const Matrix& backprop_data() const
+        const AlignedMapMat& backprop_data() const
         {
             return m_din;
         }
 
         Scalar loss() const
         {
+            if (m_fused)
+            {
+                return Scalar(m_loss / m_din.cols());
+            }
+
             // L = -sum(log(phat) * y)
             // in = phat
             // d(L) / d(in) = -y / phat
             // m_din contains 0 if y = 0, and -1/phat if y = 1
-            Scalar res = Scalar(0);
+            double res = 0.0;
             const int nelem = m_din.size();
             const Scalar* din_data = m_din.data();
 
@@ -137,13 +255,18 @@ class MultiClassEntropy: public Output
                 }
             }
 
-            return res / m_din.cols();
+            return Scalar(res / m_din.cols());
         }
 
         std::string output_type() const
         {
             return "MultiClassEntropy";
         }
+
+        Output<Scalar>* clone() const
+        {
+            return new MultiClassEntropy(*this);
+        }
 };
 
 
@@ -2,6 +2,7 @@
 #define OUTPUT_REGRESSIONMSE_H_
 
 #include <Eigen/Core>
+#include <new>
 #include <stdexcept>
 #include "../Config.h"
 
@@ -14,17 +15,33 @@ namespace MiniDNN
 ///
 /// Regression output layer using Mean Squared Error (MSE) criterion
 ///
-class RegressionMSE: public Output
+template <typename Scalar = MiniDNN::Scalar>
+class RegressionMSE: public Output<Scalar>
 {
     private:
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
-        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
+        typedef typename Matrix::AlignedMapType AlignedMapMat;
 
-        Matrix m_din;  // Derivative of the input of this layer.
+        AlignedMapMat m_din;  // Derivative of the input of this layer.
         // Note that input of this layer is also the output of previous layer
 
     public:
-        void evaluate(const Matrix& prev_layer_data, const Matrix& target)
+        RegressionMSE() :
+            m_din(NULL, 0, 0)
+        {}
+
+        std::size_t workspace_size(int nvar, int nobs) const
+        {
+            return internal::Workspace::block_size<Scalar>(std::size_t(nvar) * nobs);
+        }
+
+        void bind_workspace(internal::Workspace& ws, int nvar, int nobs)
+        {
+            new (&m_din) AlignedMapMat(ws.allocate<Scalar>(std::size_t(nvar) * nobs), nvar, nobs);
+        }
+
+        void evaluate(const ConstRefMat& prev_layer_data, const ConstRefMat& target)
         {
             // Check dimension
             const int nobs = prev_layer_data.cols();
@@ -39,11 +56,10 @@ class RegressionMSE: public Output
             // L = 0.5 * ||yhat - y||^2
             // in = yhat
             // d(L) / d(in) = yhat - y
-            m_din.resize(nvar, nobs);
             m_din.noalias() = prev_layer_data - target;
         }
 
-        const Matrix& backprop_data() const
+        const AlignedMapMat& backprop_data() const
         {
             return m_din;
         }
@@ -51,13 +67,18 @@ class RegressionMSE: public Output
         Scalar loss() const
         {
             // L = 0.5 * ||yhat - y||^2
-            return m_din.squaredNorm() / m_din.cols() * Scalar(0.5);
+            return Scalar(m_din.template cast<double>().squaredNorm() / m_din.cols() * 0.5);
         }
 
         std::string output_type() const
         {
             return "RegressionMSE";
         }
+
+        Output<Scalar>* clone() const
+        {
+            return new RegressionMSE(*this);
+        }
 };
 
 
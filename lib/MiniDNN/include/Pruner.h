@@ -0,0 +1,127 @@
+#ifndef PRUNER_H_
+#define PRUNER_H_
+
+#include <Eigen/Core>
+#include <vector>
+#include <map>
+#include <stdexcept>
+#include "Config.h"
+#include "Layer.h"
+#include "Network.h"
+#include "Utils/Enum.h"
+#include "Utils/Factory.h"
+#include "Utils/Pruning.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// \ingroup Network
+///
+/// Magnitude-based pruning of the fully connected layers of a network
+///
+/// The FullyConnected layers of a trained network are replaced by
+/// SparseFullyConnected layers, in which the weights of smallest magnitude are
+/// removed. SparseFullyConnected layers are pruned further, and the other
+/// layers are copied. The pruned network can be fine-tuned with Network::fit(),
+/// which keeps the pruned weights at zero, and saved with Network::export_net().
+///
+/// \code
+/// Pruner<> pruner(net);
+/// Network<> sparse_net;
+/// pruner.prune(sparse_net, 0.8);
+/// sparse_net.fit(opt, x, y, 100, 5);
+/// \endcode
+///
+template <typename Scalar = MiniDNN::Scalar>
+class Pruner
+{
+    private:
+        typedef std::map<std::string, int> MetaInfo;
+
+        const Network<Scalar>& m_net;
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param net The trained network to prune. It must outlive the pruner.
+        ///
+        explicit Pruner(const Network<Scalar>& net) :
+            m_net(net)
+        {}
+
+        ///
+        /// Build the pruned network, with the same sparsity in all fully connected layers
+        ///
+        /// \param dest     An empty network, to which the pruned layers and a copy of
+        ///                 the output layer are added.
+        /// \param sparsity Fraction of the weights of each layer that are set to zero, in [0, 1].
+        ///
+        void prune(Network<Scalar>& dest, const double sparsity) const
+        {
+            prune(dest, std::vector<double>(m_net.num_layers(), sparsity));
+        }
+
+        ///
+        /// Build the pruned network, with a given sparsity for each layer
+        ///
+        /// \param dest     An empty network, to which the pruned layers and a copy of
+        ///                 the output layer are added.
+        /// \param sparsity Fraction of the weights of each layer that are set to zero,
+        ///                 in [0, 1]. The values for layers that are not fully connected
+        ///                 are ignored.
+        ///
+        void prune(Network<Scalar>& dest, const std::vector<double>& sparsity) const
+        {
+            const std::vector<const Layer<Scalar>*> layers = m_net.get_layers();
+            const int nlayer = layers.size();
+
+            if (static_cast<int>(sparsity.size()) != nlayer)
+            {
+                throw std::invalid_argument("[class Pruner]: Length of sparsity does not match the number of layers");
+            }
+
+            if (dest.num_layers() > 0)
+            {
+                throw std::invalid_argument("[class Pruner]: Destination network must be empty");
+            }
+
+            for (int i = 0; i < nlayer; i++)
+            {
+                const Layer<Scalar>* src = layers[i];
+                MetaInfo map;
+                src->fill_meta_info(map, 0);
+                const int lay_id = map["Layer0"];
+
+                if (lay_id != internal::FULLY_CONNECTED && lay_id != internal::SPARSE_FULLY_CONNECTED)
+                {
+                    dest.add_layer(src->clone());
+                    continue;
+                }
+
+                // Both layers serialize the weights as a dense matrix followed by the bias,
+                // and the sparse layer takes its pattern from the nonzero weights
+                std::vector<Scalar> param = src->get_parameters();
+                const std::size_t nweight = std::size_t(src->in_size()) * src->out_size();
+                internal::prune_by_magnitude(&param[0], nweight, internal::num_kept(nweight, sparsity[i]));
+
+                map["Layer0"] = internal::SPARSE_FULLY_CONNECTED;
+                Layer<Scalar>* layer = internal::create_layer<Scalar>(map, 0);
+                dest.add_layer(layer);
+                layer->set_parameters(param);
+            }
+
+            if (m_net.get_output())
+            {
+                dest.set_output(m_net.get_output()->clone());
+            }
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* PRUNER_H_ */
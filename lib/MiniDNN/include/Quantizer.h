@@ -0,0 +1,291 @@
+#ifndef QUANTIZER_H_
+#define QUANTIZER_H_
+
+#include <Eigen/Core>
+#include <vector>
+#include <map>
+#include <new>
+#include <cmath>
+#include <algorithm>
+#include <ostream>
+#include <stdexcept>
+#include "Config.h"
+#include "Layer.h"
+#include "Network.h"
+#include "InferenceSession.h"
+#include "Layer/QuantizedLayer.h"
+#include "Utils/Enum.h"
+#include "Utils/Factory.h"
+#include "Utils/Workspace.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// \ingroup Network
+///
+/// Accuracy of a quantized network compared with the floating-point network
+/// it was created from, as returned by Quantizer::compare()
+///
+struct QuantizationReport
+{
+    int    nobs;            ///< Number of observations compared
+    double max_abs_error;   ///< Largest absolute difference of the predictions
+    double mean_abs_error;  ///< Mean absolute difference of the predictions
+    double relative_error;  ///< Frobenius norm of the difference relative to that of the reference
+    double agreement;       ///< Fraction of observations with the same predicted class, using the
+                            ///< largest output, or the threshold 0.5 if there is one output
+
+    QuantizationReport() :
+        nobs(0), max_abs_error(0), mean_abs_error(0), relative_error(0), agreement(1)
+    {}
+};
+
+inline std::ostream& operator<<(std::ostream& os, const QuantizationReport& report)
+{
+    os << "observations: " << report.nobs
+       << ", max abs error: " << report.max_abs_error
+       << ", mean abs error: " << report.mean_abs_error
+       << ", relative error: " << report.relative_error
+       << ", class agreement: " << report.agreement;
+    return os;
+}
+
+
+///
+/// \ingroup Network
+///
+/// Post-training quantization of a network to 8-bit integer parameters
+///
+/// The FullyConnected and Convolutional layers of a trained network are
+/// replaced by QuantizedFullyConnected and QuantizedConvolutional layers, and
+/// the other layers are copied. The weights are quantized with one scale per
+/// output channel. The input of each layer is quantized with one scale, which
+/// is calibrated on sample data by recording the largest input of the layer.
+///
+/// The quantized network only supports inference. It can be saved with
+/// Network::export_net() and read back with Network::read_net().
+///
+/// \code
+/// Quantizer<> quantizer(net);
+/// quantizer.calibrate(x_sample);
+/// Network<> qnet;
+/// quantizer.quantize(qnet);
+/// std::cout << Quantizer<>::compare(net, qnet, x_test) << std::endl;
+/// \endcode
+///
+template <typename Scalar = MiniDNN::Scalar>
+class Quantizer
+{
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
+        typedef typename Matrix::AlignedMapType AlignedMapMat;
+        typedef std::map<std::string, int> MetaInfo;
+
+        const Network<Scalar>& m_net;
+        std::vector<Scalar>    m_range;      // Largest magnitude of the input of each layer
+        int                    m_nobs;       // Number of observations used in calibration
+        internal::Workspace    m_workspace;  // Memory of the intermediate results
+
+        // Copying a quantizer would share the workspace
+        Quantizer(const Quantizer&);
+        Quantizer& operator=(const Quantizer&);
+
+        // Largest magnitude of a matrix, which may be empty
+        static Scalar absmax(const ConstRefMat& x)
+        {
+            return (x.size() > 0) ? Scalar(x.cwiseAbs().maxCoeff()) : Scalar(0);
+        }
+
+        // Index of the predicted class of an observation
+        static int predicted_class(const ConstRefMat& pred, int obs)
+        {
+            if (pred.rows() == 1)
+            {
+                return pred(0, obs) > Scalar(0.5);
+            }
+
+            int res;
+            pred.col(obs).maxCoeff(&res);
+            return res;
+        }
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param net The trained network to quantize. It must outlive the quantizer,
+        ///            and should not be modified after calibration has started.
+        ///
+        explicit Quantizer(const Network<Scalar>& net) :
+            m_net(net), m_nobs(0)
+        {}
+
+        ///
+        /// Record the range of the input of each layer on sample data
+        ///
+        /// This function can be called several times, e.g. on mini-batches of
+        /// a large data set, and the ranges cover all the data seen so far.
+        ///
+        /// \param x Sample predictors, typically from the training set. Each column is an observation.
+        ///
+        void calibrate(const Matrix& x)
+        {
+            const std::vector<const Layer<Scalar>*> layers = m_net.get_layers();
+            const int nlayer = layers.size();
+
+            if (nlayer <= 0)
+            {
+                throw std::invalid_argument("[class Quantizer]: Network has no layers");
+            }
+
+            if (x.rows() != layers[0]->in_size())
+            {
+                throw std::invalid_argument("[class Quantizer]: Input data have incorrect dimension");
+            }
+
+            if (m_range.empty())
+            {
+                m_range.resize(nlayer, Scalar(0));
+            }
+
+            const int nobs = x.cols();
+            std::size_t size = 0;
+
+            for (int i = 0; i < nlayer; i++)
+            {
+                size += layers[i]->inference_size(nobs);
+            }
+
+            m_workspace.reset();
+            m_workspace.reserve(size);
+            m_range[0] = std::max(m_range[0], absmax(x));
+            AlignedMapMat out = layers[0]->infer(x, m_workspace);
+
+            for (int i = 1; i < nlayer; i++)
+            {
+                m_range[i] = std::max(m_range[i], absmax(out));
+                AlignedMapMat next = layers[i]->infer(out, m_workspace);
+                new (&out) AlignedMapMat(next.data(), next.rows(), next.cols());
+            }
+
+            m_nobs += nobs;
+        }
+
+        ///
+        /// Number of observations seen by calibrate() so far
+        ///
+        int num_calibration_obs() const
+        {
+            return m_nobs;
+        }
+
+        ///
+        /// Largest magnitude of the input of each layer seen by calibrate()
+        ///
+        const std::vector<Scalar>& input_ranges() const
+        {
+            return m_range;
+        }
+
+        ///
+        /// Build the quantized network
+        ///
+        /// \param dest An empty network, to which the quantized layers and a copy of
+        ///             the output layer are added.
+        ///
+        void quantize(Network<Scalar>& dest) const
+        {
+            if (m_nobs <= 0)
+            {
+                throw std::logic_error("[class Quantizer]: calibrate() must be called before quantize()");
+            }
+
+            if (dest.num_layers() > 0)
+            {
+                throw std::invalid_argument("[class Quantizer]: Destination network must be empty");
+            }
+
+            const std::vector<const Layer<Scalar>*> layers = m_net.get_layers();
+            const int nlayer = layers.size();
+
+            for (int i = 0; i < nlayer; i++)
+            {
+                const Layer<Scalar>* src = layers[i];
+                MetaInfo map;
+                src->fill_meta_info(map, 0);
+                const int lay_id = map["Layer0"];
+
+                if (lay_id != internal::FULLY_CONNECTED && lay_id != internal::CONVOLUTIONAL)
+                {
+                    dest.add_layer(src->clone());
+                    continue;
+                }
+
+                // The quantized layers are described by the same meta information
+                map["Layer0"] = (lay_id == internal::FULLY_CONNECTED) ?
+                                internal::QUANTIZED_FULLY_CONNECTED :
+                                internal::QUANTIZED_CONVOLUTIONAL;
+                Layer<Scalar>* layer = internal::create_layer<Scalar>(map, 0);
+                dest.add_layer(layer);
+                static_cast<QuantizedLayer<Scalar>*>(layer)->quantize(src->get_parameters(), m_range[i]);
+            }
+
+            if (m_net.get_output())
+            {
+                dest.set_output(m_net.get_output()->clone());
+            }
+        }
+
+        ///
+        /// Compare the predictions of a quantized network with those of the reference network
+        ///
+        /// \param ref   The floating-point network.
+        /// \param quant The quantized network.
+        /// \param x     Test predictors. Each column is an observation.
+        ///
+        static QuantizationReport compare(const Network<Scalar>& ref, const Network<Scalar>& quant,
+                                          const Matrix& x)
+        {
+            InferenceSession<Scalar> ref_session(ref);
+            InferenceSession<Scalar> quant_session(quant);
+            const Matrix ref_pred = ref_session.predict(x);
+            const Matrix quant_pred = quant_session.predict(x);
+
+            if (ref_pred.rows() != quant_pred.rows() || ref_pred.cols() != quant_pred.cols())
+            {
+                throw std::invalid_argument("[class Quantizer]: Networks have different output dimensions");
+            }
+
+            QuantizationReport report;
+            report.nobs = x.cols();
+
+            if (ref_pred.size() <= 0)
+            {
+                return report;
+            }
+
+            const Matrix diff = quant_pred - ref_pred;
+            const double ref_norm = ref_pred.norm();
+            report.max_abs_error = diff.cwiseAbs().maxCoeff();
+            report.mean_abs_error = double(diff.cwiseAbs().sum()) / double(diff.size());
+            report.relative_error = (ref_norm > 0) ? double(diff.norm()) / ref_norm : double(diff.norm());
+            int same = 0;
+
+            for (int j = 0; j < report.nobs; j++)
+            {
+                same += (predicted_class(ref_pred, j) == predicted_class(quant_pred, j));
+            }
+
+            report.agreement = double(same) / double(report.nobs);
+            return report;
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* QUANTIZER_H_ */
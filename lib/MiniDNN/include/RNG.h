@@ -55,10 +55,10 @@ class RNG
             m_rand = (seed ? (seed & m_max) : 1);
         }
 
-        virtual Scalar rand()
+        virtual double rand()
         {
             m_rand = next_long_rand(m_rand);
-            return Scalar(m_rand) / Scalar(m_max);
+            return double(m_rand) / double(m_max);
         }
 };
 
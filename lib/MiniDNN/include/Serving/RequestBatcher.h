@@ -0,0 +1,386 @@
+#ifndef SERVING_REQUESTBATCHER_H_
+#define SERVING_REQUESTBATCHER_H_
+
+// The batcher relies on the threading library of C++11
+#if __cplusplus >= 201103L
+
+#include <Eigen/Core>
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+#include "../Config.h"
+#include "../Network.h"
+#include "../InferenceSession.h"
+
+namespace MiniDNN
+{
+
+
+///
+/// \defgroup Serving Serving
+///
+
+///
+/// \ingroup Serving
+///
+/// Dynamic batching of concurrent prediction requests
+///
+/// Requests submitted from any thread are queued, and a worker thread packs the
+/// pending requests as columns of one input matrix as soon as `max_batch`
+/// observations have been collected, or the oldest request has waited for
+/// `max_delay_us` microseconds. One forward pass then serves all of them, which
+/// replaces many skinny matrix products by a single large one. The delay bounds
+/// the latency that batching adds to each request.
+///
+/// Each worker makes predictions with its own InferenceSession, so the network
+/// must not be modified while the batcher is alive.
+///
+template <typename Scalar = MiniDNN::Scalar>
+class RequestBatcher
+{
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Map<const Matrix> ConstMapMat;
+        typedef Eigen::Map<Matrix> MapMat;
+        typedef std::chrono::steady_clock Clock;
+
+        // A pending request, owned by the queue until a worker has served it
+        struct Request
+        {
+            const Scalar*       in;       // Input, in_size x nobs
+            Scalar*             out;      // Output, out_size x nobs
+            int                 nobs;
+            Clock::time_point   arrival;
+            std::promise<void>  done;
+        };
+
+        const Network<Scalar>&    m_net;
+        const int                 m_in_size;
+        const int                 m_out_size;
+        const int                 m_max_batch;  // Maximum number of observations in a batch
+        const Clock::duration     m_max_delay;  // Maximum time a request waits for a batch to fill
+        std::deque<Request*>      m_queue;
+        int                       m_queued_obs; // Number of observations in m_queue
+        long                      m_nbatch;     // Number of batches run so far
+        long                      m_nobs;       // Number of observations served so far
+        bool                      m_stop;
+        mutable std::mutex        m_mutex;
+        std::condition_variable   m_cv;
+        std::vector<std::thread>  m_workers;
+
+        static int first_layer_size(const Network<Scalar>& net, bool input)
+        {
+            const std::vector<const Layer<Scalar>*> layers = net.get_layers();
+
+            if (layers.empty())
+            {
+                throw std::invalid_argument("[class RequestBatcher]: The network has no layers");
+            }
+
+            return input ? layers.front()->in_size() : layers.back()->out_size();
+        }
+
+        // Take the requests of the next batch from the queue, blocking until the
+        // batch is full or its oldest request is due
+        // Returns false when the batcher is stopped and the queue is empty
+        bool next_batch(std::vector<Request*>& batch, int& nobs)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+
+            if (m_queue.empty())
+            {
+                return false;
+            }
+
+            const Clock::time_point deadline = m_queue.front()->arrival + m_max_delay;
+
+            while (!m_stop && !m_queue.empty() && m_queued_obs < m_max_batch &&
+                    Clock::now() < deadline)
+            {
+                m_cv.wait_until(lock, deadline);
+            }
+
+            // Another worker may have served the queue in the meantime
+            batch.clear();
+            nobs = 0;
+
+            // submit() rejects the requests larger than m_max_batch, so the batch
+            // takes at least one request
+            while (!m_queue.empty() && nobs + m_queue.front()->nobs <= m_max_batch)
+            {
+                batch.push_back(m_queue.front());
+                nobs += m_queue.front()->nobs;
+                m_queue.pop_front();
+            }
+
+            m_queued_obs -= nobs;
+
+            if (!batch.empty())
+            {
+                m_nbatch++;
+                m_nobs += nobs;
+            }
+
+            return true;
+        }
+
+        // Body of a worker thread
+        void run()
+        {
+            InferenceSession<Scalar> session(m_net);
+            std::vector<Request*> batch;
+            Matrix x;
+            int nobs;
+
+            while (next_batch(batch, nobs))
+            {
+                if (batch.empty())
+                {
+                    continue;
+                }
+
+                try
+                {
+                    // Pack the inputs of the requests as consecutive columns
+                    x.resize(m_in_size, nobs);
+
+                    for (int i = 0, col = 0; i < int(batch.size()); col += batch[i]->nobs, i++)
+                    {
+                        x.middleCols(col, batch[i]->nobs).noalias() =
+                            ConstMapMat(batch[i]->in, m_in_size, batch[i]->nobs);
+                    }
+
+                    const Matrix pred = session.predict(x);
+
+                    // Scatter the results back
+                    for (int i = 0, col = 0; i < int(batch.size()); col += batch[i]->nobs, i++)
+                    {
+                        MapMat(batch[i]->out, m_out_size, batch[i]->nobs).noalias() =
+                            pred.middleCols(col, batch[i]->nobs);
+                        batch[i]->done.set_value();
+                    }
+                }
+                catch (...)
+                {
+                    for (int i = 0; i < int(batch.size()); i++)
+                    {
+                        try
+                        {
+                            batch[i]->done.set_exception(std::current_exception());
+                        }
+                        catch (const std::future_error&)
+                        {
+                            // The request was already served
+                        }
+                    }
+                }
+
+                for (int i = 0; i < int(batch.size()); i++)
+                {
+                    delete batch[i];
+                }
+            }
+        }
+
+        // Not copyable since the workers refer to this object
+        RequestBatcher(const RequestBatcher&);
+        RequestBatcher& operator=(const RequestBatcher&);
+
+    public:
+        ///
+        /// Constructor
+        ///
+        /// \param net          The network to make predictions with. It must outlive the batcher.
+        /// \param max_batch    Maximum number of observations in a batch.
+        /// \param max_delay_us Maximum time in microseconds that a request waits for
+        ///                     other requests to join its batch.
+        /// \param nworker      Number of worker threads, each running its own batches.
+        ///
+        RequestBatcher(const Network<Scalar>& net, int max_batch, int max_delay_us, int nworker = 1) :
+            m_net(net),
+            m_in_size(first_layer_size(net, true)),
+            m_out_size(first_layer_size(net, false)),
+            m_max_batch(max_batch),
+            m_max_delay(std::chrono::microseconds(max_delay_us)),
+            m_queued_obs(0), m_nbatch(0), m_nobs(0),
+            m_stop(false)
+        {
+            if (max_batch < 1 || max_delay_us < 0 || nworker < 1)
+            {
+                throw std::invalid_argument("[class RequestBatcher]: Invalid batching parameters");
+            }
+
+            for (int i = 0; i < nworker; i++)
+            {
+                m_workers.push_back(std::thread(&RequestBatcher::run, this));
+            }
+        }
+
+        ///
+        /// Destructor that serves the pending requests and stops the workers
+        ///
+        ~RequestBatcher()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_cv.notify_all();
+
+            for (int i = 0; i < int(m_workers.size()); i++)
+            {
+                m_workers[i].join();
+            }
+        }
+
+        ///
+        /// Number of input units of the network
+        ///
+        int in_size() const
+        {
+            return m_in_size;
+        }
+
+        ///
+        /// Number of output units of the network
+        ///
+        int out_size() const
+        {
+            return m_out_size;
+        }
+
+        ///
+        /// Submit a request without copying its data
+        ///
+        /// \param x    Pointer to the `in_size x nobs` input matrix, with each column an observation.
+        /// \param nobs Number of observations, between 1 and the maximum batch size.
+        /// \param pred Pointer to the `out_size x nobs` matrix that receives the predictions.
+        /// \return     A future that becomes ready once `pred` has been written, or that
+        ///             holds the exception thrown by the prediction. Both `x` and `pred`
+        ///             must stay valid until then.
+        ///
+        std::future<void> submit(const Scalar* x, int nobs, Scalar* pred)
+        {
+            if (nobs < 1 || nobs > m_max_batch)
+            {
+                throw std::invalid_argument("[class RequestBatcher]: Number of observations must be between 1 and the maximum batch size");
+            }
+
+            Request* req = new Request;
+            req->in = x;
+            req->out = pred;
+            req->nobs = nobs;
+            req->arrival = Clock::now();
+            std::future<void> res = req->done.get_future();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                if (m_stop)
+                {
+                    delete req;
+                    throw std::logic_error("[class RequestBatcher]: The batcher has been stopped");
+                }
+
+                m_queue.push_back(req);
+                m_queued_obs += nobs;
+            }
+            // Wake up the workers, including the one waiting for the batch to fill
+            m_cv.notify_all();
+            return res;
+        }
+
+        ///
+        /// Make predictions without copying the data, blocking until the batches
+        /// containing them have been run
+        ///
+        /// \param x    Pointer to the `in_size x nobs` input matrix, with each column an observation.
+        /// \param nobs Number of observations. More observations than the maximum batch
+        ///             size are submitted as several requests.
+        /// \param pred Pointer to the `out_size x nobs` matrix that receives the predictions.
+        ///
+        void predict(const Scalar* x, int nobs, Scalar* pred)
+        {
+            if (nobs < 1)
+            {
+                throw std::invalid_argument("[class RequestBatcher]: Number of observations must be positive");
+            }
+
+            std::vector< std::future<void> > parts;
+
+            // Wait for all the parts before any exception leaves, since they write to pred
+            try
+            {
+                for (int start = 0; start < nobs; start += m_max_batch)
+                {
+                    const int n = std::min(m_max_batch, nobs - start);
+                    parts.push_back(submit(x + std::size_t(start) * m_in_size, n,
+                                           pred + std::size_t(start) * m_out_size));
+                }
+            }
+            catch (...)
+            {
+                for (int i = 0; i < int(parts.size()); i++)
+                {
+                    parts[i].wait();
+                }
+
+                throw;
+            }
+
+            for (int i = 0; i < int(parts.size()); i++)
+            {
+                parts[i].wait();
+            }
+
+            for (int i = 0; i < int(parts.size()); i++)
+            {
+                parts[i].get();
+            }
+        }
+
+        ///
+        /// Make predictions, blocking until the batches containing them have been run
+        ///
+        /// \param x The predictors. Each column is an observation.
+        ///
+        Matrix predict(const Matrix& x)
+        {
+            if (x.rows() != m_in_size)
+            {
+                throw std::invalid_argument("[class RequestBatcher]: Input data have incorrect dimension");
+            }
+
+            Matrix pred(m_out_size, x.cols());
+
+            if (x.cols() > 0)
+            {
+                predict(x.data(), x.cols(), pred.data());
+            }
+
+            return pred;
+        }
+
+        ///
+        /// Average number of observations in the batches run so far
+        ///
+        double average_batch_size() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_nbatch > 0 ? double(m_nobs) / m_nbatch : 0.0;
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* __cplusplus >= 201103L */
+
+#endif /* SERVING_REQUESTBATCHER_H_ */
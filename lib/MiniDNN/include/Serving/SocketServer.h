@@ -0,0 +1,744 @@
+#ifndef SERVING_SOCKETSERVER_H_
+#define SERVING_SOCKETSERVER_H_
+
+// The server uses Unix domain sockets and POSIX shared memory, together with
+// the threading library of C++11
+#if !defined(_WIN32) && __cplusplus >= 201103L
+
+#include <Eigen/Core>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <memory>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../Config.h"
+#include "RequestBatcher.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Wire format of the serving protocol
+//
+// Every message is a fixed number of 32-bit integers in host byte order, which
+// is fine since both ends run on the same machine.
+//
+// 1. On connection, the server sends a Hello message.
+// 2. The client creates a shared memory region of `capacity` input columns
+//    followed by `capacity` output columns, seals its size where the system
+//    supports it, and sends an Attach message with the file descriptor of the
+//    region attached as SCM_RIGHTS ancillary data.
+// 3. For each request, the client writes the inputs into the region and sends
+//    a Request message. The server writes the predictions into the region and
+//    sends a Reply message.
+const int ServingMagic = 0x4d444e4e;  // "MDNN"
+
+struct ServingHello
+{
+    int magic;
+    int in_size;
+    int out_size;
+    int scalar_size;
+};
+
+struct ServingAttach
+{
+    int magic;
+    int capacity;
+};
+
+struct ServingRequest
+{
+    int nobs;
+};
+
+struct ServingReply
+{
+    int status;  // 0 on success
+};
+
+inline void send_all(int fd, const void* buf, std::size_t len)
+{
+    const char* p = static_cast<const char*>(buf);
+
+    while (len > 0)
+    {
+        const ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (n <= 0)
+        {
+            throw std::runtime_error("Error while writing to socket");
+        }
+
+        p += n;
+        len -= n;
+    }
+}
+
+// Returns false if the peer has closed the connection before sending anything
+inline bool recv_all(int fd, void* buf, std::size_t len)
+{
+    char* p = static_cast<char*>(buf);
+    const std::size_t total = len;
+
+    while (len > 0)
+    {
+        const ssize_t n = recv(fd, p, len, 0);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (n == 0 && len == total)
+        {
+            return false;
+        }
+
+        if (n <= 0)
+        {
+            throw std::runtime_error("Error while reading from socket");
+        }
+
+        p += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+inline sockaddr_un socket_address(const std::string& path)
+{
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        throw std::invalid_argument("Socket path is too long: " + path);
+    }
+
+    std::strcpy(addr.sun_path, path.c_str());
+    return addr;
+}
+
+// Shared mapping of a memory file descriptor
+//
+// A peer that shrinks the file after it is mapped would make every access to
+// the missing pages raise SIGBUS, so with memfd_create() the client seals the
+// size of the file, and the server only maps files whose size is sealed
+class SharedRegion
+{
+    private:
+        void*       m_addr;
+        std::size_t m_bytes;
+
+        SharedRegion(const SharedRegion&);
+        SharedRegion& operator=(const SharedRegion&);
+
+    public:
+        // If 'sealed', the size of the file must be sealed
+        SharedRegion(int fd, std::size_t bytes, bool sealed) :
+            m_addr(MAP_FAILED), m_bytes(bytes)
+        {
+#if defined(MFD_ALLOW_SEALING) && defined(F_GET_SEALS)
+            const int size_seals = F_SEAL_SHRINK | F_SEAL_GROW;
+            const int seals = sealed ? fcntl(fd, F_GET_SEALS) : 0;
+
+            if (sealed && (seals < 0 || (seals & size_seals) != size_seals))
+            {
+                throw std::runtime_error("Size of the shared memory region is not sealed");
+            }
+#else
+            (void) sealed;
+#endif
+
+            struct stat st;
+
+            if (fstat(fd, &st) != 0 || std::size_t(st.st_size) < bytes)
+            {
+                throw std::runtime_error("Shared memory region is too small");
+            }
+
+            m_addr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            if (m_addr == MAP_FAILED)
+            {
+                throw std::runtime_error("Error while mapping shared memory");
+            }
+        }
+
+        ~SharedRegion()
+        {
+            munmap(m_addr, m_bytes);
+        }
+
+        template <typename Scalar>
+        Scalar* data() const
+        {
+            return static_cast<Scalar*>(m_addr);
+        }
+};
+
+
+} // namespace internal
+
+
+///
+/// \ingroup Serving
+///
+/// Daemon that serves the predictions of a RequestBatcher over a Unix domain socket
+///
+/// The sockets only carry small control messages. The inputs and the outputs
+/// of the requests are exchanged through a shared memory region set up by each
+/// client, and the batcher reads and writes that region directly, so the
+/// payloads are never copied through the socket. Requests from all the
+/// connections are batched together.
+///
+/// Each connection is handled by its own thread. Use InferenceClient to
+/// connect to the server.
+///
+template <typename Scalar = MiniDNN::Scalar>
+class InferenceServer
+{
+    private:
+        RequestBatcher<Scalar>&     m_batcher;
+        const std::string           m_path;
+        int                         m_listen_fd;
+        std::atomic<bool>           m_stop;
+        std::thread                 m_acceptor;
+        std::map<int, std::thread>  m_handlers;  // Connection threads, by socket
+        std::set<int>               m_conn_fds;  // Open connections, shut down by stop()
+        std::vector<int>            m_finished;  // Connections whose thread has returned
+        std::mutex                  m_mutex;
+
+        // Join the threads of the closed connections
+        // Must be called with m_mutex locked
+        void reap_handlers()
+        {
+            for (int i = 0; i < int(m_finished.size()); i++)
+            {
+                std::map<int, std::thread>::iterator it = m_handlers.find(m_finished[i]);
+                it->second.join();
+                m_handlers.erase(it);
+            }
+
+            m_finished.clear();
+        }
+
+        void accept_loop()
+        {
+            while (!m_stop)
+            {
+                const int fd = accept(m_listen_fd, NULL, NULL);
+
+                if (fd < 0)
+                {
+                    if (errno == EINTR || errno == ECONNABORTED)
+                    {
+                        continue;
+                    }
+
+                    // The listening socket has been shut down
+                    break;
+                }
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                if (m_stop)
+                {
+                    close(fd);
+                    break;
+                }
+
+                // The socket of a closed connection may have been reused by this one
+                reap_handlers();
+                m_conn_fds.insert(fd);
+                m_handlers[fd] = std::thread(&InferenceServer::handle, this, fd);
+            }
+        }
+
+        // Receive the Attach message and the file descriptor of the shared memory
+        int receive_region(int fd, int& capacity)
+        {
+            internal::ServingAttach attach;
+            char control[CMSG_SPACE(sizeof(int))];
+            iovec iov;
+            iov.iov_base = &attach;
+            iov.iov_len = sizeof(attach);
+            msghdr msg;
+            std::memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            ssize_t n;
+
+            do
+            {
+                n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+            } while (n < 0 && errno == EINTR);
+
+            cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            int shm_fd = -1;
+
+            if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            {
+                std::memcpy(&shm_fd, CMSG_DATA(cmsg), sizeof(int));
+            }
+
+            if (n != ssize_t(sizeof(attach)) || attach.magic != internal::ServingMagic ||
+                    attach.capacity <= 0 || shm_fd < 0)
+            {
+                if (shm_fd >= 0)
+                {
+                    close(shm_fd);
+                }
+
+                throw std::runtime_error("[class InferenceServer]: Invalid attach message");
+            }
+
+            capacity = attach.capacity;
+            return shm_fd;
+        }
+
+        // Body of a connection thread
+        void handle(int fd)
+        {
+            const int in_size = m_batcher.in_size();
+            const int out_size = m_batcher.out_size();
+
+            try
+            {
+                internal::ServingHello hello = { internal::ServingMagic, in_size, out_size, int(sizeof(Scalar)) };
+                internal::send_all(fd, &hello, sizeof(hello));
+
+                int capacity;
+                const int shm_fd = receive_region(fd, capacity);
+                const std::size_t bytes = std::size_t(capacity) * (in_size + out_size) * sizeof(Scalar);
+                std::unique_ptr<internal::SharedRegion> region;
+
+                try
+                {
+                    region.reset(new internal::SharedRegion(shm_fd, bytes, true));
+                }
+                catch (...)
+                {
+                    close(shm_fd);
+                    throw;
+                }
+
+                close(shm_fd);
+                const Scalar* in = region->data<Scalar>();
+                Scalar* out = region->data<Scalar>() + std::size_t(capacity) * in_size;
+                internal::ServingRequest req;
+
+                while (!m_stop && internal::recv_all(fd, &req, sizeof(req)))
+                {
+                    internal::ServingReply reply = { 0 };
+
+                    if (req.nobs <= 0 || req.nobs > capacity)
+                    {
+                        reply.status = 1;
+                    }
+                    else
+                    {
+                        try
+                        {
+                            m_batcher.predict(in, req.nobs, out);
+                        }
+                        catch (const std::exception&)
+                        {
+                            reply.status = 2;
+                        }
+                    }
+
+                    internal::send_all(fd, &reply, sizeof(reply));
+                }
+            }
+            catch (const std::exception&)
+            {
+                // Drop the connection on protocol or I/O errors
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_conn_fds.erase(fd);
+            m_finished.push_back(fd);
+            close(fd);
+        }
+
+        InferenceServer(const InferenceServer&);
+        InferenceServer& operator=(const InferenceServer&);
+
+    public:
+        ///
+        /// Constructor that starts listening on the socket
+        ///
+        /// \param batcher     The batcher that runs the predictions. It must outlive the server.
+        /// \param socket_path Path of the Unix domain socket. An existing file at
+        ///                    this path is replaced.
+        ///
+        InferenceServer(RequestBatcher<Scalar>& batcher, const std::string& socket_path) :
+            m_batcher(batcher), m_path(socket_path), m_listen_fd(-1), m_stop(false)
+        {
+            const sockaddr_un addr = internal::socket_address(m_path);
+            m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+            if (m_listen_fd < 0)
+            {
+                throw std::runtime_error("[class InferenceServer]: Error while creating socket");
+            }
+
+            unlink(m_path.c_str());
+
+            if (bind(m_listen_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 ||
+                    listen(m_listen_fd, SOMAXCONN) != 0)
+            {
+                close(m_listen_fd);
+                throw std::runtime_error("[class InferenceServer]: Error while binding socket " + m_path);
+            }
+
+            m_acceptor = std::thread(&InferenceServer::accept_loop, this);
+        }
+
+        ///
+        /// Destructor that stops the server
+        ///
+        ~InferenceServer()
+        {
+            stop();
+        }
+
+        ///
+        /// Stop accepting connections, close the open ones after their current
+        /// request, and wait for all the threads of the server
+        ///
+        void stop()
+        {
+            if (m_stop.exchange(true))
+            {
+                return;
+            }
+
+            // Wake up the threads blocked in accept() and recv()
+            shutdown(m_listen_fd, SHUT_RDWR);
+            m_acceptor.join();
+            close(m_listen_fd);
+            unlink(m_path.c_str());
+            std::map<int, std::thread> handlers;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                for (std::set<int>::const_iterator it = m_conn_fds.begin(); it != m_conn_fds.end(); ++it)
+                {
+                    shutdown(*it, SHUT_RDWR);
+                }
+
+                handlers.swap(m_handlers);
+                m_finished.clear();
+            }
+
+            for (std::map<int, std::thread>::iterator it = handlers.begin(); it != handlers.end(); ++it)
+            {
+                it->second.join();
+            }
+        }
+};
+
+
+///
+/// \ingroup Serving
+///
+/// Client of an InferenceServer
+///
+/// The client owns a shared memory region that holds the inputs and the outputs
+/// of up to `capacity` observations. The inputs can be written in place through
+/// input(), followed by a call to run(), after which the predictions are read
+/// from output(), so that no data is copied on either side. An instance must
+/// not be used by several threads at the same time.
+///
+template <typename Scalar = MiniDNN::Scalar>
+class InferenceClient
+{
+    private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Map<Matrix> MapMat;
+        typedef Eigen::Map<const Matrix> ConstMapMat;
+
+        int                      m_fd;
+        int                      m_in_size;
+        int                      m_out_size;
+        const int                m_capacity;
+        internal::SharedRegion*  m_region;
+
+        // Create an anonymous shared memory file of the given size, whose size is
+        // sealed if the system supports it
+        static int create_shm(std::size_t bytes)
+        {
+#if defined(MFD_ALLOW_SEALING) && defined(F_ADD_SEALS)
+            const int fd = memfd_create("minidnn", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+            if (fd < 0)
+            {
+                throw std::runtime_error("[class InferenceClient]: Error while creating shared memory");
+            }
+
+            if (ftruncate(fd, bytes) != 0 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0)
+            {
+                close(fd);
+                throw std::runtime_error("[class InferenceClient]: Error while creating shared memory");
+            }
+
+            return fd;
+#else
+            static std::atomic<int> counter(0);
+            const std::string name = "/minidnn-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+            const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+
+            if (fd < 0)
+            {
+                throw std::runtime_error("[class InferenceClient]: Error while creating shared memory");
+            }
+
+            // The region is only reachable through the descriptor from now on
+            shm_unlink(name.c_str());
+
+            if (ftruncate(fd, bytes) != 0)
+            {
+                close(fd);
+                throw std::runtime_error("[class InferenceClient]: Error while creating shared memory");
+            }
+
+            return fd;
+#endif
+        }
+
+        void send_region(int shm_fd)
+        {
+            internal::ServingAttach attach = { internal::ServingMagic, m_capacity };
+            char control[CMSG_SPACE(sizeof(int))];
+            std::memset(control, 0, sizeof(control));
+            iovec iov;
+            iov.iov_base = &attach;
+            iov.iov_len = sizeof(attach);
+            msghdr msg;
+            std::memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(cmsg), &shm_fd, sizeof(int));
+
+            ssize_t n;
+
+            do
+            {
+                n = sendmsg(m_fd, &msg, MSG_NOSIGNAL);
+            } while (n < 0 && errno == EINTR);
+
+            if (n != ssize_t(sizeof(attach)))
+            {
+                throw std::runtime_error("[class InferenceClient]: Error while writing to socket");
+            }
+        }
+
+        void connect_server(const std::string& socket_path)
+        {
+            const sockaddr_un addr = internal::socket_address(socket_path);
+
+            if (connect(m_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0)
+            {
+                throw std::runtime_error("[class InferenceClient]: Error while connecting to " + socket_path);
+            }
+
+            internal::ServingHello hello;
+
+            if (!internal::recv_all(m_fd, &hello, sizeof(hello)) || hello.magic != internal::ServingMagic)
+            {
+                throw std::runtime_error("[class InferenceClient]: Invalid reply from the server");
+            }
+
+            if (hello.scalar_size != int(sizeof(Scalar)))
+            {
+                throw std::runtime_error("[class InferenceClient]: The server uses a different floating point type");
+            }
+
+            m_in_size = hello.in_size;
+            m_out_size = hello.out_size;
+
+            const std::size_t bytes = std::size_t(m_capacity) * (m_in_size + m_out_size) * sizeof(Scalar);
+            const int shm_fd = create_shm(bytes);
+
+            try
+            {
+                m_region = new internal::SharedRegion(shm_fd, bytes, false);
+                send_region(shm_fd);
+            }
+            catch (...)
+            {
+                close(shm_fd);
+                throw;
+            }
+
+            close(shm_fd);
+        }
+
+        InferenceClient(const InferenceClient&);
+        InferenceClient& operator=(const InferenceClient&);
+
+    public:
+        ///
+        /// Constructor that connects to a server
+        ///
+        /// \param socket_path Path of the Unix domain socket of the server.
+        /// \param capacity    Maximum number of observations in a request.
+        ///
+        InferenceClient(const std::string& socket_path, int capacity) :
+            m_fd(-1), m_in_size(0), m_out_size(0), m_capacity(capacity), m_region(NULL)
+        {
+            if (capacity <= 0)
+            {
+                throw std::invalid_argument("[class InferenceClient]: Capacity must be positive");
+            }
+
+            m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+            if (m_fd < 0)
+            {
+                throw std::runtime_error("[class InferenceClient]: Error while creating socket");
+            }
+
+            try
+            {
+                connect_server(socket_path);
+            }
+            catch (...)
+            {
+                delete m_region;
+                close(m_fd);
+                throw;
+            }
+        }
+
+        ~InferenceClient()
+        {
+            delete m_region;
+            close(m_fd);
+        }
+
+        ///
+        /// Number of input units of the served network
+        ///
+        int in_size() const
+        {
+            return m_in_size;
+        }
+
+        ///
+        /// Number of output units of the served network
+        ///
+        int out_size() const
+        {
+            return m_out_size;
+        }
+
+        ///
+        /// Maximum number of observations in a request
+        ///
+        int capacity() const
+        {
+            return m_capacity;
+        }
+
+        ///
+        /// The shared input buffer of `nobs` observations, to be filled before run()
+        ///
+        MapMat input(int nobs)
+        {
+            return MapMat(m_region->data<Scalar>(), m_in_size, nobs);
+        }
+
+        ///
+        /// The shared output buffer, holding the predictions of the last run()
+        ///
+        ConstMapMat output(int nobs) const
+        {
+            return ConstMapMat(m_region->data<Scalar>() + std::size_t(m_capacity) * m_in_size, m_out_size, nobs);
+        }
+
+        ///
+        /// Make predictions for the first `nobs` observations of the input buffer
+        ///
+        void run(int nobs)
+        {
+            if (nobs <= 0 || nobs > m_capacity)
+            {
+                throw std::invalid_argument("[class InferenceClient]: Number of observations exceeds the capacity");
+            }
+
+            internal::ServingRequest req = { nobs };
+            internal::send_all(m_fd, &req, sizeof(req));
+            internal::ServingReply reply;
+
+            if (!internal::recv_all(m_fd, &reply, sizeof(reply)))
+            {
+                throw std::runtime_error("[class InferenceClient]: The server has closed the connection");
+            }
+
+            if (reply.status != 0)
+            {
+                throw std::runtime_error("[class InferenceClient]: The server failed to make predictions");
+            }
+        }
+
+        ///
+        /// Make predictions, copying the data through the shared buffers
+        ///
+        /// \param x The predictors. Each column is an observation.
+        ///
+        Matrix predict(const Matrix& x)
+        {
+            if (x.rows() != m_in_size)
+            {
+                throw std::invalid_argument("[class InferenceClient]: Input data have incorrect dimension");
+            }
+
+            input(x.cols()) = x;
+            run(x.cols());
+            return output(x.cols());
+        }
+};
+
+
+} // namespace MiniDNN
+
+
+#endif /* !_WIN32 && __cplusplus >= 201103L */
+
+#endif /* SERVING_SOCKETSERVER_H_ */
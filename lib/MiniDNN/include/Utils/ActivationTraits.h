@@ -0,0 +1,72 @@
+#ifndef UTILS_ACTIVATIONTRAITS_H_
+#define UTILS_ACTIVATIONTRAITS_H_
+
+#include <Eigen/Core>
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Compile-time properties of an activation function, used by the layers to
+// choose fused kernels
+//
+// The defaults are valid for any activation, so user-defined activations work
+// without a specialization. The built-in activations specialize this template
+// in their own headers
+template <typename Activation>
+struct ActivationTraits
+{
+    // activate() may be called with Z and A pointing to the same matrix, and
+    // apply_jacobian() does not read Z, so the linear term need not be kept
+    static const bool in_place = false;
+    // The activation is the identity function, so it can be skipped
+    static const bool identity = false;
+    // The activation also has activate_fast(), an approximation of activate()
+    // used when the layer is in the fast activation mode, see
+    // Layer::set_fast_activation()
+    static const bool fast_mode = false;
+};
+
+// Apply the activation function in the mode of the layer
+// Activations without a fast approximation always use activate()
+template <typename Activation, bool HasFast = ActivationTraits<Activation>::fast_mode>
+struct ActivationKernel
+{
+    template <typename Scalar>
+    static inline void activate(const Eigen::Ref<const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> >& Z,
+                                Eigen::Ref< Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> > A,
+                                const bool fast)
+    {
+        Activation::template activate<Scalar>(Z, A);
+    }
+};
+
+template <typename Activation>
+struct ActivationKernel<Activation, true>
+{
+    template <typename Scalar>
+    static inline void activate(const Eigen::Ref<const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> >& Z,
+                                Eigen::Ref< Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> > A,
+                                const bool fast)
+    {
+        if (fast)
+        {
+            Activation::template activate_fast<Scalar>(Z, A);
+        }
+        else
+        {
+            Activation::template activate<Scalar>(Z, A);
+        }
+    }
+};
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_ACTIVATIONTRAITS_H_ */
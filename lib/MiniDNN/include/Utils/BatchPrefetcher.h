@@ -0,0 +1,254 @@
+#ifndef UTILS_BATCHPREFETCHER_H_
+#define UTILS_BATCHPREFETCHER_H_
+
+#include <vector>
+#include "../Config.h"
+#include "../RNG.h"
+
+#if __cplusplus >= 201103L
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
+#endif
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Prepare the mini-batches of all the epochs ahead of the training loop
+//
+// Source provides the type Buffer of a mini-batch, reset(rng) to start an
+// epoch, and next_batch(buf) that fills the next batch and returns false at
+// the end of the epoch
+//
+// With depth = 0, each batch is prepared by the training thread when it is
+// acquired. Otherwise a background thread prepares up to 'depth' batches in
+// advance into a ring of buffers while the training thread works on the batch
+// it holds. The order of the calls to the source is the same in both cases, so
+// the training result does not depend on the depth
+//
+// Background threads require C++11, and depth is ignored in older standards
+template <typename Source>
+class BatchPrefetcher
+{
+    private:
+        typedef typename Source::Buffer Buffer;
+
+        // A buffer in the ring, which marks the end of an epoch if end == true
+        struct Slot
+        {
+            Buffer buf;
+            bool   end;
+        };
+
+        Source&             m_source;
+        RNG&                m_rng;
+        const int           m_nepoch;
+        const int           m_depth;     // Maximum number of batches prepared in advance
+        std::vector<Slot>   m_slots;     // Ring of buffers, one more than m_depth
+        int                 m_epoch;     // Epoch of the next batch to be produced
+        bool                m_started;   // Whether the source has been reset for m_epoch
+        int                 m_acquired;  // Number of slots handed to the training thread
+        int                 m_released;  // Number of slots that can be reused
+        int                 m_produced;  // Number of slots that have been filled
+
+#if __cplusplus >= 201103L
+        typedef std::chrono::steady_clock Clock;
+
+        std::thread             m_thread;
+        std::mutex              m_mutex;
+        std::condition_variable m_ready;    // Signaled when a slot has been filled
+        std::condition_variable m_free;     // Signaled when a slot is taken or released
+        bool                    m_stop;     // Asks the producer to quit
+        std::exception_ptr      m_error;    // Exception thrown in the producer
+
+        // Body of the producer thread
+        void run()
+        {
+            const int nslot = m_slots.size();
+
+            try
+            {
+                for (int seq = 0; m_epoch < m_nepoch; seq++)
+                {
+                    {
+                        std::unique_lock<std::mutex> lock(m_mutex);
+                        // At most m_depth slots wait for the trainer, and a slot is
+                        // free once the batch that used it before has been released
+                        m_free.wait(lock, [&] {
+                            return m_stop || (seq - m_acquired < m_depth && seq - m_released < nslot);
+                        });
+
+                        if (m_stop)
+                        {
+                            return;
+                        }
+                    }
+
+                    produce(seq);
+                    {
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        m_produced = seq + 1;
+                    }
+                    m_ready.notify_one();
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_error = std::current_exception();
+                m_ready.notify_one();
+            }
+        }
+#endif
+
+        static int max_depth(int depth)
+        {
+#if __cplusplus >= 201103L
+            return depth;
+#else
+            return 0;
+#endif
+        }
+
+        // Fill the slot of sequence number seq with the next batch, or with
+        // an end-of-epoch mark
+        void produce(int seq)
+        {
+            if (!m_started)
+            {
+                m_source.reset(m_rng);
+                m_started = true;
+            }
+
+            Slot& slot = m_slots[seq % m_slots.size()];
+            slot.end = !m_source.next_batch(slot.buf);
+
+            if (slot.end)
+            {
+                m_epoch++;
+                m_started = false;
+            }
+        }
+
+    public:
+        BatchPrefetcher(Source& source, RNG& rng, int nepoch, int depth) :
+            m_source(source), m_rng(rng),
+            m_nepoch(nepoch),
+            m_depth(max_depth(depth)),
+            m_slots(m_depth + 1),
+            m_epoch(0), m_started(false),
+            m_acquired(0), m_released(0), m_produced(0)
+#if __cplusplus >= 201103L
+            , m_stop(false)
+#endif
+        {
+#if __cplusplus >= 201103L
+            if (m_depth > 0)
+            {
+                m_thread = std::thread(&BatchPrefetcher::run, this);
+            }
+#endif
+        }
+
+        ~BatchPrefetcher()
+        {
+#if __cplusplus >= 201103L
+            if (m_thread.joinable())
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stop = true;
+                }
+                m_free.notify_one();
+                m_thread.join();
+            }
+#endif
+        }
+
+        // Get the next batch, which stays valid until release() is called
+        // At the end of an epoch NULL is returned, and release() is not needed
+        //
+        // queue_depth is set to the number of prepared slots that were waiting,
+        // and stall to the time in seconds that the caller was blocked, either
+        // waiting for the producer or preparing the batch itself
+        const Buffer* acquire(int& queue_depth, double& stall)
+        {
+            const int seq = m_acquired;
+            queue_depth = 0;
+            stall = 0;
+
+#if __cplusplus >= 201103L
+            const Clock::time_point start = Clock::now();
+
+            if (m_depth > 0)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    queue_depth = m_produced - seq;
+                    m_ready.wait(lock, [&] { return m_produced > seq || m_error; });
+
+                    if (m_produced <= seq)
+                    {
+                        std::rethrow_exception(m_error);
+                    }
+
+                    m_acquired++;
+                }
+                m_free.notify_one();
+            }
+            else
+            {
+                produce(seq);
+                m_acquired++;
+            }
+
+            stall = std::chrono::duration<double>(Clock::now() - start).count();
+#else
+            produce(seq);
+            m_acquired++;
+#endif
+
+            const Slot& slot = m_slots[seq % m_slots.size()];
+
+            if (slot.end)
+            {
+                release();
+                return NULL;
+            }
+
+            return &slot.buf;
+        }
+
+        // Give back the buffer of the batch obtained from acquire()
+        void release()
+        {
+#if __cplusplus >= 201103L
+
+            if (m_depth > 0)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_released++;
+                }
+                m_free.notify_one();
+                return;
+            }
+
+#endif
+            m_released++;
+        }
+};
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_BATCHPREFETCHER_H_ */
@@ -0,0 +1,167 @@
+#ifndef UTILS_BATCHSAMPLER_H_
+#define UTILS_BATCHSAMPLER_H_
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <stdexcept>
+#include "../Config.h"
+#include "../RNG.h"
+#include "Random.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Storage of one mini-batch
+// Two pairs of buffers are kept, one for the full batches and one for the last
+// batch if it is smaller, so they are not reallocated from one epoch to the next
+template <typename XType, typename YType>
+class BatchBuffer
+{
+    private:
+        XType m_x[2];      // [0] for full batches, [1] for the last batch
+        YType m_y[2];
+        int   m_current;   // Buffer holding the current batch
+
+    public:
+        BatchBuffer() :
+            m_current(0)
+        {}
+
+        // Select the buffers for a full batch or for the last batch
+        void select(bool full_batch)
+        {
+            m_current = full_batch ? 0 : 1;
+        }
+
+        XType& x_batch()
+        {
+            return m_x[m_current];
+        }
+
+        YType& y_batch()
+        {
+            return m_y[m_current];
+        }
+
+        const XType& x_batch() const
+        {
+            return m_x[m_current];
+        }
+
+        const YType& y_batch() const
+        {
+            return m_y[m_current];
+        }
+};
+
+// Draw shuffled mini-batches from a data set without copying the data set
+//
+// The sampler keeps a permutation of the observation IDs, which is reshuffled
+// at the beginning of each epoch, and gathers the columns of a mini-batch into
+// a reusable buffer right before the batch is used
+template <typename DerivedX, typename DerivedY, typename XType, typename YType>
+class BatchSampler
+{
+    private:
+        const Eigen::MatrixBase<DerivedX>& m_x;
+        const Eigen::MatrixBase<DerivedY>& m_y;
+        const int       m_nobs;
+        const int       m_batch_size;      // Size of the full batches
+        const int       m_nbatch;          // Number of batches in one epoch
+        Eigen::VectorXi m_id;              // Permutation of the observation IDs
+        int             m_next;            // Index of the next batch in the epoch
+
+        static int clamp_batch_size(int batch_size, int nobs)
+        {
+            return (batch_size > nobs) ? nobs : batch_size;
+        }
+
+        int batch_obs(int i) const
+        {
+            return std::min(m_batch_size, m_nobs - i * m_batch_size);
+        }
+
+    public:
+        typedef BatchBuffer<XType, YType> Buffer;
+
+        BatchSampler(const Eigen::MatrixBase<DerivedX>& x, const Eigen::MatrixBase<DerivedY>& y,
+                     int batch_size) :
+            m_x(x), m_y(y),
+            m_nobs(x.cols()),
+            m_batch_size(clamp_batch_size(batch_size, x.cols())),
+            m_nbatch((m_nobs - 1) / m_batch_size + 1),
+            m_id(Eigen::VectorXi::LinSpaced(m_nobs, 0, m_nobs - 1)),
+            m_next(0)
+        {
+            if (y.cols() != m_nobs)
+            {
+                throw std::invalid_argument("Input X and Y have different number of observations");
+            }
+        }
+
+        int num_obs() const
+        {
+            return m_nobs;
+        }
+
+        int num_batches() const
+        {
+            return m_nbatch;
+        }
+
+        int max_batch_size() const
+        {
+            return m_batch_size;
+        }
+
+        // Start a new epoch with a new permutation of the observations
+        void reset(RNG& rng)
+        {
+            internal::shuffle(m_id.data(), m_nobs, rng);
+            m_next = 0;
+        }
+
+        // Gather the next mini-batch of the epoch into buf
+        // Returns false if all the batches of the epoch have been drawn
+        bool next_batch(Buffer& buf)
+        {
+            if (m_next >= m_nbatch)
+            {
+                return false;
+            }
+
+            const int bsize = batch_obs(m_next);
+            buf.select(bsize == m_batch_size);
+            gather(m_next, buf.x_batch(), buf.y_batch());
+            m_next++;
+            return true;
+        }
+
+        // Copy the i-th mini-batch of the current permutation into xb and yb
+        void gather(int i, XType& xb, YType& yb) const
+        {
+            const int offset = i * m_batch_size;
+            const int bsize = batch_obs(i);
+            // No-op if the buffers already have the size of the batch
+            xb.resize(m_x.rows(), bsize);
+            yb.resize(m_y.rows(), bsize);
+
+            for (int j = 0; j < bsize; j++)
+            {
+                xb.col(j).noalias() = m_x.col(m_id[offset + j]);
+                yb.col(j).noalias() = m_y.col(m_id[offset + j]);
+            }
+        }
+};
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_BATCHSAMPLER_H_ */
@@ -0,0 +1,586 @@
+#ifndef UTILS_BLOCKEDCONVOLUTION_H_
+#define UTILS_BLOCKEDCONVOLUTION_H_
+
+#include <Eigen/Core>
+#include <cstddef>
+#include <algorithm>
+#include "../Config.h"
+#include "Convolution.h"
+#include "BlockedLayout.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Direct convolution of images in the blocked layout (see BlockedLayout.h)
+//
+// The input and the output channels are split into blocks of cb = ChannelBlock::size
+// channels, and the filters are packed so that the weights of an input channel of a
+// block for the cb output channels of a block form one packet:
+//
+//     Wb[ob][ib][fc][fr][ci][co] = w(ib * cb + ci, ob * cb + co, fr, fc)
+//
+// where w(i, o, fr, fc) is the weight of input channel i for output channel o in row
+// fr and column fc of the window. The padding channels of the last blocks have zero
+// weights. A value of an input channel times a packet of weights then updates the
+// packet of the cb output channels at one pixel, which is a single fused
+// multiply-add of packets, and the packets of adjacent pixels are contiguous, so no
+// image needs to be rearranged as in the MEC algorithm of convolve_valid()
+//
+// The forward pass keeps the packets of a tile of adjacent output rows of two output
+// blocks in registers while it goes through the input blocks and the window, so each
+// packet of weights is loaded once for the whole tile. The gradient of the filters accumulates the packets
+// of one row of Wb in registers, and the gradient of the input scatters each output
+// packet to the input pixels of its window with the transposed filters
+//
+//     Wt[ob][ib][fc][fr][co][ci] = w(ib * cb + ci, ob * cb + co, fr, fc)
+//
+// The work is split over the images and the blocks of channels, and each thread writes
+// its own blocks of the results
+
+
+// Number of scalars of the packed filters Wb or Wt
+template <typename Scalar>
+inline std::size_t blocked_filter_size(const ConvDims& dim)
+{
+    const std::size_t cb = ChannelBlock<Scalar>::size;
+    return std::size_t(channel_blocks<Scalar>(dim.in_channels)) * channel_blocks<Scalar>(dim.out_channels) *
+           dim.filter_rows * dim.filter_cols * cb * cb;
+}
+
+// Pack the filters in the layout of Utils/Convolution.h to Wb, or to Wt if 'transpose' is true
+template <typename Scalar>
+inline void pack_blocked_filters(const ConvDims& dim, const Scalar* filter_data, const bool transpose,
+                                 Scalar* dest)
+{
+    const int cb = ChannelBlock<Scalar>::size;
+    const int nib = channel_blocks<Scalar>(dim.in_channels);
+    const int nob = channel_blocks<Scalar>(dim.out_channels);
+    const int filter_size = dim.filter_rows * dim.filter_cols;
+
+    for (int ob = 0; ob < nob; ob++)
+    {
+        for (int ib = 0; ib < nib; ib++)
+        {
+            for (int f = 0; f < filter_size; f++)
+            {
+                // f = fc * filter_rows + fr, as in the filters of Utils/Convolution.h
+                Scalar* w = dest + ((std::size_t(ob) * nib + ib) * filter_size + f) * cb * cb;
+
+                for (int ci = 0; ci < cb; ci++)
+                {
+                    for (int co = 0; co < cb; co++)
+                    {
+                        const int i = ib * cb + ci, o = ob * cb + co;
+                        const Scalar val = (i < dim.in_channels && o < dim.out_channels) ?
+                                           filter_data[(std::size_t(i) * dim.out_channels + o) * filter_size + f] :
+                                           Scalar(0);
+                        w[transpose ? (co * cb + ci) : (ci * cb + co)] = val;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// The inverse of pack_blocked_filters() for Wb, which drops the padding channels
+template <typename Scalar>
+inline void unpack_blocked_filters(const ConvDims& dim, const Scalar* src, Scalar* filter_data)
+{
+    const int cb = ChannelBlock<Scalar>::size;
+    const int nib = channel_blocks<Scalar>(dim.in_channels);
+    const int filter_size = dim.filter_rows * dim.filter_cols;
+
+    for (int i = 0; i < dim.in_channels; i++)
+    {
+        for (int o = 0; o < dim.out_channels; o++)
+        {
+            const Scalar* w = src + ((std::size_t(o / cb) * nib + i / cb) * filter_size) * cb * cb +
+                              (i % cb) * cb + o % cb;
+            Scalar* dest = filter_data + (std::size_t(i) * dim.out_channels + o) * filter_size;
+
+            for (int f = 0; f < filter_size; f++)
+            {
+                dest[f] = w[std::size_t(f) * cb * cb];
+            }
+        }
+    }
+}
+
+// Range [first, last) of the output rows whose row 'fr' of the window is inside the channel
+inline void blocked_row_range(const ConvDims& dim, const int fr, int& first, int& last)
+{
+    // Input row r * stride_rows - pad_rows + fr must be in [0, channel_rows)
+    const int lo = dim.pad_rows - fr;
+    first = (lo <= 0) ? 0 : (lo + dim.stride_rows - 1) / dim.stride_rows;
+    const int hi = dim.channel_rows - 1 + dim.pad_rows - fr;
+    last = (hi < 0) ? 0 : std::min(dim.conv_rows, hi / dim.stride_rows + 1);
+    first = std::min(first, last);
+}
+
+// Output rows [row, row + T) of column 'oc' of O adjacent output blocks, summed over the
+// input blocks of one image and the window. 'w' points to the packed filters of the first
+// output block, and 'out' to its results. If Check is false, the window of each row is
+// assumed to be inside the channel
+template <int T, int O, bool Check>
+struct BlockedConvTile
+{
+    template <typename Scalar>
+    static inline void apply(const ConvDims& dim, const Scalar* in, const Scalar* w,
+                             const int row, const int oc, Scalar* out)
+    {
+        typedef typename Eigen::internal::packet_traits<Scalar>::type Packet;
+        using namespace Eigen::internal;
+        const int cb = ChannelBlock<Scalar>::size;
+        const int nib = channel_blocks<Scalar>(dim.in_channels);
+        const std::size_t in_block = std::size_t(dim.channel_rows) * dim.channel_cols * cb;
+        const std::size_t out_block = std::size_t(dim.conv_rows) * dim.conv_cols * cb;
+        const std::size_t w_block = std::size_t(nib) * dim.filter_rows * dim.filter_cols * cb * cb;
+        const int row_step = dim.stride_rows * cb;
+        const int in_row = row * dim.stride_rows - dim.pad_rows;
+
+        Packet acc[T][O];
+        for (int t = 0; t < T; t++)
+        {
+            for (int o = 0; o < O; o++)
+            {
+                acc[t][o] = pset1<Packet>(Scalar(0));
+            }
+        }
+
+        for (int fc = 0; fc < dim.filter_cols; fc++)
+        {
+            const int ic = oc * dim.stride_cols - dim.pad_cols + fc;
+
+            if (ic < 0 || ic >= dim.channel_cols)
+            {
+                continue;
+            }
+
+            for (int ib = 0; ib < nib; ib++)
+            {
+                const Scalar* col = in + ib * in_block + std::size_t(ic) * dim.channel_rows * cb;
+                const Scalar* wk = w + (std::size_t(ib) * dim.filter_cols + fc) * dim.filter_rows * cb * cb;
+
+                for (int fr = 0; fr < dim.filter_rows; fr++, wk += cb * cb)
+                {
+                    const int ir = in_row + fr;
+
+                    if (Check && (ir < 0 || ir >= dim.channel_rows))
+                    {
+                        continue;
+                    }
+
+                    const Scalar* src = col + ir * cb;
+
+                    for (int ci = 0; ci < cb; ci++)
+                    {
+                        Packet wp[O];
+                        for (int o = 0; o < O; o++)
+                        {
+                            wp[o] = pload<Packet>(wk + o * w_block + ci * cb);
+                        }
+
+                        for (int t = 0; t < T; t++)
+                        {
+                            const Packet x = pset1<Packet>(src[t * row_step + ci]);
+
+                            for (int o = 0; o < O; o++)
+                            {
+                                acc[t][o] = pmadd(x, wp[o], acc[t][o]);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        for (int o = 0; o < O; o++)
+        {
+            Scalar* res = out + o * out_block + (std::size_t(oc) * dim.conv_rows + row) * cb;
+
+            for (int t = 0; t < T; t++)
+            {
+                pstore(res + t * cb, acc[t][o]);
+            }
+        }
+    }
+};
+
+// One column of the results of O adjacent output blocks of one image
+// The rows whose windows are inside the channel, [first, last), are computed by tiles of
+// 6 rows, and the other rows one by one
+template <int O>
+struct BlockedConvColumn
+{
+    template <typename Scalar>
+    static inline void apply(const ConvDims& dim, const Scalar* in, const Scalar* w,
+                             const int first, const int last, const int oc, Scalar* out)
+    {
+        int row = 0;
+
+        for (; row < first; row++)
+        {
+            BlockedConvTile<1, O, true>::apply(dim, in, w, row, oc, out);
+        }
+
+        for (; row + 6 <= last; row += 6)
+        {
+            BlockedConvTile<6, O, false>::apply(dim, in, w, row, oc, out);
+        }
+
+        for (; row < last; row++)
+        {
+            BlockedConvTile<1, O, false>::apply(dim, in, w, row, oc, out);
+        }
+
+        for (; row < dim.conv_rows; row++)
+        {
+            BlockedConvTile<1, O, true>::apply(dim, in, w, row, oc, out);
+        }
+    }
+};
+
+// Forward convolution of 'n_obs' images in the blocked layout, with the filters
+// packed as Wb. 'dest' receives the blocked results, and its padding channels are zero
+// Each task computes a pair of output blocks of one image, so that each value of the input
+// is broadcast once for both. Tiles of 6 rows and 2 blocks keep 12 packets of results
+// in registers, which was the fastest shape with SSE2 and AVX-512 for 16 to 32 channels
+template <typename Scalar>
+inline void convolve_blocked(const ConvDims& dim, const Scalar* src, const int n_obs,
+                             const Scalar* packed_filter, Scalar* dest)
+{
+    const int group = 2;
+    const int nib = channel_blocks<Scalar>(dim.in_channels);
+    const int nob = channel_blocks<Scalar>(dim.out_channels);
+    const int ngroup = (nob + group - 1) / group;
+    const std::size_t in_image = blocked_image_size<Scalar>(dim.in_channels, dim.channel_rows * dim.channel_cols);
+    const std::size_t out_block = std::size_t(dim.conv_rows) * dim.conv_cols * ChannelBlock<Scalar>::size;
+    const std::size_t w_block = std::size_t(nib) * dim.filter_rows * dim.filter_cols *
+                                ChannelBlock<Scalar>::size * ChannelBlock<Scalar>::size;
+    // Output rows whose windows are inside the channel
+    int first = 0, last = dim.conv_rows;
+    for (int fr = 0; fr < dim.filter_rows; fr++)
+    {
+        int lo, hi;
+        blocked_row_range(dim, fr, lo, hi);
+        first = std::max(first, lo);
+        last = std::min(last, hi);
+    }
+    last = std::max(first, last);
+    const int ntask = n_obs * ngroup;
+
+#ifdef _OPENMP
+    const int nthread = std::max(1, std::min(conv_num_threads(), ntask));
+    #pragma omp parallel for num_threads(nthread) schedule(static) if(nthread > 1)
+#endif
+    for (int task = 0; task < ntask; task++)
+    {
+        const int k = task / ngroup, ob = (task % ngroup) * group;
+        const int nblock = std::min(group, nob - ob);
+        const Scalar* in = src + k * in_image;
+        const Scalar* w = packed_filter + ob * w_block;
+        Scalar* out = dest + (std::size_t(k) * nob + ob) * out_block;
+
+        for (int oc = 0; oc < dim.conv_cols; oc++)
+        {
+            if (nblock == 2)
+            {
+                BlockedConvColumn<2>::apply(dim, in, w, first, last, oc, out);
+            }
+            else
+            {
+                BlockedConvColumn<1>::apply(dim, in, w, first, last, oc, out);
+            }
+        }
+    }
+}
+
+// Derivative of the filters of O adjacent output blocks for one input block and the
+// position (fc, fr) of the window, summed over the images. The packets of the O blocks
+// of Wb are accumulated in registers, and each value of the input is broadcast once
+// for all of them. 'dw' points to the derivative of the first output block in Wb
+template <int O>
+struct BlockedFilterGrad
+{
+    template <typename Scalar>
+    static inline void apply(const ConvDims& dim, const Scalar* src, const int n_obs, const Scalar* grad,
+                             const int ib, const int ob, const int fc, const int fr, Scalar* dw)
+    {
+        typedef typename Eigen::internal::packet_traits<Scalar>::type Packet;
+        using namespace Eigen::internal;
+        const int cb = ChannelBlock<Scalar>::size;
+        const int nib = channel_blocks<Scalar>(dim.in_channels);
+        const int nob = channel_blocks<Scalar>(dim.out_channels);
+        const std::size_t in_block = std::size_t(dim.channel_rows) * dim.channel_cols * cb;
+        const std::size_t out_block = std::size_t(dim.conv_rows) * dim.conv_cols * cb;
+        const std::size_t w_block = std::size_t(nib) * dim.filter_rows * dim.filter_cols * cb * cb;
+        const int row_step = dim.stride_rows * cb;
+        int first, last;
+        blocked_row_range(dim, fr, first, last);
+
+        Packet acc[O][ChannelBlock<Scalar>::size];
+        for (int o = 0; o < O; o++)
+        {
+            for (int ci = 0; ci < cb; ci++)
+            {
+                acc[o][ci] = pset1<Packet>(Scalar(0));
+            }
+        }
+
+        for (int k = 0; k < n_obs && first < last; k++)
+        {
+            const Scalar* in = src + (std::size_t(k) * nib + ib) * in_block;
+            const Scalar* g = grad + (std::size_t(k) * nob + ob) * out_block;
+
+            for (int oc = 0; oc < dim.conv_cols; oc++)
+            {
+                const int ic = oc * dim.stride_cols - dim.pad_cols + fc;
+
+                if (ic < 0 || ic >= dim.channel_cols)
+                {
+                    continue;
+                }
+
+                const Scalar* x = in + (std::size_t(ic) * dim.channel_rows +
+                                        first * dim.stride_rows - dim.pad_rows + fr) * cb;
+                const Scalar* gc = g + (std::size_t(oc) * dim.conv_rows + first) * cb;
+
+                for (int r = first; r < last; r++, x += row_step, gc += cb)
+                {
+                    Packet gp[O];
+                    for (int o = 0; o < O; o++)
+                    {
+                        gp[o] = pload<Packet>(gc + o * out_block);
+                    }
+
+                    for (int ci = 0; ci < cb; ci++)
+                    {
+                        const Packet xp = pset1<Packet>(x[ci]);
+
+                        for (int o = 0; o < O; o++)
+                        {
+                            acc[o][ci] = pmadd(xp, gp[o], acc[o][ci]);
+                        }
+                    }
+                }
+            }
+        }
+
+        for (int o = 0; o < O; o++)
+        {
+            for (int ci = 0; ci < cb; ci++)
+            {
+                pstore(dw + o * w_block + ci * cb, acc[o][ci]);
+            }
+        }
+    }
+};
+
+// Derivative of the input of one image in I adjacent input blocks at the T input pixels
+// of output rows [row, row + T) of column 'oc' and the position (fc, fr) of the window,
+// which are 'stride_rows' rows apart, added over all the output blocks
+// 'g' points to the derivative of the first output block of the image, 'wt' to the
+// filters of the first output block and the first input block in Wt, and 'x' to the
+// derivative of the input pixel of output row 'row' in the first input block
+template <int T, int I>
+struct BlockedInputGradTile
+{
+    template <typename Scalar>
+    static inline void apply(const ConvDims& dim, const Scalar* g, const Scalar* wt,
+                             const int row, const int oc, Scalar* x)
+    {
+        typedef typename Eigen::internal::packet_traits<Scalar>::type Packet;
+        using namespace Eigen::internal;
+        const int cb = ChannelBlock<Scalar>::size;
+        const int nib = channel_blocks<Scalar>(dim.in_channels);
+        const int nob = channel_blocks<Scalar>(dim.out_channels);
+        const std::size_t in_block = std::size_t(dim.channel_rows) * dim.channel_cols * cb;
+        const std::size_t out_block = std::size_t(dim.conv_rows) * dim.conv_cols * cb;
+        const std::size_t filter_block = std::size_t(dim.filter_rows) * dim.filter_cols * cb * cb;
+        const int row_step = dim.stride_rows * cb;
+
+        Packet acc[T][I];
+        for (int t = 0; t < T; t++)
+        {
+            for (int i = 0; i < I; i++)
+            {
+                acc[t][i] = pload<Packet>(x + i * in_block + t * row_step);
+            }
+        }
+
+        for (int ob = 0; ob < nob; ob++)
+        {
+            const Scalar* gc = g + ob * out_block + (std::size_t(oc) * dim.conv_rows + row) * cb;
+            const Scalar* wk = wt + ob * nib * filter_block;
+
+            for (int co = 0; co < cb; co++)
+            {
+                Packet wp[I];
+                for (int i = 0; i < I; i++)
+                {
+                    wp[i] = pload<Packet>(wk + i * filter_block + co * cb);
+                }
+
+                for (int t = 0; t < T; t++)
+                {
+                    const Packet gp = pset1<Packet>(gc[t * cb + co]);
+
+                    for (int i = 0; i < I; i++)
+                    {
+                        acc[t][i] = pmadd(gp, wp[i], acc[t][i]);
+                    }
+                }
+            }
+        }
+
+        for (int t = 0; t < T; t++)
+        {
+            for (int i = 0; i < I; i++)
+            {
+                pstore(x + i * in_block + t * row_step, acc[t][i]);
+            }
+        }
+    }
+};
+
+// Derivative of the input of one image in I adjacent input blocks, see BlockedInputGradTile
+// 'dx' points to the derivative of the first input block, and 'wt' to the filters of
+// the first output block and the first input block in Wt
+template <int I>
+struct BlockedInputGrad
+{
+    template <typename Scalar>
+    static inline void apply(const ConvDims& dim, const Scalar* g, const Scalar* wt, Scalar* dx)
+    {
+        const int cb = ChannelBlock<Scalar>::size;
+        const int row_step = dim.stride_rows * cb;
+
+        for (int fc = 0; fc < dim.filter_cols; fc++)
+        {
+            for (int fr = 0; fr < dim.filter_rows; fr++)
+            {
+                const Scalar* wk = wt + (fc * dim.filter_rows + fr) * cb * cb;
+                int first, last;
+                blocked_row_range(dim, fr, first, last);
+
+                if (first >= last)
+                {
+                    continue;
+                }
+
+                for (int oc = 0; oc < dim.conv_cols; oc++)
+                {
+                    const int ic = oc * dim.stride_cols - dim.pad_cols + fc;
+
+                    if (ic < 0 || ic >= dim.channel_cols)
+                    {
+                        continue;
+                    }
+
+                    Scalar* x = dx + (std::size_t(ic) * dim.channel_rows +
+                                      first * dim.stride_rows - dim.pad_rows + fr) * cb;
+                    int row = first;
+
+                    for (; row + 6 <= last; row += 6, x += 6 * row_step)
+                    {
+                        BlockedInputGradTile<6, I>::apply(dim, g, wk, row, oc, x);
+                    }
+
+                    for (; row < last; row++, x += row_step)
+                    {
+                        BlockedInputGradTile<1, I>::apply(dim, g, wk, row, oc, x);
+                    }
+                }
+            }
+        }
+    }
+};
+
+// Gradients of convolve_blocked() for 'n_obs' images in the blocked layout, given the
+// blocked derivative 'grad' of the results
+// 'packed_deriv' receives the derivative of the filters packed as Wb, summed over
+// the images. If 'src_grad' is not NULL, it receives the blocked derivative of the
+// input, computed with the filters packed as Wt in 'packed_filter_t'
+template <typename Scalar>
+inline void convolve_blocked_backward(const ConvDims& dim, const Scalar* src, const int n_obs,
+                                      const Scalar* grad, const Scalar* packed_filter_t,
+                                      Scalar* packed_deriv, Scalar* src_grad)
+{
+    const int cb = ChannelBlock<Scalar>::size;
+    const int nib = channel_blocks<Scalar>(dim.in_channels);
+    const int nob = channel_blocks<Scalar>(dim.out_channels);
+    const std::size_t in_block = std::size_t(dim.channel_rows) * dim.channel_cols * cb;
+    const std::size_t out_block = std::size_t(dim.conv_rows) * dim.conv_cols * cb;
+    const int filter_size = dim.filter_rows * dim.filter_cols;
+
+    // Derivative of the filters, for a pair of output blocks and an input block in each task
+    const int ngroup = (nob + 1) / 2;
+    const int nwtask = ngroup * nib;
+#ifdef _OPENMP
+    const int nwthread = std::max(1, std::min(conv_num_threads(), nwtask));
+    #pragma omp parallel for num_threads(nwthread) schedule(static) if(nwthread > 1)
+#endif
+    for (int task = 0; task < nwtask; task++)
+    {
+        const int ob = (task / nib) * 2, ib = task % nib;
+        Scalar* dw = packed_deriv + (std::size_t(ob) * nib + ib) * filter_size * cb * cb;
+
+        for (int fc = 0; fc < dim.filter_cols; fc++)
+        {
+            for (int fr = 0; fr < dim.filter_rows; fr++, dw += cb * cb)
+            {
+                if (ob + 1 < nob)
+                {
+                    BlockedFilterGrad<2>::apply(dim, src, n_obs, grad, ib, ob, fc, fr, dw);
+                }
+                else
+                {
+                    BlockedFilterGrad<1>::apply(dim, src, n_obs, grad, ib, ob, fc, fr, dw);
+                }
+            }
+        }
+    }
+
+    if (src_grad == NULL)
+    {
+        return;
+    }
+
+    // Derivative of the input, for a pair of input blocks of one image in each task
+    const int nigroup = (nib + 1) / 2;
+    const int nxtask = n_obs * nigroup;
+#ifdef _OPENMP
+    const int nxthread = std::max(1, std::min(conv_num_threads(), nxtask));
+    #pragma omp parallel for num_threads(nxthread) schedule(static) if(nxthread > 1)
+#endif
+    for (int task = 0; task < nxtask; task++)
+    {
+        const int k = task / nigroup, ib = (task % nigroup) * 2;
+        const int nblock = std::min(2, nib - ib);
+        const Scalar* g = grad + std::size_t(k) * nob * out_block;
+        const Scalar* wt = packed_filter_t + std::size_t(ib) * filter_size * cb * cb;
+        Scalar* dx = src_grad + (std::size_t(k) * nib + ib) * in_block;
+        std::fill(dx, dx + nblock * in_block, Scalar(0));
+
+        if (nblock == 2)
+        {
+            BlockedInputGrad<2>::apply(dim, g, wt, dx);
+        }
+        else
+        {
+            BlockedInputGrad<1>::apply(dim, g, wt, dx);
+        }
+    }
+}
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_BLOCKEDCONVOLUTION_H_ */
@@ -0,0 +1,195 @@
+#ifndef UTILS_BLOCKEDLAYOUT_H_
+#define UTILS_BLOCKEDLAYOUT_H_
+
+#include <Eigen/Core>
+#include <cstddef>
+#include <algorithm>
+#include "../Config.h"
+#include "Convolution.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Blocked channel-interleaved layout of images (NCHWc)
+//
+// In the planar layout of the layers, each observation is a column that holds its
+// channels one after another, each in column-major order. In the blocked layout,
+// the channels are grouped in blocks of ChannelBlock<Scalar>::size channels, the
+// number of scalars in a SIMD packet, and each block holds its pixels in the same
+// column-major order, with the values of the channels of the block adjacent:
+/*
+ * ###########################################################################
+ * #     pixel 1     #     pixel 2     #       #     pixel 1     #
+ * # c1 | c2 | c3 | c4 # c1 | c2 | c3 | c4 # ... # c5 | c6 | c7 | c8 # ...
+ * #                 #                 #       #                 #
+ * ###########################################################################
+ * |<------------- channel block 1 ------------>|<--- channel block 2 ----
+ */
+// The value of channel c at pixel p is at ((c / cb) * npixel + p) * cb + c % cb, so
+// the kernels load the values of a block of channels at one pixel as a packet, and
+// go through the pixels with unit stride
+//
+// The last block is padded with zeros if the number of channels is not a multiple
+// of the block size. The layers only exchange images in the blocked layout when it
+// is, so that both layouts have the same size, and the images are converted from
+// and to the planar layout at the ends of a chain of such layers
+
+
+// Number of channels in a block
+template <typename Scalar>
+struct ChannelBlock
+{
+    enum { size = Eigen::internal::packet_traits<Scalar>::size };
+};
+
+// Number of blocks of 'nchannel' channels
+template <typename Scalar>
+inline int channel_blocks(const int nchannel)
+{
+    const int cb = ChannelBlock<Scalar>::size;
+    return (nchannel + cb - 1) / cb;
+}
+
+// Number of scalars of one observation of 'nchannel' channels of 'npixel' pixels
+// in the blocked layout
+template <typename Scalar>
+inline std::size_t blocked_image_size(const int nchannel, const int npixel)
+{
+    return std::size_t(channel_blocks<Scalar>(nchannel)) * ChannelBlock<Scalar>::size * npixel;
+}
+
+// Whether images of 'nchannel' channels have the same size in both layouts
+template <typename Scalar>
+inline bool blocked_layout_exact(const int nchannel)
+{
+    return nchannel > 0 && nchannel % ChannelBlock<Scalar>::size == 0;
+}
+
+// Convert 'n_obs' images from the planar layout in 'src' to the blocked layout in 'dest'
+template <typename Scalar>
+inline void to_blocked_layout(const Scalar* src, const int nchannel, const int npixel, const int n_obs,
+                              Scalar* dest)
+{
+    const int cb = ChannelBlock<Scalar>::size;
+    const int nblock = channel_blocks<Scalar>(nchannel);
+    const std::size_t src_stride = std::size_t(nchannel) * npixel;
+    const std::size_t dest_stride = blocked_image_size<Scalar>(nchannel, npixel);
+
+#ifdef _OPENMP
+    const int nthread = std::max(1, std::min(conv_num_threads(), n_obs));
+    #pragma omp parallel for num_threads(nthread) schedule(static) if(nthread > 1)
+#endif
+    for (int k = 0; k < n_obs; k++)
+    {
+        const Scalar* img = src + k * src_stride;
+        Scalar* res = dest + k * dest_stride;
+
+        for (int b = 0; b < nblock; b++)
+        {
+            const int nc = std::min(cb, nchannel - b * cb);
+            const Scalar* channels = img + std::size_t(b) * cb * npixel;
+
+            for (int p = 0; p < npixel; p++, res += cb)
+            {
+                for (int c = 0; c < nc; c++)
+                {
+                    res[c] = channels[std::size_t(c) * npixel + p];
+                }
+
+                std::fill(res + nc, res + cb, Scalar(0));
+            }
+        }
+    }
+}
+
+// Convert 'n_obs' images from the blocked layout in 'src' to the planar layout in 'dest'
+template <typename Scalar>
+inline void to_planar_layout(const Scalar* src, const int nchannel, const int npixel, const int n_obs,
+                             Scalar* dest)
+{
+    const int cb = ChannelBlock<Scalar>::size;
+    const int nblock = channel_blocks<Scalar>(nchannel);
+    const std::size_t src_stride = blocked_image_size<Scalar>(nchannel, npixel);
+    const std::size_t dest_stride = std::size_t(nchannel) * npixel;
+
+#ifdef _OPENMP
+    const int nthread = std::max(1, std::min(conv_num_threads(), n_obs));
+    #pragma omp parallel for num_threads(nthread) schedule(static) if(nthread > 1)
+#endif
+    for (int k = 0; k < n_obs; k++)
+    {
+        const Scalar* img = src + k * src_stride;
+        Scalar* res = dest + k * dest_stride;
+
+        for (int b = 0; b < nblock; b++)
+        {
+            const int nc = std::min(cb, nchannel - b * cb);
+            Scalar* channels = res + std::size_t(b) * cb * npixel;
+
+            for (int p = 0; p < npixel; p++, img += cb)
+            {
+                for (int c = 0; c < nc; c++)
+                {
+                    channels[std::size_t(c) * npixel + p] = img[c];
+                }
+            }
+        }
+    }
+}
+
+// Add the bias of each channel to 'n_obs' images in the blocked layout
+// The number of channels is a multiple of the block size
+template <typename Scalar>
+inline void add_blocked_bias(const Scalar* bias, const int nchannel, const int npixel, const int n_obs,
+                             Scalar* img)
+{
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+    typedef Eigen::Map<Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> > MapMat;
+    const int cb = ChannelBlock<Scalar>::size;
+    const int nblock = nchannel / cb;
+
+    for (int b = 0; b < nblock; b++)
+    {
+        const Vector block_bias = Eigen::Map<const Vector>(bias + b * cb, cb);
+
+        for (int k = 0; k < n_obs; k++)
+        {
+            MapMat(img + (std::size_t(k) * nblock + b) * cb * npixel, cb, npixel).colwise() += block_bias;
+        }
+    }
+}
+
+// Sum of the values of each channel over 'n_obs' images in the blocked layout
+// The number of channels is a multiple of the block size
+template <typename Scalar>
+inline void blocked_channel_sums(const Scalar* img, const int nchannel, const int npixel, const int n_obs,
+                                 Scalar* sums)
+{
+    typedef Eigen::Map<const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> > ConstMapMat;
+    typedef Eigen::Map<Eigen::Matrix<Scalar, Eigen::Dynamic, 1> > MapVec;
+    const int cb = ChannelBlock<Scalar>::size;
+    const int nblock = nchannel / cb;
+    MapVec res(sums, nchannel);
+    res.setZero();
+
+    for (int k = 0; k < n_obs; k++)
+    {
+        for (int b = 0; b < nblock; b++)
+        {
+            res.segment(b * cb, cb) += ConstMapMat(img + (std::size_t(k) * nblock + b) * cb * npixel,
+                                                   cb, npixel).rowwise().sum();
+        }
+    }
+}
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_BLOCKEDLAYOUT_H_ */
@@ -2,7 +2,16 @@
 #define UTILS_CONVOLUTION_H_
 
 #include <Eigen/Core>
+#include <vector>
+#include <cstring>
+#include <algorithm>
 #include "../Config.h"
+#include "Workspace.h"
+#include "Gemm.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace MiniDNN
 {
@@ -61,7 +70,19 @@ namespace internal
 // Memory efficient convolution (MEC)
 // Algorithm is based on https://arxiv.org/abs/1706.06873
 //
-// First define a simple structure to store the various dimensions of convolution
+// The filter moves 'stride_rows' rows and 'stride_cols' columns at a time, and each
+// channel is padded with 'pad_rows' zero rows at the top and the bottom, and 'pad_cols'
+// zero columns on the left and the right. The "valid" rule is stride 1 without padding,
+// and the "same" rule for a filter of odd size is stride 1 with padding
+// (filter_rows - 1) / 2 and (filter_cols - 1) / 2
+//
+// Size of the convolution result along one dimension
+// Invalid strides give zero, and are reported by the layers
+inline int conv_output_size(const int in_size, const int filter_size, const int stride, const int padding)
+{
+    return (stride > 0) ? (in_size + 2 * padding - filter_size) / stride + 1 : 0;
+}
+// Then define a simple structure to store the various dimensions of convolution
 struct ConvDims
 {
     // Input parameters
@@ -71,24 +92,35 @@ struct ConvDims
     const int channel_cols;
     const int filter_rows;
     const int filter_cols;
+    const int stride_rows;
+    const int stride_cols;
+    const int pad_rows;
+    const int pad_cols;
     // Image dimension -- one observation with all channels
     const int img_rows;
     const int img_cols;
     // Dimension of the convolution result for each output channel
     const int conv_rows;
     const int conv_cols;
+    // Number of columns of the padded channel covered by the filter
+    const int span_cols;
 
     ConvDims(
         const int in_channels_, const int out_channels_,
         const int channel_rows_, const int channel_cols_,
-        const int filter_rows_, const int filter_cols_
+        const int filter_rows_, const int filter_cols_,
+        const int stride_rows_ = 1, const int stride_cols_ = 1,
+        const int pad_rows_ = 0, const int pad_cols_ = 0
     ) :
         in_channels(in_channels_), out_channels(out_channels_),
         channel_rows(channel_rows_), channel_cols(channel_cols_),
         filter_rows(filter_rows_), filter_cols(filter_cols_),
+        stride_rows(stride_rows_), stride_cols(stride_cols_),
+        pad_rows(pad_rows_), pad_cols(pad_cols_),
         img_rows(channel_rows_), img_cols(in_channels_ * channel_cols_),
-        conv_rows(channel_rows_ - filter_rows_ + 1),
-        conv_cols(channel_cols_ - filter_cols_ + 1)
+        conv_rows(conv_output_size(channel_rows_, filter_rows_, stride_rows_, pad_rows_)),
+        conv_cols(conv_output_size(channel_cols_, filter_cols_, stride_cols_, pad_cols_)),
+        span_cols((conv_cols - 1) * stride_cols_ + filter_cols_)
     {}
 };
 // Transform original matrix to "lower" form as described in the MEC paper
@@ -96,43 +128,183 @@ struct ConvDims
 //
 // Helper function to "flatten" source images
 // 'flat_mat' will be overwritten
-// We focus on one channel, and let 'stride' be the distance between two images
+// We let 'img_stride' be the distance between two images, and 'channel_stride' be
+// the distance between two channels of the same image
+//
+// The flat matrix has 'conv_rows' rows for each image, and 'filter_rows' columns for
+// each input channel and each column of the padded channels covered by the filter,
+// ordered by the column of the channels, then the input channel, then the row u of
+// the filter. Row r of an image in column (q, i, u) is the value of input channel i
+// in row (r * stride_rows - pad_rows + u) and column (q - pad_cols). Rows skipped by
+// the stride are never copied, and values in the padding are zero
+//
+// Each column of the flat matrix is a contiguous segment of a column of the channel,
+// and the window of the filter at one output column is a block of contiguous columns
+// of the flat matrix, so the convolution over all input channels is a single matrix
+// product for each output column
+//
+// First row r of each image in column (q, i, u) of the flat matrix whose value is in
+// the channel, and the end of these rows
+inline void flat_row_range(const ConvDims& dim, const int u, int& first, int& last)
+{
+    const int lo = dim.pad_rows - u;
+    const int hi = dim.channel_rows - 1 + dim.pad_rows - u;
+    first = (lo <= 0) ? 0 : (lo + dim.stride_rows - 1) / dim.stride_rows;
+    last = (hi < 0) ? 0 : std::min(dim.conv_rows, hi / dim.stride_rows + 1);
+    last = std::max(first, last);
+}
+template <typename Scalar>
 inline void flatten_mat(
-    const ConvDims& dim, const Scalar* src, const int stride, const int n_obs,
-    Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>& flat_mat
+    const ConvDims& dim, const Scalar* src, const int img_stride, const int channel_stride,
+    const int n_obs,
+    Eigen::Map< Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> >& flat_mat
 )
 {
-    // Number of bytes in the segment that will be copied at one time
-    const int& segment_size = dim.filter_rows;
-    const std::size_t copy_bytes = sizeof(Scalar) * segment_size;
+    const int flat_rows = dim.conv_rows * n_obs;
     Scalar* writer = flat_mat.data();
-    const int channel_size = dim.channel_rows * dim.channel_cols;
 
-    for (int i = 0; i < n_obs; i++, src += stride)
+    for (int q = 0; q < dim.span_cols; q++)
     {
-        const Scalar* reader_row = src;
-        const Scalar* const reader_row_end = src + dim.conv_rows;
+        const int col = q - dim.pad_cols;
 
-        for (; reader_row < reader_row_end; reader_row++)
+        if (col < 0 || col >= dim.channel_cols)
         {
-            const Scalar* reader = reader_row;
-            const Scalar* const reader_end = reader + channel_size;
+            const std::size_t len = std::size_t(flat_rows) * dim.in_channels * dim.filter_rows;
+            std::fill(writer, writer + len, Scalar(0));
+            writer += len;
+            continue;
+        }
 
-            for (; reader < reader_end; reader += dim.channel_rows, writer += segment_size)
+        for (int i = 0; i < dim.in_channels; i++)
+        {
+            const Scalar* const channel = src + i * channel_stride + col * dim.channel_rows;
+
+            for (int u = 0; u < dim.filter_rows; u++)
             {
-                std::memcpy(writer, reader, copy_bytes);
+                int first, last;
+                flat_row_range(dim, u, first, last);
+                const Scalar* reader = channel + first * dim.stride_rows - dim.pad_rows + u;
+
+                for (int k = 0; k < n_obs; k++, reader += img_stride, writer += dim.conv_rows)
+                {
+                    std::fill(writer, writer + first, Scalar(0));
+
+                    if (dim.stride_rows == 1)
+                    {
+                        std::memcpy(writer + first, reader, sizeof(Scalar) * (last - first));
+                    }
+                    else
+                    {
+                        for (int r = first; r < last; r++)
+                        {
+                            writer[r] = reader[(r - first) * dim.stride_rows];
+                        }
+                    }
+
+                    std::fill(writer + last, writer + dim.conv_rows, Scalar(0));
+                }
+            }
+        }
+    }
+}
+// The transpose of flatten_mat(): each value of 'flat_mat' is added to the position
+// of the images it was copied from, and values in the padding are dropped
+template <typename Scalar>
+inline void unflatten_mat(
+    const ConvDims& dim,
+    const Eigen::Map< Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> >& flat_mat,
+    const int img_stride, const int channel_stride, const int n_obs, Scalar* dest
+)
+{
+    const int flat_rows = dim.conv_rows * n_obs;
+    const Scalar* reader = flat_mat.data();
+
+    for (int q = 0; q < dim.span_cols; q++)
+    {
+        const int col = q - dim.pad_cols;
+
+        if (col < 0 || col >= dim.channel_cols)
+        {
+            reader += std::size_t(flat_rows) * dim.in_channels * dim.filter_rows;
+            continue;
+        }
+
+        for (int i = 0; i < dim.in_channels; i++)
+        {
+            Scalar* const channel = dest + i * channel_stride + col * dim.channel_rows;
+
+            for (int u = 0; u < dim.filter_rows; u++)
+            {
+                int first, last;
+                flat_row_range(dim, u, first, last);
+                Scalar* writer = channel + first * dim.stride_rows - dim.pad_rows + u;
+
+                for (int k = 0; k < n_obs; k++, writer += img_stride, reader += dim.conv_rows)
+                {
+                    for (int r = first; r < last; r++)
+                    {
+                        writer[(r - first) * dim.stride_rows] += reader[r];
+                    }
+                }
+            }
+        }
+    }
+}
+// The filters are multiplied with the windows of the flat matrix, so their rows are
+// arranged in the same order: the filter of input channel i and output channel o is
+// stored in column o, and its value in row u and column v is in row
+// (v * in_channels + i) * filter_rows + u
+// 'dest' is a (filter_size * in_channels) x out_channels matrix
+template <typename Scalar>
+inline void pack_filters(const ConvDims& dim, const Scalar* filter_data, Scalar* dest)
+{
+    const int filter_size = dim.filter_rows * dim.filter_cols;
+    const int window_size = filter_size * dim.in_channels;
+    const int col_size = dim.in_channels * dim.filter_rows;
+
+    for (int i = 0; i < dim.in_channels; i++)
+    {
+        for (int o = 0; o < dim.out_channels; o++, filter_data += filter_size)
+        {
+            Scalar* writer = dest + o * window_size + i * dim.filter_rows;
+
+            for (int v = 0; v < dim.filter_cols; v++, writer += col_size)
+            {
+                std::copy(filter_data + v * dim.filter_rows, filter_data + (v + 1) * dim.filter_rows, writer);
+            }
+        }
+    }
+}
+// The inverse of pack_filters()
+template <typename Scalar>
+inline void unpack_filters(const ConvDims& dim, const Scalar* src, Scalar* filter_data)
+{
+    const int filter_size = dim.filter_rows * dim.filter_cols;
+    const int window_size = filter_size * dim.in_channels;
+    const int col_size = dim.in_channels * dim.filter_rows;
+
+    for (int i = 0; i < dim.in_channels; i++)
+    {
+        for (int o = 0; o < dim.out_channels; o++, filter_data += filter_size)
+        {
+            const Scalar* reader = src + o * window_size + i * dim.filter_rows;
+
+            for (int v = 0; v < dim.filter_cols; v++, reader += col_size)
+            {
+                std::copy(reader, reader + dim.filter_rows, filter_data + v * dim.filter_rows);
             }
         }
     }
 }
 // A special matrix product. We select a window from 'mat1' and calculates its product with 'mat2',
 // and progressively move the window to the right
+template <typename Scalar>
 inline void moving_product(
     const int step,
-    const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>&
-    mat1,
+    const Eigen::Map< Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> >& mat1,
     Eigen::Map< const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> >& mat2,
-    Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& res
+    Eigen::Map< Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>, 0, Eigen::OuterStride<> >& res,
+    Scalar* buffer, const std::size_t buffer_size
 )
 {
     const int row1 = mat1.rows();
@@ -145,84 +317,102 @@ inline void moving_product(
     for (int left_end = 0; left_end <= col_end;
             left_end += step, res_start_col += col2)
     {
-        res.block(0, res_start_col, row1, col2).noalias() += mat1.block(0, left_end,
-                row1, row2) * mat2;
+        gemm_add(mat1.block(0, left_end, row1, row2), mat2,
+                 res.block(0, res_start_col, row1, col2), buffer, buffer_size);
     }
 }
-// The main convolution function using the "valid" rule
-inline void convolve_valid(
-    const ConvDims& dim,
-    const Scalar* src, const bool image_outer_loop, const int n_obs,
-    const Scalar* filter_data,
-    Scalar* dest)
+// The transpose of moving_product() with respect to 'mat1': given the derivative
+// of 'res', the derivative of each window of 'mat1' is accumulated in 'dmat1'
+template <typename Scalar>
+inline void moving_product_flat_grad(
+    const int step,
+    const Eigen::Map< Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>, 0, Eigen::OuterStride<> >& dres,
+    const Eigen::Map< const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> >& mat2,
+    Eigen::Map< Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> >& dmat1,
+    Scalar* buffer, const std::size_t buffer_size
+)
 {
-    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
-    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
-    RMatrix;
-    typedef Eigen::Map<const Matrix> ConstMapMat;
-    // Flat matrix
-    const int flat_rows = dim.conv_rows * n_obs;
-    const int flat_cols = dim.filter_rows * dim.channel_cols;
-    const int channel_size = dim.channel_rows * dim.channel_cols;
-    // Distance between two images
-    const int img_stride = image_outer_loop ? (dim.img_rows * dim.img_cols) :
-                           channel_size;
-    // Distance between two channels
-    const int channel_stride = image_outer_loop ? channel_size :
-                               (channel_size * n_obs);
-    RMatrix flat_mat(flat_rows, flat_cols);
-    // Convolution results
-    const int& res_rows = flat_rows;
-    const int res_cols = dim.conv_cols * dim.out_channels;
-    Matrix res = Matrix::Zero(res_rows, res_cols);
-    const int& step = dim.filter_rows;
-    const int filter_size = dim.filter_rows * dim.filter_cols;
-    const int filter_stride = filter_size * dim.out_channels;
+    const int row1 = dmat1.rows();
+    const int col1 = dmat1.cols();
+    const int row2 = mat2.rows();
+    const int col2 = mat2.cols();
+    const int col_end = col1 - row2;
+    int res_start_col = 0;
 
-    for (int i = 0; i < dim.in_channels;
-            i++, src += channel_stride, filter_data += filter_stride)
+    for (int left_end = 0; left_end <= col_end;
+            left_end += step, res_start_col += col2)
     {
-        // Flatten source image
-        flatten_mat(dim, src, img_stride, n_obs, flat_mat);
-        // Compute the convolution result
-        ConstMapMat filter(filter_data, filter_size, dim.out_channels);
-        moving_product(step, flat_mat, filter, res);
+        gemm_add(dres.block(0, res_start_col, row1, col2), mat2.transpose(),
+                 dmat1.block(0, left_end, row1, row2), buffer, buffer_size);
     }
+}
+// The transpose of moving_product() with respect to 'mat2': given the derivative
+// of 'res', the derivative of 'mat2' is accumulated in 'dmat2'
+template <typename Scalar>
+inline void moving_product_filter_grad(
+    const int step,
+    const Eigen::Map< Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> >& mat1,
+    const Eigen::Map< Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>, 0, Eigen::OuterStride<> >& dres,
+    Eigen::Map< Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> >& dmat2,
+    Scalar* buffer, const std::size_t buffer_size
+)
+{
+    const int row1 = mat1.rows();
+    const int col1 = mat1.cols();
+    const int row2 = dmat2.rows();
+    const int col2 = dmat2.cols();
+    const int col_end = col1 - row2;
+    int res_start_col = 0;
 
-    // The layout of 'res' is very complicated
-    /*
-     * obs0_out0[0, 0] obs0_out1[0, 0] obs0_out2[0, 0] obs0_out0[0, 1] obs0_out1[0, 1] obs0_out2[0, 1] ...
-     * obs0_out0[1, 0] obs0_out1[1, 0] obs0_out2[1, 0] obs0_out0[1, 1] obs0_out1[1, 1] obs0_out2[1, 1] ...
-     * obs0_out0[2, 0] obs0_out1[2, 0] obs0_out2[2, 0] obs0_out0[2, 1] obs0_out1[2, 1] obs0_out2[2, 1] ...
-     * obs1_out0[0, 0] obs1_out1[0, 0] obs1_out2[0, 0] obs1_out0[0, 1] obs1_out1[0, 1] obs1_out2[0, 1] ...
-     * obs1_out0[1, 0] obs1_out1[1, 0] obs1_out2[1, 0] obs1_out0[1, 1] obs1_out1[1, 1] obs1_out2[1, 1] ...
-     * obs1_out0[2, 0] obs1_out1[2, 0] obs1_out2[2, 0] obs1_out0[2, 1] obs1_out1[2, 1] obs1_out2[2, 1] ...
-     * ...
-     *
-     */
-    // obs<k>_out<l> means the convolution result of the k-th image on the l-th output channel
-    // [i, j] gives the matrix indices
-    // The destination has the layout
-    /*
-     * obs0_out0[0, 0] obs0_out0[0, 1] obs0_out0[0, 2] obs0_out1[0, 0] obs0_out1[0, 1] obs0_out1[0, 2] ...
-     * obs0_out0[1, 0] obs0_out0[1, 1] obs0_out0[1, 2] obs0_out1[1, 0] obs0_out1[1, 1] obs0_out1[1, 2] ...
-     * obs0_out0[2, 0] obs0_out0[2, 1] obs0_out0[2, 2] obs0_out1[2, 0] obs0_out1[2, 1] obs0_out1[2, 2] ...
-     *
-     */
-    // which in a larger scale looks like
-    // [obs0_out0 obs0_out1 obs0_out2 obs1_out0 obs1_out1 obs1_out2 obs2_out0 ...]
-    // Copy data to destination
-    // dest[a, b] corresponds to obs<k>_out<l>[i, j]
-    // where k = b / (conv_cols * out_channels),
-    //       l = (b % (conv_cols * out_channels)) / conv_cols
-    //       i = a,
-    //       j = b % conv_cols
-    // and then obs<k>_out<l>[i, j] corresponds to res[c, d]
-    // where c = k * conv_rows + i,
-    //       d = j * out_channels + l
+    for (int left_end = 0; left_end <= col_end;
+            left_end += step, res_start_col += col2)
+    {
+        gemm_add(mat1.block(0, left_end, row1, row2).transpose(),
+                 dres.block(0, res_start_col, row1, col2), dmat2, buffer, buffer_size);
+    }
+}
+// The products computed by convolve_valid() are stored in a matrix 'res' whose
+// layout is very complicated
+/*
+ * obs0_out0[0, 0] obs0_out1[0, 0] obs0_out2[0, 0] obs0_out0[0, 1] obs0_out1[0, 1] obs0_out2[0, 1] ...
+ * obs0_out0[1, 0] obs0_out1[1, 0] obs0_out2[1, 0] obs0_out0[1, 1] obs0_out1[1, 1] obs0_out2[1, 1] ...
+ * obs0_out0[2, 0] obs0_out1[2, 0] obs0_out2[2, 0] obs0_out0[2, 1] obs0_out1[2, 1] obs0_out2[2, 1] ...
+ * obs1_out0[0, 0] obs1_out1[0, 0] obs1_out2[0, 0] obs1_out0[0, 1] obs1_out1[0, 1] obs1_out2[0, 1] ...
+ * obs1_out0[1, 0] obs1_out1[1, 0] obs1_out2[1, 0] obs1_out0[1, 1] obs1_out1[1, 1] obs1_out2[1, 1] ...
+ * obs1_out0[2, 0] obs1_out1[2, 0] obs1_out2[2, 0] obs1_out0[2, 1] obs1_out1[2, 1] obs1_out2[2, 1] ...
+ * ...
+ *
+ */
+// obs<k>_out<l> means the convolution result of the k-th image on the l-th output channel
+// [i, j] gives the matrix indices
+// The destination has the layout
+/*
+ * obs0_out0[0, 0] obs0_out0[0, 1] obs0_out0[0, 2] obs0_out1[0, 0] obs0_out1[0, 1] obs0_out1[0, 2] ...
+ * obs0_out0[1, 0] obs0_out0[1, 1] obs0_out0[1, 2] obs0_out1[1, 0] obs0_out1[1, 1] obs0_out1[1, 2] ...
+ * obs0_out0[2, 0] obs0_out0[2, 1] obs0_out0[2, 2] obs0_out1[2, 0] obs0_out1[2, 1] obs0_out1[2, 2] ...
+ *
+ */
+// which in a larger scale looks like
+// [obs0_out0 obs0_out1 obs0_out2 obs1_out0 obs1_out1 obs1_out2 obs2_out0 ...]
+// dest[a, b] corresponds to obs<k>_out<l>[i, j]
+// where k = b / (conv_cols * out_channels),
+//       l = (b % (conv_cols * out_channels)) / conv_cols
+//       i = a,
+//       j = b % conv_cols
+// and then obs<k>_out<l>[i, j] corresponds to res[c, d]
+// where c = k * conv_rows + i,
+//       d = j * out_channels + l
+//
+// Copy data from 'res' to the destination
+// 'res_rows' is the distance between two columns of 'res', which is larger than
+// 'conv_rows * n_obs' if the images are a chunk of a larger batch
+template <typename Scalar>
+inline void unpack_result(const ConvDims& dim, const int n_obs, const Scalar* res, const int res_rows,
+                          Scalar* dest)
+{
+    const int res_cols = dim.conv_cols * dim.out_channels;
     const int dest_rows = dim.conv_rows;
     const int dest_cols = res_cols * n_obs;
-    const Scalar* res_data = res.data();
     const std::size_t copy_bytes = sizeof(Scalar) * dest_rows;
 
     for (int b = 0; b < dest_cols; b++, dest += dest_rows)
@@ -231,148 +421,325 @@ inline void convolve_valid(
         const int l = (b % res_cols) / dim.conv_cols;
         const int j = b % dim.conv_cols;
         const int d = j * dim.out_channels + l;
-        const int res_col_head = d * res_rows;
-        std::memcpy(dest, res_data + res_col_head + k * dim.conv_rows, copy_bytes);
+        const std::size_t res_col_head = std::size_t(d) * res_rows;
+        std::memcpy(dest, res + res_col_head + k * dim.conv_rows, copy_bytes);
     }
 }
-
-
-
-// The moving_product() function for the "full" rule
-inline void moving_product(
-    const int padding, const int step,
-    const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>&
-    mat1,
-    const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& mat2,
-    Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& res
-)
+// The inverse of unpack_result()
+// The loops follow the order of 'res', so that the writes are sequential
+template <typename Scalar>
+inline void pack_result(const ConvDims& dim, const int n_obs, const Scalar* src, Scalar* res,
+                        const int res_rows)
 {
-    const int row1 = mat1.rows();
-    const int col1 = mat1.cols();
-    const int row2 = mat2.rows();
-    const int col2 = mat2.cols();
-    int res_start_col = 0;
-    // Left padding
-    int left_end = -padding;
-    int right_end = step;
+    const std::size_t copy_bytes = sizeof(Scalar) * dim.conv_rows;
+    const std::size_t channel_size = std::size_t(dim.conv_rows) * dim.conv_cols;
+    const std::size_t img_size = channel_size * dim.out_channels;
 
-    for (; left_end < 0
-            && right_end <= col1;
-            left_end += step, right_end += step, res_start_col += col2)
+    for (int j = 0; j < dim.conv_cols; j++)
     {
-        res.block(0, res_start_col, row1, col2).noalias() += mat1.leftCols(right_end) *
-                mat2.bottomRows(right_end);
+        for (int l = 0; l < dim.out_channels; l++)
+        {
+            const int d = j * dim.out_channels + l;
+            Scalar* writer = res + std::size_t(d) * res_rows;
+            const Scalar* reader = src + l * channel_size + j * dim.conv_rows;
+
+            for (int k = 0; k < n_obs; k++, writer += dim.conv_rows, reader += img_size)
+            {
+                std::memcpy(writer, reader, copy_bytes);
+            }
+        }
     }
+}
+// The images are processed in chunks, which bounds the size of the flat matrix,
+// while keeping enough rows in each chunk for efficient matrix products
+//
+// With OpenMP, the chunks are distributed over the threads, and each thread has its
+// own flat matrix. The chunks write disjoint rows of the results, except for the
+// derivative of the filters, which each thread accumulates in its own matrix before
+// they are summed up. Inside a parallel region, for example in the data-parallel
+// training of Network, the kernels run on the calling thread
+//
+// Number of threads available to the convolution kernels
+inline int conv_num_threads()
+{
+#ifdef _OPENMP
+    return omp_in_parallel() ? 1 : omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+// Number of images in each chunk, which leaves at least one chunk to each thread
+template <typename Scalar>
+inline int conv_chunk_size(const ConvDims& dim, const int n_obs, const int nthread)
+{
+    const std::size_t chunk_bytes = 4 * 1024 * 1024;
+    const std::size_t flat_bytes = sizeof(Scalar) * dim.conv_rows * dim.span_cols *
+                                   dim.in_channels * dim.filter_rows;
+    const int chunk = int(std::min(chunk_bytes / flat_bytes, std::size_t(n_obs)));
+    const int per_thread = (n_obs - 1) / nthread + 1;
+    return std::max(1, std::min(chunk, per_thread));
+}
+// Number of threads that have work, given the chunk size
+inline int conv_num_workers(const int n_obs, const int chunk, const int nthread)
+{
+    return std::max(1, std::min(nthread, (n_obs - 1) / chunk + 1));
+}
+// Size of the memory, in bytes, of the packing buffers of the matrix products of
+// convolve_valid() on a chunk of images, and also of convolve_backward() if 'backward'
+template <typename Scalar>
+inline std::size_t conv_gemm_size(const ConvDims& dim, const int chunk, const bool backward)
+{
+    const int flat_rows = dim.conv_rows * chunk;
+    const int window_size = dim.filter_rows * dim.filter_cols * dim.in_channels;
+    const std::size_t forward = gemm_workspace_size<Scalar>(flat_rows, dim.out_channels, window_size);
 
-    // Main part
-    for (; right_end <= col1;
-            left_end += step, right_end += step, res_start_col += col2)
+    if (!backward)
     {
-        res.block(0, res_start_col, row1, col2).noalias() += mat1.block(0, left_end,
-                row1, row2) * mat2;
+        return forward;
     }
 
-    // Right padding
-    for (; left_end < col1; left_end += step, res_start_col += col2)
+    return std::max(forward, std::max(
+        gemm_workspace_size<Scalar>(window_size, dim.out_channels, flat_rows),
+        gemm_workspace_size<Scalar>(flat_rows, window_size, dim.out_channels)));
+}
+// Size of the workspace memory, in bytes, needed by convolve_valid() with 'nthread'
+// threads: a flat matrix, the results and the packing buffers of a chunk for each
+// worker, and the packed filters
+template <typename Scalar>
+inline std::size_t convolve_valid_workspace_size(const ConvDims& dim, const int n_obs, const int nthread)
+{
+    const int chunk = conv_chunk_size<Scalar>(dim, n_obs, nthread);
+    const int nworker = conv_num_workers(n_obs, chunk, nthread);
+    const std::size_t flat_rows = std::size_t(dim.conv_rows) * chunk;
+    const std::size_t flat_cols = std::size_t(dim.span_cols) * dim.in_channels * dim.filter_rows;
+    const std::size_t window_size = std::size_t(dim.filter_rows) * dim.filter_cols * dim.in_channels;
+    return nworker * (Workspace::block_size<Scalar>(flat_rows * flat_cols) +
+                      Workspace::block_size<Scalar>(flat_rows * dim.conv_cols * dim.out_channels) +
+                      conv_gemm_size<Scalar>(dim, chunk, false)) +
+           Workspace::block_size<Scalar>(window_size * dim.out_channels);
+}
+template <typename Scalar>
+inline std::size_t convolve_valid_workspace_size(const ConvDims& dim, const int n_obs)
+{
+    return convolve_valid_workspace_size<Scalar>(dim, n_obs, conv_num_threads());
+}
+// Size of the workspace memory, in bytes, needed by convolve_backward() with 'nthread'
+// threads, which has the buffers of convolve_valid() with the packing buffers of all
+// the products, and also the derivative of the filters for each worker
+template <typename Scalar>
+inline std::size_t convolve_backward_workspace_size(const ConvDims& dim, const int n_obs, const int nthread)
+{
+    const int chunk = conv_chunk_size<Scalar>(dim, n_obs, nthread);
+    const int nworker = conv_num_workers(n_obs, chunk, nthread);
+    const std::size_t flat_rows = std::size_t(dim.conv_rows) * chunk;
+    const std::size_t flat_cols = std::size_t(dim.span_cols) * dim.in_channels * dim.filter_rows;
+    const std::size_t window_size = std::size_t(dim.filter_rows) * dim.filter_cols * dim.in_channels;
+    return nworker * (Workspace::block_size<Scalar>(flat_rows * flat_cols) +
+                      Workspace::block_size<Scalar>(flat_rows * dim.conv_cols * dim.out_channels) +
+                      conv_gemm_size<Scalar>(dim, chunk, true) +
+                      Workspace::block_size<Scalar>(window_size * dim.out_channels)) +
+           Workspace::block_size<Scalar>(window_size * dim.out_channels);
+}
+template <typename Scalar>
+inline std::size_t convolve_backward_workspace_size(const ConvDims& dim, const int n_obs)
+{
+    return convolve_backward_workspace_size<Scalar>(dim, n_obs, conv_num_threads());
+}
+// Number of threads used by a kernel with the memory left in 'ws'
+// This is normally conv_num_threads(), but fewer threads are used if the number of
+// OpenMP threads has grown since the workspace was sized
+template <typename Scalar>
+inline int conv_kernel_threads(const ConvDims& dim, const int n_obs, const bool backward, const Workspace& ws)
+{
+    int nthread = conv_num_threads();
+
+    while (nthread > 1 && (backward ? convolve_backward_workspace_size<Scalar>(dim, n_obs, nthread) :
+                           convolve_valid_workspace_size<Scalar>(dim, n_obs, nthread)) > ws.available())
     {
-        if (left_end <= 0)
-        {
-            res.block(0, res_start_col, row1, col2).noalias() += mat1 * mat2.block(0,
-                    -left_end, col1, row2);
-        }
-        else
-        {
-            const int overlap = col1 - left_end;
-            res.block(0, res_start_col, row1, col2).noalias() += mat1.rightCols(overlap) *
-                    mat2.topRows(overlap);
-        }
+        nthread--;
     }
+
+    return nthread;
 }
-// The main convolution function for the "full" rule
-inline void convolve_full(
+// Index of the calling thread in a parallel region
+inline int conv_thread_id()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+// The main convolution function using the "valid" rule, with optional strides and padding
+// Temporary matrices are allocated from 'ws'
+template <typename Scalar>
+inline void convolve_valid(
     const ConvDims& dim,
-    const Scalar* src, const int n_obs, const Scalar* filter_data,
-    Scalar* dest)
+    const Scalar* src, const bool image_outer_loop, const int n_obs,
+    const Scalar* filter_data,
+    Scalar* dest, Workspace& ws)
 {
     typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
-    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
-    RMatrix;
     typedef Eigen::Map<const Matrix> ConstMapMat;
-    // Padding sizes
-    const int padding_top = dim.filter_rows - 1;
-    const int padding_left = dim.filter_cols - 1;
-    // Dimension of convolution result using "full" rule
-    const int conv_rows = dim.channel_rows + padding_top;
-    const int conv_cols = dim.channel_cols + padding_left;
-    // Add (top and bottom) padding to source images
-    const int pad_rows = dim.img_rows + padding_top * 2;
-    const int pad_cols = dim.img_cols * n_obs;
-    Matrix pad_mat(pad_rows, pad_cols);
-    ConstMapMat src_mat(src, dim.img_rows, pad_cols);
-    pad_mat.topRows(padding_top).setZero();
-    pad_mat.bottomRows(padding_top).setZero();
-    pad_mat.block(padding_top, 0, dim.img_rows, pad_cols).noalias() = src_mat;
-    src = pad_mat.data();
-    ConvDims pad_dim(dim.in_channels, dim.out_channels, pad_rows, dim.channel_cols,
-                     dim.filter_rows, dim.filter_cols);
-    // Flat matrix
-    const int flat_rows = conv_rows * n_obs;
-    const int flat_cols = dim.filter_rows * dim.channel_cols;
-    const int img_stride = pad_rows * dim.img_cols;
-    const int channel_stride = pad_rows * dim.channel_cols;
-    RMatrix flat_mat(flat_rows, flat_cols);
-    // The processing of filters are different from the "valid" rule in two ways:
-    // 1. The layout of input channels and output channels are switched
-    // 2. The filters need to be rotated, which is equivalent to reversing the vector of each filter
-    // We also separate filters that belong to different input channels
-    std::vector<Matrix> filters_in(dim.in_channels);
-    const int filter_size = dim.filter_rows * dim.filter_cols;
-    const int nfilter = dim.in_channels * dim.out_channels;
+    typedef Eigen::Map<Matrix> MapMat;
+    typedef Eigen::Map<Matrix, 0, Eigen::OuterStride<> > StridedMapMat;
+    const std::size_t ws_mark = ws.mark();
+    // Flat matrices and convolution results of a chunk of images, one for each worker
+    const int nthread = conv_kernel_threads<Scalar>(dim, n_obs, false, ws);
+    const int chunk = conv_chunk_size<Scalar>(dim, n_obs, nthread);
+    const int nworker = conv_num_workers(n_obs, chunk, nthread);
+    const int nchunk = (n_obs - 1) / chunk + 1;
+    const int flat_cols = dim.span_cols * dim.in_channels * dim.filter_rows;
+    const int res_cols = dim.conv_cols * dim.out_channels;
+    const std::size_t chunk_rows = std::size_t(dim.conv_rows) * chunk;
+    const int channel_size = dim.channel_rows * dim.channel_cols;
+    // Distance between two images
+    const int img_stride = image_outer_loop ? (dim.img_rows * dim.img_cols) :
+                           channel_size;
+    // Distance between two channels
+    const int channel_stride = image_outer_loop ? channel_size :
+                               (channel_size * n_obs);
+    // Distance between two images in the destination
+    const int dest_stride = dim.conv_rows * res_cols;
+    // The flat matrix and the results of worker t start at 'flat_data + t * flat_block'
+    // and 'res_data + t * res_block'
+    const std::size_t flat_block = Workspace::block_size<Scalar>(chunk_rows * flat_cols) / sizeof(Scalar);
+    const std::size_t res_block = Workspace::block_size<Scalar>(chunk_rows * res_cols) / sizeof(Scalar);
+    const std::size_t gemm_bytes = conv_gemm_size<Scalar>(dim, chunk, false);
+    const std::size_t gemm_block = gemm_bytes / sizeof(Scalar);
+    Scalar* flat_data = ws.allocate<Scalar>(flat_block * nworker);
+    Scalar* res_data = ws.allocate<Scalar>(res_block * nworker);
+    Scalar* gemm_data = ws.allocate<Scalar>(gemm_block * nworker);
+    // Filters in the order of the flat matrix
+    const int window_size = dim.filter_rows * dim.filter_cols * dim.in_channels;
+    Scalar* filter_mat = ws.allocate<Scalar>(std::size_t(window_size) * dim.out_channels);
+    pack_filters(dim, filter_data, filter_mat);
+    ConstMapMat filter(filter_mat, window_size, dim.out_channels);
+    const int step = dim.stride_cols * dim.in_channels * dim.filter_rows;
 
-    for (int i = 0; i < dim.in_channels; i++)
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(nworker) schedule(static) if(nworker > 1)
+#endif
+    for (int c = 0; c < nchunk; c++)
     {
-        filters_in[i].resize(filter_size, dim.out_channels);
+        const int k = c * chunk;
+        const int n = std::min(chunk, n_obs - k);
+        const int flat_rows = dim.conv_rows * n;
+        const int t = conv_thread_id();
+        // Flatten source images
+        MapMat flat_mat(flat_data + t * flat_block, flat_rows, flat_cols);
+        flatten_mat(dim, src + std::size_t(k) * img_stride, img_stride, channel_stride, n, flat_mat);
+        // Compute the convolution result
+        StridedMapMat res(res_data + t * res_block, flat_rows, res_cols, Eigen::OuterStride<>(flat_rows));
+        res.setZero();
+        moving_product(step, flat_mat, filter, res, gemm_data + t * gemm_block, gemm_bytes);
+        // Copy data to destination
+        unpack_result(dim, n, res.data(), flat_rows, dest + std::size_t(k) * dest_stride);
     }
 
-    const Scalar* reader = filter_data;
+    ws.release(ws_mark);
+}
 
-    for (int i = 0; i < nfilter; i++, reader += filter_size)
-    {
-        Scalar* writer = filters_in[i % dim.in_channels].data() +
-                         (i / dim.in_channels) * filter_size;
-        std::reverse_copy(reader, reader + filter_size, writer);
-    }
 
-    // Convolution results
-    const int& res_rows = flat_rows;
-    const int res_cols = conv_cols * dim.out_channels;
-    Matrix res = Matrix::Zero(res_rows, res_cols);
-    const int& step = dim.filter_rows;
-    const int filter_padding = padding_left * dim.filter_rows;
 
-    for (int i = 0; i < dim.in_channels; i++, src += channel_stride)
+// The derivatives of convolve_valid(), given the derivative 'grad' of the convolution
+// result of 'n_obs' images in 'src'. 'dim' and 'filter_data' are the same as in
+// convolve_valid(), the images are stored with 'image_outer_loop == true', and 'grad'
+// has the layout of 'dest' in convolve_valid()
+//
+// The derivatives of the filters are summed over the images and written to
+// 'filter_grad' with the layout of the filters. The derivatives of the images are
+// written to 'src_grad' with the layout of 'src', unless 'src_grad' is NULL
+//
+// Without strides and padding, the derivative of the images is the "full" convolution
+// of 'grad' with the rotated filters. Instead of padding 'grad' and rotating the filters,
+// we apply the transpose of each step of convolve_valid() in reverse order, which also
+// supports strides and padding, and only visits the positions where the filter was
+// applied. Both derivatives use the same flat matrix and the same copy of 'grad' in
+// the layout of 'res' in convolve_valid(), which are computed once for each chunk
+// Temporary matrices are allocated from 'ws'
+template <typename Scalar>
+inline void convolve_backward(
+    const ConvDims& dim,
+    const Scalar* src, const int n_obs, const Scalar* grad, const Scalar* filter_data,
+    Scalar* filter_grad, Scalar* src_grad, Workspace& ws)
+{
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+    typedef Eigen::Map<const Matrix> ConstMapMat;
+    typedef Eigen::Map<Matrix> MapMat;
+    typedef Eigen::Map<Matrix, 0, Eigen::OuterStride<> > StridedMapMat;
+    const std::size_t ws_mark = ws.mark();
+    const int nthread = conv_kernel_threads<Scalar>(dim, n_obs, true, ws);
+    const int chunk = conv_chunk_size<Scalar>(dim, n_obs, nthread);
+    const int nworker = conv_num_workers(n_obs, chunk, nthread);
+    const int nchunk = (n_obs - 1) / chunk + 1;
+    const int flat_cols = dim.span_cols * dim.in_channels * dim.filter_rows;
+    const int res_cols = dim.conv_cols * dim.out_channels;
+    const std::size_t chunk_rows = std::size_t(dim.conv_rows) * chunk;
+    const int channel_size = dim.channel_rows * dim.channel_cols;
+    const int img_stride = dim.img_rows * dim.img_cols;
+    const int grad_stride = dim.conv_rows * res_cols;
+    // Each worker has a flat matrix, which is reused for the derivative of the flat
+    // matrix, the derivative of the results of a chunk, and the derivative of the filters
+    // in the order of the flat matrix, which is accumulated over the chunks
+    const int window_size = dim.filter_rows * dim.filter_cols * dim.in_channels;
+    const std::size_t filter_size = std::size_t(window_size) * dim.out_channels;
+    const std::size_t flat_block = Workspace::block_size<Scalar>(chunk_rows * flat_cols) / sizeof(Scalar);
+    const std::size_t res_block = Workspace::block_size<Scalar>(chunk_rows * res_cols) / sizeof(Scalar);
+    const std::size_t filter_block = Workspace::block_size<Scalar>(filter_size) / sizeof(Scalar);
+    const std::size_t gemm_bytes = conv_gemm_size<Scalar>(dim, chunk, true);
+    const std::size_t gemm_block = gemm_bytes / sizeof(Scalar);
+    Scalar* flat_data = ws.allocate<Scalar>(flat_block * nworker);
+    Scalar* dres_data = ws.allocate<Scalar>(res_block * nworker);
+    Scalar* gemm_data = ws.allocate<Scalar>(gemm_block * nworker);
+    Scalar* dfilter_data = ws.allocate<Scalar>(filter_block * nworker);
+    std::fill(dfilter_data, dfilter_data + filter_block * nworker, Scalar(0));
+    // Filters in the order of the flat matrix
+    Scalar* filter_mat = ws.allocate<Scalar>(filter_size);
+    pack_filters(dim, filter_data, filter_mat);
+    const ConstMapMat filter(filter_mat, window_size, dim.out_channels);
+    const int step = dim.stride_cols * dim.in_channels * dim.filter_rows;
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(nworker) schedule(static) if(nworker > 1)
+#endif
+    for (int c = 0; c < nchunk; c++)
     {
-        // Flatten source image
-        flatten_mat(pad_dim, src, img_stride, n_obs, flat_mat);
-        // Compute the convolution result
-        moving_product(filter_padding, step, flat_mat, filters_in[i], res);
+        const int k = c * chunk;
+        const int n = std::min(chunk, n_obs - k);
+        const int flat_rows = dim.conv_rows * n;
+        const int t = conv_thread_id();
+        MapMat flat_mat(flat_data + t * flat_block, flat_rows, flat_cols);
+        flatten_mat(dim, src + std::size_t(k) * img_stride, img_stride, channel_size, n, flat_mat);
+        pack_result(dim, n, grad + std::size_t(k) * grad_stride, dres_data + t * res_block, flat_rows);
+        const StridedMapMat dres(dres_data + t * res_block, flat_rows, res_cols, Eigen::OuterStride<>(flat_rows));
+        MapMat dfilter(dfilter_data + t * filter_block, window_size, dim.out_channels);
+        Scalar* gemm_buffer = gemm_data + t * gemm_block;
+        moving_product_filter_grad(step, flat_mat, dres, dfilter, gemm_buffer, gemm_bytes);
+
+        if (src_grad != NULL)
+        {
+            // The flat matrix is no longer needed, and is overwritten by its derivative
+            MapMat& dflat_mat = flat_mat;
+            dflat_mat.setZero();
+            moving_product_flat_grad(step, dres, filter, dflat_mat, gemm_buffer, gemm_bytes);
+            // Add the derivatives back to the images
+            Scalar* dest = src_grad + std::size_t(k) * img_stride;
+            std::fill(dest, dest + std::size_t(img_stride) * n, Scalar(0));
+            unflatten_mat(dim, dflat_mat, img_stride, channel_size, n, dest);
+        }
     }
 
-    // Copy results to destination
-    const int& dest_rows = conv_rows;
-    const int  dest_cols = res_cols * n_obs;
-    const Scalar* res_data = res.data();
-    const std::size_t copy_bytes = sizeof(Scalar) * dest_rows;
+    // Sum up the derivatives of the filters of the workers
+    MapMat dfilter(dfilter_data, window_size, dim.out_channels);
 
-    for (int b = 0; b < dest_cols; b++, dest += dest_rows)
+    for (int t = 1; t < nworker; t++)
     {
-        const int k = b / res_cols;
-        const int l = (b % res_cols) / conv_cols;
-        const int j = b % conv_cols;
-        const int d = j * dim.out_channels + l;
-        const int res_col_head = d * res_rows;
-        std::memcpy(dest, res_data + res_col_head + k * conv_rows, copy_bytes);
+        dfilter.noalias() += MapMat(dfilter_data + t * filter_block, window_size, dim.out_channels);
     }
+
+    unpack_filters(dim, dfilter.data(), filter_grad);
+    ws.release(ws_mark);
 }
 
 
@@ -17,7 +17,12 @@ enum LAYER_ENUM
 {
     FULLY_CONNECTED = 0,
     CONVOLUTIONAL,
-    MAX_POOLING
+    MAX_POOLING,
+    QUANTIZED_FULLY_CONNECTED,
+    QUANTIZED_CONVOLUTIONAL,
+    SPARSE_FULLY_CONNECTED,
+    POINTWISE_CONVOLUTIONAL,
+    GROUPED_CONVOLUTIONAL
 };
 
 // Convert a hidden layer type string to an integer
@@ -29,6 +34,16 @@ inline int layer_id(const std::string& type)
         return CONVOLUTIONAL;
     if (type == "MaxPooling")
         return MAX_POOLING;
+    if (type == "QuantizedFullyConnected")
+        return QUANTIZED_FULLY_CONNECTED;
+    if (type == "QuantizedConvolutional")
+        return QUANTIZED_CONVOLUTIONAL;
+    if (type == "SparseFullyConnected")
+        return SPARSE_FULLY_CONNECTED;
+    if (type == "PointwiseConvolutional")
+        return POINTWISE_CONVOLUTIONAL;
+    if (type == "GroupedConvolutional")
+        return GROUPED_CONVOLUTIONAL;
 
     throw std::invalid_argument("[function layer_id]: Layer is not of a known type");
     return -1;
@@ -0,0 +1,638 @@
+#ifndef UTILS_FFTCONVOLUTION_H_
+#define UTILS_FFTCONVOLUTION_H_
+
+#include <Eigen/Core>
+#include <unsupported/Eigen/FFT>
+#include <complex>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "../Config.h"
+#include "Convolution.h"
+#include "Workspace.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Convolution with the fast Fourier transform (FFT) for large filters with stride 1
+//
+// The padded input channels are divided into overlapping tiles of N_r x N_c values,
+// and each tile gives T_r x T_c output values, T_r = N_r - filter_rows + 1 and
+// T_c = N_c - filter_cols + 1 (overlap-save). The convolution of convolve_valid() is a
+// correlation, so the spectrum of an output tile is the product of the spectrum of
+// the input tile and the conjugate spectrum of the filter, summed over the input
+// channels. For each frequency this sum is a complex matrix product of the spectra of
+// all the tiles and input channels with the spectra of the filters, which needs about
+// 2 * N_r * N_c / (T_r * T_c) real multiplications per output value and pair of
+// channels instead of filter_rows * filter_cols
+//
+// The derivative of the input is the convolution of the derivative of each output
+// tile with the filters, and its N_r x N_c values are added to the input derivative
+// (overlap-add). The derivative of the filters is the correlation of the input tiles
+// with the derivative of the output tiles, which is summed over the tiles in the
+// frequency domain and transformed back once
+//
+// A 2D transform is a real FFT of each column, which gives the N_r / 2 + 1 frequencies
+// h = 0, ..., N_r / 2, followed by a complex FFT along the rows. Frequency (h, k) is
+// stored in position k * (N_r / 2 + 1) + h. The transforms are unscaled, and the
+// factor 1 / (N_r * N_c) is included in the spectra of the filters
+//
+// The dimensions and the memory layout of the images, filters and results are the
+// same as in convolve_valid() with 'image_outer_loop == true'
+//
+// Sizes of the transforms and of the tiles
+struct FFTConvDims
+{
+    const int fft_rows;   // N_r, a multiple of 4
+    const int fft_cols;   // N_c
+    const int tile_rows;  // T_r
+    const int tile_cols;  // T_c
+    const int ntile_rows; // Number of tiles along the rows of the output
+    const int ntile_cols; // Number of tiles along the columns of the output
+    const int ntile;      // Number of tiles in each channel
+    const int half_rows;  // N_r / 2 + 1
+    const int nbin;       // Number of stored frequencies
+
+    FFTConvDims(const ConvDims& dim, const int fft_rows_, const int fft_cols_) :
+        fft_rows(fft_rows_), fft_cols(fft_cols_),
+        tile_rows(fft_rows_ - dim.filter_rows + 1), tile_cols(fft_cols_ - dim.filter_cols + 1),
+        ntile_rows((dim.conv_rows - 1) / tile_rows + 1), ntile_cols((dim.conv_cols - 1) / tile_cols + 1),
+        ntile(ntile_rows * ntile_cols),
+        half_rows(fft_rows_ / 2 + 1), nbin(half_rows * fft_cols_)
+    {}
+};
+// Estimated time of the FFT convolution of one image with transforms of size
+// 'fft_rows' x 'fft_cols', in units of a multiply-add of convolve_valid(). The weights
+// of the products of the spectra and of the transforms of the input and output tiles
+// were measured on layers with 1 to 64 channels and filters of 5x5 to 15x15
+inline double fft_conv_cost(const ConvDims& dim, const int fft_rows, const int fft_cols)
+{
+    const FFTConvDims fdim(dim, fft_rows, fft_cols);
+    const double grid = double(fft_rows) * fft_cols;
+    const double prod = 8.0 * fdim.nbin * dim.in_channels * dim.out_channels;
+    const double trans = 8.0 * grid * std::log(grid) / std::log(2.0) * (dim.in_channels + dim.out_channels);
+    return fdim.ntile * (prod + trans);
+}
+// Choose the size of the transforms with the lowest cost among lengths that are
+// multiples of 4 with small prime factors. Both sizes are 0 if the filter does not
+// have stride 1
+inline void fft_conv_size(const ConvDims& dim, int& fft_rows, int& fft_cols)
+{
+    static const int lengths[] = {8, 12, 16, 20, 24, 32, 40, 48, 60, 64, 80, 96, 120, 128};
+    const int nlength = sizeof(lengths) / sizeof(lengths[0]);
+    fft_rows = fft_cols = 0;
+
+    if (dim.stride_rows != 1 || dim.stride_cols != 1)
+    {
+        return;
+    }
+
+    double best = 0.0;
+
+    for (int i = 0; i < nlength; i++)
+    {
+        for (int j = 0; j < nlength; j++)
+        {
+            // Each dimension of the grid must hold the filter, and is not larger
+            // than needed for the whole padded input
+            if (lengths[i] < dim.filter_rows || lengths[j] < dim.filter_cols ||
+                (i > 0 && lengths[i - 1] >= dim.conv_rows + dim.filter_rows - 1) ||
+                (j > 0 && lengths[j - 1] >= dim.conv_cols + dim.filter_cols - 1))
+            {
+                continue;
+            }
+
+            const double cost = fft_conv_cost(dim, lengths[i], lengths[j]);
+
+            if (fft_rows == 0 || cost < best)
+            {
+                best = cost;
+                fft_rows = lengths[i];
+                fft_cols = lengths[j];
+            }
+        }
+    }
+}
+// Whether the FFT convolution is expected to be faster than convolve_valid()
+// Small filters are left to the direct convolution or the Winograd algorithm
+inline bool fft_preferred(const ConvDims& dim)
+{
+    int fft_rows, fft_cols;
+    fft_conv_size(dim, fft_rows, fft_cols);
+
+    if (fft_rows <= 0 || dim.filter_rows * dim.filter_cols < 25)
+    {
+        return false;
+    }
+
+    const double direct = double(dim.conv_rows) * dim.conv_cols * dim.in_channels * dim.out_channels *
+                          dim.filter_rows * dim.filter_cols;
+    return fft_conv_cost(dim, fft_rows, fft_cols) < direct;
+}
+// The FFT plans and the buffers of the transforms for one thread
+// Eigen::FFT keeps its plans in the object, so each thread needs its own copy
+template <typename Scalar>
+class FFTBuffers
+{
+    public:
+        typedef std::complex<Scalar> Complex;
+
+        Eigen::FFT<Scalar>   fft;
+        std::vector<Complex> spec;     // Spectrum of a tile
+        std::vector<Complex> line_in;  // Input of a transform along the rows
+        std::vector<Complex> line_out; // Output of a transform along the rows
+        std::vector<Scalar>  grid;     // Values of a tile, an N_r x N_c column-major matrix
+
+        FFTBuffers()
+        {
+            fft.SetFlag(Eigen::FFT<Scalar>::HalfSpectrum);
+            fft.SetFlag(Eigen::FFT<Scalar>::Unscaled);
+        }
+
+        void resize(const FFTConvDims& fdim)
+        {
+            spec.resize(fdim.nbin);
+            line_in.resize(fdim.fft_cols);
+            line_out.resize(fdim.fft_cols);
+            grid.resize(std::size_t(fdim.fft_rows) * fdim.fft_cols);
+        }
+};
+// Make sure that there are buffers for 'nworker' threads
+template <typename Scalar>
+inline void fft_prepare_buffers(const FFTConvDims& fdim, const int nworker, std::vector< FFTBuffers<Scalar> >& bufs)
+{
+    if (int(bufs.size()) < nworker)
+    {
+        bufs.resize(nworker);
+    }
+
+    for (int t = 0; t < nworker; t++)
+    {
+        bufs[t].resize(fdim);
+    }
+}
+// Transform a window of 'win_rows' x 'win_cols' values of a channel with 'rows' rows and
+// 'cols' columns, starting from row 'row0' and column 'col0', to the spectrum of an
+// N_r x N_c grid. Values outside of the channel and of the window are zero
+// The spectrum is written to 'buf.spec'
+template <typename Scalar>
+inline void fft_forward(const FFTConvDims& fdim, const Scalar* channel, const int rows, const int cols,
+                        const int row0, const int col0, const int win_rows, const int win_cols,
+                        FFTBuffers<Scalar>& buf)
+{
+    typedef std::complex<Scalar> Complex;
+    const int H = fdim.half_rows;
+    Complex* spec = &buf.spec[0];
+    Scalar* column = &buf.grid[0];
+    const int first_row = std::max(0, -row0), last_row = std::min(win_rows, rows - row0);
+    const int first_col = std::max(0, -col0), last_col = std::min(win_cols, cols - col0);
+
+    // Transforms of the columns
+    for (int c = 0; c < fdim.fft_cols; c++)
+    {
+        Complex* writer = spec + c * H;
+
+        if (c < first_col || c >= last_col || first_row >= last_row)
+        {
+            std::fill(writer, writer + H, Complex(0));
+            continue;
+        }
+
+        const Scalar* reader = channel + (col0 + c) * rows + row0;
+        std::fill(column, column + first_row, Scalar(0));
+        std::copy(reader + first_row, reader + last_row, column + first_row);
+        std::fill(column + last_row, column + fdim.fft_rows, Scalar(0));
+        buf.fft.fwd(writer, column, fdim.fft_rows);
+    }
+
+    // Transforms along the rows
+    for (int h = 0; h < H; h++)
+    {
+        for (int c = 0; c < fdim.fft_cols; c++)
+        {
+            buf.line_in[c] = spec[c * H + h];
+        }
+
+        buf.fft.fwd(&buf.line_out[0], &buf.line_in[0], fdim.fft_cols);
+
+        for (int c = 0; c < fdim.fft_cols; c++)
+        {
+            spec[c * H + h] = buf.line_out[c];
+        }
+    }
+}
+// The inverse of fft_forward(), which transforms 'buf.spec' to the first 'out_cols'
+// columns of 'buf.grid'. 'buf.spec' is overwritten
+template <typename Scalar>
+inline void fft_inverse(const FFTConvDims& fdim, const int out_cols, FFTBuffers<Scalar>& buf)
+{
+    typedef std::complex<Scalar> Complex;
+    const int H = fdim.half_rows;
+    Complex* spec = &buf.spec[0];
+
+    for (int h = 0; h < H; h++)
+    {
+        for (int c = 0; c < fdim.fft_cols; c++)
+        {
+            buf.line_in[c] = spec[c * H + h];
+        }
+
+        buf.fft.inv(&buf.line_out[0], &buf.line_in[0], fdim.fft_cols);
+
+        for (int c = 0; c < fdim.fft_cols; c++)
+        {
+            spec[c * H + h] = buf.line_out[c];
+        }
+    }
+
+    for (int c = 0; c < out_cols; c++)
+    {
+        buf.fft.inv(&buf.grid[0] + c * fdim.fft_rows, spec + c * H, fdim.fft_rows);
+    }
+}
+// Length of the filter spectra
+inline std::size_t fft_filter_size(const ConvDims& dim, const FFTConvDims& fdim)
+{
+    return std::size_t(fdim.nbin) * dim.in_channels * dim.out_channels;
+}
+// Transform the filters, stored with the layout of convolve_valid(), to 'nbin' complex
+// matrices of size in_channels x out_channels. Frequency b of the conjugate spectrum
+// of the filter of input channel i and output channel o, divided by N_r * N_c, is
+// stored in matrix b, row i and column o
+template <typename Scalar>
+inline void fft_transform_filters(const ConvDims& dim, const FFTConvDims& fdim, const Scalar* filter_data,
+                                  std::complex<Scalar>* dest, FFTBuffers<Scalar>& buf)
+{
+    const int filter_size = dim.filter_rows * dim.filter_cols;
+    const std::size_t mat_size = std::size_t(dim.in_channels) * dim.out_channels;
+    const Scalar scale = Scalar(1) / (Scalar(fdim.fft_rows) * fdim.fft_cols);
+    buf.resize(fdim);
+
+    for (int i = 0; i < dim.in_channels; i++)
+    {
+        for (int o = 0; o < dim.out_channels; o++, filter_data += filter_size)
+        {
+            fft_forward(fdim, filter_data, dim.filter_rows, dim.filter_cols, 0, 0,
+                        dim.filter_rows, dim.filter_cols, buf);
+            std::complex<Scalar>* writer = dest + std::size_t(o) * dim.in_channels + i;
+
+            for (int b = 0; b < fdim.nbin; b++, writer += mat_size)
+            {
+                *writer = std::conj(buf.spec[b]) * scale;
+            }
+        }
+    }
+}
+// Spectra of all the tiles of the channels of 'n' images, each with 'channels' channels
+// of size 'rows' x 'cols'. Tile (tr, tc) covers the window of 'win_rows' x 'win_cols'
+// values starting from row (tr * T_r - pad_rows) and column (tc * T_c - pad_cols)
+// Frequency b of tile j of image k in channel l is stored in row (k * ntile + j) and
+// column l of matrix b, each with 'nrow' rows
+template <typename Scalar>
+inline void fft_transform_tiles(const FFTConvDims& fdim, const Scalar* src, const int n, const int channels,
+                                const int rows, const int cols, const int pad_rows, const int pad_cols,
+                                const int win_rows, const int win_cols,
+                                std::complex<Scalar>* dest, FFTBuffers<Scalar>& buf)
+{
+    const int nrow = n * fdim.ntile;
+    const std::size_t channel_size = std::size_t(rows) * cols;
+    const std::size_t mat_size = std::size_t(nrow) * channels;
+
+    for (int k = 0; k < n; k++)
+    {
+        for (int l = 0; l < channels; l++, src += channel_size)
+        {
+            for (int tc = 0; tc < fdim.ntile_cols; tc++)
+            {
+                for (int tr = 0; tr < fdim.ntile_rows; tr++)
+                {
+                    fft_forward(fdim, src, rows, cols, tr * fdim.tile_rows - pad_rows,
+                                tc * fdim.tile_cols - pad_cols, win_rows, win_cols, buf);
+                    const int row = k * fdim.ntile + tc * fdim.ntile_rows + tr;
+                    std::complex<Scalar>* writer = dest + std::size_t(l) * nrow + row;
+
+                    for (int b = 0; b < fdim.nbin; b++, writer += mat_size)
+                    {
+                        *writer = buf.spec[b];
+                    }
+                }
+            }
+        }
+    }
+}
+// Copy the spectrum of tile j of image k in channel l from the matrices written
+// by fft_transform_tiles() to 'buf.spec'
+template <typename Scalar>
+inline void fft_gather_tile(const FFTConvDims& fdim, const std::complex<Scalar>* src, const int nrow,
+                            const int channels, const int row, const int l, FFTBuffers<Scalar>& buf)
+{
+    const std::size_t mat_size = std::size_t(nrow) * channels;
+    const std::complex<Scalar>* reader = src + std::size_t(l) * nrow + row;
+
+    for (int b = 0; b < fdim.nbin; b++, reader += mat_size)
+    {
+        buf.spec[b] = *reader;
+    }
+}
+// The images are processed in chunks, as in convolve_valid(), so that the spectra of
+// the tiles of each chunk take about 4MB, and each thread has at least one chunk
+// Number of images in each chunk
+template <typename Scalar>
+inline int fft_chunk_size(const ConvDims& dim, const FFTConvDims& fdim, const int n_obs, const int nthread)
+{
+    const std::size_t chunk_bytes = 4 * 1024 * 1024;
+    const std::size_t obs_bytes = sizeof(std::complex<Scalar>) * fdim.nbin * fdim.ntile *
+                                  (dim.in_channels + dim.out_channels);
+    const int chunk = int(std::min(chunk_bytes / obs_bytes, std::size_t(n_obs)));
+    const int per_thread = (n_obs - 1) / nthread + 1;
+    return std::max(1, std::min(chunk, per_thread));
+}
+// Size of the workspace memory, in bytes, needed by convolve_fft() or, if 'backward' is
+// true, by convolve_fft_backward() with 'nthread' threads: the spectra of the input and
+// output tiles of a chunk for each worker, and the spectra of the derivative of the
+// filters for each worker in the backward pass
+template <typename Scalar>
+inline std::size_t fft_workspace_size(const ConvDims& dim, const FFTConvDims& fdim, const int n_obs,
+                                      const bool backward, const int nthread)
+{
+    typedef std::complex<Scalar> Complex;
+    const int chunk = fft_chunk_size<Scalar>(dim, fdim, n_obs, nthread);
+    const int nworker = conv_num_workers(n_obs, chunk, nthread);
+    const std::size_t mat_rows = std::size_t(fdim.nbin) * fdim.ntile * chunk;
+    const std::size_t filter_block = backward ? Workspace::block_size<Complex>(fft_filter_size(dim, fdim)) : 0;
+    return nworker * (Workspace::block_size<Complex>(mat_rows * dim.in_channels) +
+                      Workspace::block_size<Complex>(mat_rows * dim.out_channels) + filter_block);
+}
+template <typename Scalar>
+inline std::size_t fft_workspace_size(const ConvDims& dim, const FFTConvDims& fdim, const int n_obs,
+                                      const bool backward)
+{
+    return fft_workspace_size<Scalar>(dim, fdim, n_obs, backward, conv_num_threads());
+}
+// Number of threads used by the kernels with the memory left in 'ws'
+template <typename Scalar>
+inline int fft_kernel_threads(const ConvDims& dim, const FFTConvDims& fdim, const int n_obs,
+                              const bool backward, const Workspace& ws)
+{
+    int nthread = conv_num_threads();
+
+    while (nthread > 1 && fft_workspace_size<Scalar>(dim, fdim, n_obs, backward, nthread) > ws.available())
+    {
+        nthread--;
+    }
+
+    return nthread;
+}
+// The convolution of convolve_valid() with 'image_outer_loop == true', for filters with
+// stride 1. 'filter_spec' contains the spectra computed by fft_transform_filters(), and
+// 'bufs' holds the FFT plans and buffers of the threads, which are created if needed
+// Temporary matrices are allocated from 'ws'
+template <typename Scalar>
+inline void convolve_fft(
+    const ConvDims& dim, const FFTConvDims& fdim,
+    const Scalar* src, const int n_obs,
+    const std::complex<Scalar>* filter_spec,
+    Scalar* dest, std::vector< FFTBuffers<Scalar> >& bufs, Workspace& ws)
+{
+    typedef std::complex<Scalar> Complex;
+    typedef Eigen::Matrix<Complex, Eigen::Dynamic, Eigen::Dynamic> ComplexMatrix;
+    typedef Eigen::Map<const ComplexMatrix> ConstMapMat;
+    typedef Eigen::Map<ComplexMatrix> MapMat;
+    const std::size_t ws_mark = ws.mark();
+    const int nthread = fft_kernel_threads<Scalar>(dim, fdim, n_obs, false, ws);
+    const int chunk = fft_chunk_size<Scalar>(dim, fdim, n_obs, nthread);
+    const int nworker = conv_num_workers(n_obs, chunk, nthread);
+    const int nchunk = (n_obs - 1) / chunk + 1;
+    fft_prepare_buffers(fdim, nworker, bufs);
+    // Spectra of the input and output tiles of worker t start at
+    // 'in_data + t * in_block' and 'out_data + t * out_block'
+    const std::size_t mat_rows = std::size_t(fdim.nbin) * fdim.ntile * chunk;
+    const std::size_t in_block = Workspace::block_size<Complex>(mat_rows * dim.in_channels) / sizeof(Complex);
+    const std::size_t out_block = Workspace::block_size<Complex>(mat_rows * dim.out_channels) / sizeof(Complex);
+    Complex* in_data = ws.allocate<Complex>(in_block * nworker);
+    Complex* out_data = ws.allocate<Complex>(out_block * nworker);
+    const std::size_t img_size = std::size_t(dim.img_rows) * dim.img_cols;
+    const std::size_t channel_size = std::size_t(dim.conv_rows) * dim.conv_cols;
+    const std::size_t filter_size = std::size_t(dim.in_channels) * dim.out_channels;
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(nworker) schedule(static) if(nworker > 1)
+#endif
+    for (int c = 0; c < nchunk; c++)
+    {
+        const int k0 = c * chunk;
+        const int n = std::min(chunk, n_obs - k0);
+        const int nrow = n * fdim.ntile;
+        const int t = conv_thread_id();
+        FFTBuffers<Scalar>& buf = bufs[t];
+        Complex* in_spec = in_data + t * in_block;
+        Complex* out_spec = out_data + t * out_block;
+        fft_transform_tiles(fdim, src + k0 * img_size, n, dim.in_channels, dim.channel_rows, dim.channel_cols,
+                            dim.pad_rows, dim.pad_cols, fdim.fft_rows, fdim.fft_cols, in_spec, buf);
+
+        for (int b = 0; b < fdim.nbin; b++)
+        {
+            const ConstMapMat x(in_spec + b * std::size_t(nrow) * dim.in_channels, nrow, dim.in_channels);
+            const ConstMapMat w(filter_spec + b * filter_size, dim.in_channels, dim.out_channels);
+            MapMat y(out_spec + b * std::size_t(nrow) * dim.out_channels, nrow, dim.out_channels);
+            y.noalias() = x * w;
+        }
+
+        // Transform the output tiles back, and copy the values that are in the output
+        Scalar* channel = dest + k0 * channel_size * dim.out_channels;
+
+        for (int k = 0; k < n; k++)
+        {
+            for (int o = 0; o < dim.out_channels; o++, channel += channel_size)
+            {
+                for (int tc = 0; tc < fdim.ntile_cols; tc++)
+                {
+                    const int c0 = tc * fdim.tile_cols;
+                    const int nc = std::min(fdim.tile_cols, dim.conv_cols - c0);
+
+                    for (int tr = 0; tr < fdim.ntile_rows; tr++)
+                    {
+                        const int r0 = tr * fdim.tile_rows;
+                        const int nr = std::min(fdim.tile_rows, dim.conv_rows - r0);
+                        fft_gather_tile(fdim, out_spec, nrow, dim.out_channels,
+                                        k * fdim.ntile + tc * fdim.ntile_rows + tr, o, buf);
+                        fft_inverse(fdim, nc, buf);
+
+                        for (int z = 0; z < nc; z++)
+                        {
+                            const Scalar* reader = &buf.grid[0] + z * fdim.fft_rows;
+                            std::copy(reader, reader + nr, channel + (c0 + z) * dim.conv_rows + r0);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    ws.release(ws_mark);
+}
+// The derivatives of convolve_fft(), with the same arguments as convolve_backward()
+// The images are stored with 'image_outer_loop == true', and 'filter_spec' contains the
+// spectra computed by fft_transform_filters()
+// Temporary matrices are allocated from 'ws'
+template <typename Scalar>
+inline void convolve_fft_backward(
+    const ConvDims& dim, const FFTConvDims& fdim,
+    const Scalar* src, const int n_obs, const Scalar* grad,
+    const std::complex<Scalar>* filter_spec,
+    Scalar* filter_grad, Scalar* src_grad,
+    std::vector< FFTBuffers<Scalar> >& bufs, Workspace& ws)
+{
+    typedef std::complex<Scalar> Complex;
+    typedef Eigen::Matrix<Complex, Eigen::Dynamic, Eigen::Dynamic> ComplexMatrix;
+    typedef Eigen::Map<const ComplexMatrix> ConstMapMat;
+    typedef Eigen::Map<ComplexMatrix> MapMat;
+    const std::size_t ws_mark = ws.mark();
+    const int nthread = fft_kernel_threads<Scalar>(dim, fdim, n_obs, true, ws);
+    const int chunk = fft_chunk_size<Scalar>(dim, fdim, n_obs, nthread);
+    const int nworker = conv_num_workers(n_obs, chunk, nthread);
+    const int nchunk = (n_obs - 1) / chunk + 1;
+    fft_prepare_buffers(fdim, nworker, bufs);
+    // Each worker has the spectra of the input tiles, which are overwritten by the spectra
+    // of their derivatives, the spectra of the derivatives of the output tiles, and the
+    // spectra of the derivative of the filters, which are summed over the chunks
+    const std::size_t mat_rows = std::size_t(fdim.nbin) * fdim.ntile * chunk;
+    const std::size_t filter_size = std::size_t(dim.in_channels) * dim.out_channels;
+    const std::size_t in_block = Workspace::block_size<Complex>(mat_rows * dim.in_channels) / sizeof(Complex);
+    const std::size_t out_block = Workspace::block_size<Complex>(mat_rows * dim.out_channels) / sizeof(Complex);
+    const std::size_t filter_block = Workspace::block_size<Complex>(fft_filter_size(dim, fdim)) / sizeof(Complex);
+    Complex* in_data = ws.allocate<Complex>(in_block * nworker);
+    Complex* out_data = ws.allocate<Complex>(out_block * nworker);
+    Complex* dfilter_data = ws.allocate<Complex>(filter_block * nworker);
+    std::fill(dfilter_data, dfilter_data + filter_block * nworker, Complex(0));
+    const std::size_t img_size = std::size_t(dim.img_rows) * dim.img_cols;
+    const std::size_t channel_size = std::size_t(dim.channel_rows) * dim.channel_cols;
+    const std::size_t grad_size = std::size_t(dim.conv_rows) * dim.conv_cols * dim.out_channels;
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(nworker) schedule(static) if(nworker > 1)
+#endif
+    for (int c = 0; c < nchunk; c++)
+    {
+        const int k0 = c * chunk;
+        const int n = std::min(chunk, n_obs - k0);
+        const int nrow = n * fdim.ntile;
+        const int t = conv_thread_id();
+        FFTBuffers<Scalar>& buf = bufs[t];
+        Complex* in_spec = in_data + t * in_block;
+        Complex* out_spec = out_data + t * out_block;
+        Complex* dfilter_spec = dfilter_data + t * filter_block;
+        fft_transform_tiles(fdim, src + k0 * img_size, n, dim.in_channels, dim.channel_rows, dim.channel_cols,
+                            dim.pad_rows, dim.pad_cols, fdim.fft_rows, fdim.fft_cols, in_spec, buf);
+        // The derivative of each output tile, padded with zeros
+        fft_transform_tiles(fdim, grad + k0 * grad_size, n, dim.out_channels, dim.conv_rows, dim.conv_cols,
+                            0, 0, fdim.tile_rows, fdim.tile_cols, out_spec, buf);
+
+        for (int b = 0; b < fdim.nbin; b++)
+        {
+            MapMat x(in_spec + b * std::size_t(nrow) * dim.in_channels, nrow, dim.in_channels);
+            const ConstMapMat dy(out_spec + b * std::size_t(nrow) * dim.out_channels, nrow, dim.out_channels);
+            MapMat dw(dfilter_spec + b * filter_size, dim.in_channels, dim.out_channels);
+            dw.noalias() += x.transpose() * dy.conjugate();
+
+            if (src_grad != NULL)
+            {
+                const ConstMapMat w(filter_spec + b * filter_size, dim.in_channels, dim.out_channels);
+                x.noalias() = dy * w.adjoint();
+            }
+        }
+
+        if (src_grad == NULL)
+        {
+            continue;
+        }
+
+        // Transform the derivatives of the input tiles back, and add the values that
+        // are in the input
+        Scalar* dest = src_grad + k0 * img_size;
+        std::fill(dest, dest + n * img_size, Scalar(0));
+
+        for (int k = 0; k < n; k++)
+        {
+            for (int i = 0; i < dim.in_channels; i++, dest += channel_size)
+            {
+                for (int tc = 0; tc < fdim.ntile_cols; tc++)
+                {
+                    const int c0 = tc * fdim.tile_cols - dim.pad_cols;
+                    const int first_col = std::max(0, -c0);
+                    const int last_col = std::min(fdim.fft_cols, dim.channel_cols - c0);
+
+                    for (int tr = 0; tr < fdim.ntile_rows; tr++)
+                    {
+                        const int r0 = tr * fdim.tile_rows - dim.pad_rows;
+                        const int first_row = std::max(0, -r0);
+                        const int last_row = std::min(fdim.fft_rows, dim.channel_rows - r0);
+                        fft_gather_tile(fdim, in_spec, nrow, dim.in_channels,
+                                        k * fdim.ntile + tc * fdim.ntile_rows + tr, i, buf);
+                        fft_inverse(fdim, last_col, buf);
+
+                        for (int z = first_col; z < last_col; z++)
+                        {
+                            const Scalar* reader = &buf.grid[0] + z * fdim.fft_rows;
+                            Scalar* writer = dest + (c0 + z) * dim.channel_rows + r0;
+
+                            for (int x = first_row; x < last_row; x++)
+                            {
+                                writer[x] += reader[x];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Sum up the spectra of the workers, and transform them back
+    MapMat dfilter(dfilter_data, filter_block, 1);
+
+    for (int t = 1; t < nworker; t++)
+    {
+        dfilter.noalias() += MapMat(dfilter_data + t * filter_block, filter_block, 1);
+    }
+
+    const int filter_len = dim.filter_rows * dim.filter_cols;
+    const Scalar scale = Scalar(1) / (Scalar(fdim.fft_rows) * fdim.fft_cols);
+    FFTBuffers<Scalar>& buf = bufs[0];
+
+    for (int i = 0; i < dim.in_channels; i++)
+    {
+        for (int o = 0; o < dim.out_channels; o++, filter_grad += filter_len)
+        {
+            const Complex* reader = dfilter_data + std::size_t(o) * dim.in_channels + i;
+
+            for (int b = 0; b < fdim.nbin; b++, reader += filter_size)
+            {
+                buf.spec[b] = *reader;
+            }
+
+            fft_inverse(fdim, dim.filter_cols, buf);
+
+            for (int v = 0; v < dim.filter_cols; v++)
+            {
+                for (int u = 0; u < dim.filter_rows; u++)
+                {
+                    filter_grad[v * dim.filter_rows + u] = buf.grid[v * fdim.fft_rows + u] * scale;
+                }
+            }
+        }
+    }
+
+    ws.release(ws_mark);
+}
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_FFTCONVOLUTION_H_ */
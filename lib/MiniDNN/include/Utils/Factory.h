@@ -12,6 +12,11 @@
 #include "../Layer/FullyConnected.h"
 #include "../Layer/Convolutional.h"
 #include "../Layer/MaxPooling.h"
+#include "../Layer/QuantizedFullyConnected.h"
+#include "../Layer/QuantizedConvolutional.h"
+#include "../Layer/SparseFullyConnected.h"
+#include "../Layer/PointwiseConvolutional.h"
+#include "../Layer/GroupedConvolutional.h"
 
 #include "../Activation/Identity.h"
 #include "../Activation/ReLU.h"
@@ -32,13 +37,23 @@ namespace internal
 {
 
 
+// Value of an optional key in the network meta information, which may be absent
+// from files written by older versions
+inline int optional_meta(const std::map<std::string, int>& map, const std::string& key,
+                         const int default_value)
+{
+    std::map<std::string, int>::const_iterator it = map.find(key);
+    return (it == map.end()) ? default_value : it->second;
+}
+
 // Create a layer from the network meta information and the index of the layer
-inline Layer* create_layer(const std::map<std::string, int>& map, int index)
+template <typename Scalar>
+Layer<Scalar>* create_layer(const std::map<std::string, int>& map, int index)
 {
     std::string ind = internal::to_string(index);
     const int lay_id = map.find("Layer" + ind)->second;
     const int act_id = map.find("Activation" + ind)->second;
-    Layer* layer;
+    Layer<Scalar>* layer;
 
     if (lay_id == FULLY_CONNECTED)
     {
@@ -48,22 +63,22 @@ inline Layer* create_layer(const std::map<std::string, int>& map, int index)
         switch (act_id)
         {
         case IDENTITY:
-            layer = new FullyConnected<Identity>(in_size, out_size);
+            layer = new FullyConnected<Identity, Scalar>(in_size, out_size);
             break;
         case RELU:
-            layer = new FullyConnected<ReLU>(in_size, out_size);
+            layer = new FullyConnected<ReLU, Scalar>(in_size, out_size);
             break;
         case SIGMOID:
-            layer = new FullyConnected<Sigmoid>(in_size, out_size);
+            layer = new FullyConnected<Sigmoid, Scalar>(in_size, out_size);
             break;
         case SOFTMAX:
-            layer = new FullyConnected<Softmax>(in_size, out_size);
+            layer = new FullyConnected<Softmax, Scalar>(in_size, out_size);
             break;
         case TANH:
-            layer = new FullyConnected<Tanh>(in_size, out_size);
+            layer = new FullyConnected<Tanh, Scalar>(in_size, out_size);
             break;
         case MISH:
-            layer = new FullyConnected<Mish>(in_size, out_size);
+            layer = new FullyConnected<Mish, Scalar>(in_size, out_size);
             break;
         default:
             throw std::invalid_argument("[function create_layer]: Activation is not of a known type");
@@ -76,32 +91,42 @@ inline Layer* create_layer(const std::map<std::string, int>& map, int index)
         const int out_channels = map.find("out_channels" + ind)->second;
         const int window_width = map.find("window_width" + ind)->second;
         const int window_height = map.find("window_height" + ind)->second;
+        const int stride_width = optional_meta(map, "stride_width" + ind, 1);
+        const int stride_height = optional_meta(map, "stride_height" + ind, 1);
+        const int pad_width = optional_meta(map, "pad_width" + ind, 0);
+        const int pad_height = optional_meta(map, "pad_height" + ind, 0);
 
         switch(act_id)
         {
         case IDENTITY:
-            layer = new Convolutional<Identity>(in_width, in_height, in_channels,
-                                                out_channels, window_width, window_height);
+            layer = new Convolutional<Identity, Scalar>(in_width, in_height, in_channels,
+                                                        out_channels, window_width, window_height,
+                                                        stride_width, stride_height, pad_width, pad_height);
             break;
         case RELU:
-            layer = new Convolutional<ReLU>(in_width, in_height, in_channels,
-                                            out_channels, window_width, window_height);
+            layer = new Convolutional<ReLU, Scalar>(in_width, in_height, in_channels,
+                                                    out_channels, window_width, window_height,
+                                                    stride_width, stride_height, pad_width, pad_height);
             break;
         case SIGMOID:
-            layer = new Convolutional<Sigmoid>(in_width, in_height, in_channels,
-                                               out_channels, window_width, window_height);
+            layer = new Convolutional<Sigmoid, Scalar>(in_width, in_height, in_channels,
+                                                       out_channels, window_width, window_height,
+                                                       stride_width, stride_height, pad_width, pad_height);
             break;
         case SOFTMAX:
-            layer = new Convolutional<Softmax>(in_width, in_height, in_channels,
-                                               out_channels, window_width, window_height);
+            layer = new Convolutional<Softmax, Scalar>(in_width, in_height, in_channels,
+                                                       out_channels, window_width, window_height,
+                                                       stride_width, stride_height, pad_width, pad_height);
             break;
         case TANH:
-            layer = new Convolutional<Tanh>(in_width, in_height, in_channels,
-                                            out_channels, window_width, window_height);
+            layer = new Convolutional<Tanh, Scalar>(in_width, in_height, in_channels,
+                                                    out_channels, window_width, window_height,
+                                                    stride_width, stride_height, pad_width, pad_height);
             break;
         case MISH:
-            layer = new Convolutional<Mish>(in_width, in_height, in_channels,
-                                            out_channels, window_width, window_height);
+            layer = new Convolutional<Mish, Scalar>(in_width, in_height, in_channels,
+                                                    out_channels, window_width, window_height,
+                                                    stride_width, stride_height, pad_width, pad_height);
             break;
         default:
             throw std::invalid_argument("[function create_layer]: Activation is not of a known type");
@@ -117,33 +142,216 @@ inline Layer* create_layer(const std::map<std::string, int>& map, int index)
         switch (act_id)
         {
         case IDENTITY:
-            layer = new MaxPooling<Identity>(in_width, in_height, in_channels,
-                                             pooling_width, pooling_height);
+            layer = new MaxPooling<Identity, Scalar>(in_width, in_height, in_channels,
+                                                     pooling_width, pooling_height);
             break;
         case RELU:
-            layer = new MaxPooling<ReLU>(in_width, in_height, in_channels,
+            layer = new MaxPooling<ReLU, Scalar>(in_width, in_height, in_channels,
                                          pooling_width, pooling_height);
             break;
         case SIGMOID:
-            layer = new MaxPooling<Sigmoid>(in_width, in_height, in_channels,
-                                            pooling_width, pooling_height);
+            layer = new MaxPooling<Sigmoid, Scalar>(in_width, in_height, in_channels,
+                                                    pooling_width, pooling_height);
             break;
         case SOFTMAX:
-            layer = new MaxPooling<Softmax>(in_width, in_height, in_channels,
-                                            pooling_width, pooling_height);
+            layer = new MaxPooling<Softmax, Scalar>(in_width, in_height, in_channels,
+                                                    pooling_width, pooling_height);
             break;
         case TANH:
-            layer = new MaxPooling<Tanh>(in_width, in_height, in_channels,
+            layer = new MaxPooling<Tanh, Scalar>(in_width, in_height, in_channels,
                                          pooling_width, pooling_height);
             break;
         case MISH:
-            layer = new MaxPooling<Mish>(in_width, in_height, in_channels,
+            layer = new MaxPooling<Mish, Scalar>(in_width, in_height, in_channels,
                                          pooling_width, pooling_height);
             break;
         default:
             throw std::invalid_argument("[function create_layer]: Activation is not of a known type");
         }
 
+    } else if (lay_id == QUANTIZED_FULLY_CONNECTED) {
+        const int in_size = map.find("in_size" + ind)->second;
+        const int out_size = map.find("out_size" + ind)->second;
+
+        switch (act_id)
+        {
+        case IDENTITY:
+            layer = new QuantizedFullyConnected<Identity, Scalar>(in_size, out_size);
+            break;
+        case RELU:
+            layer = new QuantizedFullyConnected<ReLU, Scalar>(in_size, out_size);
+            break;
+        case SIGMOID:
+            layer = new QuantizedFullyConnected<Sigmoid, Scalar>(in_size, out_size);
+            break;
+        case SOFTMAX:
+            layer = new QuantizedFullyConnected<Softmax, Scalar>(in_size, out_size);
+            break;
+        case TANH:
+            layer = new QuantizedFullyConnected<Tanh, Scalar>(in_size, out_size);
+            break;
+        case MISH:
+            layer = new QuantizedFullyConnected<Mish, Scalar>(in_size, out_size);
+            break;
+        default:
+            throw std::invalid_argument("[function create_layer]: Activation is not of a known type");
+        }
+
+    } else if (lay_id == QUANTIZED_CONVOLUTIONAL) {
+        const int in_width = map.find("in_width" + ind)->second;
+        const int in_height = map.find("in_height" + ind)->second;
+        const int in_channels = map.find("in_channels" + ind)->second;
+        const int out_channels = map.find("out_channels" + ind)->second;
+        const int window_width = map.find("window_width" + ind)->second;
+        const int window_height = map.find("window_height" + ind)->second;
+        const int stride_width = optional_meta(map, "stride_width" + ind, 1);
+        const int stride_height = optional_meta(map, "stride_height" + ind, 1);
+        const int pad_width = optional_meta(map, "pad_width" + ind, 0);
+        const int pad_height = optional_meta(map, "pad_height" + ind, 0);
+
+        switch (act_id)
+        {
+        case IDENTITY:
+            layer = new QuantizedConvolutional<Identity, Scalar>(in_width, in_height, in_channels,
+                                                                 out_channels, window_width, window_height,
+                                                                 stride_width, stride_height, pad_width, pad_height);
+            break;
+        case RELU:
+            layer = new QuantizedConvolutional<ReLU, Scalar>(in_width, in_height, in_channels,
+                                                             out_channels, window_width, window_height,
+                                                             stride_width, stride_height, pad_width, pad_height);
+            break;
+        case SIGMOID:
+            layer = new QuantizedConvolutional<Sigmoid, Scalar>(in_width, in_height, in_channels,
+                                                                out_channels, window_width, window_height,
+                                                                stride_width, stride_height, pad_width, pad_height);
+            break;
+        case SOFTMAX:
+            layer = new QuantizedConvolutional<Softmax, Scalar>(in_width, in_height, in_channels,
+                                                                out_channels, window_width, window_height,
+                                                                stride_width, stride_height, pad_width, pad_height);
+            break;
+        case TANH:
+            layer = new QuantizedConvolutional<Tanh, Scalar>(in_width, in_height, in_channels,
+                                                             out_channels, window_width, window_height,
+                                                             stride_width, stride_height, pad_width, pad_height);
+            break;
+        case MISH:
+            layer = new QuantizedConvolutional<Mish, Scalar>(in_width, in_height, in_channels,
+                                                             out_channels, window_width, window_height,
+                                                             stride_width, stride_height, pad_width, pad_height);
+            break;
+        default:
+            throw std::invalid_argument("[function create_layer]: Activation is not of a known type");
+        }
+
+    } else if (lay_id == SPARSE_FULLY_CONNECTED) {
+        const int in_size = map.find("in_size" + ind)->second;
+        const int out_size = map.find("out_size" + ind)->second;
+
+        switch (act_id)
+        {
+        case IDENTITY:
+            layer = new SparseFullyConnected<Identity, Scalar>(in_size, out_size);
+            break;
+        case RELU:
+            layer = new SparseFullyConnected<ReLU, Scalar>(in_size, out_size);
+            break;
+        case SIGMOID:
+            layer = new SparseFullyConnected<Sigmoid, Scalar>(in_size, out_size);
+            break;
+        case SOFTMAX:
+            layer = new SparseFullyConnected<Softmax, Scalar>(in_size, out_size);
+            break;
+        case TANH:
+            layer = new SparseFullyConnected<Tanh, Scalar>(in_size, out_size);
+            break;
+        case MISH:
+            layer = new SparseFullyConnected<Mish, Scalar>(in_size, out_size);
+            break;
+        default:
+            throw std::invalid_argument("[function create_layer]: Activation is not of a known type");
+        }
+
+    } else if (lay_id == POINTWISE_CONVOLUTIONAL) {
+        const int in_width = map.find("in_width" + ind)->second;
+        const int in_height = map.find("in_height" + ind)->second;
+        const int in_channels = map.find("in_channels" + ind)->second;
+        const int out_channels = map.find("out_channels" + ind)->second;
+
+        switch (act_id)
+        {
+        case IDENTITY:
+            layer = new PointwiseConvolutional<Identity, Scalar>(in_width, in_height, in_channels, out_channels);
+            break;
+        case RELU:
+            layer = new PointwiseConvolutional<ReLU, Scalar>(in_width, in_height, in_channels, out_channels);
+            break;
+        case SIGMOID:
+            layer = new PointwiseConvolutional<Sigmoid, Scalar>(in_width, in_height, in_channels, out_channels);
+            break;
+        case SOFTMAX:
+            layer = new PointwiseConvolutional<Softmax, Scalar>(in_width, in_height, in_channels, out_channels);
+            break;
+        case TANH:
+            layer = new PointwiseConvolutional<Tanh, Scalar>(in_width, in_height, in_channels, out_channels);
+            break;
+        case MISH:
+            layer = new PointwiseConvolutional<Mish, Scalar>(in_width, in_height, in_channels, out_channels);
+            break;
+        default:
+            throw std::invalid_argument("[function create_layer]: Activation is not of a known type");
+        }
+
+    } else if (lay_id == GROUPED_CONVOLUTIONAL) {
+        const int in_width = map.find("in_width" + ind)->second;
+        const int in_height = map.find("in_height" + ind)->second;
+        const int in_channels = map.find("in_channels" + ind)->second;
+        const int out_channels = map.find("out_channels" + ind)->second;
+        const int window_width = map.find("window_width" + ind)->second;
+        const int window_height = map.find("window_height" + ind)->second;
+        const int groups = map.find("groups" + ind)->second;
+        const int stride_width = map.find("stride_width" + ind)->second;
+        const int stride_height = map.find("stride_height" + ind)->second;
+        const int pad_width = map.find("pad_width" + ind)->second;
+        const int pad_height = map.find("pad_height" + ind)->second;
+
+        switch (act_id)
+        {
+        case IDENTITY:
+            layer = new GroupedConvolutional<Identity, Scalar>(in_width, in_height, in_channels,
+                                                               out_channels, window_width, window_height, groups,
+                                                               stride_width, stride_height, pad_width, pad_height);
+            break;
+        case RELU:
+            layer = new GroupedConvolutional<ReLU, Scalar>(in_width, in_height, in_channels,
+                                                           out_channels, window_width, window_height, groups,
+                                                           stride_width, stride_height, pad_width, pad_height);
+            break;
+        case SIGMOID:
+            layer = new GroupedConvolutional<Sigmoid, Scalar>(in_width, in_height, in_channels,
+                                                              out_channels, window_width, window_height, groups,
+                                                              stride_width, stride_height, pad_width, pad_height);
+            break;
+        case SOFTMAX:
+            layer = new GroupedConvolutional<Softmax, Scalar>(in_width, in_height, in_channels,
+                                                              out_channels, window_width, window_height, groups,
+                                                              stride_width, stride_height, pad_width, pad_height);
+            break;
+        case TANH:
+            layer = new GroupedConvolutional<Tanh, Scalar>(in_width, in_height, in_channels,
+                                                           out_channels, window_width, window_height, groups,
+                                                           stride_width, stride_height, pad_width, pad_height);
+            break;
+        case MISH:
+            layer = new GroupedConvolutional<Mish, Scalar>(in_width, in_height, in_channels,
+                                                           out_channels, window_width, window_height, groups,
+                                                           stride_width, stride_height, pad_width, pad_height);
+            break;
+        default:
+            throw std::invalid_argument("[function create_layer]: Activation is not of a known type");
+        }
+
     } else {
 
         throw std::invalid_argument("[function create_layer]: Layer is not of a known type");
@@ -154,19 +362,20 @@ inline Layer* create_layer(const std::map<std::string, int>& map, int index)
 }
 
 // Create an output layer from the network meta information
-inline Output* create_output(const std::map<std::string, int>& map)
+template <typename Scalar>
+Output<Scalar>* create_output(const std::map<std::string, int>& map)
 {
-    Output* output;
+    Output<Scalar>* output;
     int out_id = map.find("OutputLayer")->second;
 
     switch (out_id)
     {
     case REGRESSION_MSE:
-        return new RegressionMSE();
+        return new RegressionMSE<Scalar>();
     case BINARY_CLASS_ENTROPY:
-        return new BinaryClassEntropy();
+        return new BinaryClassEntropy<Scalar>();
     case MULTI_CLASS_ENTROPY:
-        return new MultiClassEntropy();
+        return new MultiClassEntropy<Scalar>();
     default:
         throw std::invalid_argument("[function create_output]: Output is not of a known type");
     }
@@ -0,0 +1,222 @@
+#ifndef UTILS_FASTMATH_H_
+#define UTILS_FASTMATH_H_
+
+#include <Eigen/Core>
+#include "../Config.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Elementary functions of the activations, evaluated in one pass over the data
+//
+// Each function is written once with the packet operations of Eigen, which also
+// accept a single Scalar, so the same code gives the vectorized kernel and the
+// evaluation of the remaining coefficients. The functions are applied to matrices
+// through the functors below, e.g. Z.array().unaryExpr(fast_tanh_op<Scalar>())
+//
+// The fast approximations have about the accuracy of single precision:
+// - fast_exp():  relative error below 2e-7 on [-708, 709], inputs are clamped to [-745, 709]
+// - fast_tanh(): absolute error below 3e-7
+// - sigmoid(x) = [1 + tanh(x / 2)] / 2 has an absolute error below 2e-7
+
+
+// exp(x) = 2^k * exp(r), k = round(x / log(2)), |r| <= log(2) / 2
+// exp(r) is approximated by its Taylor polynomial of degree 6
+template <typename Packet>
+inline Packet fast_exp(const Packet& x)
+{
+    using namespace Eigen::internal;
+    const Packet lo = pset1<Packet>(-745.0);
+    const Packet hi = pset1<Packet>(709.0);
+    const Packet log2e = pset1<Packet>(1.4426950408889634);
+    const Packet ln2 = pset1<Packet>(0.6931471805599453);
+    const Packet half = pset1<Packet>(0.5);
+    const Packet one = pset1<Packet>(1.0);
+    const Packet xc = pmax(pmin(x, hi), lo);
+    const Packet k = pfloor(pmadd(xc, log2e, half));
+    const Packet r = psub(xc, pmul(k, ln2));
+    Packet p = pset1<Packet>(1.0 / 720);
+    p = pmadd(p, r, pset1<Packet>(1.0 / 120));
+    p = pmadd(p, r, pset1<Packet>(1.0 / 24));
+    p = pmadd(p, r, pset1<Packet>(1.0 / 6));
+    p = pmadd(p, r, half);
+    p = pmadd(p, r, one);
+    p = pmadd(p, r, one);
+    return pldexp(p, k);
+}
+
+// Rational approximation of tanh(x), with the coefficients of the float kernel of Eigen
+// tanh(x) = x * P(x^2) / Q(x^2), where |x| is clamped to 7.9 and |tanh(x)| rounds to 1
+template <typename Packet>
+inline Packet fast_tanh(const Packet& x)
+{
+    using namespace Eigen::internal;
+    const Packet clamp = pset1<Packet>(7.90531110763549805);
+    const Packet xc = pmax(pmin(x, clamp), pnegate(clamp));
+    const Packet x2 = pmul(xc, xc);
+    Packet p = pset1<Packet>(-2.76076847742355e-16);
+    p = pmadd(x2, p, pset1<Packet>(2.00018790482477e-13));
+    p = pmadd(x2, p, pset1<Packet>(-8.60467152213735e-11));
+    p = pmadd(x2, p, pset1<Packet>(5.12229709037114e-08));
+    p = pmadd(x2, p, pset1<Packet>(1.48572235717979e-05));
+    p = pmadd(x2, p, pset1<Packet>(6.37261928875436e-04));
+    p = pmadd(x2, p, pset1<Packet>(4.89352455891786e-03));
+    p = pmul(xc, p);
+    Packet q = pset1<Packet>(1.19825839466702e-06);
+    q = pmadd(x2, q, pset1<Packet>(1.18534705686654e-04));
+    q = pmadd(x2, q, pset1<Packet>(2.26843463243900e-03));
+    q = pmadd(x2, q, pset1<Packet>(4.89352518554385e-03));
+    return pdiv(p, q);
+}
+
+// exp(x), with the approximation or with the kernel of Eigen
+template <bool Fast, typename Packet>
+inline Packet exp_kernel(const Packet& x)
+{
+    return Fast ? fast_exp(x) : Eigen::internal::pexp(x);
+}
+
+// h(x) = tanh(softplus(x)) = [(1 + e)^2 - 1] / [(1 + e)^2 + 1], e = exp(x)
+// Let n = e * (e + 2), then h(x) = n / (n + 2), and
+// h'(x) = 4 * e * (e + 1) / (n + 2)^2
+// h(x) rounds to 1 for x > 20, so x is clamped there to avoid overflow, which
+// also keeps x * h'(x) small for large x
+template <typename Packet>
+inline Packet mish_clamp(const Packet& x)
+{
+    return Eigen::internal::pmin(x, Eigen::internal::pset1<Packet>(20.0));
+}
+
+// Mish(x) = x * h(x)
+template <bool Fast, typename Packet>
+inline Packet mish(const Packet& x)
+{
+    using namespace Eigen::internal;
+    const Packet two = pset1<Packet>(2.0);
+    const Packet e = exp_kernel<Fast>(mish_clamp(x));
+    const Packet n = pmul(e, padd(e, two));
+    return pmul(x, pdiv(n, padd(n, two)));
+}
+
+// Mish'(x) = h(x) + x * h'(x), with the clamped x in the second term
+template <typename Packet>
+inline Packet mish_derivative(const Packet& x)
+{
+    using namespace Eigen::internal;
+    const Packet one = pset1<Packet>(1.0);
+    const Packet two = pset1<Packet>(2.0);
+    const Packet xc = mish_clamp(x);
+    const Packet e = pexp(xc);
+    const Packet n = pmul(e, padd(e, two));
+    const Packet d = padd(n, two);
+    const Packet dh = pdiv(pmul(pset1<Packet>(4.0), pmul(e, padd(e, one))), pmul(d, d));
+    return pmadd(xc, dh, pdiv(n, d));
+}
+
+// Functors for Eigen::ArrayBase::unaryExpr()
+template <typename Scalar>
+struct fast_exp_op
+{
+    inline Scalar operator()(const Scalar& x) const { return fast_exp(x); }
+    template <typename Packet>
+    inline Packet packetOp(const Packet& x) const { return fast_exp(x); }
+};
+
+template <typename Scalar>
+struct fast_tanh_op
+{
+    inline Scalar operator()(const Scalar& x) const { return fast_tanh(x); }
+    template <typename Packet>
+    inline Packet packetOp(const Packet& x) const { return fast_tanh(x); }
+};
+
+template <typename Scalar>
+struct fast_sigmoid_op
+{
+    inline Scalar operator()(const Scalar& x) const { return packetOp(x); }
+    template <typename Packet>
+    inline Packet packetOp(const Packet& x) const
+    {
+        const Packet half = Eigen::internal::pset1<Packet>(0.5);
+        return Eigen::internal::pmadd(half, fast_tanh(Eigen::internal::pmul(half, x)), half);
+    }
+};
+
+template <typename Scalar, bool Fast>
+struct mish_op
+{
+    inline Scalar operator()(const Scalar& x) const { return mish<Fast>(x); }
+    template <typename Packet>
+    inline Packet packetOp(const Packet& x) const { return mish<Fast>(x); }
+};
+
+template <typename Scalar>
+struct mish_derivative_op
+{
+    inline Scalar operator()(const Scalar& x) const { return mish_derivative(x); }
+    template <typename Packet>
+    inline Packet packetOp(const Packet& x) const { return mish_derivative(x); }
+};
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+// The functors are vectorized whenever Eigen vectorizes exp(), whose kernel uses the
+// same packet operations
+namespace Eigen
+{
+
+namespace internal
+{
+
+
+template <typename Scalar>
+struct functor_traits< MiniDNN::internal::fast_exp_op<Scalar> >
+{
+    enum { Cost = 12 * NumTraits<Scalar>::MulCost, PacketAccess = packet_traits<Scalar>::HasExp };
+};
+
+template <typename Scalar>
+struct functor_traits< MiniDNN::internal::fast_tanh_op<Scalar> >
+{
+    enum { Cost = 12 * NumTraits<Scalar>::MulCost + scalar_div_cost<Scalar, true>::value,
+           PacketAccess = packet_traits<Scalar>::HasExp && packet_traits<Scalar>::HasDiv };
+};
+
+template <typename Scalar>
+struct functor_traits< MiniDNN::internal::fast_sigmoid_op<Scalar> >
+{
+    enum { Cost = 14 * NumTraits<Scalar>::MulCost + scalar_div_cost<Scalar, true>::value,
+           PacketAccess = packet_traits<Scalar>::HasExp && packet_traits<Scalar>::HasDiv };
+};
+
+template <typename Scalar, bool Fast>
+struct functor_traits< MiniDNN::internal::mish_op<Scalar, Fast> >
+{
+    enum { Cost = functor_traits< scalar_exp_op<Scalar> >::Cost + 4 * NumTraits<Scalar>::MulCost +
+                  scalar_div_cost<Scalar, true>::value,
+           PacketAccess = packet_traits<Scalar>::HasExp && packet_traits<Scalar>::HasDiv };
+};
+
+template <typename Scalar>
+struct functor_traits< MiniDNN::internal::mish_derivative_op<Scalar> >
+{
+    enum { Cost = functor_traits< scalar_exp_op<Scalar> >::Cost + 8 * NumTraits<Scalar>::MulCost +
+                  2 * scalar_div_cost<Scalar, true>::value,
+           PacketAccess = packet_traits<Scalar>::HasExp && packet_traits<Scalar>::HasDiv };
+};
+
+
+} // namespace internal
+
+} // namespace Eigen
+
+
+#endif /* UTILS_FASTMATH_H_ */
@@ -13,24 +13,44 @@ namespace internal
 // Find the location of the maximum element in x[0], x[1], ..., x[n-1]
 // Special cases for small n using recursive template
 // N is assumed to be >= 2
+// The recursion is written on a class, since function templates cannot be
+// partially specialized for N = 2
 template <int N>
-inline int find_max(const Scalar* x)
+struct FindMax
 {
-    const int loc = find_max < N - 1 > (x);
-    return (x[N - 1] > x[loc]) ? (N - 1) : loc;
-}
+    template <typename Scalar>
+    static inline int apply(const Scalar* x)
+    {
+        const int loc = FindMax < N - 1 >::apply(x);
+        return (x[N - 1] > x[loc]) ? (N - 1) : loc;
+    }
+};
 
 template <>
-inline int find_max<2>(const Scalar* x)
+struct FindMax<2>
 {
-    return int(x[1] > x[0]);
+    template <typename Scalar>
+    static inline int apply(const Scalar* x)
+    {
+        return int(x[1] > x[0]);
+    }
+};
+
+template <int N, typename Scalar>
+inline int find_max(const Scalar* x)
+{
+    return FindMax<N>::apply(x);
 }
 
-// n is assumed be >= 2
+// n is assumed be >= 1
+template <typename Scalar>
 inline int find_max(const Scalar* x, const int n)
 {
     switch (n)
     {
+        case 1:
+            return 0;
+
         case 2:
             return find_max<2>(x);
 
@@ -57,12 +77,19 @@ inline int find_max(const Scalar* x, const int n)
 // Find the maximum element in the block x[0:(nrow-1), 0:(ncol-1)]
 // col_stride is the distance between x[0, 0] and x[0, 1]
 // Special cases for small n
+template <typename Scalar>
 inline Scalar find_block_max(const Scalar* x, const int nrow, const int ncol,
                              const int col_stride, int& loc)
 {
     // Max element in the first column
     loc = find_max(x, nrow);
     Scalar val = x[loc];
+
+    if (ncol == 1)
+    {
+        return val;
+    }
+
     // 2nd column
     x += col_stride;
     int loc_next = find_max(x, nrow);
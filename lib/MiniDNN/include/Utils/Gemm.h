@@ -0,0 +1,154 @@
+#ifndef UTILS_GEMM_H_
+#define UTILS_GEMM_H_
+
+#include <Eigen/Core>
+#include <cstddef>
+#include <algorithm>
+#include "../Config.h"
+#include "Workspace.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Matrix products whose packing buffers are given by the caller
+//
+// For large products Eigen packs blocks of the two operands into temporary buffers,
+// which are taken from the heap when they exceed EIGEN_STACK_ALLOCATION_LIMIT.
+// gemm_add() runs the same kernel on a single thread, with the buffers carved from a
+// block of the workspace of gemm_workspace_size() bytes, so that the convolution
+// kernels, which split the batch over the threads themselves, do not touch the heap
+
+
+// The blocking of an Eigen product of a column-major result, whose buffers are set by
+// use_buffer() instead of being allocated by Eigen
+template <typename Scalar>
+class GemmBlocking: public Eigen::internal::gemm_blocking_space<Eigen::ColMajor, Scalar, Scalar,
+    Eigen::Dynamic, Eigen::Dynamic, Eigen::Dynamic, 1, false>
+{
+    private:
+        typedef Eigen::internal::gemm_blocking_space<Eigen::ColMajor, Scalar, Scalar,
+                Eigen::Dynamic, Eigen::Dynamic, Eigen::Dynamic, 1, false> Base;
+
+        // The buffers belong to the caller, and are not freed by Eigen
+        GemmBlocking(const GemmBlocking&);
+        GemmBlocking& operator=(const GemmBlocking&);
+
+    public:
+        GemmBlocking(const Eigen::Index rows, const Eigen::Index cols, const Eigen::Index depth) :
+            Base(rows, cols, depth, 1, true)
+        {}
+
+        ~GemmBlocking()
+        {
+            this->m_blockA = NULL;
+            this->m_blockB = NULL;
+        }
+
+        // Number of bytes taken by the buffers
+        std::size_t buffer_size() const
+        {
+            return Workspace::block_size<Scalar>(std::size_t(this->mc()) * this->kc()) +
+                   Workspace::block_size<Scalar>(std::size_t(this->kc()) * this->nc());
+        }
+
+        // Use 'size' bytes of memory aligned like the workspace blocks as the buffers
+        // The blocks are made smaller if they do not fit, since the blocking sizes chosen
+        // by Eigen do not always grow with the dimensions of the product. This only
+        // changes the order of the operations
+        void use_buffer(Scalar* buffer, const std::size_t size)
+        {
+            while (buffer_size() > size)
+            {
+                if (this->m_mc > 1)
+                {
+                    this->m_mc = (this->m_mc + 1) / 2;
+                }
+                else if (this->m_nc > 1)
+                {
+                    this->m_nc = (this->m_nc + 1) / 2;
+                }
+                else if (this->m_kc > 1)
+                {
+                    this->m_kc = (this->m_kc + 1) / 2;
+                }
+                else
+                {
+                    // Eigen allocates the buffers as usual
+                    return;
+                }
+            }
+
+            this->m_blockA = buffer;
+            this->m_blockB = buffer + Workspace::block_size<Scalar>(std::size_t(this->mc()) * this->kc()) / sizeof(Scalar);
+        }
+};
+
+// Size of the memory, in bytes, preferred by gemm_add() for the products whose result
+// has at most 'rows' rows and 'cols' columns, and whose inner dimension is at most
+// 'depth'
+//
+// The blocks of Eigen are bounded by the ones of a large product, which are sized for
+// the caches. This bound grows with the dimensions, so that the memory sized for a
+// batch also serves the smaller batches, while the blocking of one given product may
+// be larger, and is then reduced by use_buffer()
+template <typename Scalar>
+inline std::size_t gemm_workspace_size(const int rows, const int cols, const int depth)
+{
+    // The blocking sizes are computed without allocating memory
+    const Eigen::Index large = 1 << 16;
+    const GemmBlocking<Scalar> blocking(large, large, large);
+    const std::size_t mc = std::min<Eigen::Index>(rows, blocking.mc());
+    const std::size_t kc = std::min<Eigen::Index>(depth, blocking.kc());
+    const std::size_t nc = std::min<Eigen::Index>(cols, blocking.nc());
+    return Workspace::block_size<Scalar>(mc * kc) + Workspace::block_size<Scalar>(kc * nc);
+}
+
+// res += lhs * rhs, where 'res' is a column-major view, and 'lhs' and 'rhs' have direct
+// access to their data, possibly transposed or multiplied by a scalar
+// 'buffer' points to 'size' bytes of memory for the packed blocks, see gemm_workspace_size()
+template <typename Lhs, typename Rhs, typename Res>
+inline void gemm_add(const Lhs& a_lhs, const Rhs& a_rhs, Res res,
+                     typename Res::Scalar* buffer, const std::size_t size)
+{
+    typedef typename Res::Scalar Scalar;
+    typedef Eigen::internal::blas_traits<Lhs> LhsBlasTraits;
+    typedef Eigen::internal::blas_traits<Rhs> RhsBlasTraits;
+    typedef typename Eigen::internal::remove_all<typename LhsBlasTraits::DirectLinearAccessType>::type ActualLhs;
+    typedef typename Eigen::internal::remove_all<typename RhsBlasTraits::DirectLinearAccessType>::type ActualRhs;
+
+    // Small products and matrix-vector products do not use packing buffers
+    if (res.rows() <= 1 || res.cols() <= 1 || a_lhs.cols() == 0 ||
+        (a_rhs.rows() + res.rows() + res.cols()) < EIGEN_GEMM_TO_COEFFBASED_THRESHOLD)
+    {
+        res.noalias() += a_lhs * a_rhs;
+        return;
+    }
+
+    typename Eigen::internal::add_const_on_value_type<typename LhsBlasTraits::DirectLinearAccessType>::type
+        lhs = LhsBlasTraits::extract(a_lhs);
+    typename Eigen::internal::add_const_on_value_type<typename RhsBlasTraits::DirectLinearAccessType>::type
+        rhs = RhsBlasTraits::extract(a_rhs);
+    const Scalar alpha = LhsBlasTraits::extractScalarFactor(a_lhs) * RhsBlasTraits::extractScalarFactor(a_rhs);
+
+    GemmBlocking<Scalar> blocking(res.rows(), res.cols(), lhs.cols());
+    blocking.use_buffer(buffer, size);
+    Eigen::internal::general_matrix_matrix_product<Eigen::Index,
+        Scalar, (ActualLhs::Flags & Eigen::RowMajorBit) ? Eigen::RowMajor : Eigen::ColMajor, false,
+        Scalar, (ActualRhs::Flags & Eigen::RowMajorBit) ? Eigen::RowMajor : Eigen::ColMajor, false,
+        Eigen::ColMajor, Res::InnerStrideAtCompileTime>::run(
+            res.rows(), res.cols(), lhs.cols(),
+            lhs.data(), lhs.outerStride(), rhs.data(), rhs.outerStride(),
+            res.data(), res.innerStride(), res.outerStride(), alpha, blocking, NULL);
+}
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_GEMM_H_ */
@@ -58,9 +58,11 @@ inline bool create_directory(const std::string& dir)
 ///
 /// Write an std::vector<Scalar> vector to file
 ///
+/// \tparam Scalar      Type of the elements, whose bytes are written as is
 /// \param vec          The vector to be written to file
 /// \param filename     The filename of the output
 ///
+template <typename Scalar>
 inline void write_vector_to_file(
     const std::vector<Scalar>& vec, const std::string& filename
 )
@@ -82,6 +84,7 @@ inline void write_vector_to_file(
 /// \param filename     The filename prefix of the parameter files
 /// \param params       The parameters of the NN model
 ///
+template <typename Scalar>
 inline void write_parameters(
     const std::string& folder, const std::string& filename,
     const std::vector< std::vector< Scalar> >& params
@@ -97,9 +100,11 @@ inline void write_parameters(
 ///
 /// Read in an std::vector<Scalar> vector from file
 ///
+/// \tparam Scalar      Type of the elements stored in the file
 /// \param filename     The filename of the input
 /// \return             The vector that has been read
 ///
+template <typename Scalar>
 inline std::vector<Scalar> read_vector_from_file(const std::string& filename)
 {
 
@@ -119,11 +124,13 @@ inline std::vector<Scalar> read_vector_from_file(const std::string& filename)
 ///
 /// Read in parameters of an NN model from file
 ///
+/// \tparam Scalar      Type of the parameters stored in the files
 /// \param folder       The folder where the parameter files are stored
 /// \param filename     The filename prefix of the parameter files
 /// \param nlayer       Number of layers in the NN model
 /// \return             A vector of vectors that contains the NN parameters
 ///
+template <typename Scalar>
 inline std::vector< std::vector< Scalar> > read_parameters(
     const std::string& folder, const std::string& filename, int nlayer
 )
@@ -133,7 +140,53 @@ inline std::vector< std::vector< Scalar> > read_parameters(
 
     for (int i = 0; i < nlayer; i++)
     {
-        params.push_back(read_vector_from_file(folder + "/" + filename + to_string(i)));
+        params.push_back(read_vector_from_file<Scalar>(folder + "/" + filename + to_string(i)));
+    }
+
+    return params;
+}
+
+///
+/// Read in parameters of an NN model from file, converting them to another type
+///
+/// \tparam Scalar      Type of the returned parameters
+/// \param folder       The folder where the parameter files are stored
+/// \param filename     The filename prefix of the parameter files
+/// \param nlayer       Number of layers in the NN model
+/// \param scalar_size  Size in bytes of the parameters stored in the files,
+///                     either `sizeof(float)` or `sizeof(double)`
+/// \return             A vector of vectors that contains the NN parameters
+///
+template <typename Scalar>
+inline std::vector< std::vector< Scalar> > read_parameters(
+    const std::string& folder, const std::string& filename, int nlayer, int scalar_size
+)
+{
+    if (scalar_size == int(sizeof(Scalar)))
+    {
+        return read_parameters<Scalar>(folder, filename, nlayer);
+    }
+
+    std::vector< std::vector< Scalar> > params(nlayer);
+
+    for (int i = 0; i < nlayer; i++)
+    {
+        const std::string file = folder + "/" + filename + to_string(i);
+
+        if (scalar_size == int(sizeof(float)))
+        {
+            const std::vector<float> vec = read_vector_from_file<float>(file);
+            params[i].assign(vec.begin(), vec.end());
+        }
+        else if (scalar_size == int(sizeof(double)))
+        {
+            const std::vector<double> vec = read_vector_from_file<double>(file);
+            params[i].assign(vec.begin(), vec.end());
+        }
+        else
+        {
+            throw std::invalid_argument("Unsupported floating-point type in file " + file);
+        }
     }
 
     return params;
@@ -0,0 +1,161 @@
+#ifndef UTILS_OPTIMIZERSTATE_H_
+#define UTILS_OPTIMIZERSTATE_H_
+
+#include <Eigen/Core>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include "../Config.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// The statistics kept by an optimizer, e.g. the running averages of the gradients,
+// for all the groups of parameters that it updates
+//
+// A group is identified by the address of its gradient, and is registered the first
+// time it is updated. The statistics of all the groups are stored one after another,
+// so statistic j of the parameter i of a group starts at data(j)[offset + i], where
+// offset is returned by find(). Network updates all its parameters as one group, but
+// groups can also be the blocks of each layer, as in Layer::update(). The number of
+// updates is counted for each group, so each group advances once in a training step
+// even if the optimizer is called for several groups in that step
+//
+// Groups whose gradient has moved are removed by remove(), which compacts the
+// statistics of the other groups
+//
+// The groups are usually updated in the same order in every step, so the next group
+// is checked first and finding a group does not depend on the number of groups
+template <typename Scalar, typename StateScalar>
+class OptimizerState
+{
+    private:
+        typedef Eigen::Array<StateScalar, Eigen::Dynamic, Eigen::Dynamic> Array;
+
+        struct Group
+        {
+            const Scalar* key;    // Address of the gradient
+            int           offset; // Position of the statistics of the first parameter
+            int           size;   // Number of parameters
+            int           steps;  // Number of updates so far
+        };
+
+        std::vector<Group> m_groups;
+        std::size_t        m_next; // Group that is expected in the next call of find()
+        Array              m_data; // One column for each statistic
+
+    public:
+        explicit OptimizerState(const int nstat) :
+            m_next(0), m_data(0, nstat)
+        {}
+
+        // Remove all the groups
+        void clear()
+        {
+            m_groups.clear();
+            m_next = 0;
+            m_data.resize(0, m_data.cols());
+        }
+
+        // Position of the statistics of a group of 'size' parameters, which is updated
+        // for the 'step'-th time, starting from 1
+        // A new group starts with zero statistics. A known gradient whose size has
+        // changed, e.g. after pruning, is also registered again
+        int find(const Scalar* key, const int size, int& step)
+        {
+            const std::size_t ngroup = m_groups.size();
+            const std::size_t first = (m_next < ngroup) ? m_next : 0;
+
+            for (std::size_t k = 0; k < ngroup; k++)
+            {
+                const std::size_t i = (first + k) % ngroup;
+
+                if (m_groups[i].key != key)
+                {
+                    continue;
+                }
+
+                if (m_groups[i].size == size)
+                {
+                    m_next = i + 1;
+                    step = ++m_groups[i].steps;
+                    return m_groups[i].offset;
+                }
+
+                remove(key);
+                break;
+            }
+
+            const int offset = m_data.rows();
+            m_data.conservativeResize(offset + size, Eigen::NoChange);
+            m_data.bottomRows(size).setZero();
+            const Group group = { key, offset, size, 1 };
+            m_groups.push_back(group);
+            m_next = m_groups.size();
+            step = 1;
+            return offset;
+        }
+
+        int find(const Scalar* key, const int size)
+        {
+            int step;
+            return find(key, size, step);
+        }
+
+        // Remove the group of a gradient, if it is registered, and move the statistics
+        // of the following groups to fill its place
+        void remove(const Scalar* key)
+        {
+            const std::size_t ngroup = m_groups.size();
+            std::size_t i = 0;
+
+            while (i < ngroup && m_groups[i].key != key)
+            {
+                i++;
+            }
+
+            if (i == ngroup)
+            {
+                return;
+            }
+
+            const int offset = m_groups[i].offset;
+            const int size = m_groups[i].size;
+            const int rows = m_data.rows();
+
+            for (int j = 0; j < m_data.cols(); j++)
+            {
+                StateScalar* col = data(j);
+                std::copy(col + offset + size, col + rows, col + offset);
+            }
+
+            m_data.conservativeResize(rows - size, Eigen::NoChange);
+
+            for (std::size_t k = i + 1; k < ngroup; k++)
+            {
+                m_groups[k].offset -= size;
+            }
+
+            m_groups.erase(m_groups.begin() + i);
+            m_next = (m_next > i) ? (m_next - 1) : m_next;
+        }
+
+        // Statistic j of all the groups
+        // The pointer is invalidated when a group is registered or removed
+        StateScalar* data(const int j)
+        {
+            return m_data.data() + std::size_t(j) * m_data.rows();
+        }
+};
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_OPTIMIZERSTATE_H_ */
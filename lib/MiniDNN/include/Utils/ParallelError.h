@@ -0,0 +1,117 @@
+#ifndef UTILS_PARALLELERROR_H_
+#define UTILS_PARALLELERROR_H_
+
+#include <string>
+#include <stdexcept>
+#include "../Config.h"
+
+#if __cplusplus >= 201103L
+#include <exception>
+#endif
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// The first exception thrown by the iterations of an OpenMP loop
+//
+// An exception that leaves a parallel region terminates the program, so each
+// iteration catches it and records it with capture(), and rethrow() throws it
+// again after the region. Without C++11 the exception cannot be copied, and
+// rethrow() throws a std::runtime_error with the same message
+//
+// Usage:
+//     ParallelError error;
+//     #pragma omp parallel for
+//     for (int i = 0; i < n; i++)
+//     {
+//         try { ... }
+//         catch (...) { error.capture(); }
+//     }
+//     error.rethrow();
+class ParallelError
+{
+    private:
+#if __cplusplus >= 201103L
+        std::exception_ptr m_error;
+#else
+        bool               m_failed;
+        std::string        m_message;
+#endif
+
+    public:
+#if __cplusplus >= 201103L
+        ParallelError() {}
+#else
+        ParallelError() :
+            m_failed(false)
+        {}
+#endif
+
+        // Record the exception being handled, if it is the first one
+        // It must be called in a catch block
+        void capture()
+        {
+#if __cplusplus >= 201103L
+            std::exception_ptr error = std::current_exception();
+#else
+            std::string message = "unknown exception";
+
+            try
+            {
+                throw;
+            }
+            catch (const std::exception& e)
+            {
+                message = e.what();
+            }
+            catch (...)
+            {}
+#endif
+
+#ifdef _OPENMP
+            #pragma omp critical(minidnn_parallel_error)
+#endif
+            {
+#if __cplusplus >= 201103L
+                if (!m_error)
+                {
+                    m_error = error;
+                }
+#else
+                if (!m_failed)
+                {
+                    m_failed = true;
+                    m_message = message;
+                }
+#endif
+            }
+        }
+
+        // Throw the recorded exception, if any
+        void rethrow() const
+        {
+#if __cplusplus >= 201103L
+            if (m_error)
+            {
+                std::rethrow_exception(m_error);
+            }
+#else
+            if (m_failed)
+            {
+                throw std::runtime_error(m_message);
+            }
+#endif
+        }
+};
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_PARALLELERROR_H_ */
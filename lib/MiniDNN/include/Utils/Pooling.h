@@ -0,0 +1,307 @@
+#ifndef UTILS_POOLING_H_
+#define UTILS_POOLING_H_
+
+#include <Eigen/Core>
+#include <algorithm>
+#include "../Config.h"
+#include "Convolution.h"
+#include "BlockedLayout.h"
+#include "FindMax.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Max-pooling with the "valid" rule, on non-overlapping pool_rows x pool_cols windows
+//
+// The channels are stored one after another, each in column-major order, so an image
+// of 'n_obs' observations with 'in_channels' channels is a sequence of
+// in_channels * n_obs channels, and the results are stored in the same way. The windows
+// of a column of results are adjacent in the input, pool_rows values apart, so each
+// kernel below goes through a whole column of windows at once
+//
+// The locations of the maximums are relative to the beginning of their channel, and
+// only depend on the input channel, which makes the backward pass parallel over the
+// channels without any conflict
+
+
+// Geometry of the pooling of one channel
+struct PoolDims
+{
+    const int channel_rows;
+    const int channel_cols;
+    const int pool_rows;
+    const int pool_cols;
+    const int out_rows;
+    const int out_cols;
+
+    PoolDims(const int in_rows, const int in_cols, const int pool_rows_, const int pool_cols_) :
+        channel_rows(in_rows), channel_cols(in_cols),
+        pool_rows(pool_rows_), pool_cols(pool_cols_),
+        out_rows(in_rows / pool_rows_), out_cols(in_cols / pool_cols_)
+    {}
+
+    int channel_size() const
+    {
+        return channel_rows * channel_cols;
+    }
+
+    int out_size() const
+    {
+        return out_rows * out_cols;
+    }
+};
+
+// Maximums and their locations in 'n' adjacent windows of a fixed size, the window i
+// starting at x[i * PR]. The loops on the window are unrolled by the compiler, and
+// the comparisons are branch free. The first maximum in column-major order is
+// chosen, as in find_block_max()
+template <int PR, int PC>
+struct PoolWindowMax
+{
+    template <typename Scalar>
+    static inline void apply(const Scalar* x, const int col_stride, const int n,
+                             Scalar* z, int* loc, const int offset)
+    {
+        for (int i = 0; i < n; i++, x += PR)
+        {
+            Scalar val = x[0];
+            int pos = 0;
+
+            for (int j = 0; j < PC; j++)
+            {
+                for (int k = (j == 0 ? 1 : 0); k < PR; k++)
+                {
+                    const Scalar next = x[j * col_stride + k];
+                    const bool larger = next > val;
+                    val = larger ? next : val;
+                    pos = larger ? (j * col_stride + k) : pos;
+                }
+            }
+
+            z[i] = val;
+            loc[i] = offset + i * PR + pos;
+        }
+    }
+};
+
+// Maximums of the windows of one channel, with their locations
+template <typename Scalar>
+inline void pool_channel_max(const PoolDims& dim, const Scalar* src, Scalar* dest, int* loc)
+{
+    const int col_stride = dim.channel_rows * dim.pool_cols;
+
+    for (int c = 0, offset = 0; c < dim.out_cols; c++, offset += col_stride)
+    {
+        Scalar* z = dest + c * dim.out_rows;
+        int* l = loc + c * dim.out_rows;
+
+        if (dim.pool_rows == 2 && dim.pool_cols == 2)
+        {
+            PoolWindowMax<2, 2>::apply(src + offset, dim.channel_rows, dim.out_rows, z, l, offset);
+        }
+        else if (dim.pool_rows == 3 && dim.pool_cols == 3)
+        {
+            PoolWindowMax<3, 3>::apply(src + offset, dim.channel_rows, dim.out_rows, z, l, offset);
+        }
+        else
+        {
+            for (int r = 0, start = offset; r < dim.out_rows; r++, start += dim.pool_rows)
+            {
+                z[r] = find_block_max(src + start, dim.pool_rows, dim.pool_cols, dim.channel_rows, l[r]);
+                l[r] += start;
+            }
+        }
+    }
+}
+
+// Maximums of the windows of one channel, when their locations are not needed
+// Each value of a window is compared with a whole column of windows at once, so the
+// maximums are computed on columns of results by Eigen instead of one by one
+template <typename Scalar>
+inline void pool_channel_max(const PoolDims& dim, const Scalar* src, Scalar* dest)
+{
+    typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> Array;
+    typedef Eigen::Map<Array> MapArray;
+    typedef Eigen::Map<const Array, Eigen::Unaligned, Eigen::InnerStride<> > ConstStridedArray;
+    const Eigen::InnerStride<> window_stride(dim.pool_rows);
+    const int col_stride = dim.channel_rows * dim.pool_cols;
+
+    for (int c = 0; c < dim.out_cols; c++)
+    {
+        const Scalar* col = src + c * col_stride;
+        MapArray z(dest + c * dim.out_rows, dim.out_rows);
+        z = ConstStridedArray(col, dim.out_rows, window_stride);
+
+        for (int j = 0; j < dim.pool_cols; j++)
+        {
+            for (int k = (j == 0 ? 1 : 0); k < dim.pool_rows; k++)
+            {
+                z = z.cwiseMax(ConstStridedArray(col + j * dim.channel_rows + k, dim.out_rows, window_stride));
+            }
+        }
+    }
+}
+
+// Max-pooling of 'n_channels' channels, in parallel over the channels
+// The locations of the maximums are written to 'loc' unless it is NULL
+template <typename Scalar>
+inline void max_pool(const PoolDims& dim, const Scalar* src, const int n_channels, Scalar* dest, int* loc)
+{
+    const int in_size = dim.channel_size();
+    const int out_size = dim.out_size();
+
+#ifdef _OPENMP
+    const int nthread = std::max(1, std::min(conv_num_threads(), n_channels));
+    #pragma omp parallel for num_threads(nthread) schedule(static) if(nthread > 1)
+#endif
+    for (int i = 0; i < n_channels; i++)
+    {
+        const Scalar* in = src + std::size_t(i) * in_size;
+        Scalar* out = dest + std::size_t(i) * out_size;
+
+        if (loc == NULL)
+        {
+            pool_channel_max(dim, in, out);
+        }
+        else
+        {
+            pool_channel_max(dim, in, out, loc + std::size_t(i) * out_size);
+        }
+    }
+}
+
+// Scatter the derivatives 'grad' of 'n' parts of 'out_size' results to the locations of
+// their maximums in the parts of 'in_size' values of 'src_grad'. Each part of 'src_grad'
+// is overwritten by its own thread, which sets the derivatives to zero except at the
+// maximums
+template <typename Scalar>
+inline void scatter_pool_gradient(const Scalar* grad, const int* loc, const int n,
+                                  const int in_size, const int out_size, Scalar* src_grad)
+{
+#ifdef _OPENMP
+    const int nthread = std::max(1, std::min(conv_num_threads(), n));
+    #pragma omp parallel for num_threads(nthread) schedule(static) if(nthread > 1)
+#endif
+    for (int i = 0; i < n; i++)
+    {
+        const Scalar* g = grad + std::size_t(i) * out_size;
+        const int* l = loc + std::size_t(i) * out_size;
+        Scalar* din = src_grad + std::size_t(i) * in_size;
+        std::fill(din, din + in_size, Scalar(0));
+
+        // The windows do not overlap, so each location appears only once
+        for (int j = 0; j < out_size; j++)
+        {
+            din[l[j]] = g[j];
+        }
+    }
+}
+
+// The derivatives of the input of max_pool(), given the derivative 'grad' of the results
+// and the locations of the maximums
+template <typename Scalar>
+inline void max_pool_backward(const PoolDims& dim, const Scalar* grad, const int* loc,
+                              const int n_channels, Scalar* src_grad)
+{
+    scatter_pool_gradient(grad, loc, n_channels, dim.channel_size(), dim.out_size(), src_grad);
+}
+
+// Max-pooling of images in the blocked layout (see BlockedLayout.h)
+//
+// Each block of channels of an image is pooled like a single channel whose values are
+// packets of ChannelBlock::size channels, and the results are stored in the same layout.
+// The locations of the maximums are relative to the beginning of their block, and are
+// computed for each channel of the block with the same rule as pool_channel_max()
+template <typename Scalar>
+inline void pool_block_max(const PoolDims& dim, const Scalar* src, Scalar* dest, int* loc)
+{
+    typedef typename Eigen::internal::packet_traits<Scalar>::type Packet;
+    using namespace Eigen::internal;
+    const int cb = ChannelBlock<Scalar>::size;
+    const int col_stride = dim.channel_rows * cb;
+
+    for (int c = 0; c < dim.out_cols; c++)
+    {
+        for (int r = 0; r < dim.out_rows; r++)
+        {
+            const int start = (c * dim.pool_cols * dim.channel_rows + r * dim.pool_rows) * cb;
+            const Scalar* x = src + start;
+            const int res = (c * dim.out_rows + r) * cb;
+
+            if (loc == NULL)
+            {
+                Packet val = pload<Packet>(x);
+
+                for (int j = 0; j < dim.pool_cols; j++)
+                {
+                    for (int k = (j == 0 ? 1 : 0); k < dim.pool_rows; k++)
+                    {
+                        val = pmax(val, pload<Packet>(x + j * col_stride + k * cb));
+                    }
+                }
+
+                pstore(dest + res, val);
+                continue;
+            }
+
+            for (int lane = 0; lane < cb; lane++)
+            {
+                Scalar val = x[lane];
+                int pos = lane;
+
+                for (int j = 0; j < dim.pool_cols; j++)
+                {
+                    for (int k = (j == 0 ? 1 : 0); k < dim.pool_rows; k++)
+                    {
+                        const int offset = j * col_stride + k * cb + lane;
+                        const bool larger = x[offset] > val;
+                        val = larger ? x[offset] : val;
+                        pos = larger ? offset : pos;
+                    }
+                }
+
+                dest[res + lane] = val;
+                loc[res + lane] = start + pos;
+            }
+        }
+    }
+}
+
+// Max-pooling of 'n_blocks' blocks of channels in the blocked layout, in parallel over
+// the blocks. The locations of the maximums are written to 'loc' unless it is NULL
+template <typename Scalar>
+inline void max_pool_blocked(const PoolDims& dim, const Scalar* src, const int n_blocks, Scalar* dest, int* loc)
+{
+    const std::size_t in_size = std::size_t(dim.channel_size()) * ChannelBlock<Scalar>::size;
+    const std::size_t out_size = std::size_t(dim.out_size()) * ChannelBlock<Scalar>::size;
+
+#ifdef _OPENMP
+    const int nthread = std::max(1, std::min(conv_num_threads(), n_blocks));
+    #pragma omp parallel for num_threads(nthread) schedule(static) if(nthread > 1)
+#endif
+    for (int i = 0; i < n_blocks; i++)
+    {
+        pool_block_max(dim, src + i * in_size, dest + i * out_size, loc == NULL ? NULL : loc + i * out_size);
+    }
+}
+
+// The derivatives of the input of max_pool_blocked(), in the blocked layout
+template <typename Scalar>
+inline void max_pool_blocked_backward(const PoolDims& dim, const Scalar* grad, const int* loc,
+                                      const int n_blocks, Scalar* src_grad)
+{
+    const int cb = ChannelBlock<Scalar>::size;
+    scatter_pool_gradient(grad, loc, n_blocks, dim.channel_size() * cb, dim.out_size() * cb, src_grad);
+}
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_POOLING_H_ */
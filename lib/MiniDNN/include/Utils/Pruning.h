@@ -0,0 +1,78 @@
+#ifndef UTILS_PRUNING_H_
+#define UTILS_PRUNING_H_
+
+#include <Eigen/Core>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include "../Config.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Number of values kept when a fraction 'sparsity' of n values should be zero
+inline std::size_t num_kept(const std::size_t n, const double sparsity)
+{
+    if (sparsity < 0.0 || sparsity > 1.0)
+    {
+        throw std::invalid_argument("[function num_kept]: Sparsity must be in [0, 1]");
+    }
+
+    return std::size_t(std::floor((1.0 - sparsity) * double(n) + 0.5));
+}
+
+// Set all but the nkeep values of largest magnitude to zero
+// Values that are already zero count as removed
+template <typename Scalar>
+void prune_by_magnitude(Scalar* data, const std::size_t n, const std::size_t nkeep)
+{
+    typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> Array;
+    Eigen::Map<Array> values(data, n);
+
+    if (nkeep == 0)
+    {
+        values.setZero();
+        return;
+    }
+
+    if (std::size_t((values != Scalar(0)).count()) <= nkeep)
+    {
+        return;
+    }
+
+    // The smallest magnitude that is kept
+    std::vector<Scalar> mag(n);
+    Eigen::Map<Array>(&mag[0], n) = values.abs();
+    typename std::vector<Scalar>::iterator kth = mag.begin() + (n - nkeep);
+    std::nth_element(mag.begin(), kth, mag.end());
+    const Scalar threshold = *kth;
+    // Values equal to the threshold are kept until there are nkeep values
+    std::size_t nequal = nkeep - std::size_t((values.abs() > threshold).count());
+
+    for (std::size_t i = 0; i < n; i++)
+    {
+        const Scalar val = std::abs(data[i]);
+
+        if (val == threshold && nequal > 0)
+        {
+            nequal--;
+        }
+        else if (val <= threshold)
+        {
+            data[i] = Scalar(0);
+        }
+    }
+}
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_PRUNING_H_ */
@@ -0,0 +1,376 @@
+#ifndef UTILS_QUANTIZATION_H_
+#define UTILS_QUANTIZATION_H_
+
+#include <Eigen/Core>
+#include <stdint.h>
+#include <cstddef>
+#include "../Config.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Unroll the loops of the int8 kernel, which compilers may not do at -O2
+// Otherwise the accumulators of a register block are copied in each step
+#if defined(__clang__)
+#define MINIDNN_PRAGMA(x) _Pragma(#x)
+#define MINIDNN_UNROLL(n) MINIDNN_PRAGMA(unroll n)
+#elif defined(__GNUC__)
+#define MINIDNN_PRAGMA(x) _Pragma(#x)
+#define MINIDNN_UNROLL(n) MINIDNN_PRAGMA(GCC unroll n)
+#else
+#define MINIDNN_UNROLL(n)
+#endif
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Symmetric linear quantization: a real value x is represented by the integer
+// q = round(x / scale) clamped to [-127, 127], and is recovered as q * scale
+//
+// The range [-127, 127] is symmetric so that negating a quantized value never
+// overflows
+const int QuantMax = 127;
+
+// Scale that maps [-absmax, absmax] to [-QuantMax, QuantMax]
+template <typename Scalar>
+inline Scalar quantization_scale(const Scalar& absmax)
+{
+    return (absmax > Scalar(0)) ? absmax / Scalar(QuantMax) : Scalar(1);
+}
+
+// Quantize n values with the given scale
+template <typename Scalar>
+inline void quantize(const Scalar* src, const std::size_t n, const Scalar& scale, int8_t* dest)
+{
+    typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> Array;
+    typedef Eigen::Array<int8_t, Eigen::Dynamic, 1> QArray;
+    Eigen::Map<QArray>(dest, n) = (Eigen::Map<const Array>(src, n) * (Scalar(1) / scale)).round().
+                                  cwiseMax(Scalar(-QuantMax)).cwiseMin(Scalar(QuantMax)).template cast<int8_t>();
+}
+
+// Quantize n values with a scale chosen from their largest magnitude
+// Returns the scale
+template <typename Scalar>
+inline Scalar quantize(const Scalar* src, const std::size_t n, int8_t* dest)
+{
+    typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> Array;
+    const Scalar scale = quantization_scale(
+        n > 0 ? Scalar(Eigen::Map<const Array>(src, n).abs().maxCoeff()) : Scalar(0));
+    quantize(src, n, scale, dest);
+    return scale;
+}
+
+
+// Quantize n values with the given scale, and store them as unsigned values
+// with the zero point ZeroPoint, i.e., q + ZeroPoint
+//
+// The values are shifted before they are rounded, so the rounding is a
+// truncation of positive numbers, which is faster than round()
+const int ZeroPoint = 128;
+
+template <typename Scalar>
+inline void quantize_unsigned(const Scalar* src, const std::size_t n, const Scalar& scale, uint8_t* dest)
+{
+    typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> Array;
+    typedef Eigen::Array<uint8_t, Eigen::Dynamic, 1> UArray;
+    const Scalar lower = Scalar(ZeroPoint - QuantMax), upper = Scalar(ZeroPoint + QuantMax) + Scalar(0.5);
+    Eigen::Map<UArray>(dest, n) = (Eigen::Map<const Array>(src, n) * (Scalar(1) / scale) + (Scalar(ZeroPoint) + Scalar(0.5))).
+                                  cwiseMax(lower).cwiseMin(upper).template cast<uint8_t>();
+}
+
+// Sum of each column of an int8 matrix, used to remove the zero point of the
+// unsigned operand in gemm_u8s8()
+inline void column_sums(const int8_t* b, const int k, const int n, int32_t* sums)
+{
+    typedef Eigen::Matrix<int8_t, Eigen::Dynamic, Eigen::Dynamic> QMatrix;
+    typedef Eigen::Matrix<int32_t, Eigen::Dynamic, 1> IntVector;
+    Eigen::Map<IntVector>(sums, n) = Eigen::Map<const QMatrix>(b, k, n).template cast<int32_t>().colwise().sum().transpose();
+}
+
+
+// Building blocks of the uint8 x int8 kernel for the available instruction set
+//
+// Each step multiplies 'Width' pairs of values and accumulates the products
+// to int32 lanes. With VNNI one instruction does all of this on 32 pairs of
+// bytes. Otherwise the values are widened to int16, and the products are added
+// pairwise with int16 x int16 -> int32 multiply-add instructions, which cannot
+// overflow since every product is at most 255 * 127 in magnitude
+struct U8S8Kernel
+{
+#if defined(__AVXVNNI__) || (defined(__AVX512VNNI__) && defined(__AVX512VL__))
+    typedef __m256i Acc;
+    typedef __m256i Packet;
+    static const int Width = 32;
+
+    static Acc zero()
+    {
+        return _mm256_setzero_si256();
+    }
+
+    static Packet load_u8(const uint8_t* p)
+    {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    }
+
+    static Packet load_s8(const int8_t* p)
+    {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    }
+
+    static Acc madd(const Packet& a, const Packet& b, const Acc& acc)
+    {
+#if defined(__AVXVNNI__)
+        return _mm256_dpbusd_avx_epi32(acc, a, b);
+#else
+        return _mm256_dpbusd_epi32(acc, a, b);
+#endif
+    }
+#elif defined(__AVX2__)
+    typedef __m256i Acc;
+    typedef __m256i Packet;
+    static const int Width = 16;
+
+    static Acc zero()
+    {
+        return _mm256_setzero_si256();
+    }
+
+    static Packet load_u8(const uint8_t* p)
+    {
+        return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    }
+
+    static Packet load_s8(const int8_t* p)
+    {
+        return _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    }
+
+    static Acc madd(const Packet& a, const Packet& b, const Acc& acc)
+    {
+        return _mm256_add_epi32(acc, _mm256_madd_epi16(a, b));
+    }
+#elif defined(__SSE2__)
+    typedef __m128i Acc;
+    typedef __m128i Packet;
+    static const int Width = 8;
+
+    static Acc zero()
+    {
+        return _mm_setzero_si128();
+    }
+
+    static Packet load_u8(const uint8_t* p)
+    {
+        return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), _mm_setzero_si128());
+    }
+
+    // Duplicate each byte into a 16-bit lane and shift the sign back down
+    static Packet load_s8(const int8_t* p)
+    {
+        const __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+        return _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+    }
+
+    static Acc madd(const Packet& a, const Packet& b, const Acc& acc)
+    {
+        return _mm_add_epi32(acc, _mm_madd_epi16(a, b));
+    }
+#else
+    typedef int32_t Acc;
+    typedef int32_t Packet;
+    static const int Width = 1;
+
+    static Acc zero()
+    {
+        return 0;
+    }
+
+    static Packet load_u8(const uint8_t* p)
+    {
+        return *p;
+    }
+
+    static Packet load_s8(const int8_t* p)
+    {
+        return *p;
+    }
+
+    static Acc madd(const Packet& a, const Packet& b, const Acc& acc)
+    {
+        return acc + a * b;
+    }
+#endif
+
+    static int32_t sum(const Acc& acc)
+    {
+        int32_t res[4];
+        const Acc zero = U8S8Kernel::zero();
+        sum4(acc, zero, zero, zero, res);
+        return res[0];
+    }
+
+    // Sums of the lanes of four accumulators
+    static void sum4(const Acc& a0, const Acc& a1, const Acc& a2, const Acc& a3, int32_t* res)
+    {
+#if defined(__AVX2__)
+        const __m256i s = _mm256_hadd_epi32(_mm256_hadd_epi32(a0, a1), _mm256_hadd_epi32(a2, a3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(res),
+                         _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1)));
+#elif defined(__SSE2__)
+        // Transpose the 4 x 4 block of lanes and add the rows
+        const __m128i t0 = _mm_unpacklo_epi32(a0, a1), t1 = _mm_unpackhi_epi32(a0, a1);
+        const __m128i t2 = _mm_unpacklo_epi32(a2, a3), t3 = _mm_unpackhi_epi32(a2, a3);
+        const __m128i s = _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi64(t0, t2), _mm_unpackhi_epi64(t0, t2)),
+                                        _mm_add_epi32(_mm_unpacklo_epi64(t1, t3), _mm_unpackhi_epi64(t1, t3)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(res), s);
+#else
+        res[0] = a0;
+        res[1] = a1;
+        res[2] = a2;
+        res[3] = a3;
+#endif
+    }
+};
+
+// Length of the columns of the operands of gemm_u8s8() that hold k values,
+// padded such that the kernel does not need a scalar loop for the remainder
+// The padding of the int8 operand must be zero
+inline int padded_depth(const int k)
+{
+    return (k + U8S8Kernel::Width - 1) / U8S8Kernel::Width * U8S8Kernel::Width;
+}
+
+// Register block of the matrix product, MR columns of A times NR columns of B
+template <int MR, int NR>
+inline void gemm_u8s8_block(const int k, const uint8_t* a, const int8_t* b, const int32_t* bsum,
+                            int32_t* c, const std::ptrdiff_t rs, const std::ptrdiff_t cs)
+{
+    typedef U8S8Kernel::Acc Acc;
+    typedef U8S8Kernel::Packet Packet;
+    const std::ptrdiff_t ldk = k;
+    Acc acc[MR][NR];
+
+    for (int i = 0; i < MR; i++)
+    {
+        for (int j = 0; j < NR; j++)
+        {
+            acc[i][j] = U8S8Kernel::zero();
+        }
+    }
+
+    int p = 0;
+
+    MINIDNN_UNROLL(2)
+    for (; p + U8S8Kernel::Width <= k; p += U8S8Kernel::Width)
+    {
+        Packet vb[NR];
+
+        MINIDNN_UNROLL(8)
+        for (int j = 0; j < NR; j++)
+        {
+            vb[j] = U8S8Kernel::load_s8(b + j * ldk + p);
+        }
+
+        MINIDNN_UNROLL(8)
+        for (int i = 0; i < MR; i++)
+        {
+            const Packet va = U8S8Kernel::load_u8(a + i * ldk + p);
+
+            MINIDNN_UNROLL(8)
+            for (int j = 0; j < NR; j++)
+            {
+                acc[i][j] = U8S8Kernel::madd(va, vb[j], acc[i][j]);
+            }
+        }
+    }
+
+    // Reduce the accumulators of four columns of A together when possible
+    const int MR4 = MR / 4 * 4;
+
+    for (int j = 0; j < NR; j++)
+    {
+        int32_t res[MR + 4];
+
+        for (int i = 0; i < MR4; i += 4)
+        {
+            U8S8Kernel::sum4(acc[i][j], acc[i + 1][j], acc[i + 2][j], acc[i + 3][j], res + i);
+        }
+
+        for (int i = MR4; i < MR; i++)
+        {
+            res[i] = U8S8Kernel::sum(acc[i][j]);
+        }
+
+        for (int i = 0; i < MR; i++)
+        {
+            for (int q = p; q < k; q++)
+            {
+                res[i] += int32_t(a[i * ldk + q]) * int32_t(b[j * ldk + q]);
+            }
+
+            c[i * rs + j * cs] = res[i] - ZeroPoint * bsum[j];
+        }
+    }
+}
+
+// Product of quantized matrices with int32 results, C = (A - ZeroPoint)' * B
+//
+// A is k x m with uint8 values, as produced by quantize_unsigned(), and B is k x n
+// with int8 values. Both are column-major with leading dimension k, so each entry
+// of C is the dot product of two contiguous columns. bsum contains the sums of
+// the columns of B, see column_sums(). Entry (i, j) of C is written to
+// c[i * rs + j * cs], so C or its transpose can be stored in column-major order
+inline void gemm_u8s8(const int m, const int n, const int k, const uint8_t* a, const int8_t* b,
+                      const int32_t* bsum, int32_t* c, const std::ptrdiff_t rs, const std::ptrdiff_t cs)
+{
+    const std::ptrdiff_t ldk = k;
+    int j = 0;
+
+    // Each column of B is loaded once for four columns of A
+    for (; j + 2 <= n; j += 2)
+    {
+        const int8_t* bj = b + j * ldk;
+        int i = 0;
+
+        for (; i + 4 <= m; i += 4)
+        {
+            gemm_u8s8_block<4, 2>(k, a + i * ldk, bj, bsum + j, c + i * rs + j * cs, rs, cs);
+        }
+
+        for (; i < m; i++)
+        {
+            gemm_u8s8_block<1, 2>(k, a + i * ldk, bj, bsum + j, c + i * rs + j * cs, rs, cs);
+        }
+    }
+
+    if (j < n)
+    {
+        const int8_t* bj = b + j * ldk;
+        int i = 0;
+
+        for (; i + 4 <= m; i += 4)
+        {
+            gemm_u8s8_block<4, 1>(k, a + i * ldk, bj, bsum + j, c + i * rs + j * cs, rs, cs);
+        }
+
+        for (; i < m; i++)
+        {
+            gemm_u8s8_block<1, 1>(k, a + i * ldk, bj, bsum + j, c + i * rs + j * cs, rs, cs);
+        }
+    }
+}
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_QUANTIZATION_H_ */
@@ -0,0 +1,435 @@
+#ifndef UTILS_SEPARABLECONVOLUTION_H_
+#define UTILS_SEPARABLECONVOLUTION_H_
+
+#include <Eigen/Core>
+#include <algorithm>
+#include "../Config.h"
+#include "Convolution.h"
+#include "Workspace.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Kernels of the two parts of a depthwise separable convolution
+//
+// The pointwise convolution uses 1x1 filters without strides or padding, so each
+// output channel is a linear combination of the input channels. The channels of an
+// image are stored one after another, and the image is a matrix with one column per
+// channel, which is multiplied by the transposed filters in a single matrix product,
+// without the flat matrix of convolve_valid()
+//
+// The grouped convolution splits the input and output channels into 'groups' groups
+// of consecutive channels, and each output channel only depends on the input channels
+// of its group. With as many groups as input channels, it is the depthwise
+// convolution. Each input channel is copied once with its zero padding, and for each
+// column of an output channel of the group and each position (u, v) of the filter, the
+// column is updated with a column of the padded input channel shifted by (u, v) and
+// sampled with the strides, so the column stays in cache. This needs
+// in_channels * out_channels / groups * filter_rows * filter_cols multiplications per
+// output position, instead of in_channels * out_channels * filter_rows * filter_cols
+//
+// The filters of the pointwise convolution form an out_channels x in_channels matrix,
+// and the filters of the grouped convolution are stored as in Utils/Convolution.h with
+// in_channels / groups input channels, so both have the same layout as the filters of
+// the equivalent Convolutional layer with one group
+//
+// As in Utils/Convolution.h, the images are distributed over the OpenMP threads, and
+// each thread has its own padded channels and accumulates the derivative of the
+// filters in its own matrix
+
+
+// Number of threads of the kernels, reduced if the workspace cannot hold the
+// 'thread_size' bytes of temporary memory of each thread
+inline int separable_kernel_threads(const std::size_t thread_size, const int n_obs, const Workspace& ws)
+{
+    int nthread = std::max(1, std::min(conv_num_threads(), n_obs));
+
+    while (nthread > 1 && nthread * thread_size > ws.available())
+    {
+        nthread--;
+    }
+
+    return nthread;
+}
+// Size of the workspace memory, in bytes, needed by the kernels with 'thread_size'
+// bytes of temporary memory for each thread
+inline std::size_t separable_workspace_size(const std::size_t thread_size, const int n_obs)
+{
+    const int nthread = std::max(1, std::min(conv_num_threads(), n_obs));
+    return nthread * thread_size;
+}
+
+// Pointwise convolution of 'n_obs' images with 'in_channels' channels of 'channel_size'
+// values each, given the filters as an out_channels x in_channels matrix
+template <typename Scalar>
+inline void convolve_pointwise(
+    const int channel_size, const int in_channels, const int out_channels,
+    const Scalar* src, const int n_obs, const Scalar* filter_data, Scalar* dest)
+{
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+    typedef Eigen::Map<const Matrix> ConstMapMat;
+    typedef Eigen::Map<Matrix> MapMat;
+    const std::size_t src_stride = std::size_t(channel_size) * in_channels;
+    const std::size_t dest_stride = std::size_t(channel_size) * out_channels;
+    const ConstMapMat filter(filter_data, out_channels, in_channels);
+
+#ifdef _OPENMP
+    const int nthread = std::max(1, std::min(conv_num_threads(), n_obs));
+    #pragma omp parallel for num_threads(nthread) schedule(static) if(nthread > 1)
+#endif
+    for (int k = 0; k < n_obs; k++)
+    {
+        const ConstMapMat img(src + k * src_stride, channel_size, in_channels);
+        MapMat res(dest + k * dest_stride, channel_size, out_channels);
+        res.noalias() = img * filter.transpose();
+    }
+}
+
+// The derivatives of convolve_pointwise(), given the derivative 'grad' of the results
+// The derivatives of the filters are summed over the images, and the derivatives of
+// the images are written to 'src_grad' unless it is NULL
+template <typename Scalar>
+inline void convolve_pointwise_backward(
+    const int channel_size, const int in_channels, const int out_channels,
+    const Scalar* src, const int n_obs, const Scalar* grad, const Scalar* filter_data,
+    Scalar* filter_grad, Scalar* src_grad, Workspace& ws)
+{
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+    typedef Eigen::Map<const Matrix> ConstMapMat;
+    typedef Eigen::Map<Matrix> MapMat;
+    const std::size_t src_stride = std::size_t(channel_size) * in_channels;
+    const std::size_t grad_stride = std::size_t(channel_size) * out_channels;
+    const std::size_t filter_size = std::size_t(in_channels) * out_channels;
+    const ConstMapMat filter(filter_data, out_channels, in_channels);
+    const std::size_t ws_mark = ws.mark();
+    const std::size_t filter_block = Workspace::block_size<Scalar>(filter_size) / sizeof(Scalar);
+    const int nthread = separable_kernel_threads(filter_block * sizeof(Scalar), n_obs, ws);
+    Scalar* dfilter_data = ws.allocate<Scalar>(filter_block * nthread);
+    std::fill(dfilter_data, dfilter_data + filter_block * nthread, Scalar(0));
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(nthread) schedule(static) if(nthread > 1)
+#endif
+    for (int k = 0; k < n_obs; k++)
+    {
+        const ConstMapMat img(src + k * src_stride, channel_size, in_channels);
+        const ConstMapMat dres(grad + k * grad_stride, channel_size, out_channels);
+        MapMat dfilter(dfilter_data + conv_thread_id() * filter_block, out_channels, in_channels);
+        dfilter.noalias() += dres.transpose() * img;
+
+        if (src_grad != NULL)
+        {
+            MapMat dimg(src_grad + k * src_stride, channel_size, in_channels);
+            dimg.noalias() = dres * filter;
+        }
+    }
+
+    // Sum up the derivatives of the filters of the threads
+    MapMat dfilter(filter_grad, out_channels, in_channels);
+    dfilter = MapMat(dfilter_data, out_channels, in_channels);
+
+    for (int t = 1; t < nthread; t++)
+    {
+        dfilter.noalias() += MapMat(dfilter_data + t * filter_block, out_channels, in_channels);
+    }
+
+    ws.release(ws_mark);
+}
+
+// y[r * y_stride] += w * x[r * x_stride] for r = 0, ..., n - 1
+template <typename Scalar>
+inline void grouped_axpy(const int n, const Scalar w, const Scalar* x, const int x_stride,
+                         Scalar* y, const int y_stride)
+{
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+    typedef Eigen::Map<const Vector, 0, Eigen::InnerStride<> > ConstStridedMapVec;
+    typedef Eigen::Map<Vector, 0, Eigen::InnerStride<> > StridedMapVec;
+
+    if (x_stride == 1 && y_stride == 1)
+    {
+        Eigen::Map<Vector>(y, n) += w * Eigen::Map<const Vector>(x, n);
+        return;
+    }
+
+    StridedMapVec(y, n, Eigen::InnerStride<>(y_stride)) += w * ConstStridedMapVec(x, n, Eigen::InnerStride<>(x_stride));
+}
+// Sum of x[r * x_stride] * y[r] for r = 0, ..., n - 1
+template <typename Scalar>
+inline Scalar grouped_dot(const int n, const Scalar* x, const int x_stride, const Scalar* y)
+{
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+    typedef Eigen::Map<const Vector, 0, Eigen::InnerStride<> > ConstStridedMapVec;
+
+    if (x_stride == 1)
+    {
+        return Eigen::Map<const Vector>(x, n).dot(Eigen::Map<const Vector>(y, n));
+    }
+
+    return ConstStridedMapVec(x, n, Eigen::InnerStride<>(x_stride)).dot(Eigen::Map<const Vector>(y, n));
+}
+
+// Number of rows of an input channel with the zero padding
+inline int grouped_padded_rows(const ConvDims& dim)
+{
+    return dim.channel_rows + 2 * dim.pad_rows;
+}
+// Number of values of an input channel with the zero padding
+inline std::size_t grouped_padded_size(const ConvDims& dim)
+{
+    return std::size_t(grouped_padded_rows(dim)) * (dim.channel_cols + 2 * dim.pad_cols);
+}
+// Copy an input channel to the middle of a zero-padded channel
+template <typename Scalar>
+inline void grouped_pad_channel(const ConvDims& dim, const Scalar* in, Scalar* padded)
+{
+    const int prows = grouped_padded_rows(dim);
+    std::fill(padded, padded + grouped_padded_size(dim), Scalar(0));
+    padded += std::size_t(dim.pad_cols) * prows + dim.pad_rows;
+
+    for (int c = 0; c < dim.channel_cols; c++, in += dim.channel_rows, padded += prows)
+    {
+        std::copy(in, in + dim.channel_rows, padded);
+    }
+}
+// Add the middle of a zero-padded channel to an input channel
+template <typename Scalar>
+inline void grouped_unpad_channel(const ConvDims& dim, const Scalar* padded, Scalar* in)
+{
+    const int prows = grouped_padded_rows(dim);
+    padded += std::size_t(dim.pad_cols) * prows + dim.pad_rows;
+
+    for (int c = 0; c < dim.channel_cols; c++, in += dim.channel_rows, padded += prows)
+    {
+        Eigen::Map<Eigen::Matrix<Scalar, Eigen::Dynamic, 1> >(in, dim.channel_rows) +=
+            Eigen::Map<const Eigen::Matrix<Scalar, Eigen::Dynamic, 1> >(padded, dim.channel_rows);
+    }
+}
+
+// Convolution of one input channel 'in' with 'prows' rows, already padded, with the
+// filter 'w' of one output channel, which is added to the output channel 'out'
+// Each output column is updated by all the positions of the filter while it is in cache
+template <typename Scalar>
+inline void grouped_channel(const ConvDims& dim, const Scalar* in, const int prows,
+                            const Scalar* w, Scalar* out)
+{
+    for (int j = 0; j < dim.conv_cols; j++, out += dim.conv_rows)
+    {
+        for (int v = 0; v < dim.filter_cols; v++)
+        {
+            const Scalar* in_col = in + std::size_t(j * dim.stride_cols + v) * prows;
+
+            for (int u = 0; u < dim.filter_rows; u++)
+            {
+                grouped_axpy(dim.conv_rows, w[v * dim.filter_rows + u], in_col + u, dim.stride_rows, out, 1);
+            }
+        }
+    }
+}
+// The derivatives of grouped_channel(), given the derivative 'dout' of the output channel
+// The derivative of the filter is added to 'dw', and the derivative of the padded input
+// channel is added to 'din' unless it is NULL
+template <typename Scalar>
+inline void grouped_channel_backward(const ConvDims& dim, const Scalar* in, const int prows,
+                                     const Scalar* w, const Scalar* dout, Scalar* dw, Scalar* din)
+{
+    for (int j = 0; j < dim.conv_cols; j++, dout += dim.conv_rows)
+    {
+        for (int v = 0; v < dim.filter_cols; v++)
+        {
+            const std::size_t col_start = std::size_t(j * dim.stride_cols + v) * prows;
+
+            for (int u = 0; u < dim.filter_rows; u++)
+            {
+                const int tap = v * dim.filter_rows + u;
+                dw[tap] += grouped_dot(dim.conv_rows, in + col_start + u, dim.stride_rows, dout);
+
+                if (din != NULL)
+                {
+                    grouped_axpy(dim.conv_rows, w[tap], dout, 1, din + col_start + u, dim.stride_rows);
+                }
+            }
+        }
+    }
+}
+
+// Size of the temporary memory of each thread of the grouped convolution, in bytes:
+// the padded input channel, and in the backward pass the padded derivative of the input
+// channel and the derivatives of the filters
+template <typename Scalar>
+inline std::size_t grouped_thread_size(const ConvDims& dim, const int groups, const bool backward)
+{
+    const bool padded = (dim.pad_rows > 0 || dim.pad_cols > 0);
+    const std::size_t pad_size = padded ? Workspace::block_size<Scalar>(grouped_padded_size(dim)) : 0;
+
+    if (!backward)
+    {
+        return pad_size;
+    }
+
+    const std::size_t filter_size = std::size_t(dim.filter_rows) * dim.filter_cols *
+                                    (dim.in_channels / groups) * dim.out_channels;
+    return 2 * pad_size + Workspace::block_size<Scalar>(filter_size);
+}
+
+// Grouped convolution of 'n_obs' images, with the dimensions of the equivalent
+// dense convolution in 'dim', and the result in the layout of convolve_valid()
+// The input channels with padding are copied to temporary memory allocated from 'ws'
+template <typename Scalar>
+inline void convolve_grouped(
+    const ConvDims& dim, const int groups,
+    const Scalar* src, const int n_obs, const Scalar* filter_data, Scalar* dest, Workspace& ws)
+{
+    const int in_group = dim.in_channels / groups;
+    const int out_group = dim.out_channels / groups;
+    const int channel_size = dim.channel_rows * dim.channel_cols;
+    const int conv_size = dim.conv_rows * dim.conv_cols;
+    const std::size_t img_stride = std::size_t(channel_size) * dim.in_channels;
+    const std::size_t res_stride = std::size_t(conv_size) * dim.out_channels;
+    const int filter_area = dim.filter_rows * dim.filter_cols;
+    const bool padded = (dim.pad_rows > 0 || dim.pad_cols > 0);
+    const int prows = padded ? grouped_padded_rows(dim) : dim.channel_rows;
+    const std::size_t ws_mark = ws.mark();
+    const std::size_t thread_size = grouped_thread_size<Scalar>(dim, groups, false);
+    const int nthread = separable_kernel_threads(thread_size, n_obs, ws);
+    const std::size_t pad_block = thread_size / sizeof(Scalar);
+    Scalar* pad_data = padded ? ws.allocate<Scalar>(pad_block * nthread) : NULL;
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(nthread) schedule(static) if(nthread > 1)
+#endif
+    for (int k = 0; k < n_obs; k++)
+    {
+        const Scalar* img = src + k * img_stride;
+        Scalar* res = dest + k * res_stride;
+        Scalar* pad = padded ? pad_data + conv_thread_id() * pad_block : NULL;
+        std::fill(res, res + res_stride, Scalar(0));
+
+        // Each input channel is padded once, and used by the output channels of its group
+        for (int c = 0; c < dim.in_channels; c++)
+        {
+            const int i = c % in_group;
+            const int out_start = (c / in_group) * out_group;
+            const Scalar* in = img + std::size_t(c) * channel_size;
+
+            if (padded)
+            {
+                grouped_pad_channel(dim, in, pad);
+                in = pad;
+            }
+
+            for (int o = out_start; o < out_start + out_group; o++)
+            {
+                grouped_channel(dim, in, prows, filter_data + (std::size_t(i) * dim.out_channels + o) * filter_area,
+                                res + std::size_t(o) * conv_size);
+            }
+        }
+    }
+
+    ws.release(ws_mark);
+}
+
+// The derivatives of convolve_grouped(), given the derivative 'grad' of the results
+// The derivatives of the filters are summed over the images, and the derivatives of
+// the images are written to 'src_grad' unless it is NULL
+template <typename Scalar>
+inline void convolve_grouped_backward(
+    const ConvDims& dim, const int groups,
+    const Scalar* src, const int n_obs, const Scalar* grad, const Scalar* filter_data,
+    Scalar* filter_grad, Scalar* src_grad, Workspace& ws)
+{
+    const int in_group = dim.in_channels / groups;
+    const int out_group = dim.out_channels / groups;
+    const int channel_size = dim.channel_rows * dim.channel_cols;
+    const int conv_size = dim.conv_rows * dim.conv_cols;
+    const std::size_t img_stride = std::size_t(channel_size) * dim.in_channels;
+    const std::size_t grad_stride = std::size_t(conv_size) * dim.out_channels;
+    const int filter_area = dim.filter_rows * dim.filter_cols;
+    const std::size_t filter_size = std::size_t(filter_area) * in_group * dim.out_channels;
+    const bool padded = (dim.pad_rows > 0 || dim.pad_cols > 0);
+    const int prows = padded ? grouped_padded_rows(dim) : dim.channel_rows;
+    const std::size_t ws_mark = ws.mark();
+    const int nthread = separable_kernel_threads(grouped_thread_size<Scalar>(dim, groups, true), n_obs, ws);
+    const std::size_t pad_block = padded ? Workspace::block_size<Scalar>(grouped_padded_size(dim)) / sizeof(Scalar) : 0;
+    const std::size_t filter_block = Workspace::block_size<Scalar>(filter_size) / sizeof(Scalar);
+    Scalar* dfilter_data = ws.allocate<Scalar>(filter_block * nthread);
+    Scalar* pad_data = padded ? ws.allocate<Scalar>(2 * pad_block * nthread) : NULL;
+    std::fill(dfilter_data, dfilter_data + filter_block * nthread, Scalar(0));
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(nthread) schedule(static) if(nthread > 1)
+#endif
+    for (int k = 0; k < n_obs; k++)
+    {
+        const Scalar* img = src + k * img_stride;
+        const Scalar* dres = grad + k * grad_stride;
+        Scalar* dimg = (src_grad == NULL) ? NULL : src_grad + k * img_stride;
+        const int t = conv_thread_id();
+        Scalar* dfilter = dfilter_data + t * filter_block;
+        Scalar* pad = padded ? pad_data + 2 * t * pad_block : NULL;
+        Scalar* dpad = padded ? pad + pad_block : NULL;
+
+        for (int c = 0; c < dim.in_channels; c++)
+        {
+            const int i = c % in_group;
+            const int out_start = (c / in_group) * out_group;
+            const Scalar* in = img + std::size_t(c) * channel_size;
+            Scalar* din = (dimg == NULL) ? NULL : dimg + std::size_t(c) * channel_size;
+
+            if (padded)
+            {
+                grouped_pad_channel(dim, in, pad);
+                in = pad;
+            }
+
+            if (din != NULL)
+            {
+                std::fill(din, din + channel_size, Scalar(0));
+
+                if (padded)
+                {
+                    std::fill(dpad, dpad + grouped_padded_size(dim), Scalar(0));
+                }
+            }
+
+            Scalar* din_acc = (din != NULL && padded) ? dpad : din;
+
+            for (int o = out_start; o < out_start + out_group; o++)
+            {
+                const std::size_t filter_offset = (std::size_t(i) * dim.out_channels + o) * filter_area;
+                grouped_channel_backward(dim, in, prows, filter_data + filter_offset,
+                                         dres + std::size_t(o) * conv_size, dfilter + filter_offset, din_acc);
+            }
+
+            if (din != NULL && padded)
+            {
+                grouped_unpad_channel(dim, dpad, din);
+            }
+        }
+    }
+
+    // Sum up the derivatives of the filters of the threads
+    std::copy(dfilter_data, dfilter_data + filter_size, filter_grad);
+
+    for (int t = 1; t < nthread; t++)
+    {
+        const Scalar* partial = dfilter_data + t * filter_block;
+
+        for (std::size_t j = 0; j < filter_size; j++)
+        {
+            filter_grad[j] += partial[j];
+        }
+    }
+
+    ws.release(ws_mark);
+}
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_SEPARABLECONVOLUTION_H_ */
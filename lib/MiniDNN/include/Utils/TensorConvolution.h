@@ -0,0 +1,147 @@
+#ifndef UTILS_TENSORCONVOLUTION_H_
+#define UTILS_TENSORCONVOLUTION_H_
+
+#include "../Config.h"
+#include "Convolution.h"
+
+// This header is only included when MINIDNN_USE_EIGEN_TENSOR is defined, see Config.h
+#if __cplusplus < 201103L
+#error "[TensorConvolution.h]: MINIDNN_USE_EIGEN_TENSOR requires C++11"
+#endif
+
+// The thread pool device of the Tensor module is only defined with EIGEN_USE_THREADS,
+// which must be defined before Eigen is first included
+#ifndef EIGEN_USE_THREADS
+#error "[TensorConvolution.h]: MINIDNN_USE_EIGEN_TENSOR requires EIGEN_USE_THREADS to be defined"
+#endif
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated"
+#pragma GCC diagnostic ignored "-Wenum-compare"
+#include <unsupported/Eigen/CXX11/Tensor>
+#pragma GCC diagnostic pop
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Convolution with the Eigen Tensor module, evaluated on a thread pool device
+//
+// The input of 'n_obs' images is seen as a tensor of 1 x channel_rows x channel_cols x
+// (in_channels * n_obs) values, from which extract_image_patches() takes the
+// filter_rows x filter_cols patches at the positions of the filter, including the
+// zero padding and the strides. The patches form a tensor of
+// (filter_rows * filter_cols) x P x in_channels x n_obs values, P = conv_rows * conv_cols,
+// and the filters of Utils/Convolution.h are a tensor of
+// (filter_rows * filter_cols) x out_channels x in_channels values, so the convolution
+// is a contraction over the patch elements and the input channels, whose result is
+// reordered to the layout of 'dest' in convolve_valid()
+//
+// The derivative of the filters contracts the same patches with the derivative of the
+// result over the positions and the observations. The derivative of the input is the
+// convolution of the derivative of the result with the rotated filters, where the
+// derivative is inflated by the strides and padded with filter_rows - 1 - pad_rows
+// zero rows on the top and filter_cols - 1 - pad_cols zero columns on the left
+//
+// The contractions use the blocked and multithreaded kernels of the Tensor module,
+// and the temporary memory is allocated by the device
+
+
+// Tensor views of the data
+template <typename Scalar>
+struct TensorConvTypes
+{
+    typedef Eigen::TensorMap< Eigen::Tensor<const Scalar, 4> > ConstMap4;
+    typedef Eigen::TensorMap< Eigen::Tensor<const Scalar, 3> > ConstMap3;
+    typedef Eigen::TensorMap< Eigen::Tensor<Scalar, 3> >       Map3;
+    typedef Eigen::IndexPair<int>                             Pair;
+};
+
+// Same as convolve_valid() with 'image_outer_loop == true', computed on 'device'
+template <typename Scalar>
+inline void convolve_tensor(
+    const ConvDims& dim,
+    const Scalar* src, const int n_obs, const Scalar* filter_data, Scalar* dest,
+    const Eigen::ThreadPoolDevice& device)
+{
+    typedef TensorConvTypes<Scalar> Types;
+    const Eigen::Index fsize = Eigen::Index(dim.filter_rows) * dim.filter_cols;
+    const Eigen::Index npos = Eigen::Index(dim.conv_rows) * dim.conv_cols;
+    typename Types::ConstMap4 in(src, 1, dim.channel_rows, dim.channel_cols,
+                                 Eigen::Index(dim.in_channels) * n_obs);
+    typename Types::ConstMap3 filter(filter_data, fsize, dim.out_channels, dim.in_channels);
+    typename Types::Map3 out(dest, npos, dim.out_channels, n_obs);
+    const Eigen::array<Eigen::Index, 4> patch_shape = {{ fsize, npos, dim.in_channels, n_obs }};
+    const Eigen::array<typename Types::Pair, 2> contract_dims = {{ typename Types::Pair(0, 0),
+                                                                  typename Types::Pair(2, 2) }};
+    const Eigen::array<int, 3> order = {{ 0, 2, 1 }};
+    out.device(device) = in.extract_image_patches(dim.filter_rows, dim.filter_cols,
+                                                  dim.stride_rows, dim.stride_cols, 1, 1, 1, 1,
+                                                  dim.pad_rows, dim.pad_rows, dim.pad_cols, dim.pad_cols,
+                                                  Scalar(0))
+                         .reshape(patch_shape).contract(filter, contract_dims).shuffle(order);
+}
+
+// Same as convolve_backward(), computed on 'device'
+// The derivatives of the images are written to 'src_grad' unless it is NULL
+template <typename Scalar>
+inline void convolve_tensor_backward(
+    const ConvDims& dim,
+    const Scalar* src, const int n_obs, const Scalar* grad, const Scalar* filter_data,
+    Scalar* filter_grad, Scalar* src_grad, const Eigen::ThreadPoolDevice& device)
+{
+    typedef TensorConvTypes<Scalar> Types;
+    const Eigen::Index fsize = Eigen::Index(dim.filter_rows) * dim.filter_cols;
+    const Eigen::Index npos = Eigen::Index(dim.conv_rows) * dim.conv_cols;
+    const Eigen::array<int, 3> order = {{ 0, 2, 1 }};
+    // Derivative of the filters, contracted over the positions and the observations
+    typename Types::ConstMap4 in(src, 1, dim.channel_rows, dim.channel_cols,
+                                 Eigen::Index(dim.in_channels) * n_obs);
+    typename Types::ConstMap3 dres(grad, npos, dim.out_channels, n_obs);
+    typename Types::Map3 dfilter(filter_grad, fsize, dim.out_channels, dim.in_channels);
+    const Eigen::array<Eigen::Index, 4> patch_shape = {{ fsize, npos, dim.in_channels, n_obs }};
+    const Eigen::array<typename Types::Pair, 2> filter_dims = {{ typename Types::Pair(1, 0),
+                                                                typename Types::Pair(3, 2) }};
+    dfilter.device(device) = in.extract_image_patches(dim.filter_rows, dim.filter_cols,
+                                                      dim.stride_rows, dim.stride_cols, 1, 1, 1, 1,
+                                                      dim.pad_rows, dim.pad_rows, dim.pad_cols, dim.pad_cols,
+                                                      Scalar(0))
+                             .reshape(patch_shape).contract(dres, filter_dims).shuffle(order);
+
+    if (src_grad == NULL)
+    {
+        return;
+    }
+
+    // Derivative of the images, the "full" convolution of the inflated derivative
+    // of the result with the rotated filters. The bottom and right paddings make the
+    // result as large as the input, so they also cover the input rows and columns
+    // that were not reached by the filter
+    const Eigen::Index nin = Eigen::Index(dim.channel_rows) * dim.channel_cols;
+    const int pad_top = dim.filter_rows - 1 - dim.pad_rows;
+    const int pad_left = dim.filter_cols - 1 - dim.pad_cols;
+    const int pad_bottom = dim.channel_rows + dim.pad_rows - 1 - (dim.conv_rows - 1) * dim.stride_rows;
+    const int pad_right = dim.channel_cols + dim.pad_cols - 1 - (dim.conv_cols - 1) * dim.stride_cols;
+    typename Types::ConstMap4 dout(grad, 1, dim.conv_rows, dim.conv_cols,
+                                   Eigen::Index(dim.out_channels) * n_obs);
+    typename Types::ConstMap3 filter(filter_data, fsize, dim.out_channels, dim.in_channels);
+    typename Types::Map3 din(src_grad, nin, dim.in_channels, n_obs);
+    const Eigen::array<Eigen::Index, 4> dpatch_shape = {{ fsize, nin, dim.out_channels, n_obs }};
+    const Eigen::array<typename Types::Pair, 2> input_dims = {{ typename Types::Pair(0, 0),
+                                                               typename Types::Pair(2, 1) }};
+    const Eigen::array<bool, 3> rotate = {{ true, false, false }};
+    din.device(device) = dout.extract_image_patches(dim.filter_rows, dim.filter_cols, 1, 1, 1, 1,
+                                                    dim.stride_rows, dim.stride_cols,
+                                                    pad_top, pad_bottom, pad_left, pad_right, Scalar(0))
+                         .reshape(dpatch_shape).contract(filter.reverse(rotate), input_dims).shuffle(order);
+}
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+#endif /* UTILS_TENSORCONVOLUTION_H_ */
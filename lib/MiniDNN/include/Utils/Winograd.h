@@ -0,0 +1,522 @@
+#ifndef UTILS_WINOGRAD_H_
+#define UTILS_WINOGRAD_H_
+
+#include <Eigen/Core>
+#include <algorithm>
+#include "../Config.h"
+#include "Convolution.h"
+#include "Workspace.h"
+#include "Gemm.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// Winograd minimal filtering for 3x3 filters with stride 1
+// Algorithm is based on https://arxiv.org/abs/1509.09308
+//
+// The output of each channel is divided into tiles of M x M values, and each tile
+// is computed from an A x A tile of the padded input, A = M + 2, as
+//     Y = AT * [(G * g * GT) .* (BT * d * B)] * A
+// where g is the 3x3 filter and d is the input tile. The element-wise product is a
+// sum over the input channels, so for each of the A x A positions of the transformed
+// tiles the convolution is a matrix product of the transformed input tiles of all
+// the images and channels with the transformed filters. This needs A^2 / M^2
+// multiplications per output value instead of 9, i.e. 4 for F(2x2, 3x3) and 2.25 for
+// F(4x4, 3x3), at the cost of some rounding error, which grows with the tile size
+//
+// The dimensions and the memory layout of the images, filters and results are the
+// same as in convolve_valid() with 'image_outer_loop == true'
+//
+// Transforms of F(M x M, 3 x 3)
+// The input and output transforms are applied to L tiles at a time, and each of the
+// A values of a row or column of the tiles is a vector of L values, with a distance
+// of DS or RS between two vectors. The distances are constants, so that the loops on
+// the tiles are vectorized
+template <int M>
+struct WinogradTransform;
+
+template <>
+struct WinogradTransform<2>
+{
+    // A x 3 matrix G, row-major
+    static const double* g()
+    {
+        static const double m[] = {
+            1,    0,   0,
+            0.5,  0.5, 0.5,
+            0.5, -0.5, 0.5,
+            0,    0,   1
+        };
+        return m;
+    }
+    // r = BT * d
+    template <int L, int DS, int RS, typename Scalar>
+    static void input(const Scalar* d, Scalar* r)
+    {
+        for (int l = 0; l < L; l++)
+        {
+            const Scalar d0 = d[l], d1 = d[DS + l], d2 = d[2 * DS + l], d3 = d[3 * DS + l];
+            r[l] = d0 - d2;
+            r[RS + l] = d1 + d2;
+            r[2 * RS + l] = d2 - d1;
+            r[3 * RS + l] = d1 - d3;
+        }
+    }
+    // r = AT * d
+    template <int L, int DS, int RS, typename Scalar>
+    static void output(const Scalar* d, Scalar* r)
+    {
+        for (int l = 0; l < L; l++)
+        {
+            const Scalar d0 = d[l], d1 = d[DS + l], d2 = d[2 * DS + l], d3 = d[3 * DS + l];
+            r[l] = d0 + d1 + d2;
+            r[RS + l] = d1 - d2 - d3;
+        }
+    }
+};
+
+template <>
+struct WinogradTransform<4>
+{
+    static const double* g()
+    {
+        static const double m[] = {
+            1.0 / 4,   0,          0,
+            -1.0 / 6,  -1.0 / 6,   -1.0 / 6,
+            -1.0 / 6,  1.0 / 6,    -1.0 / 6,
+            1.0 / 24,  1.0 / 12,   1.0 / 6,
+            1.0 / 24,  -1.0 / 12,  1.0 / 6,
+            0,         0,          1
+        };
+        return m;
+    }
+    template <int L, int DS, int RS, typename Scalar>
+    static void input(const Scalar* d, Scalar* r)
+    {
+        for (int l = 0; l < L; l++)
+        {
+            const Scalar d0 = d[l], d1 = d[DS + l], d2 = d[2 * DS + l],
+                         d3 = d[3 * DS + l], d4 = d[4 * DS + l], d5 = d[5 * DS + l];
+            r[l] = Scalar(4) * d0 - Scalar(5) * d2 + d4;
+            r[RS + l] = d3 + d4 - Scalar(4) * (d1 + d2);
+            r[2 * RS + l] = d4 - d3 + Scalar(4) * (d1 - d2);
+            r[3 * RS + l] = d4 - d2 + Scalar(2) * (d3 - d1);
+            r[4 * RS + l] = d4 - d2 + Scalar(2) * (d1 - d3);
+            r[5 * RS + l] = Scalar(4) * d1 - Scalar(5) * d3 + d5;
+        }
+    }
+    template <int L, int DS, int RS, typename Scalar>
+    static void output(const Scalar* d, Scalar* r)
+    {
+        for (int l = 0; l < L; l++)
+        {
+            const Scalar d0 = d[l], d1 = d[DS + l], d2 = d[2 * DS + l],
+                         d3 = d[3 * DS + l], d4 = d[4 * DS + l], d5 = d[5 * DS + l];
+            const Scalar s12 = d1 + d2, s34 = d3 + d4, t12 = d1 - d2, t34 = d3 - d4;
+            r[l] = d0 + s12 + s34;
+            r[RS + l] = t12 + Scalar(2) * t34;
+            r[2 * RS + l] = s12 + Scalar(4) * s34;
+            r[3 * RS + l] = t12 + Scalar(8) * t34 + d5;
+        }
+    }
+};
+// Number of transformed tiles, and of tiles of the output of each channel
+inline int winograd_tiles(const ConvDims& dim, const int tile)
+{
+    return ((dim.conv_rows - 1) / tile + 1) * ((dim.conv_cols - 1) / tile + 1);
+}
+// Output tile size used for a convolution: 2 or 4, whichever needs fewer
+// multiplications after rounding the output up to whole tiles, or 0 if the
+// Winograd algorithm does not apply, i.e. the filter is not 3x3 or the stride is not 1
+inline int winograd_tile_size(const ConvDims& dim)
+{
+    if (dim.filter_rows != 3 || dim.filter_cols != 3 || dim.stride_rows != 1 || dim.stride_cols != 1)
+    {
+        return 0;
+    }
+
+    const long long cost2 = 16LL * winograd_tiles(dim, 2);
+    const long long cost4 = 36LL * winograd_tiles(dim, 4);
+    return (cost4 < cost2) ? 4 : 2;
+}
+// Whether the Winograd algorithm is expected to be faster than convolve_valid()
+// The transforms cost about as much as the saved multiplications when there are
+// fewer than 32 input or output channels
+inline bool winograd_preferred(const ConvDims& dim)
+{
+    return winograd_tile_size(dim) > 0 && dim.in_channels >= 32 && dim.out_channels >= 32;
+}
+// Length of the transformed filters
+inline std::size_t winograd_filter_size(const ConvDims& dim, const int tile)
+{
+    return std::size_t(tile + 2) * (tile + 2) * dim.in_channels * dim.out_channels;
+}
+// Transform the filters, stored with the layout of convolve_valid(), to A x A matrices
+// of size in_channels x out_channels. Position (a, b) of the transformed filter of input
+// channel i and output channel o is stored in matrix (a * A + b), row i and column o
+template <int M, typename Scalar>
+inline void winograd_transform_filters_impl(const ConvDims& dim, const Scalar* filter_data, Scalar* dest)
+{
+    const int A = M + 2;
+    const double* G = WinogradTransform<M>::g();
+    const std::size_t mat_size = std::size_t(dim.in_channels) * dim.out_channels;
+
+    for (int i = 0; i < dim.in_channels; i++)
+    {
+        for (int o = 0; o < dim.out_channels; o++, filter_data += 9)
+        {
+            // tmp = G * g, g(u, v) is stored in filter_data[v * 3 + u]
+            double tmp[A][3];
+
+            for (int a = 0; a < A; a++)
+            {
+                for (int v = 0; v < 3; v++)
+                {
+                    tmp[a][v] = G[a * 3] * filter_data[v * 3] + G[a * 3 + 1] * filter_data[v * 3 + 1] +
+                                G[a * 3 + 2] * filter_data[v * 3 + 2];
+                }
+            }
+
+            // U = tmp * GT
+            Scalar* writer = dest + std::size_t(o) * dim.in_channels + i;
+
+            for (int a = 0; a < A; a++)
+            {
+                for (int b = 0; b < A; b++, writer += mat_size)
+                {
+                    *writer = Scalar(tmp[a][0] * G[b * 3] + tmp[a][1] * G[b * 3 + 1] + tmp[a][2] * G[b * 3 + 2]);
+                }
+            }
+        }
+    }
+}
+template <typename Scalar>
+inline void winograd_transform_filters(const ConvDims& dim, const int tile, const Scalar* filter_data,
+                                       Scalar* dest)
+{
+    if (tile == 4)
+    {
+        winograd_transform_filters_impl<4>(dim, filter_data, dest);
+    }
+    else
+    {
+        winograd_transform_filters_impl<2>(dim, filter_data, dest);
+    }
+}
+// Number of tiles transformed at a time, which fill a cache line
+template <typename Scalar>
+struct WinogradBatch
+{
+    static const int L = 64 / sizeof(Scalar);
+};
+// Copy n <= L values, with a fixed length in the common case n == L, which avoids
+// a call to memmove() for each row of the tiles
+template <int L, typename Scalar>
+inline void winograd_copy(const Scalar* src, const int n, Scalar* dest)
+{
+    if (n == L)
+    {
+        std::copy(src, src + L, dest);
+    }
+    else
+    {
+        std::copy(src, src + n, dest);
+    }
+}
+// Transform the input tiles of 'n_obs' images to A x A matrices of size
+// (n_obs * tiles) x in_channels. Position (a, b) of tile t of image k in input
+// channel i is stored in matrix (a * A + b), row (k * tiles + t) and column i
+// The tiles of each output channel are ordered by columns
+template <int M, typename Scalar>
+inline void winograd_transform_input(const ConvDims& dim, const Scalar* src, const int n_obs, Scalar* dest)
+{
+    const int A = M + 2;
+    const int L = WinogradBatch<Scalar>::L;
+    const int tile_rows = (dim.conv_rows - 1) / M + 1;
+    const int tile_cols = (dim.conv_cols - 1) / M + 1;
+    const int ntile = tile_rows * tile_cols;
+    const int nrow = n_obs * ntile;
+    const std::size_t mat_size = std::size_t(nrow) * dim.in_channels;
+    const int channel_size = dim.channel_rows * dim.channel_cols;
+    // Tiles of the input, d[x][y][l] is the value in row x and column y of tile l,
+    // and the transformed tiles
+    Scalar d[A][A][L], tmp[A][A][L], v[A][A][L];
+
+    for (int k = 0; k < n_obs; k++)
+    {
+        for (int i = 0; i < dim.in_channels; i++)
+        {
+            const Scalar* channel = src + (std::size_t(k) * dim.in_channels + i) * channel_size;
+            Scalar* const col = dest + std::size_t(i) * nrow + std::size_t(k) * ntile;
+
+            for (int t0 = 0; t0 < ntile; t0 += L)
+            {
+                const int nl = std::min(L, ntile - t0);
+
+                // Tile (t0 + l) is in row tr and column tc of the tiles
+                int tr = t0 % tile_rows, tc = t0 / tile_rows;
+
+                for (int l = 0; l < nl; l++)
+                {
+                    const int r0 = tr * M - dim.pad_rows;
+                    const int c0 = tc * M - dim.pad_cols;
+
+                    if (r0 >= 0 && c0 >= 0 && r0 + A <= dim.channel_rows && c0 + A <= dim.channel_cols)
+                    {
+                        const Scalar* reader = channel + c0 * dim.channel_rows + r0;
+
+                        for (int y = 0; y < A; y++, reader += dim.channel_rows)
+                        {
+                            for (int x = 0; x < A; x++)
+                            {
+                                d[x][y][l] = reader[x];
+                            }
+                        }
+                    }
+                    else
+                    {
+                        for (int y = 0; y < A; y++)
+                        {
+                            const int c = c0 + y;
+
+                            for (int x = 0; x < A; x++)
+                            {
+                                const int r = r0 + x;
+                                d[x][y][l] = (r >= 0 && r < dim.channel_rows && c >= 0 && c < dim.channel_cols) ?
+                                             channel[c * dim.channel_rows + r] : Scalar(0);
+                            }
+                        }
+                    }
+
+                    if (++tr == tile_rows)
+                    {
+                        tr = 0;
+                        tc++;
+                    }
+                }
+
+                // tmp = BT * d, v = tmp * B
+                for (int y = 0; y < A; y++)
+                {
+                    WinogradTransform<M>::template input<L, A * L, A * L>(&d[0][y][0], &tmp[0][y][0]);
+                }
+
+                for (int a = 0; a < A; a++)
+                {
+                    WinogradTransform<M>::template input<L, L, L>(&tmp[a][0][0], &v[a][0][0]);
+                }
+
+                Scalar* writer = col + t0;
+
+                for (int a = 0; a < A; a++)
+                {
+                    for (int b = 0; b < A; b++, writer += mat_size)
+                    {
+                        winograd_copy<L>(v[a][b], nl, writer);
+                    }
+                }
+            }
+        }
+    }
+}
+// Transform the A x A matrices of size (n_obs * tiles) x out_channels, which are the
+// products of the transformed input tiles and filters, back to the output tiles, and
+// write the convolution results of the 'n_obs' images to 'dest'
+template <int M, typename Scalar>
+inline void winograd_transform_output(const ConvDims& dim, const Scalar* src, const int n_obs, Scalar* dest)
+{
+    const int A = M + 2;
+    const int L = WinogradBatch<Scalar>::L;
+    const int tile_rows = (dim.conv_rows - 1) / M + 1;
+    const int tile_cols = (dim.conv_cols - 1) / M + 1;
+    const int ntile = tile_rows * tile_cols;
+    const int nrow = n_obs * ntile;
+    const std::size_t mat_size = std::size_t(nrow) * dim.out_channels;
+    const int channel_size = dim.conv_rows * dim.conv_cols;
+    // m[a][b][l] is position (a, b) of the product for tile l, and y[x][z][l] is
+    // the value in row x and column z of the output tile l
+    Scalar m[A][A][L], tmp[M][A][L], y[M][M][L];
+
+    for (int k = 0; k < n_obs; k++)
+    {
+        for (int o = 0; o < dim.out_channels; o++)
+        {
+            Scalar* channel = dest + (std::size_t(k) * dim.out_channels + o) * channel_size;
+            const Scalar* reader = src + std::size_t(o) * nrow + std::size_t(k) * ntile;
+
+            for (int t0 = 0; t0 < ntile; t0 += L, reader += L)
+            {
+                const int nl = std::min(L, ntile - t0);
+                const Scalar* mat = reader;
+
+                for (int a = 0; a < A; a++)
+                {
+                    for (int b = 0; b < A; b++, mat += mat_size)
+                    {
+                        winograd_copy<L>(mat, nl, m[a][b]);
+                    }
+                }
+
+                // tmp = AT * m, y = tmp * A
+                for (int b = 0; b < A; b++)
+                {
+                    WinogradTransform<M>::template output<L, A * L, A * L>(&m[0][b][0], &tmp[0][b][0]);
+                }
+
+                for (int x = 0; x < M; x++)
+                {
+                    WinogradTransform<M>::template output<L, L, L>(&tmp[x][0][0], &y[x][0][0]);
+                }
+
+                // Keep the rows and columns inside the output
+                for (int l = 0; l < nl; l++)
+                {
+                    const int r0 = ((t0 + l) % tile_rows) * M;
+                    const int c0 = ((t0 + l) / tile_rows) * M;
+                    const int nr = std::min(M, dim.conv_rows - r0);
+                    const int nc = std::min(M, dim.conv_cols - c0);
+
+                    for (int z = 0; z < nc; z++)
+                    {
+                        Scalar* writer = channel + (c0 + z) * dim.conv_rows + r0;
+
+                        for (int x = 0; x < nr; x++)
+                        {
+                            writer[x] = y[x][z][l];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+// The images are processed in chunks, as in convolve_valid(), so that the transformed
+// tiles of each chunk take about 4MB, and each thread has at least one chunk
+// Number of images in each chunk
+template <typename Scalar>
+inline int winograd_chunk_size(const ConvDims& dim, const int tile, const int n_obs, const int nthread)
+{
+    const std::size_t chunk_bytes = 4 * 1024 * 1024;
+    const std::size_t obs_bytes = sizeof(Scalar) * (tile + 2) * (tile + 2) * winograd_tiles(dim, tile) *
+                                  (dim.in_channels + dim.out_channels);
+    const int chunk = int(std::min(chunk_bytes / obs_bytes, std::size_t(n_obs)));
+    const int per_thread = (n_obs - 1) / nthread + 1;
+    return std::max(1, std::min(chunk, per_thread));
+}
+// Size of the workspace memory, in bytes, needed by convolve_winograd() with 'nthread'
+// threads: the transformed input and output tiles of a chunk, and the packing buffers
+// of their products, for each worker
+template <typename Scalar>
+inline std::size_t winograd_workspace_size(const ConvDims& dim, const int tile, const int n_obs,
+                                           const int nthread)
+{
+    const int chunk = winograd_chunk_size<Scalar>(dim, tile, n_obs, nthread);
+    const int nworker = conv_num_workers(n_obs, chunk, nthread);
+    const std::size_t mat_rows = std::size_t(tile + 2) * (tile + 2) * winograd_tiles(dim, tile) * chunk;
+    const int nrow = winograd_tiles(dim, tile) * chunk;
+    return nworker * (Workspace::block_size<Scalar>(mat_rows * dim.in_channels) +
+                      Workspace::block_size<Scalar>(mat_rows * dim.out_channels) +
+                      gemm_workspace_size<Scalar>(nrow, dim.out_channels, dim.in_channels));
+}
+template <typename Scalar>
+inline std::size_t winograd_workspace_size(const ConvDims& dim, const int tile, const int n_obs)
+{
+    return winograd_workspace_size<Scalar>(dim, tile, n_obs, conv_num_threads());
+}
+// The convolution of convolve_valid() with 'image_outer_loop == true', for 3x3 filters
+// with stride 1. 'tile' is given by winograd_tile_size(), and 'filter_trans' contains
+// the filters transformed by winograd_transform_filters()
+// Temporary matrices are allocated from 'ws'
+template <int M, typename Scalar>
+inline void convolve_winograd_impl(
+    const ConvDims& dim,
+    const Scalar* src, const int n_obs,
+    const Scalar* filter_trans,
+    Scalar* dest, Workspace& ws)
+{
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+    typedef Eigen::Map<const Matrix> ConstMapMat;
+    typedef Eigen::Map<Matrix> MapMat;
+    const int A = M + 2;
+    const std::size_t ws_mark = ws.mark();
+    // Use fewer threads if the number of OpenMP threads has grown since the workspace was sized
+    int nthread = conv_num_threads();
+
+    while (nthread > 1 && winograd_workspace_size<Scalar>(dim, M, n_obs, nthread) > ws.available())
+    {
+        nthread--;
+    }
+
+    const int chunk = winograd_chunk_size<Scalar>(dim, M, n_obs, nthread);
+    const int nworker = conv_num_workers(n_obs, chunk, nthread);
+    const int nchunk = (n_obs - 1) / chunk + 1;
+    const int ntile = winograd_tiles(dim, M);
+    const std::size_t mat_rows = std::size_t(A) * A * ntile * chunk;
+    // Transformed input and output tiles of worker t start at
+    // 'in_data + t * in_block' and 'out_data + t * out_block'
+    const std::size_t in_block = Workspace::block_size<Scalar>(mat_rows * dim.in_channels) / sizeof(Scalar);
+    const std::size_t out_block = Workspace::block_size<Scalar>(mat_rows * dim.out_channels) / sizeof(Scalar);
+    const std::size_t gemm_bytes = gemm_workspace_size<Scalar>(ntile * chunk, dim.out_channels, dim.in_channels);
+    const std::size_t gemm_block = gemm_bytes / sizeof(Scalar);
+    Scalar* in_data = ws.allocate<Scalar>(in_block * nworker);
+    Scalar* out_data = ws.allocate<Scalar>(out_block * nworker);
+    Scalar* gemm_data = ws.allocate<Scalar>(gemm_block * nworker);
+    const std::size_t img_size = std::size_t(dim.img_rows) * dim.img_cols;
+    const std::size_t dest_size = std::size_t(dim.conv_rows) * dim.conv_cols * dim.out_channels;
+    const std::size_t filter_size = std::size_t(dim.in_channels) * dim.out_channels;
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(nworker) schedule(static) if(nworker > 1)
+#endif
+    for (int c = 0; c < nchunk; c++)
+    {
+        const int k = c * chunk;
+        const int n = std::min(chunk, n_obs - k);
+        const int nrow = n * ntile;
+        const int t = conv_thread_id();
+        Scalar* in_trans = in_data + t * in_block;
+        Scalar* out_trans = out_data + t * out_block;
+        winograd_transform_input<M>(dim, src + k * img_size, n, in_trans);
+
+        for (int e = 0; e < A * A; e++)
+        {
+            const ConstMapMat v(in_trans + e * std::size_t(nrow) * dim.in_channels, nrow, dim.in_channels);
+            const ConstMapMat u(filter_trans + e * filter_size, dim.in_channels, dim.out_channels);
+            MapMat prod(out_trans + e * std::size_t(nrow) * dim.out_channels, nrow, dim.out_channels);
+            prod.setZero();
+            gemm_add(v, u, prod, gemm_data + t * gemm_block, gemm_bytes);
+        }
+
+        winograd_transform_output<M>(dim, out_trans, n, dest + k * dest_size);
+    }
+
+    ws.release(ws_mark);
+}
+template <typename Scalar>
+inline void convolve_winograd(
+    const ConvDims& dim, const int tile,
+    const Scalar* src, const int n_obs,
+    const Scalar* filter_trans,
+    Scalar* dest, Workspace& ws)
+{
+    if (tile == 4)
+    {
+        convolve_winograd_impl<4>(dim, src, n_obs, filter_trans, dest, ws);
+    }
+    else
+    {
+        convolve_winograd_impl<2>(dim, src, n_obs, filter_trans, dest, ws);
+    }
+}
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_WINOGRAD_H_ */
@@ -0,0 +1,141 @@
+#ifndef UTILS_WORKSPACE_H_
+#define UTILS_WORKSPACE_H_
+
+#include <Eigen/Core>
+#include <cstddef>
+#include <stdexcept>
+#include "../Config.h"
+
+namespace MiniDNN
+{
+
+namespace internal
+{
+
+
+// A preallocated memory arena that hands out aligned blocks in a stack-like manner
+//
+// The network computes the total amount of memory needed by its layers for a
+// given batch size, reserves it once, and then the layers carve their buffers
+// from the arena in the forward pass. Temporary scratch memory is obtained with
+// allocate() between mark() and release(), so it is reused by all the layers
+//
+// Reserving a larger size is the only operation that touches the heap, and the
+// number of such allocations is recorded in num_allocations()
+class Workspace
+{
+    private:
+        // Every block starts on a cache line boundary, which also satisfies
+        // the alignment requirement of Eigen's aligned maps
+        static const std::size_t Alignment = 64;
+
+        void*          m_memory;   // Memory obtained from the heap
+        unsigned char* m_data;     // Beginning of the arena, the first aligned byte of m_memory
+        std::size_t    m_capacity; // Size of the arena in bytes
+        std::size_t    m_top;      // Offset of the first free byte
+        int            m_nalloc;   // Number of heap allocations so far
+
+        // Workspaces are owned by one network, and are not copyable
+        Workspace(const Workspace&);
+        Workspace& operator=(const Workspace&);
+
+    public:
+        Workspace() :
+            m_memory(NULL), m_data(NULL), m_capacity(0), m_top(0), m_nalloc(0)
+        {}
+
+        ~Workspace()
+        {
+            Eigen::internal::aligned_free(m_memory);
+        }
+
+        // Number of bytes occupied by a block of n objects of type T,
+        // including the padding for alignment
+        template <typename T>
+        static std::size_t block_size(std::size_t n)
+        {
+            return (n * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+        }
+
+        // Make sure that the arena has at least 'size' bytes
+        // Existing blocks are invalidated if the arena is reallocated, so this
+        // function should only be called when no block is in use
+        void reserve(std::size_t size)
+        {
+            if (size <= m_capacity)
+            {
+                return;
+            }
+
+            // Eigen aligns the memory to 16 or 32 bytes, so the arena starts at the
+            // first cache line boundary of a slightly larger block
+            Eigen::internal::aligned_free(m_memory);
+            m_memory = NULL;
+            m_data = NULL;
+            m_capacity = 0;
+            m_memory = Eigen::internal::aligned_malloc(size + Alignment);
+            const std::size_t address = reinterpret_cast<std::size_t>(m_memory);
+            m_data = static_cast<unsigned char*>(m_memory) + (Alignment - address % Alignment) % Alignment;
+            m_capacity = size;
+            m_top = 0;
+            m_nalloc++;
+        }
+
+        // Release all the blocks
+        void reset()
+        {
+            m_top = 0;
+        }
+
+        // Get a block of n objects of type T
+        template <typename T>
+        T* allocate(std::size_t n)
+        {
+            const std::size_t size = block_size<T>(n);
+
+            if (m_top + size > m_capacity)
+            {
+                throw std::logic_error("[class Workspace]: Workspace size is insufficient");
+            }
+
+            T* res = reinterpret_cast<T*>(m_data + m_top);
+            m_top += size;
+            return res;
+        }
+
+        // The current position of the stack, used to free temporary blocks
+        std::size_t mark() const
+        {
+            return m_top;
+        }
+
+        // Free all the blocks allocated after mark() returned 'pos'
+        void release(std::size_t pos)
+        {
+            m_top = pos;
+        }
+
+        std::size_t capacity() const
+        {
+            return m_capacity;
+        }
+
+        // Number of bytes that can still be allocated
+        std::size_t available() const
+        {
+            return m_capacity - m_top;
+        }
+
+        int num_allocations() const
+        {
+            return m_nalloc;
+        }
+};
+
+
+} // namespace internal
+
+} // namespace MiniDNN
+
+
+#endif /* UTILS_WORKSPACE_H_ */
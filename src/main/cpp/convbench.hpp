@@ -0,0 +1,149 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include "util.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace NeuralRun {
+    namespace ConvBench {
+        constexpr int MAX_ARGUMENT_COUNT = 9;
+
+        constexpr int DEFAULT_IN_CHANNELS = 32;
+        constexpr int DEFAULT_OUT_CHANNELS = 64;
+        constexpr int DEFAULT_IMAGE_SIZE = 28;
+        constexpr int DEFAULT_WINDOW_SIZE = 3;
+        constexpr int DEFAULT_STRIDE = 1;
+        constexpr int DEFAULT_PADDING = 1;
+        constexpr int DEFAULT_BATCH_SIZE = 32;
+        constexpr int DEFAULT_THREADS = 1;
+        constexpr int DEFAULT_REPEATS = 5;
+
+        constexpr double SECONDS_TO_MILLISECONDS = 1000;
+
+        /**
+         * The best times in seconds of the passes of a convolutional layer.
+         */
+        struct Timing {
+            double forward = std::numeric_limits<double>::infinity();
+            double backward = std::numeric_limits<double>::infinity();
+
+            double total() const noexcept {
+                return forward + backward;
+            }
+        };
+
+        /**
+         * Times the forward pass and the backpropagation of the layer on the given data.
+         * The output of the last forward pass is copied to the given matrix.
+         */
+        Timing time_layer(MiniDNN::Convolutional<MiniDNN::ReLU>& layer, const Eigen::MatrixXd& data,
+                          const Eigen::MatrixXd& gradient, int repeats, Eigen::MatrixXd& output) {
+            int batch_size = data.cols();
+            MiniDNN::internal::Workspace workspace;
+            workspace.reserve(layer.workspace_size(batch_size) + layer.scratch_size(batch_size));
+            layer.bind_workspace(workspace, batch_size);
+
+            Timing timing;
+            // The first pass only warms up the caches and the thread pool.
+            for (int i = 0; i <= repeats; ++i) {
+                double start = Timer::time();
+                layer.forward(data);
+                double middle = Timer::time();
+                layer.backprop(data, gradient);
+                double end = Timer::time();
+                if (i > 0) {
+                    timing.forward = std::min(timing.forward, middle - start);
+                    timing.backward = std::min(timing.backward, end - middle);
+                }
+            }
+            output = layer.output();
+            return timing;
+        }
+
+        void print_timing(const std::string& backend, const Timing& timing) {
+            std::cout << ' ' << backend << ": forward [" << timing.forward * SECONDS_TO_MILLISECONDS
+                      << " ms], backward [" << timing.backward * SECONDS_TO_MILLISECONDS
+                      << " ms], total [" << timing.total() * SECONDS_TO_MILLISECONDS << " ms]" << std::endl;
+        }
+
+        /**
+         * Compares the built-in convolution of a layer with square images and windows,
+         * which uses the Winograd algorithm or the FFT when the layer prefers them,
+         * with the Eigen Tensor convolution on a thread pool of the same size when the
+         * Tensor backend is compiled (MINIDNN_USE_EIGEN_TENSOR).
+         */
+        void run(std::vector<std::string> arguments) {
+            int argument_count = arguments.size();
+            if (argument_count > MAX_ARGUMENT_COUNT) {
+                std::ostringstream stream;
+                stream << "Invalid number of run arguments. Expected at most: [" << MAX_ARGUMENT_COUNT
+                       << "]. Received: [" << argument_count << "].";
+                throw std::runtime_error(stream.str());
+            }
+
+            int in_channels = argument_count > 0 ? std::stoi(arguments[0]) : DEFAULT_IN_CHANNELS;
+            int out_channels = argument_count > 1 ? std::stoi(arguments[1]) : DEFAULT_OUT_CHANNELS;
+            int image_size = argument_count > 2 ? std::stoi(arguments[2]) : DEFAULT_IMAGE_SIZE;
+            int window_size = argument_count > 3 ? std::stoi(arguments[3]) : DEFAULT_WINDOW_SIZE;
+            int stride = argument_count > 4 ? std::stoi(arguments[4]) : DEFAULT_STRIDE;
+            int padding = argument_count > 5 ? std::stoi(arguments[5]) : DEFAULT_PADDING;
+            int batch_size = argument_count > 6 ? std::stoi(arguments[6]) : DEFAULT_BATCH_SIZE;
+            int threads = argument_count > 7 ? std::stoi(arguments[7]) : DEFAULT_THREADS;
+            int repeats = argument_count > 8 ? std::stoi(arguments[8]) : DEFAULT_REPEATS;
+            if (threads < 1 || repeats < 1) {
+                throw std::runtime_error("Run mode [convbench] requires at least one thread and one repeat.");
+            }
+            std::cout << " Input channels: [" << in_channels << "]\n"
+                      << " Output channels: [" << out_channels << "]\n"
+                      << " Image size: [" << image_size << "]\n"
+                      << " Window size: [" << window_size << "]\n"
+                      << " Stride: [" << stride << "]\n"
+                      << " Padding: [" << padding << "]\n"
+                      << " Mini-batch size: [" << batch_size << "]\n"
+                      << " Threads: [" << threads << "]\n"
+                      << " Repeats: [" << repeats << ']' << std::endl;
+
+            std::cout << "\nConstructing layers..." << std::endl;
+            MiniDNN::Convolutional<MiniDNN::ReLU> builtin(image_size, image_size, in_channels, out_channels,
+                                                         window_size, window_size, stride, stride, padding, padding);
+            MiniDNN::RNG rng(Timer::current());
+            builtin.init(0, 0.01, rng);
+            std::string algorithm = builtin.winograd_enabled() ? "Winograd" : builtin.fft_enabled() ? "FFT" : "direct";
+
+            Eigen::MatrixXd data = Eigen::MatrixXd::Random(builtin.in_size(), batch_size);
+            Eigen::MatrixXd gradient = Eigen::MatrixXd::Random(builtin.out_size(), batch_size);
+#ifdef _OPENMP
+            omp_set_num_threads(threads);
+#endif
+
+            std::cout << "\nTiming backends..." << std::endl;
+            Eigen::MatrixXd builtin_output;
+            Timing builtin_timing = time_layer(builtin, data, gradient, repeats, builtin_output);
+            print_timing("Built-in (" + algorithm + ")", builtin_timing);
+#ifdef MINIDNN_USE_EIGEN_TENSOR
+            // A clone has its own copy of the parameters and gradients, unlike a copy of the layer
+            std::unique_ptr<MiniDNN::Convolutional<MiniDNN::ReLU>> tensor(
+                static_cast<MiniDNN::Convolutional<MiniDNN::ReLU>*>(builtin.clone()));
+            Eigen::ThreadPool pool(threads);
+            Eigen::ThreadPoolDevice device(&pool, threads);
+            tensor->use_tensor_device(&device);
+            Eigen::MatrixXd tensor_output;
+            Timing tensor_timing = time_layer(*tensor, data, gradient, repeats, tensor_output);
+            print_timing("Eigen Tensor", tensor_timing);
+            std::cout << " Largest output difference: [" << (builtin_output - tensor_output).cwiseAbs().maxCoeff()
+                      << "]\n Faster backend: ["
+                      << (tensor_timing.total() < builtin_timing.total() ? "Eigen Tensor" : "built-in")
+                      << ']' << std::endl;
+#else
+            std::cout << " Eigen Tensor: [not compiled], build with -DMINIDNN_USE_EIGEN_TENSOR -DEIGEN_USE_THREADS"
+                      << " to compare the backends" << std::endl;
+#endif
+        }
+    }
+}
@@ -2,6 +2,8 @@
 #include "small.hpp"
 #include "quad.hpp"
 #include "ranges.hpp"
+#include "serve.hpp"
+#include "convbench.hpp"
 
 constexpr int RUN_MODE_INDEX = 1;
 constexpr int RUN_ARGUMENTS_INDEX = 2;
@@ -34,6 +36,10 @@ int main(int argc, char** argv) {
         NeuralRun::Quad::run(run_arguments);
     } else if (run_mode == "ranges") {
         NeuralRun::Ranges::run(run_arguments);
+    } else if (run_mode == "serve") {
+        NeuralRun::Serve::run(run_arguments);
+    } else if (run_mode == "convbench") {
+        NeuralRun::ConvBench::run(run_arguments);
     } else {
         std::ostringstream stream;
         stream << "Unknown run mode: [" << run_mode << "].";
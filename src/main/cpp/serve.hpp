@@ -0,0 +1,63 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include "util.hpp"
+
+namespace NeuralRun {
+    namespace Serve {
+        constexpr int MAX_ARGUMENT_COUNT = 6;
+        
+        constexpr char DEFAULT_MODEL_FOLDER[] = "model";
+        constexpr char DEFAULT_MODEL_NAME[] = "network";
+        constexpr char DEFAULT_SOCKET_PATH[] = "/tmp/neural.sock";
+        constexpr int DEFAULT_MAX_BATCH = 64;
+        constexpr int DEFAULT_MAX_DELAY = 1000;
+        constexpr int DEFAULT_WORKERS = 1;
+        
+        /**
+         * Serves the predictions of an exported network over a Unix domain socket.
+         * Concurrent requests are batched together, for at most the given number of
+         * observations and microseconds, and their data are exchanged through shared memory.
+         * Runs until a line is read from the standard input.
+         */
+        void run(std::vector<std::string> arguments) {
+#ifdef _WIN32
+            throw std::runtime_error("Run mode [serve] requires Unix domain sockets.");
+#else
+            int argument_count = arguments.size();
+            if (argument_count > MAX_ARGUMENT_COUNT) {
+                std::ostringstream stream;
+                stream << "Invalid number of run arguments. Expected at most: [" << MAX_ARGUMENT_COUNT
+                       << "]. Received: [" << argument_count << "].";
+                throw std::runtime_error(stream.str());
+            }
+            
+            std::string model_folder = argument_count > 0 ? arguments[0] : DEFAULT_MODEL_FOLDER;
+            std::string model_name = argument_count > 1 ? arguments[1] : DEFAULT_MODEL_NAME;
+            std::string socket_path = argument_count > 2 ? arguments[2] : DEFAULT_SOCKET_PATH;
+            int max_batch = argument_count > 3 ? std::stoi(arguments[3]) : DEFAULT_MAX_BATCH;
+            int max_delay = argument_count > 4 ? std::stoi(arguments[4]) : DEFAULT_MAX_DELAY;
+            int workers = argument_count > 5 ? std::stoi(arguments[5]) : DEFAULT_WORKERS;
+            std::cout << " Model folder: [" << model_folder << "]\n"
+                      << " Model name: [" << model_name << "]\n"
+                      << " Socket path: [" << socket_path << "]\n"
+                      << " Maximum batch size: [" << max_batch << "]\n"
+                      << " Maximum batching delay (us): [" << max_delay << "]\n"
+                      << " Worker threads: [" << workers << ']' << std::endl;
+            
+            std::cout << "\nLoading network..." << std::endl;
+            MiniDNN::Network network;
+            network.read_net(model_folder, model_name);
+            
+            MiniDNN::RequestBatcher batcher(network, max_batch, max_delay, workers);
+            MiniDNN::InferenceServer server(batcher, socket_path);
+            std::cout << "\nServing on [" << socket_path << "]. Press Enter to stop." << std::endl;
+            std::string line;
+            std::getline(std::cin, line);
+            server.stop();
+            std::cout << "Average batch size: [" << batcher.average_batch_size() << ']' << std::endl;
+#endif
+        }
+    }
+}
@@ -133,35 +133,35 @@ class RNG {
 };
 
 namespace NeuralUtil {
-    class ProbabilisticCallback : public MiniDNN::Callback {
+    class ProbabilisticCallback : public MiniDNN::Callback<> {
         public:
-            ProbabilisticCallback(MiniDNN::Callback& callback, double probability) noexcept:
+            ProbabilisticCallback(MiniDNN::Callback<>& callback, double probability) noexcept:
                 callback(callback),
                 probability(probability)
             {}
             
-            void pre_training_batch(const MiniDNN::Network* net, const Eigen::MatrixXd& x, const Eigen::MatrixXd& y) {
+            void pre_training_batch(const MiniDNN::Network<>* net, const Eigen::MatrixXd& x, const Eigen::MatrixXd& y) {
                 if (this->should_act()) {
                     this->set_callback_members();
                     this->callback.pre_training_batch(net, x, y);
                 }
             }
             
-            void pre_training_batch(const MiniDNN::Network* net, const Eigen::MatrixXd& x, const Eigen::RowVectorXi& y) {
+            void pre_training_batch(const MiniDNN::Network<>* net, const Eigen::MatrixXd& x, const Eigen::RowVectorXi& y) {
                 if (this->should_act()) {
                     this->set_callback_members();
                     this->callback.pre_training_batch(net, x, y);
                 }
             }
             
-            void post_training_batch(const MiniDNN::Network* net, const Eigen::MatrixXd& x, const Eigen::MatrixXd& y) {
+            void post_training_batch(const MiniDNN::Network<>* net, const Eigen::MatrixXd& x, const Eigen::MatrixXd& y) {
                 if (this->should_act()) {
                     this->set_callback_members();
                     this->callback.post_training_batch(net, x, y);
                 }
             }
             
-            void post_training_batch(const MiniDNN::Network* net, const Eigen::MatrixXd& x, const Eigen::RowVectorXi& y) {
+            void post_training_batch(const MiniDNN::Network<>* net, const Eigen::MatrixXd& x, const Eigen::RowVectorXi& y) {
                 if (this->should_act()) {
                     this->set_callback_members();
                     this->callback.post_training_batch(net, x, y);
@@ -181,7 +181,7 @@ namespace NeuralUtil {
             }
             
             RNG rng;
-            MiniDNN::Callback& callback;
+            MiniDNN::Callback<>& callback;
             double probability;
     };
     
@@ -198,7 +198,7 @@ namespace NeuralUtil {
         return max_index;
     }
     
-    void test_classifier(MiniDNN::Network& network,
+    void test_classifier(MiniDNN::Network<>& network,
                          const Eigen::MatrixXd& test_data,
                          const Eigen::MatrixXd& test_labels,
                          int test_size,
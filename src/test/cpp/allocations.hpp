@@ -0,0 +1,107 @@
+#pragma once
+
+#include <MiniDNN.h>
+#include "heap.hpp"
+#include "check.hpp"
+
+namespace NeuralTest {
+    namespace Allocations {
+        constexpr int IMAGE_SIZE = 16;
+        constexpr int CHANNELS = 16;
+        constexpr int OUTPUTS = 3;
+        constexpr int OBSERVATIONS = 72;
+        constexpr int BATCH_SIZE = 32;
+        constexpr int EPOCHS = 3;
+        constexpr int SEED = 5;
+        // The last mini-batch of each epoch is smaller than the others
+        constexpr int NUM_BATCHES = (OBSERVATIONS - 1) / BATCH_SIZE + 1;
+
+        using Network = MiniDNN::Network<double>;
+        using Convolution = MiniDNN::Convolutional<MiniDNN::ReLU, double>;
+
+        /**
+         * Starts counting the allocations after the first epoch, in which the buffers of
+         * the full and of the last mini-batches are allocated, and counts the following
+         * mini-batches.
+         */
+        class Recorder : public MiniDNN::Callback<double> {
+        public:
+            int batches = 0;
+
+            void post_training_batch(const Network* network, const Matrix& x, const Matrix& y) override {
+                if (m_epoch_id > 0) {
+                    batches++;
+                } else if (m_batch_id == m_nbatch - 1) {
+                    Heap::start();
+                }
+            }
+        };
+
+        /**
+         * Trains the network, and checks that no mini-batch after the first epoch allocates memory.
+         */
+        void check_steady_state(Network& network, int threads) {
+            Eigen::MatrixXd x = Eigen::MatrixXd::Random(network.get_layers()[0]->in_size(), OBSERVATIONS);
+            Eigen::MatrixXd y = Eigen::MatrixXd::Random(OUTPUTS, OBSERVATIONS);
+            MiniDNN::Adam<double> optimizer;
+            Recorder recorder;
+            network.set_callback(recorder);
+            network.set_num_threads(threads);
+            network.init(0, 0.01, SEED);
+
+            try {
+                network.fit(optimizer, x, y, BATCH_SIZE, EPOCHS, SEED);
+            } catch (...) {
+                Heap::stop();
+                throw;
+            }
+            Heap::stop();
+            network.set_default_callback();
+
+            CHECK(recorder.batches == (EPOCHS - 1) * NUM_BATCHES);
+            CHECK(Heap::count() == 0);
+            // The arena of each worker has been allocated once
+            CHECK(network.num_workspace_allocations() == threads);
+        }
+
+        /**
+         * Training a fully connected network does not allocate memory after the first epoch.
+         */
+        void fully_connected() {
+            for (int threads = 1; threads <= 2; threads++) {
+                Network network;
+                network.add_layer(new MiniDNN::FullyConnected<MiniDNN::ReLU, double>(10, 20));
+                network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Identity, double>(20, OUTPUTS));
+                network.set_output(new MiniDNN::RegressionMSE<double>());
+                check_steady_state(network, threads);
+            }
+        }
+
+        /**
+         * Training a convolutional network does not allocate memory after the first
+         * epoch, with the direct and the Winograd algorithms.
+         */
+        void convolutional() {
+            for (int winograd = 0; winograd <= 1; winograd++) {
+                for (int threads = 1; threads <= 2; threads++) {
+                    Network network;
+                    Convolution* convolution = new Convolution(IMAGE_SIZE, IMAGE_SIZE, CHANNELS, CHANNELS,
+                                                               3, 3, 1, 1, 1, 1);
+                    convolution->use_winograd(winograd == 1);
+                    network.add_layer(convolution);
+                    network.add_layer(new MiniDNN::MaxPooling<MiniDNN::Identity, double>(
+                        IMAGE_SIZE, IMAGE_SIZE, CHANNELS, 2, 2));
+                    network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Identity, double>(
+                        IMAGE_SIZE * IMAGE_SIZE * CHANNELS / 4, OUTPUTS));
+                    network.set_output(new MiniDNN::RegressionMSE<double>());
+                    check_steady_state(network, threads);
+                }
+            }
+        }
+
+        void run() {
+            fully_connected();
+            convolutional();
+        }
+    }
+}
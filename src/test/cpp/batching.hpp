@@ -0,0 +1,217 @@
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <MiniDNN.h>
+#include "check.hpp"
+
+namespace NeuralTest {
+    namespace Batching {
+        constexpr int INPUTS = 5;
+        constexpr int OUTPUTS = 2;
+        // The last mini-batch of each epoch is smaller than the others
+        constexpr int OBSERVATIONS = 23;
+        constexpr int BATCH_SIZE = 5;
+        constexpr int BATCHES = (OBSERVATIONS + BATCH_SIZE - 1) / BATCH_SIZE;
+        constexpr int EPOCHS = 3;
+        constexpr int MAX_DEPTH = 4;
+        constexpr int SEED = 29;
+
+        using Network = MiniDNN::Network<double>;
+        using Sampler = MiniDNN::internal::BatchSampler<Eigen::MatrixXd, Eigen::MatrixXd,
+                                                        Eigen::MatrixXd, Eigen::MatrixXd>;
+        // The observation IDs of the mini-batches of each epoch
+        using Batches = std::vector<std::vector<int>>;
+
+        /**
+         * Data set whose observations hold their own ID in every input and output.
+         */
+        void data(Eigen::MatrixXd& x, Eigen::MatrixXd& y) {
+            const Eigen::RowVectorXd ids = Eigen::RowVectorXd::LinSpaced(OBSERVATIONS, 0, OBSERVATIONS - 1);
+            x = ids.replicate(INPUTS, 1);
+            y = ids.replicate(OUTPUTS, 1);
+        }
+
+        /**
+         * Draws the mini-batches of one epoch, and checks that their inputs and outputs
+         * come from the same observations.
+         */
+        std::vector<int> epoch(Sampler& sampler, MiniDNN::RNG& rng) {
+            Sampler::Buffer buffer;
+            std::vector<int> ids;
+            sampler.reset(rng);
+
+            for (int i = 0; sampler.next_batch(buffer); i++) {
+                const Eigen::MatrixXd& x = buffer.x_batch();
+                const Eigen::MatrixXd& y = buffer.y_batch();
+                CHECK(x.cols() == (i < BATCHES - 1 ? BATCH_SIZE : OBSERVATIONS - i * BATCH_SIZE));
+                CHECK(y.cols() == x.cols());
+
+                for (int j = 0; j < x.cols(); j++) {
+                    CHECK((x.col(j).array() == x(0, j)).all() && (y.col(j).array() == x(0, j)).all());
+                    ids.push_back(int(x(0, j)));
+                }
+            }
+            return ids;
+        }
+
+        /**
+         * Each epoch of the sampler is a new permutation of all the observations, and
+         * the same seed gives the same sequence of mini-batches.
+         */
+        void sampler_permutations() {
+            Eigen::MatrixXd x, y;
+            data(x, y);
+            Sampler sampler(x, y, BATCH_SIZE);
+            CHECK(sampler.num_batches() == BATCHES);
+
+            MiniDNN::RNG rng(SEED);
+            Batches batches;
+            for (int k = 0; k < EPOCHS; k++) {
+                std::vector<int> ids = epoch(sampler, rng);
+                batches.push_back(ids);
+                std::sort(ids.begin(), ids.end());
+                for (int i = 0; i < OBSERVATIONS; i++) {
+                    CHECK(ids[i] == i);
+                }
+            }
+            CHECK(batches[0] != batches[1] && batches[1] != batches[2]);
+
+            Sampler repeat_sampler(x, y, BATCH_SIZE);
+            MiniDNN::RNG repeat(SEED);
+            for (int k = 0; k < EPOCHS; k++) {
+                CHECK(epoch(repeat_sampler, repeat) == batches[k]);
+            }
+        }
+
+        /**
+         * Records the observation IDs of the mini-batches seen by the network.
+         */
+        class BatchRecorder : public MiniDNN::Callback<double> {
+        public:
+            std::vector<int> ids;
+
+            void pre_training_batch(const Network* network, const Matrix& x, const Matrix& y) override {
+                for (int j = 0; j < x.cols(); j++) {
+                    ids.push_back(int(x(0, j)));
+                }
+            }
+        };
+
+        /**
+         * Trains a network with the given prefetch depth, and returns its parameters
+         * and the observations of its mini-batches.
+         */
+        void train(int depth, std::vector<std::vector<double>>& parameters, std::vector<int>& ids) {
+            Eigen::MatrixXd x, y;
+            data(x, y);
+            x /= OBSERVATIONS;
+            y /= OBSERVATIONS;
+
+            Network network;
+            network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Tanh, double>(INPUTS, OUTPUTS));
+            network.set_output(new MiniDNN::RegressionMSE<double>());
+            BatchRecorder recorder;
+            network.set_callback(recorder);
+            network.set_prefetch_depth(depth);
+            network.init(0, 0.1, SEED);
+            MiniDNN::SGD<double> optimizer;
+            network.fit(optimizer, x, y, BATCH_SIZE, EPOCHS, SEED);
+            network.set_default_callback();
+            parameters = network.get_parameters();
+            ids = recorder.ids;
+        }
+
+        /**
+         * Training is deterministic for a given seed.
+         */
+        void fit_deterministic() {
+            std::vector<std::vector<double>> parameters, repeat_parameters;
+            std::vector<int> ids, repeat_ids;
+            train(0, parameters, ids);
+            train(0, repeat_parameters, repeat_ids);
+            CHECK(ids.size() == std::size_t(EPOCHS * OBSERVATIONS));
+            CHECK(ids == repeat_ids);
+            CHECK(parameters == repeat_parameters);
+        }
+
+        /**
+         * Preparing the mini-batches in the background does not change the batches nor
+         * the result of training.
+         */
+        void prefetch_deterministic() {
+            std::vector<std::vector<double>> parameters;
+            std::vector<int> ids;
+            train(0, parameters, ids);
+
+            for (int depth = 1; depth <= MAX_DEPTH; depth++) {
+                std::vector<std::vector<double>> prefetch_parameters;
+                std::vector<int> prefetch_ids;
+                train(depth, prefetch_parameters, prefetch_ids);
+                CHECK(prefetch_ids == ids);
+                CHECK(prefetch_parameters == parameters);
+            }
+        }
+
+        /**
+         * A source of mini-batches that fails after a given number of batches.
+         */
+        class FailingSource {
+        public:
+            typedef MiniDNN::internal::BatchBuffer<Eigen::MatrixXd, Eigen::MatrixXd> Buffer;
+
+            explicit FailingSource(int batches) : m_remaining(batches) {}
+
+            void reset(MiniDNN::RNG& rng) {}
+
+            bool next_batch(Buffer& buffer) {
+                if (m_remaining-- == 0) {
+                    throw std::runtime_error("source failure");
+                }
+                buffer.x_batch().setZero(INPUTS, BATCH_SIZE);
+                buffer.y_batch().setZero(OUTPUTS, BATCH_SIZE);
+                return true;
+            }
+
+        private:
+            int m_remaining;
+        };
+
+        /**
+         * An exception thrown while preparing a batch in the background is rethrown
+         * when the training thread asks for that batch, after the batches before it.
+         */
+        void prefetch_exception() {
+            for (int depth = 0; depth <= MAX_DEPTH; depth++) {
+                FailingSource source(BATCHES);
+                MiniDNN::RNG rng(SEED);
+                MiniDNN::internal::BatchPrefetcher<FailingSource> prefetcher(source, rng, EPOCHS, depth);
+                int queue_depth;
+                double stall;
+                int acquired = 0;
+                bool thrown = false;
+
+                try {
+                    while (prefetcher.acquire(queue_depth, stall) != NULL) {
+                        CHECK(queue_depth <= depth);
+                        prefetcher.release();
+                        acquired++;
+                    }
+                } catch (const std::runtime_error& error) {
+                    thrown = std::string(error.what()) == "source failure";
+                }
+                CHECK(thrown);
+                CHECK(acquired == BATCHES);
+            }
+        }
+
+        void run() {
+            sampler_permutations();
+            fit_deterministic();
+            prefetch_deterministic();
+            prefetch_exception();
+        }
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdexcept>
+#include <sstream>
+#include <string>
+
+/**
+ * Checks of the test cases.
+ */
+namespace Check {
+    /**
+     * Throws an error with the given message and location if the condition does not hold.
+     */
+    void that(bool condition, const std::string& message, const char* file, int line) {
+        if (!condition) {
+            std::ostringstream stream;
+            stream << file << ':' << line << ": check failed: [" << message << "].";
+            throw std::runtime_error(stream.str());
+        }
+    }
+}
+
+#define CHECK(condition) Check::that((condition), #condition, __FILE__, __LINE__)
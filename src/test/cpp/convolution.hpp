@@ -0,0 +1,443 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include <MiniDNN.h>
+#include "check.hpp"
+#include "gradient.hpp"
+
+namespace NeuralTest {
+    namespace Convolution {
+        constexpr int OBSERVATIONS = 3;
+        constexpr double TOLERANCE = 1e-12;
+        constexpr double GRADIENT_TOLERANCE = 1e-6;
+        // Relative tolerance of the fast algorithms, whose rounding errors are larger
+        constexpr double FAST_TOLERANCE = 1e-10;
+        constexpr int SEED = 53;
+
+        /**
+         * Shape of a convolutional layer, with the arguments of its constructor.
+         */
+        struct Shape {
+            int width, height, in_channels, out_channels;
+            int window_width, window_height, stride_width, stride_height, pad_width, pad_height;
+
+            int out_width() const {
+                return (width + 2 * pad_width - window_width) / stride_width + 1;
+            }
+
+            int out_height() const {
+                return (height + 2 * pad_height - window_height) / stride_height + 1;
+            }
+
+            template <typename Layer>
+            Layer* create() const {
+                return new Layer(width, height, in_channels, out_channels, window_width, window_height,
+                                 stride_width, stride_height, pad_width, pad_height);
+            }
+        };
+
+        // Strided and padded layers, with square and non-square images, windows and strides
+        const Shape STRIDED[] = {
+            {7, 7, 2, 3, 3, 3, 2, 2, 1, 1},
+            {8, 6, 2, 2, 3, 2, 2, 1, 1, 0},
+            {6, 9, 1, 4, 2, 4, 1, 3, 0, 2},
+            {5, 5, 3, 2, 5, 5, 1, 1, 2, 2},
+            {9, 7, 2, 2, 4, 3, 3, 2, 3, 2},
+        };
+
+        /**
+         * Direct evaluation of the convolution of the input, whose channels are stored
+         * one after another in column-major order, with the parameters of the layer,
+         * which are the filters of each pair of input and output channels followed by
+         * the bias of each output channel.
+         */
+        Eigen::MatrixXd reference(const Shape& shape, const std::vector<double>& parameters,
+                                  const Eigen::MatrixXd& x) {
+            const int out_width = shape.out_width(), out_height = shape.out_height();
+            const int window = shape.window_width * shape.window_height;
+            const double* bias = parameters.data() + shape.in_channels * shape.out_channels * window;
+            Eigen::MatrixXd res(out_width * out_height * shape.out_channels, x.cols());
+
+            for (int k = 0; k < x.cols(); k++) {
+                for (int co = 0; co < shape.out_channels; co++) {
+                    for (int c = 0; c < out_width; c++) {
+                        for (int r = 0; r < out_height; r++) {
+                            double sum = bias[co];
+                            for (int ci = 0; ci < shape.in_channels; ci++) {
+                                const double* filter = parameters.data() + (ci * shape.out_channels + co) * window;
+                                for (int j = 0; j < shape.window_width; j++) {
+                                    for (int i = 0; i < shape.window_height; i++) {
+                                        const int row = r * shape.stride_height + i - shape.pad_height;
+                                        const int col = c * shape.stride_width + j - shape.pad_width;
+                                        if (row >= 0 && row < shape.height && col >= 0 && col < shape.width) {
+                                            sum += filter[j * shape.window_height + i] *
+                                                   x((ci * shape.width + col) * shape.height + row, k);
+                                        }
+                                    }
+                                }
+                            }
+                            res((co * out_width + c) * out_height + r, k) = sum;
+                        }
+                    }
+                }
+            }
+            return res;
+        }
+
+        /**
+         * Runs the layer, which has been initialized, on the input in the given workspace,
+         * which backprop() uses afterwards.
+         */
+        Eigen::MatrixXd forward(MiniDNN::Layer<double>& layer, MiniDNN::internal::Workspace& workspace,
+                                const Eigen::MatrixXd& x) {
+            workspace.reset();
+            workspace.reserve(layer.workspace_size(x.cols()) + layer.scratch_size(x.cols()));
+            layer.bind_workspace(workspace, x.cols());
+            layer.forward(x);
+            return layer.output();
+        }
+
+        /**
+         * Strided and padded convolutions have the expected output size, match the
+         * direct evaluation, and have the gradients given by finite differences.
+         */
+        void strided_padded() {
+            using Layer = MiniDNN::Convolutional<MiniDNN::Identity, double>;
+            MiniDNN::RNG rng(SEED);
+            MiniDNN::internal::Workspace workspace;
+
+            for (const Shape& shape : STRIDED) {
+                Layer* layer = shape.create<Layer>();
+                CHECK(layer->out_size() == shape.out_width() * shape.out_height() * shape.out_channels);
+                layer->init(0, 0.5, rng);
+
+                const Eigen::MatrixXd x = Eigen::MatrixXd::Random(layer->in_size(), OBSERVATIONS);
+                const Eigen::MatrixXd expected = reference(shape, layer->get_parameters(), x);
+                CHECK((forward(*layer, workspace, x) - expected).cwiseAbs().maxCoeff() <= TOLERANCE);
+
+                Gradient::check(*layer, OBSERVATIONS, GRADIENT_TOLERANCE, SEED);
+                delete layer;
+
+                // With a nonlinear activation
+                MiniDNN::Layer<double>* tanh_layer = shape.create<MiniDNN::Convolutional<MiniDNN::Tanh, double>>();
+                tanh_layer->init(0, 0.5, rng);
+                Gradient::check(*tanh_layer, OBSERVATIONS, GRADIENT_TOLERANCE, SEED);
+                delete tanh_layer;
+            }
+        }
+
+        /**
+         * Largest absolute difference of two outputs, relative to the largest output.
+         */
+        double relative_difference(const Eigen::MatrixXd& output, const Eigen::MatrixXd& expected) {
+            return (output - expected).cwiseAbs().maxCoeff() / expected.cwiseAbs().maxCoeff();
+        }
+
+        // 3x3 layers with stride 1, whose outputs are covered by whole or partial tiles of
+        // size 2 (5 x 5, 4 x 2) and size 4 (7 x 7, 8 x 6)
+        const Shape WINOGRAD[] = {
+            {7, 7, 3, 4, 3, 3, 1, 1, 0, 0},
+            {6, 4, 2, 3, 3, 3, 1, 1, 0, 0},
+            {7, 7, 2, 2, 3, 3, 1, 1, 1, 1},
+            {8, 6, 3, 2, 3, 3, 1, 1, 1, 1},
+        };
+
+        /**
+         * The Winograd algorithm gives the output of the direct convolution up to rounding
+         * errors, and does not change the gradients, which use the direct convolution.
+         */
+        void winograd_matches_direct() {
+            using Layer = MiniDNN::Convolutional<MiniDNN::Identity, double>;
+            MiniDNN::RNG rng(SEED);
+            MiniDNN::internal::Workspace workspace;
+
+            for (const Shape& shape : WINOGRAD) {
+                Layer* layer = shape.create<Layer>();
+                layer->init(0, 0.5, rng);
+                CHECK(!layer->winograd_enabled());
+                const Eigen::MatrixXd x = Eigen::MatrixXd::Random(layer->in_size(), OBSERVATIONS);
+                const Eigen::MatrixXd direct = forward(*layer, workspace, x);
+                CHECK((direct - reference(shape, layer->get_parameters(), x)).cwiseAbs().maxCoeff() <= TOLERANCE);
+
+                layer->use_winograd(true);
+                CHECK(layer->winograd_enabled());
+                CHECK(relative_difference(forward(*layer, workspace, x), direct) <= FAST_TOLERANCE);
+                CHECK(layer->winograd_error(x) <= FAST_TOLERANCE);
+                Gradient::check(*layer, OBSERVATIONS, GRADIENT_TOLERANCE, SEED);
+
+                layer->use_winograd(false);
+                CHECK(!layer->winograd_enabled() && forward(*layer, workspace, x) == direct);
+                delete layer;
+            }
+
+            // The algorithm is enabled by default for many channels, and predictions of
+            // a network that uses it match those of the direct convolution
+            MiniDNN::Network<double> network;
+            Layer* layer = new Layer(6, 6, 32, 32, 3, 3, 1, 1, 1, 1);
+            network.add_layer(layer);
+            network.set_output(new MiniDNN::RegressionMSE<double>());
+            network.init(0, 0.1, SEED);
+            CHECK(layer->winograd_enabled());
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Random(layer->in_size(), OBSERVATIONS);
+            const Eigen::MatrixXd prediction = network.predict(x);
+            layer->use_winograd(false);
+            CHECK(relative_difference(prediction, network.predict(x)) <= FAST_TOLERANCE);
+
+            // Strided layers cannot use it
+            bool thrown = false;
+            try {
+                Layer strided(6, 6, 1, 1, 3, 3, 2, 2);
+                strided.use_winograd(true);
+            } catch (const std::invalid_argument&) {
+                thrown = true;
+            }
+            CHECK(thrown);
+        }
+
+        // Layers with stride 1 and large, non-square or padded windows
+        const Shape FFT[] = {
+            {9, 9, 2, 3, 5, 5, 1, 1, 0, 0},
+            {12, 10, 2, 2, 7, 5, 1, 1, 3, 2},
+            {11, 8, 3, 2, 9, 3, 1, 1, 0, 1},
+        };
+
+        /**
+         * The FFT convolution gives the output and the gradients of the direct convolution
+         * up to rounding errors, in prediction and in training.
+         */
+        void fft_matches_direct() {
+            using Layer = MiniDNN::Convolutional<MiniDNN::Identity, double>;
+            MiniDNN::RNG rng(SEED);
+            MiniDNN::internal::Workspace workspace;
+
+            for (const Shape& shape : FFT) {
+                Layer* layer = shape.create<Layer>();
+                layer->init(0, 0.5, rng);
+                layer->use_fft(false);
+                const Eigen::MatrixXd x = Eigen::MatrixXd::Random(layer->in_size(), OBSERVATIONS);
+                const Eigen::MatrixXd weights = Eigen::MatrixXd::Random(layer->out_size(), OBSERVATIONS);
+                const Eigen::MatrixXd direct = forward(*layer, workspace, x);
+                CHECK((direct - reference(shape, layer->get_parameters(), x)).cwiseAbs().maxCoeff() <= TOLERANCE);
+                layer->backprop(x, weights);
+                const Eigen::MatrixXd direct_input_gradient = layer->backprop_data();
+                const std::vector<double> direct_gradient = layer->get_derivatives();
+
+                layer->use_fft(true);
+                CHECK(layer->fft_enabled());
+                CHECK(relative_difference(forward(*layer, workspace, x), direct) <= FAST_TOLERANCE);
+                layer->backprop(x, weights);
+                CHECK(relative_difference(layer->backprop_data(), direct_input_gradient) <= FAST_TOLERANCE);
+                const std::vector<double> gradient = layer->get_derivatives();
+                for (std::size_t k = 0; k < gradient.size(); k++) {
+                    CHECK(std::abs(gradient[k] - direct_gradient[k]) <= FAST_TOLERANCE * std::max(1.0, std::abs(direct_gradient[k])));
+                }
+                Gradient::check(*layer, OBSERVATIONS, GRADIENT_TOLERANCE, SEED);
+                delete layer;
+            }
+
+            // The FFT convolution and the Winograd algorithm exclude each other
+            Layer layer(8, 8, 1, 1, 3, 3);
+            layer.init(0, 0.5, rng);
+            layer.use_winograd(true);
+            layer.use_fft(true);
+            CHECK(layer.fft_enabled() && !layer.winograd_enabled());
+            layer.use_winograd(true);
+            CHECK(!layer.fft_enabled() && layer.winograd_enabled());
+
+            bool thrown = false;
+            try {
+                Layer strided(9, 9, 1, 1, 5, 5, 2, 2);
+                strided.use_fft(true);
+            } catch (const std::invalid_argument&) {
+                thrown = true;
+            }
+            CHECK(thrown);
+        }
+
+        /**
+         * Trains a network whose convolution uses the FFT or not, and returns its parameters.
+         */
+        std::vector<std::vector<double>> train_fft(bool fft) {
+            MiniDNN::Network<double> network;
+            MiniDNN::Convolutional<MiniDNN::Tanh, double>* layer =
+                new MiniDNN::Convolutional<MiniDNN::Tanh, double>(10, 10, 1, 2, 5, 5, 1, 1, 2, 2);
+            layer->use_fft(fft);
+            network.add_layer(layer);
+            network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Identity, double>(200, 2));
+            network.set_output(new MiniDNN::RegressionMSE<double>());
+            network.init(0, 0.1, SEED);
+            std::srand(SEED);
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Random(100, 20);
+            const Eigen::MatrixXd y = Eigen::MatrixXd::Random(2, 20);
+            MiniDNN::Adam<double> optimizer;
+            network.fit(optimizer, x, y, 8, 2, SEED);
+            return network.get_parameters();
+        }
+
+        /**
+         * Training with the FFT convolution gives the parameters of the direct convolution.
+         */
+        void fft_training() {
+            const std::vector<std::vector<double>> direct = train_fft(false), fft = train_fft(true);
+            for (std::size_t i = 0; i < direct.size(); i++) {
+                for (std::size_t k = 0; k < direct[i].size(); k++) {
+                    CHECK(std::abs(fft[i][k] - direct[i][k]) <= FAST_TOLERANCE);
+                }
+            }
+        }
+
+        /**
+         * Runs the layer and its reference on the same input and output gradient, and
+         * checks that they give the same output and input gradient. Returns the parameter
+         * gradients of the layer and the reference.
+         */
+        void compare_layers(MiniDNN::Layer<double>& layer, MiniDNN::Layer<double>& reference_layer,
+                            std::vector<double>& gradient, std::vector<double>& reference_gradient) {
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Random(layer.in_size(), OBSERVATIONS);
+            const Eigen::MatrixXd weights = Eigen::MatrixXd::Random(layer.out_size(), OBSERVATIONS);
+            MiniDNN::internal::Workspace workspace, reference_workspace;
+
+            CHECK((forward(layer, workspace, x) - forward(reference_layer, reference_workspace, x))
+                  .cwiseAbs().maxCoeff() <= TOLERANCE);
+            layer.backprop(x, weights);
+            reference_layer.backprop(x, weights);
+            CHECK((layer.backprop_data() - reference_layer.backprop_data()).cwiseAbs().maxCoeff() <= TOLERANCE);
+            gradient = layer.get_derivatives();
+            reference_gradient = reference_layer.get_derivatives();
+        }
+
+        // Grouped layers with the number of input channels, the number of output channels
+        // and the number of groups, including the depthwise convolution
+        const Shape GROUPED[] = {
+            {7, 6, 4, 6, 3, 3, 1, 1, 1, 1},
+            {8, 8, 4, 4, 3, 3, 2, 2, 1, 1},
+            {6, 7, 6, 3, 2, 3, 1, 2, 0, 1},
+        };
+        const int GROUPS[][2] = {{1, 2}, {2, 4}, {1, 3}};
+
+        /**
+         * A grouped convolution is the convolution whose filters between channels of
+         * different groups are zero, and a pointwise convolution is the convolution
+         * with a 1x1 window.
+         */
+        void grouped_matches_dense() {
+            using Dense = MiniDNN::Convolutional<MiniDNN::Tanh, double>;
+            using Grouped = MiniDNN::GroupedConvolutional<MiniDNN::Tanh, double>;
+            MiniDNN::RNG rng(SEED);
+
+            for (std::size_t s = 0; s < sizeof(GROUPED) / sizeof(GROUPED[0]); s++) {
+                const Shape& shape = GROUPED[s];
+                const int window = shape.window_width * shape.window_height;
+
+                for (int groups : GROUPS[s]) {
+                    Grouped layer(shape.width, shape.height, shape.in_channels, shape.out_channels,
+                                  shape.window_width, shape.window_height, groups, shape.stride_width,
+                                  shape.stride_height, shape.pad_width, shape.pad_height);
+                    layer.init(0, 0.5, rng);
+                    CHECK(layer.groups() == groups);
+                    CHECK(layer.out_size() == shape.out_width() * shape.out_height() * shape.out_channels);
+
+                    // The filters of the group of each output channel, and zeros elsewhere
+                    const int group_in = shape.in_channels / groups, group_out = shape.out_channels / groups;
+                    const std::vector<double> parameters = layer.get_parameters();
+                    const std::size_t filters = std::size_t(group_in) * shape.out_channels * window;
+                    std::vector<double> dense_parameters(std::size_t(shape.in_channels) * shape.out_channels * window, 0);
+                    for (int co = 0; co < shape.out_channels; co++) {
+                        for (int i = 0; i < group_in; i++) {
+                            const int ci = co / group_out * group_in + i;
+                            std::copy(parameters.begin() + (i * shape.out_channels + co) * window,
+                                      parameters.begin() + (i * shape.out_channels + co + 1) * window,
+                                      dense_parameters.begin() + (ci * shape.out_channels + co) * window);
+                        }
+                    }
+                    dense_parameters.insert(dense_parameters.end(), parameters.begin() + filters, parameters.end());
+
+                    Dense* dense = shape.create<Dense>();
+                    dense->init();
+                    dense->set_parameters(dense_parameters);
+                    std::vector<double> gradient, dense_gradient;
+                    compare_layers(layer, *dense, gradient, dense_gradient);
+                    delete dense;
+
+                    for (int co = 0; co < shape.out_channels; co++) {
+                        for (int i = 0; i < group_in; i++) {
+                            const int ci = co / group_out * group_in + i;
+                            for (int k = 0; k < window; k++) {
+                                CHECK(std::abs(gradient[(i * shape.out_channels + co) * window + k] -
+                                               dense_gradient[(ci * shape.out_channels + co) * window + k]) <= TOLERANCE);
+                            }
+                        }
+                    }
+                    for (int co = 0; co < shape.out_channels; co++) {
+                        CHECK(std::abs(gradient[filters + co] - dense_gradient[dense_parameters.size() - shape.out_channels + co]) <= TOLERANCE);
+                    }
+
+                    Gradient::check(layer, OBSERVATIONS, GRADIENT_TOLERANCE, SEED);
+                }
+            }
+
+            // Pointwise convolutions, with more or fewer output channels than input channels
+            const int channels[][2] = {{3, 5}, {6, 2}};
+            for (const auto& c : channels) {
+                MiniDNN::PointwiseConvolutional<MiniDNN::Tanh, double> layer(7, 5, c[0], c[1]);
+                layer.init(0, 0.5, rng);
+                Dense dense(7, 5, c[0], c[1], 1, 1);
+                dense.init();
+                dense.set_parameters(layer.get_parameters());
+                std::vector<double> gradient, dense_gradient;
+                compare_layers(layer, dense, gradient, dense_gradient);
+                CHECK(gradient.size() == dense_gradient.size());
+                for (std::size_t k = 0; k < gradient.size(); k++) {
+                    CHECK(std::abs(gradient[k] - dense_gradient[k]) <= TOLERANCE);
+                }
+                Gradient::check(layer, OBSERVATIONS, GRADIENT_TOLERANCE, SEED);
+            }
+
+            // The groups must divide the numbers of channels
+            int thrown = 0;
+            for (int groups : {0, 3}) {
+                try {
+                    Grouped layer(6, 6, 4, 6, 3, 3, groups);
+                } catch (const std::invalid_argument&) {
+                    thrown++;
+                }
+            }
+            CHECK(thrown == 2);
+        }
+
+        /**
+         * The layer rejects strides and paddings that are not supported.
+         */
+        void invalid_shapes() {
+            using Layer = MiniDNN::Convolutional<MiniDNN::Identity, double>;
+            const Shape invalid[] = {
+                {6, 6, 1, 1, 3, 3, 0, 1, 0, 0},
+                {6, 6, 1, 1, 3, 3, 1, 1, -1, 0},
+                {6, 6, 1, 1, 3, 3, 1, 1, 0, 3},
+                {6, 6, 1, 1, 9, 3, 1, 1, 1, 0},
+            };
+            int thrown = 0;
+
+            for (const Shape& shape : invalid) {
+                try {
+                    delete shape.create<Layer>();
+                } catch (const std::invalid_argument&) {
+                    thrown++;
+                }
+            }
+            CHECK(thrown == 4);
+        }
+
+        void run() {
+            strided_padded();
+            invalid_shapes();
+            winograd_matches_direct();
+            fft_matches_direct();
+            fft_training();
+            grouped_matches_dense();
+        }
+    }
+}
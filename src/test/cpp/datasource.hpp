@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <MiniDNN.h>
+#include "check.hpp"
+
+namespace NeuralTest {
+    namespace DataSource {
+        constexpr int INPUTS = 4;
+        constexpr int OUTPUTS = 2;
+        constexpr int OBSERVATIONS = 37;
+        constexpr int BATCH_SIZE = 6;
+        constexpr int BATCHES = (OBSERVATIONS + BATCH_SIZE - 1) / BATCH_SIZE;
+        constexpr int CHUNK_SIZE = 14;
+        constexpr int EPOCHS = 3;
+        constexpr int SEED = 31;
+
+        using Matrix = Eigen::MatrixXd;
+        using Source = MiniDNN::DataSource<double>;
+
+        /**
+         * Data set whose observations hold their own ID in every input and output.
+         */
+        void data(Matrix& x, Matrix& y) {
+            const Eigen::RowVectorXd ids = Eigen::RowVectorXd::LinSpaced(OBSERVATIONS, 0, OBSERVATIONS - 1);
+            x = ids.replicate(INPUTS, 1);
+            y = ids.replicate(OUTPUTS, 1);
+        }
+
+        /**
+         * A file in the temporary directory that is removed with this object.
+         */
+        class TemporaryFile {
+        public:
+            TemporaryFile(const std::string& name, const Matrix& data) :
+                m_path((std::filesystem::temp_directory_path() / ("minidnn_test_" + name)).string()) {
+                std::ofstream stream(m_path.c_str(), std::ios::out | std::ios::binary);
+                stream.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(double));
+            }
+
+            ~TemporaryFile() {
+                std::remove(m_path.c_str());
+            }
+
+            const std::string& path() const {
+                return m_path;
+            }
+
+        private:
+            std::string m_path;
+        };
+
+        /**
+         * Reads the mini-batches of the epochs, checks their sizes and that their
+         * inputs and outputs come from the same observations, and returns the IDs
+         * of the observations of each batch.
+         */
+        std::vector<std::vector<int>> read(Source& source, MiniDNN::RNG& rng) {
+            std::vector<std::vector<int>> batches;
+            Matrix x, y;
+
+            for (int k = 0; k < EPOCHS; k++) {
+                source.reset(rng);
+                while (source.next_batch(x, y)) {
+                    CHECK(x.rows() == INPUTS && y.rows() == OUTPUTS);
+                    CHECK(x.cols() > 0 && x.cols() <= source.batch_size() && y.cols() == x.cols());
+                    std::vector<int> ids;
+                    for (int j = 0; j < x.cols(); j++) {
+                        CHECK((x.col(j).array() == x(0, j)).all() && (y.col(j).array() == x(0, j)).all());
+                        ids.push_back(int(x(0, j)));
+                    }
+                    batches.push_back(ids);
+                }
+            }
+            return batches;
+        }
+
+        /**
+         * Whether the batches of each epoch hold every observation exactly once.
+         */
+        bool epochs_complete(const std::vector<std::vector<int>>& batches) {
+            std::vector<int> ids;
+            int epochs = 0;
+
+            for (std::size_t i = 0; i < batches.size(); i++) {
+                ids.insert(ids.end(), batches[i].begin(), batches[i].end());
+                if (int(ids.size()) < OBSERVATIONS) {
+                    continue;
+                }
+                std::sort(ids.begin(), ids.end());
+                for (int j = 0; j < int(ids.size()); j++) {
+                    if (ids[j] != j) {
+                        return false;
+                    }
+                }
+                ids.clear();
+                epochs++;
+            }
+            return ids.empty() && epochs == EPOCHS;
+        }
+
+        /**
+         * Fitting on a MatrixSource is the same as fitting on the matrices.
+         */
+        void matrix_source() {
+            Matrix x, y;
+            data(x, y);
+            x /= OBSERVATIONS;
+            y /= OBSERVATIONS;
+            std::vector<std::vector<double>> parameters[2];
+
+            for (int i = 0; i < 2; i++) {
+                MiniDNN::Network<double> network;
+                network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Tanh, double>(INPUTS, OUTPUTS));
+                network.set_output(new MiniDNN::RegressionMSE<double>());
+                network.init(0, 0.1, SEED);
+                MiniDNN::SGD<double> optimizer;
+
+                if (i == 0) {
+                    network.fit(optimizer, x, y, BATCH_SIZE, EPOCHS, SEED);
+                } else {
+                    MiniDNN::MatrixSource<double> source(x, y, BATCH_SIZE);
+                    network.fit(optimizer, source, EPOCHS, SEED);
+                }
+                parameters[i] = network.get_parameters();
+            }
+            CHECK(parameters[0] == parameters[1]);
+        }
+
+        /**
+         * The memory-mapped files give each observation once per epoch, in contiguous
+         * batches whose order is shuffled unless asked otherwise.
+         */
+        void mapped_file_source() {
+            Matrix x, y;
+            data(x, y);
+            const TemporaryFile x_file("mapped_x.bin", x), y_file("mapped_y.bin", y);
+
+            for (int shuffle = 0; shuffle <= 1; shuffle++) {
+                MiniDNN::MappedFileSource<double> source(x_file.path(), y_file.path(), INPUTS, OUTPUTS,
+                                                         BATCH_SIZE, shuffle);
+                CHECK(source.size_hint() == OBSERVATIONS && source.batch_size() == BATCH_SIZE);
+                MiniDNN::RNG rng(SEED);
+                const std::vector<std::vector<int>> batches = read(source, rng);
+                CHECK(epochs_complete(batches));
+
+                bool in_order = true;
+                for (std::size_t i = 0; i < batches.size(); i++) {
+                    const std::vector<int>& ids = batches[i];
+                    CHECK(ids[0] % BATCH_SIZE == 0);
+                    for (std::size_t j = 1; j < ids.size(); j++) {
+                        CHECK(ids[j] == ids[j - 1] + 1);
+                    }
+                    in_order = in_order && ids[0] == int(i % BATCHES) * BATCH_SIZE;
+                }
+                CHECK(in_order == !shuffle);
+            }
+        }
+
+        /**
+         * The chunked files give each observation once per epoch, and only shuffle the
+         * observations within a chunk.
+         */
+        void chunked_file_source() {
+            Matrix x, y;
+            data(x, y);
+            const TemporaryFile x_file("chunked_x.bin", x), y_file("chunked_y.bin", y);
+            // The chunk size is rounded up to a multiple of the batch size
+            const int chunk_size = (CHUNK_SIZE + BATCH_SIZE - 1) / BATCH_SIZE * BATCH_SIZE;
+
+            for (int shuffle = 0; shuffle <= 1; shuffle++) {
+                MiniDNN::ChunkedFileSource<double> source(x_file.path(), y_file.path(), INPUTS, OUTPUTS,
+                                                          BATCH_SIZE, CHUNK_SIZE, shuffle);
+                CHECK(source.size_hint() == OBSERVATIONS && source.batch_size() == BATCH_SIZE);
+                MiniDNN::RNG rng(SEED);
+                const std::vector<std::vector<int>> batches = read(source, rng);
+                CHECK(epochs_complete(batches));
+
+                std::vector<int> ids;
+                for (std::size_t i = 0; i < batches.size(); i++) {
+                    ids.insert(ids.end(), batches[i].begin(), batches[i].end());
+                }
+
+                bool in_order = true;
+                for (std::size_t j = 0; j < ids.size(); j++) {
+                    const int position = j % OBSERVATIONS;
+                    CHECK(ids[j] / chunk_size == position / chunk_size);
+                    in_order = in_order && ids[j] == position;
+                }
+                CHECK(in_order == !shuffle);
+            }
+        }
+
+        /**
+         * The file sources reject missing files and files whose size does not match the
+         * dimension of the observations or the other file.
+         */
+        void invalid_files() {
+            Matrix x, y;
+            data(x, y);
+            const TemporaryFile x_file("invalid_x.bin", x), y_file("invalid_y.bin", y);
+            const TemporaryFile short_file("invalid_short.bin", y.leftCols(OBSERVATIONS - 1));
+            const std::string missing = x_file.path() + ".missing";
+
+            bool thrown[6] = {false, false, false, false, false, false};
+            try {
+                MiniDNN::MappedFileSource<double> source(missing, y_file.path(), INPUTS, OUTPUTS, BATCH_SIZE);
+            } catch (const std::runtime_error&) {
+                thrown[0] = true;
+            }
+            try {
+                MiniDNN::MappedFileSource<double> source(x_file.path(), y_file.path(), INPUTS + 1, OUTPUTS, BATCH_SIZE);
+            } catch (const std::invalid_argument&) {
+                thrown[1] = true;
+            }
+            try {
+                MiniDNN::MappedFileSource<double> source(x_file.path(), short_file.path(), INPUTS, OUTPUTS, BATCH_SIZE);
+            } catch (const std::invalid_argument&) {
+                thrown[2] = true;
+            }
+            try {
+                MiniDNN::ChunkedFileSource<double> source(missing, y_file.path(), INPUTS, OUTPUTS, BATCH_SIZE, CHUNK_SIZE);
+            } catch (const std::runtime_error&) {
+                thrown[3] = true;
+            }
+            try {
+                MiniDNN::ChunkedFileSource<double> source(x_file.path(), y_file.path(), INPUTS + 1, OUTPUTS, BATCH_SIZE, CHUNK_SIZE);
+            } catch (const std::invalid_argument&) {
+                thrown[4] = true;
+            }
+            try {
+                MiniDNN::ChunkedFileSource<double> source(x_file.path(), short_file.path(), INPUTS, OUTPUTS, BATCH_SIZE, CHUNK_SIZE);
+            } catch (const std::invalid_argument&) {
+                thrown[5] = true;
+            }
+            CHECK(std::count(thrown, thrown + 6, true) == 6);
+        }
+
+        void run() {
+            matrix_source();
+            mapped_file_source();
+            chunked_file_source();
+            invalid_files();
+        }
+    }
+}
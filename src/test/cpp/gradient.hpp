@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include <MiniDNN.h>
+#include "check.hpp"
+
+/**
+ * Checks of the gradients computed by the layers against finite differences.
+ *
+ * The loss of a layer is the sum of its outputs weighted by fixed random
+ * coefficients, so that the gradient of its output is the matrix of the coefficients.
+ */
+namespace Gradient {
+    using Layer = MiniDNN::Layer<double>;
+
+    constexpr double STEP = 1e-6;
+
+    /**
+     * Runs the layer on the input in the given workspace, and returns the weighted
+     * sum of its outputs.
+     */
+    double loss(Layer& layer, MiniDNN::internal::Workspace& workspace, const Eigen::MatrixXd& x,
+                const Eigen::MatrixXd& weights) {
+        const int observations = x.cols();
+        workspace.reset();
+        workspace.reserve(layer.workspace_size(observations) + layer.scratch_size(observations));
+        layer.bind_workspace(workspace, observations);
+        layer.forward(x);
+        return layer.output().cwiseProduct(weights).sum();
+    }
+
+    /**
+     * Whether the derivative is the estimate by central differences, up to the
+     * given relative tolerance.
+     */
+    bool matches(double derivative, double estimate, double tolerance) {
+        return std::abs(derivative - estimate) <= tolerance * std::max(1.0, std::abs(estimate));
+    }
+
+    /**
+     * Checks the gradients of the input and of the parameters of the layer, which has
+     * been initialized, on random observations. The layers average the gradients of
+     * the parameters over the observations.
+     */
+    void check(Layer& layer, int observations, double tolerance, int seed) {
+        std::srand(seed);
+        Eigen::MatrixXd x = Eigen::MatrixXd::Random(layer.in_size(), observations);
+        const Eigen::MatrixXd weights = Eigen::MatrixXd::Random(layer.out_size(), observations);
+        MiniDNN::internal::Workspace workspace;
+
+        loss(layer, workspace, x, weights);
+        layer.backprop(x, weights);
+        const Eigen::MatrixXd input_gradient = layer.backprop_data();
+        const std::vector<double> parameter_gradient = layer.get_derivatives();
+
+        for (int j = 0; j < x.cols(); j++) {
+            for (int i = 0; i < x.rows(); i++) {
+                const double value = x(i, j);
+                x(i, j) = value + STEP;
+                const double post = loss(layer, workspace, x, weights);
+                x(i, j) = value - STEP;
+                const double pre = loss(layer, workspace, x, weights);
+                x(i, j) = value;
+                CHECK(matches(input_gradient(i, j), (post - pre) / (2 * STEP), tolerance));
+            }
+        }
+
+        std::vector<double> parameters = layer.get_parameters();
+
+        for (std::size_t k = 0; k < parameters.size(); k++) {
+            const double value = parameters[k];
+            parameters[k] = value + STEP;
+            layer.set_parameters(parameters);
+            const double post = loss(layer, workspace, x, weights);
+            parameters[k] = value - STEP;
+            layer.set_parameters(parameters);
+            const double pre = loss(layer, workspace, x, weights);
+            parameters[k] = value;
+            CHECK(matches(parameter_gradient[k] * observations, (post - pre) / (2 * STEP), tolerance));
+        }
+
+        layer.set_parameters(parameters);
+    }
+}
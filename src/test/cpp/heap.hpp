@@ -0,0 +1,88 @@
+#pragma once
+
+// This header must be included before Eigen, so that Eigen reports its heap
+// allocations to the counter below instead of aborting.
+#define EIGEN_RUNTIME_NO_MALLOC
+#define eigen_assert(condition) Heap::assertion((condition), #condition)
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+/**
+ * Counts the heap allocations made by operator new and by Eigen.
+ */
+namespace Heap {
+    inline std::atomic<bool> counting(false);
+    inline std::atomic<long> allocations(0);
+
+    /**
+     * Handles the assertions of Eigen. A failed assertion is thrown as an error,
+     * except the one raised when Eigen allocates while the counter is running,
+     * which is counted.
+     */
+    inline void assertion(bool condition, const char* expression) {
+        if (condition) {
+            return;
+        }
+        if (counting && std::strstr(expression, "is_malloc_allowed") != nullptr) {
+            allocations++;
+            return;
+        }
+        throw std::logic_error(std::string("Eigen assertion failed: ") + expression);
+    }
+
+    /**
+     * Starts counting the allocations from zero.
+     */
+    void start();
+
+    /**
+     * Stops counting the allocations.
+     */
+    void stop();
+
+    /**
+     * Number of allocations counted so far.
+     */
+    inline long count() {
+        return allocations;
+    }
+}
+
+#include <Eigen/Core>
+
+namespace Heap {
+    void start() {
+        allocations = 0;
+        counting = true;
+        Eigen::internal::set_is_malloc_allowed(false);
+    }
+
+    void stop() {
+        Eigen::internal::set_is_malloc_allowed(true);
+        counting = false;
+    }
+}
+
+void* operator new(std::size_t size) {
+    if (Heap::counting) {
+        Heap::allocations++;
+    }
+    void* pointer = std::malloc(size == 0 ? 1 : size);
+    if (pointer == nullptr) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <MiniDNN.h>
+#include "check.hpp"
+
+namespace NeuralTest {
+    namespace Inference {
+        constexpr int IMAGE_SIZE = 8;
+        constexpr int CHANNELS = 3;
+        constexpr int OUTPUTS = 4;
+        constexpr int OBSERVATIONS = 24;
+        constexpr int THREADS = 4;
+        constexpr int ROUNDS = 20;
+        constexpr int SEED = 37;
+
+        using Network = MiniDNN::Network<double>;
+        using Session = MiniDNN::InferenceSession<double>;
+
+        void build(Network& network) {
+            network.add_layer(new MiniDNN::Convolutional<MiniDNN::ReLU, double>(
+                IMAGE_SIZE, IMAGE_SIZE, 1, CHANNELS, 3, 3, 1, 1, 1, 1));
+            network.add_layer(new MiniDNN::MaxPooling<MiniDNN::Identity, double>(
+                IMAGE_SIZE, IMAGE_SIZE, CHANNELS, 2, 2));
+            network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Tanh, double>(
+                IMAGE_SIZE * IMAGE_SIZE * CHANNELS / 4, 10));
+            network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Softmax, double>(10, OUTPUTS));
+            network.set_output(new MiniDNN::MultiClassEntropy<double>());
+            network.init(0, 0.1, SEED);
+        }
+
+        /**
+         * Sessions on several threads share one network, and each of them gives the
+         * predictions of the network on batches of any size.
+         */
+        void concurrent_sessions() {
+            Network network;
+            build(network);
+            std::srand(SEED);
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Random(IMAGE_SIZE * IMAGE_SIZE, OBSERVATIONS);
+            std::vector<Eigen::MatrixXd> expected(OBSERVATIONS + 1);
+            for (int n = 1; n <= OBSERVATIONS; n++) {
+                expected[n] = network.predict(x.leftCols(n));
+            }
+
+            std::vector<int> failures(THREADS, 0);
+            std::vector<std::thread> threads;
+            for (int t = 0; t < THREADS; t++) {
+                threads.push_back(std::thread([&, t] {
+                    Session session(network);
+                    for (int i = 0; i < ROUNDS; i++) {
+                        const int n = 1 + (7 * i + 5 * t) % OBSERVATIONS;
+                        if (session.predict(x.leftCols(n)) != expected[n]) {
+                            failures[t]++;
+                        }
+                    }
+                }));
+            }
+            for (std::size_t t = 0; t < threads.size(); t++) {
+                threads[t].join();
+            }
+
+            for (int t = 0; t < THREADS; t++) {
+                CHECK(failures[t] == 0);
+            }
+            // The network itself has not been disturbed by the sessions
+            CHECK(network.predict(x) == expected[OBSERVATIONS]);
+        }
+
+        /**
+         * The memory of a session is only reallocated when the batch grows.
+         */
+        void session_memory() {
+            Network network;
+            build(network);
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Random(IMAGE_SIZE * IMAGE_SIZE, OBSERVATIONS);
+            Session session(network);
+
+            session.predict(x);
+            const int allocations = session.num_workspace_allocations();
+            CHECK(allocations > 0);
+            for (int n = 1; n <= OBSERVATIONS; n++) {
+                session.predict(x.leftCols(n));
+            }
+            CHECK(session.num_workspace_allocations() == allocations);
+        }
+
+        /**
+         * A session rejects inputs of the wrong dimension.
+         */
+        void invalid_input() {
+            Network network;
+            build(network);
+            Session session(network);
+            bool thrown = false;
+            try {
+                session.predict(Eigen::MatrixXd::Zero(IMAGE_SIZE, 1));
+            } catch (const std::invalid_argument&) {
+                thrown = true;
+            }
+            CHECK(thrown);
+        }
+
+        void run() {
+            concurrent_sessions();
+            session_memory();
+            invalid_input();
+        }
+    }
+}
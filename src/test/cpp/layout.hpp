@@ -0,0 +1,152 @@
+#pragma once
+
+#include <vector>
+#include <MiniDNN.h>
+#include "check.hpp"
+#include "gradient.hpp"
+
+namespace NeuralTest {
+    namespace Layout {
+        // A multiple of the packet size of double with SSE2, AVX and AVX-512
+        constexpr int CHANNELS = 8;
+        constexpr int IMAGE_WIDTH = 11;
+        constexpr int IMAGE_HEIGHT = 9;
+        constexpr int OUTPUTS = 3;
+        constexpr int OBSERVATIONS = 40;
+        constexpr int BATCH_SIZE = 16;
+        constexpr int EPOCHS = 2;
+        constexpr double TOLERANCE = 1e-10;
+        constexpr double GRADIENT_TOLERANCE = 1e-6;
+        constexpr int SEED = 13;
+
+        using Network = MiniDNN::Network<double>;
+        using Convolution = MiniDNN::Convolutional<MiniDNN::ReLU, double>;
+        using MaxPooling = MiniDNN::MaxPooling<MiniDNN::ReLU, double>;
+        using Parameters = std::vector<std::vector<double>>;
+
+        /**
+         * Builds a network of 3-channel images with strided, padded and non-square
+         * convolutions and a pooling layer, whose hidden layers have CHANNELS channels.
+         */
+        void build(Network& network) {
+            // 11 x 9 -> 6 x 9 -> 6 x 8 -> 3 x 4 -> 2 x 3
+            network.add_layer(new Convolution(IMAGE_WIDTH, IMAGE_HEIGHT, 3, CHANNELS, 3, 3, 2, 1, 1, 1));
+            network.add_layer(new Convolution(6, 9, CHANNELS, CHANNELS, 3, 2, 1, 1, 1, 0));
+            network.add_layer(new MaxPooling(6, 8, CHANNELS, 2, 2));
+            network.add_layer(new Convolution(3, 4, CHANNELS, CHANNELS, 2, 2));
+            network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Identity, double>(2 * 3 * CHANNELS, OUTPUTS));
+            network.set_output(new MiniDNN::RegressionMSE<double>());
+        }
+
+        /**
+         * Trains the network, and returns its parameters and its predictions.
+         */
+        void train(Network& network, int threads, Parameters& parameters, Eigen::MatrixXd& prediction) {
+            std::srand(SEED);
+            Eigen::MatrixXd x = Eigen::MatrixXd::Random(IMAGE_WIDTH * IMAGE_HEIGHT * 3, OBSERVATIONS);
+            Eigen::MatrixXd y = Eigen::MatrixXd::Random(OUTPUTS, OBSERVATIONS);
+            MiniDNN::Adam<double> optimizer;
+            network.set_num_threads(threads);
+            network.init(0, 0.1, SEED);
+            network.fit(optimizer, x, y, BATCH_SIZE, EPOCHS, SEED);
+            parameters = network.get_parameters();
+            prediction = network.predict(x);
+
+            MiniDNN::InferenceSession<double> session(network);
+            CHECK(session.predict(x) == prediction);
+        }
+
+        /**
+         * Largest absolute difference of two sets of parameters of the same network.
+         */
+        double difference(const Parameters& a, const Parameters& b) {
+            double res = 0;
+            for (std::size_t i = 0; i < a.size(); i++) {
+                for (std::size_t j = 0; j < a[i].size(); j++) {
+                    res = std::max(res, std::abs(a[i][j] - b[i][j]));
+                }
+            }
+            return res;
+        }
+
+        /**
+         * Adjacent convolutional and pooling layers exchange blocked images, while the
+         * input of the network and the input of the fully connected layer stay planar.
+         */
+        void blocked_links() {
+            Network network;
+            build(network);
+            network.set_blocked_layout(true);
+            const std::vector<const MiniDNN::Layer<double>*> layers = network.get_layers();
+            const bool input[] = {false, true, true, true, false};
+            const bool output[] = {true, true, true, false, false};
+
+            for (std::size_t i = 0; i < layers.size(); i++) {
+                CHECK(layers[i]->blocked_input() == input[i]);
+                CHECK(layers[i]->blocked_output() == output[i]);
+            }
+
+            network.set_blocked_layout(false);
+
+            for (std::size_t i = 0; i < layers.size(); i++) {
+                CHECK(!layers[i]->blocked_input() && !layers[i]->blocked_output());
+            }
+        }
+
+        /**
+         * Training and prediction give the same results in the blocked and the planar
+         * layouts, in serial and data-parallel training.
+         */
+        void blocked_matches_planar() {
+            for (int threads = 1; threads <= 2; threads++) {
+                Parameters planar_parameters, blocked_parameters;
+                Eigen::MatrixXd planar_prediction, blocked_prediction;
+
+                Network planar;
+                build(planar);
+                train(planar, threads, planar_parameters, planar_prediction);
+
+                Network blocked;
+                build(blocked);
+                blocked.set_blocked_layout(true);
+                train(blocked, threads, blocked_parameters, blocked_prediction);
+
+                CHECK(difference(planar_parameters, blocked_parameters) <= TOLERANCE);
+                CHECK((planar_prediction - blocked_prediction).cwiseAbs().maxCoeff() <= TOLERANCE);
+            }
+        }
+
+        /**
+         * The gradients of the layers with blocked inputs or outputs match finite differences.
+         */
+        void blocked_gradient() {
+            const bool sides[][2] = {{true, true}, {true, false}, {false, true}};
+            MiniDNN::RNG rng(SEED);
+
+            for (const auto& side : sides) {
+                Convolution convolution(7, 6, CHANNELS, CHANNELS, 3, 2, 2, 1, 1, 1);
+                convolution.init(0, 0.1, rng);
+                convolution.set_blocked_layout(side[0], side[1]);
+                CHECK(convolution.blocked_input() == side[0] && convolution.blocked_output() == side[1]);
+                Gradient::check(convolution, 3, GRADIENT_TOLERANCE, SEED);
+
+                MaxPooling pooling(7, 6, CHANNELS, 3, 2);
+                pooling.set_blocked_layout(side[0], side[1]);
+                Gradient::check(pooling, 3, GRADIENT_TOLERANCE, SEED);
+            }
+
+            // A planar input with a number of channels that needs padding in the blocks
+            Convolution convolution(5, 5, 3, CHANNELS, 3, 3, 1, 1, 1, 1);
+            convolution.init(0, 0.1, rng);
+            convolution.set_blocked_layout(true, true);
+            CHECK(!convolution.blocked_input() && convolution.blocked_output());
+            Gradient::check(convolution, 3, GRADIENT_TOLERANCE, SEED);
+        }
+
+        void run() {
+            blocked_links();
+            blocked_matches_planar();
+            blocked_gradient();
+        }
+    }
+}
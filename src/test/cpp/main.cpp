@@ -0,0 +1,38 @@
+#include "heap.hpp"
+#include <iostream>
+#include <exception>
+#include "transforms.hpp"
+#include "allocations.hpp"
+#include "pooling.hpp"
+#include "layout.hpp"
+#include "parallel.hpp"
+#include "batching.hpp"
+#include "datasource.hpp"
+#include "inference.hpp"
+#include "serving.hpp"
+#include "quantization.hpp"
+#include "pruning.hpp"
+#include "convolution.hpp"
+#include "output.hpp"
+
+int main() {
+    try {
+        NeuralTest::Transforms::run();
+        NeuralTest::Allocations::run();
+        NeuralTest::Pooling::run();
+        NeuralTest::Layout::run();
+        NeuralTest::Parallel::run();
+        NeuralTest::Batching::run();
+        NeuralTest::DataSource::run();
+        NeuralTest::Inference::run();
+        NeuralTest::Serving::run();
+        NeuralTest::Quantization::run();
+        NeuralTest::Pruning::run();
+        NeuralTest::Convolution::run();
+        NeuralTest::Output::run();
+    } catch (const std::exception& error) {
+        std::cout << error.what() << std::endl;
+        return 1;
+    }
+    std::cout << "All tests passed." << std::endl;
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include <MiniDNN.h>
+#include "check.hpp"
+
+namespace NeuralTest {
+    namespace Output {
+        constexpr int INPUTS = 6;
+        constexpr int HIDDEN = 8;
+        constexpr int CLASSES = 4;
+        constexpr int OBSERVATIONS = 30;
+        constexpr int BATCH_SIZE = 8;
+        constexpr int EPOCHS = 3;
+        // Scale of the weights that saturates the activation of the last layer
+        constexpr double LARGE_WEIGHTS = 1000;
+        constexpr double TOLERANCE = 1e-10;
+        constexpr int SEED = 59;
+
+        using Network = MiniDNN::Network<double>;
+        using Parameters = std::vector<std::vector<double>>;
+        using Labels = Eigen::RowVectorXi;
+
+        /**
+         * Records the loss of each mini-batch.
+         */
+        class LossRecorder : public MiniDNN::Callback<double> {
+        public:
+            std::vector<double> losses;
+
+            void post_training_batch(const Network* network, const Matrix& x, const Matrix& y) override {
+                losses.push_back(network->training_loss());
+            }
+
+            void post_training_batch(const Network* network, const Matrix& x, const IntegerVector& y) override {
+                losses.push_back(network->training_loss());
+            }
+        };
+
+        /**
+         * Result of training a network.
+         */
+        struct Training {
+            Parameters parameters;
+            std::vector<double> losses;
+            Eigen::MatrixXd prediction;
+        };
+
+        /**
+         * Trains a network whose last layer has the given activation, with the given
+         * output layer and number of workers.
+         */
+        template <typename Activation, typename Target>
+        Training train(MiniDNN::Output<double>* output, int outputs, const Eigen::MatrixXd& x,
+                       const Target& y, int threads) {
+            Network network;
+            network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Tanh, double>(INPUTS, HIDDEN));
+            network.add_layer(new MiniDNN::FullyConnected<Activation, double>(HIDDEN, outputs));
+            network.set_output(output);
+            network.init(0, 0.5, SEED);
+            LossRecorder recorder;
+            network.set_callback(recorder);
+            network.set_num_threads(threads);
+            MiniDNN::Adam<double> optimizer;
+            network.fit(optimizer, x, y, BATCH_SIZE, EPOCHS, SEED);
+            network.set_default_callback();
+
+            Training res;
+            res.parameters = network.get_parameters();
+            res.losses = recorder.losses;
+            res.prediction = network.predict(x);
+            return res;
+        }
+
+        /**
+         * Whether two trainings give the same losses, parameters and predictions, up to
+         * rounding errors.
+         */
+        bool same_training(const Training& a, const Training& b) {
+            bool res = a.losses.size() == b.losses.size() && a.parameters.size() == b.parameters.size();
+            for (std::size_t i = 0; res && i < a.losses.size(); i++) {
+                res = std::abs(a.losses[i] - b.losses[i]) <= TOLERANCE;
+            }
+            for (std::size_t i = 0; res && i < a.parameters.size(); i++) {
+                for (std::size_t k = 0; res && k < a.parameters[i].size(); k++) {
+                    res = std::abs(a.parameters[i][k] - b.parameters[i][k]) <= TOLERANCE;
+                }
+            }
+            return res && (a.prediction - b.prediction).cwiseAbs().maxCoeff() <= TOLERANCE;
+        }
+
+        /**
+         * Random class labels, and the matrix of the same targets.
+         */
+        void labels(int classes, Labels& y, Eigen::MatrixXd& y_matrix) {
+            y.resize(OBSERVATIONS);
+            y_matrix.setZero(classes, OBSERVATIONS);
+            for (int i = 0; i < OBSERVATIONS; i++) {
+                y[i] = std::rand() % classes;
+                y_matrix(y[i], i) = 1;
+            }
+        }
+
+        /**
+         * Training with Softmax fused with the loss gives the losses, the parameters and
+         * the predictions of the separate Softmax and loss, with class labels and target
+         * matrices, in serial and data-parallel training.
+         */
+        void fused_softmax_matches_unfused() {
+            std::srand(SEED);
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Random(INPUTS, OBSERVATIONS);
+            Labels y;
+            Eigen::MatrixXd y_matrix;
+            labels(CLASSES, y, y_matrix);
+            using Softmax = MiniDNN::Softmax;
+            using Entropy = MiniDNN::MultiClassEntropy<double>;
+
+            for (int threads = 1; threads <= 2; threads++) {
+                const Training unfused = train<Softmax>(new Entropy(false), CLASSES, x, y, threads);
+                CHECK(same_training(train<Softmax>(new Entropy(true), CLASSES, x, y, threads), unfused));
+                CHECK(same_training(train<Softmax>(new Entropy(true), CLASSES, x, y_matrix, threads), unfused));
+            }
+        }
+
+        /**
+         * Trains a single layer with large weights for one mini-batch, and returns its loss.
+         */
+        template <typename Activation, typename Target>
+        double saturated_loss(MiniDNN::Output<double>* output, int outputs, const Eigen::MatrixXd& x,
+                              const Target& y, Parameters& parameters) {
+            Network network;
+            network.add_layer(new MiniDNN::FullyConnected<Activation, double>(INPUTS, outputs));
+            network.set_output(output);
+            network.init(0, 1, SEED);
+            parameters = network.get_parameters();
+            for (double& parameter : parameters[0]) {
+                parameter *= LARGE_WEIGHTS;
+            }
+            network.set_parameters(parameters);
+
+            LossRecorder recorder;
+            network.set_callback(recorder);
+            MiniDNN::SGD<double> optimizer;
+            network.fit(optimizer, x, y, OBSERVATIONS, 1, SEED);
+            network.set_default_callback();
+            return recorder.losses[0];
+        }
+
+        /**
+         * Linear terms of a fully connected layer with the given parameters.
+         */
+        Eigen::MatrixXd linear_terms(const std::vector<double>& parameters, int outputs, const Eigen::MatrixXd& x) {
+            const Eigen::Map<const Eigen::MatrixXd> weights(parameters.data(), INPUTS, outputs);
+            const Eigen::Map<const Eigen::VectorXd> bias(parameters.data() + INPUTS * outputs, outputs);
+            return (weights.transpose() * x).colwise() + bias;
+        }
+
+        /**
+         * The fused loss is exact for saturated Softmax outputs, whose probabilities
+         * underflow to zero.
+         */
+        void fused_softmax_saturated() {
+            std::srand(SEED);
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Random(INPUTS, OBSERVATIONS);
+            Labels y;
+            Eigen::MatrixXd y_matrix;
+            labels(CLASSES, y, y_matrix);
+            Parameters parameters;
+            const double loss = saturated_loss<MiniDNN::Softmax>(
+                new MiniDNN::MultiClassEntropy<double>(true), CLASSES, x, y, parameters);
+
+            // Mean of log(sum(exp(z))) - z[label] over the observations
+            const Eigen::MatrixXd z = linear_terms(parameters[0], CLASSES, x);
+            double expected = 0;
+            for (int i = 0; i < OBSERVATIONS; i++) {
+                const double m = z.col(i).maxCoeff();
+                expected += m + std::log((z.col(i).array() - m).exp().sum()) - z(y[i], i);
+            }
+            expected /= OBSERVATIONS;
+            CHECK(std::isfinite(loss) && std::abs(loss - expected) <= TOLERANCE * std::max(1.0, expected));
+        }
+
+        /**
+         * Class labels beyond the number of classes are rejected.
+         */
+        void invalid_labels() {
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Random(INPUTS, OBSERVATIONS);
+            Labels y = Labels::Zero(OBSERVATIONS);
+            y[1] = CLASSES;
+
+            for (bool fused : {false, true}) {
+                bool thrown = false;
+                try {
+                    train<MiniDNN::Softmax>(new MiniDNN::MultiClassEntropy<double>(fused), CLASSES, x, y, 1);
+                } catch (const std::invalid_argument&) {
+                    thrown = true;
+                }
+                CHECK(thrown);
+            }
+        }
+
+        void run() {
+            fused_softmax_matches_unfused();
+            fused_softmax_saturated();
+            invalid_labels();
+        }
+    }
+}
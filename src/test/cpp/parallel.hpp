@@ -0,0 +1,207 @@
+#pragma once
+
+#include <stdexcept>
+#include <vector>
+#include <MiniDNN.h>
+#include "check.hpp"
+
+namespace NeuralTest {
+    namespace Parallel {
+        constexpr int INPUTS = 12;
+        constexpr int OUTPUTS = 3;
+        constexpr int IMAGE_SIZE = 6;
+        constexpr int CHANNELS = 4;
+        // The last mini-batch is smaller than the others, and the slices of the
+        // workers have different sizes
+        constexpr int OBSERVATIONS = 50;
+        constexpr int BATCH_SIZE = 20;
+        constexpr int EPOCHS = 3;
+        constexpr int MAX_THREADS = 3;
+        constexpr double TOLERANCE = 1e-12;
+        constexpr int SEED = 17;
+
+        using Network = MiniDNN::Network<double>;
+        using Parameters = std::vector<std::vector<double>>;
+
+        /**
+         * Records the loss of each mini-batch over the whole batch.
+         */
+        class LossRecorder : public MiniDNN::Callback<double> {
+        public:
+            std::vector<double> losses;
+
+            void post_training_batch(const Network* network, const Matrix& x, const Matrix& y) override {
+                losses.push_back(network->training_loss());
+            }
+
+            void post_training_batch(const Network* network, const Matrix& x, const IntegerVector& y) override {
+                losses.push_back(network->training_loss());
+            }
+        };
+
+        /**
+         * A fully connected layer whose copies throw in the forward pass, so that the
+         * workers of data-parallel training fail while the network itself does not.
+         */
+        class FailingCopy : public MiniDNN::FullyConnected<MiniDNN::Identity, double> {
+        public:
+            FailingCopy(int in_size, int out_size) :
+                MiniDNN::FullyConnected<MiniDNN::Identity, double>(in_size, out_size), m_fail(false) {}
+
+            void forward(const MiniDNN::Layer<double>::ConstRefMat& prev_layer_data) override {
+                if (m_fail) {
+                    throw std::domain_error("worker failure");
+                }
+                MiniDNN::FullyConnected<MiniDNN::Identity, double>::forward(prev_layer_data);
+            }
+
+            MiniDNN::Layer<double>* clone() const override {
+                FailingCopy* res = new FailingCopy(*this);
+                res->own_parameters();
+                res->m_fail = true;
+                return res;
+            }
+
+        private:
+            bool m_fail;
+        };
+
+        void fully_connected(Network& network) {
+            network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Tanh, double>(INPUTS, 16));
+            network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Softmax, double>(16, OUTPUTS));
+            network.set_output(new MiniDNN::MultiClassEntropy<double>());
+        }
+
+        void convolutional(Network& network) {
+            network.add_layer(new MiniDNN::Convolutional<MiniDNN::ReLU, double>(
+                IMAGE_SIZE, IMAGE_SIZE, 1, CHANNELS, 3, 3, 1, 1, 1, 1));
+            network.add_layer(new MiniDNN::MaxPooling<MiniDNN::Identity, double>(
+                IMAGE_SIZE, IMAGE_SIZE, CHANNELS, 2, 2));
+            network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Softmax, double>(
+                IMAGE_SIZE * IMAGE_SIZE * CHANNELS / 4, OUTPUTS));
+            network.set_output(new MiniDNN::MultiClassEntropy<double>());
+        }
+
+        /**
+         * Trains the network built by 'build' with the given number of workers, and
+         * returns its parameters and the loss of each mini-batch.
+         */
+        template <typename Build>
+        void train(Build build, int threads, Parameters& parameters, std::vector<double>& losses) {
+            Network network;
+            build(network);
+            const int inputs = network.get_layers()[0]->in_size();
+            std::srand(SEED);
+            Eigen::MatrixXd x = Eigen::MatrixXd::Random(inputs, OBSERVATIONS);
+            Eigen::RowVectorXi labels(OBSERVATIONS);
+            for (int i = 0; i < OBSERVATIONS; i++) {
+                labels[i] = i % OUTPUTS;
+            }
+
+            MiniDNN::Adam<double> optimizer;
+            LossRecorder recorder;
+            network.set_callback(recorder);
+            network.set_num_threads(threads);
+            network.init(0, 0.1, SEED);
+            network.fit(optimizer, x, labels, BATCH_SIZE, EPOCHS, SEED);
+            network.set_default_callback();
+            parameters = network.get_parameters();
+            losses = recorder.losses;
+        }
+
+        /**
+         * Data-parallel training gives the parameters and the losses of serial
+         * training, up to rounding errors.
+         */
+        template <typename Build>
+        void check_matches_serial(Build build) {
+            Parameters serial_parameters;
+            std::vector<double> serial_losses;
+            train(build, 1, serial_parameters, serial_losses);
+            CHECK(serial_losses.size() == EPOCHS * ((OBSERVATIONS + BATCH_SIZE - 1) / BATCH_SIZE));
+
+            for (int threads = 2; threads <= MAX_THREADS; threads++) {
+                Parameters parameters;
+                std::vector<double> losses;
+                train(build, threads, parameters, losses);
+
+                CHECK(parameters.size() == serial_parameters.size());
+                for (std::size_t i = 0; i < parameters.size(); i++) {
+                    for (std::size_t j = 0; j < parameters[i].size(); j++) {
+                        CHECK(std::abs(parameters[i][j] - serial_parameters[i][j]) <= TOLERANCE);
+                    }
+                }
+
+                CHECK(losses.size() == serial_losses.size());
+                for (std::size_t i = 0; i < losses.size(); i++) {
+                    CHECK(std::abs(losses[i] - serial_losses[i]) <= TOLERANCE * std::max(1.0, serial_losses[i]));
+                }
+            }
+        }
+
+        void parallel_matches_serial() {
+            check_matches_serial(fully_connected);
+            check_matches_serial(convolutional);
+        }
+
+        /**
+         * An exception thrown by a worker leaves Network::fit() as in serial training.
+         */
+        void worker_exception() {
+            Network network;
+            network.add_layer(new FailingCopy(INPUTS, OUTPUTS));
+            network.set_output(new MiniDNN::RegressionMSE<double>());
+            network.set_num_threads(2);
+            network.init(0, 0.1, SEED);
+            Eigen::MatrixXd x = Eigen::MatrixXd::Random(INPUTS, OBSERVATIONS);
+            Eigen::MatrixXd y = Eigen::MatrixXd::Random(OUTPUTS, OBSERVATIONS);
+            MiniDNN::SGD<double> optimizer;
+
+            bool thrown = false;
+            try {
+                network.fit(optimizer, x, y, BATCH_SIZE, 1, SEED);
+            } catch (const std::domain_error& error) {
+                thrown = std::string(error.what()) == "worker failure";
+            }
+            CHECK(thrown);
+
+            // The network can still be trained serially
+            network.set_num_threads(1);
+            CHECK(network.fit(optimizer, x, y, BATCH_SIZE, 1, SEED));
+        }
+
+        /**
+         * Data-parallel training rejects the layers whose parameters would not be
+         * synchronized between the workers.
+         */
+        void parameters_outside_arena() {
+            Network network;
+            fully_connected(network);
+            network.init(0, 0.1, SEED);
+            Eigen::MatrixXd x = Eigen::MatrixXd::Random(INPUTS, OBSERVATIONS);
+            Eigen::MatrixXd y = Eigen::MatrixXd::Zero(OUTPUTS, OBSERVATIONS);
+            y.row(0).setOnes();
+
+            MiniDNN::Quantizer<double> quantizer(network);
+            quantizer.calibrate(x);
+            Network quantized;
+            quantizer.quantize(quantized);
+            quantized.set_num_threads(2);
+            MiniDNN::SGD<double> optimizer;
+
+            bool thrown = false;
+            try {
+                quantized.fit(optimizer, x, y, BATCH_SIZE, 1, SEED);
+            } catch (const std::invalid_argument&) {
+                thrown = true;
+            }
+            CHECK(thrown);
+        }
+
+        void run() {
+            parallel_matches_serial();
+            worker_exception();
+            parameters_outside_arena();
+        }
+    }
+}
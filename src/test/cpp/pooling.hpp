@@ -0,0 +1,60 @@
+#pragma once
+
+#include <MiniDNN.h>
+#include "check.hpp"
+#include "gradient.hpp"
+
+namespace NeuralTest {
+    namespace Pooling {
+        constexpr int IMAGE_WIDTH = 7;
+        constexpr int IMAGE_HEIGHT = 6;
+        constexpr int CHANNELS = 3;
+        constexpr int OBSERVATIONS = 4;
+        constexpr double TOLERANCE = 1e-6;
+        constexpr int SEED = 11;
+
+        using MaxPooling = MiniDNN::MaxPooling<MiniDNN::Identity, double>;
+
+        /**
+         * The input gradient of max-pooling matches finite differences for square and
+         * non-square windows, including the windows of a single row or column, and
+         * the windows that do not cover the whole image.
+         */
+        void max_pooling_gradient() {
+            const int windows[][2] = {{2, 2}, {3, 3}, {2, 1}, {1, 2}, {3, 2}, {2, 3}, {1, 4}, {4, 1}, {6, 5}};
+
+            for (const auto& window : windows) {
+                MaxPooling pooling(IMAGE_WIDTH, IMAGE_HEIGHT, CHANNELS, window[0], window[1]);
+                Gradient::check(pooling, OBSERVATIONS, TOLERANCE, SEED);
+            }
+        }
+
+        /**
+         * Max-pooling with windows of one row or one column picks the maximum of the window.
+         */
+        void max_pooling_thin_windows() {
+            // One channel of 4 x 2 (height x width) stored column by column
+            Eigen::MatrixXd x(8, 1);
+            x << 1, 5, 2, 0, 3, 4, 7, 6;
+            MiniDNN::internal::Workspace workspace;
+
+            // Windows of 2 rows and 1 column
+            MaxPooling tall(2, 4, 1, 1, 2);
+            Gradient::loss(tall, workspace, x, Eigen::MatrixXd::Zero(4, 1));
+            Eigen::MatrixXd expected(4, 1);
+            expected << 5, 2, 4, 7;
+            CHECK(tall.output() == expected);
+
+            // Windows of 1 row and 2 columns
+            MaxPooling wide(2, 4, 1, 2, 1);
+            Gradient::loss(wide, workspace, x, Eigen::MatrixXd::Zero(4, 1));
+            expected << 3, 5, 7, 6;
+            CHECK(wide.output() == expected);
+        }
+
+        void run() {
+            max_pooling_gradient();
+            max_pooling_thin_windows();
+        }
+    }
+}
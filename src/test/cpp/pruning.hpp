@@ -0,0 +1,217 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include <MiniDNN.h>
+#include "check.hpp"
+#include "gradient.hpp"
+
+namespace NeuralTest {
+    namespace Pruning {
+        constexpr int INPUTS = 10;
+        constexpr int HIDDEN = 12;
+        constexpr int OUTPUTS = 3;
+        constexpr int OBSERVATIONS = 40;
+        constexpr int BATCH_SIZE = 16;
+        constexpr int EPOCHS = 3;
+        constexpr double SPARSITY = 0.75;
+        constexpr double TOLERANCE = 1e-12;
+        constexpr int SEED = 47;
+
+        using Network = MiniDNN::Network<double>;
+        using Sparse = MiniDNN::SparseFullyConnected<MiniDNN::Tanh, double>;
+        using Parameters = std::vector<std::vector<double>>;
+
+        void build(Network& network) {
+            network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Tanh, double>(INPUTS, HIDDEN));
+            network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Identity, double>(HIDDEN, OUTPUTS));
+            network.set_output(new MiniDNN::RegressionMSE<double>());
+            network.init(0, 0.5, SEED);
+        }
+
+        /**
+         * Number of weights kept in a layer of the given size at the given sparsity.
+         */
+        int kept(int in_size, int out_size, double sparsity) {
+            return int(std::floor((1 - sparsity) * in_size * out_size + 0.5));
+        }
+
+        /**
+         * The pruned network keeps the weights of largest magnitude of each fully
+         * connected layer, and predicts as a dense network with the same weights.
+         */
+        void pruned_network() {
+            Network network;
+            build(network);
+            Network pruned;
+            MiniDNN::Pruner<double>(network).prune(pruned, SPARSITY);
+
+            const Parameters original = network.get_parameters();
+            const Parameters parameters = pruned.get_parameters();
+            const std::vector<const MiniDNN::Layer<double>*> layers = pruned.get_layers();
+            CHECK(layers.size() == 2);
+
+            for (std::size_t i = 0; i < layers.size(); i++) {
+                const MiniDNN::Layer<double>* layer = layers[i];
+                const int weights = layer->in_size() * layer->out_size();
+                double smallest_kept = INFINITY, largest_removed = 0;
+                int nonzeros = 0;
+
+                for (int k = 0; k < weights; k++) {
+                    if (parameters[i][k] != 0) {
+                        CHECK(parameters[i][k] == original[i][k]);
+                        smallest_kept = std::min(smallest_kept, std::abs(original[i][k]));
+                        nonzeros++;
+                    } else {
+                        largest_removed = std::max(largest_removed, std::abs(original[i][k]));
+                    }
+                }
+                CHECK(nonzeros == kept(layer->in_size(), layer->out_size(), SPARSITY));
+                CHECK(smallest_kept >= largest_removed);
+                // The bias is not pruned
+                CHECK(std::equal(parameters[i].begin() + weights, parameters[i].end(), original[i].begin() + weights));
+            }
+
+            const Sparse* sparse = dynamic_cast<const Sparse*>(layers[0]);
+            CHECK(sparse != NULL);
+            CHECK(sparse->num_nonzeros() == kept(INPUTS, HIDDEN, SPARSITY));
+            CHECK(std::abs(sparse->sparsity() - (1 - double(sparse->num_nonzeros()) / (INPUTS * HIDDEN))) <= TOLERANCE);
+
+            Network dense;
+            build(dense);
+            dense.set_parameters(parameters);
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Random(INPUTS, OBSERVATIONS);
+            CHECK((pruned.predict(x) - dense.predict(x)).cwiseAbs().maxCoeff() <= TOLERANCE);
+        }
+
+        /**
+         * The pruned weights stay at zero during fine-tuning, in serial and data-parallel
+         * training, while the other weights are trained.
+         */
+        void masks_survive_training() {
+            Network network;
+            build(network);
+            std::srand(SEED);
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Random(INPUTS, OBSERVATIONS);
+            const Eigen::MatrixXd y = Eigen::MatrixXd::Random(OUTPUTS, OBSERVATIONS);
+
+            for (int threads = 1; threads <= 2; threads++) {
+                Network pruned;
+                MiniDNN::Pruner<double>(network).prune(pruned, SPARSITY);
+                const Parameters before = pruned.get_parameters();
+
+                MiniDNN::Adam<double> optimizer;
+                pruned.set_num_threads(threads);
+                pruned.fit(optimizer, x, y, BATCH_SIZE, EPOCHS, SEED);
+                const Parameters after = pruned.get_parameters();
+
+                for (std::size_t i = 0; i < before.size(); i++) {
+                    for (std::size_t k = 0; k < before[i].size(); k++) {
+                        CHECK((before[i][k] == 0) == (after[i][k] == 0));
+                    }
+                    CHECK(before[i] != after[i]);
+                }
+            }
+        }
+
+        /**
+         * A sparse layer prunes further but never adds weights back.
+         */
+        void layer_pruning() {
+            Sparse layer(INPUTS, HIDDEN);
+            MiniDNN::RNG rng(SEED);
+            layer.init(0, 0.5, rng);
+            CHECK(layer.num_nonzeros() == INPUTS * HIDDEN && layer.sparsity() == 0);
+
+            layer.prune(0.5);
+            CHECK(layer.num_nonzeros() == kept(INPUTS, HIDDEN, 0.5));
+            const std::vector<double> half = layer.get_parameters();
+            layer.prune(SPARSITY);
+            CHECK(layer.num_nonzeros() == kept(INPUTS, HIDDEN, SPARSITY));
+            const std::vector<double> pruned = layer.get_parameters();
+            for (std::size_t k = 0; k < pruned.size(); k++) {
+                CHECK(pruned[k] == 0 || pruned[k] == half[k]);
+            }
+
+            layer.prune(0.5);
+            CHECK(layer.get_parameters() == pruned);
+        }
+
+        /**
+         * The gradients of a sparse layer are those of a dense layer with the same
+         * weights, restricted to the weights that have not been pruned. The pruned
+         * weights cannot be perturbed by finite differences, which would add them back.
+         */
+        void sparse_gradient() {
+            Sparse sparse(INPUTS, HIDDEN);
+            MiniDNN::RNG rng(SEED);
+            sparse.init(0, 0.5, rng);
+            sparse.prune(SPARSITY);
+            MiniDNN::FullyConnected<MiniDNN::Tanh, double> dense(INPUTS, HIDDEN);
+            dense.init();
+            dense.set_parameters(sparse.get_parameters());
+
+            std::srand(SEED);
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Random(INPUTS, OBSERVATIONS);
+            const Eigen::MatrixXd weights = Eigen::MatrixXd::Random(HIDDEN, OBSERVATIONS);
+            MiniDNN::internal::Workspace sparse_workspace, dense_workspace;
+            const double sparse_loss = Gradient::loss(sparse, sparse_workspace, x, weights);
+            const double dense_loss = Gradient::loss(dense, dense_workspace, x, weights);
+            CHECK(std::abs(sparse_loss - dense_loss) <= TOLERANCE);
+            sparse.backprop(x, weights);
+            dense.backprop(x, weights);
+            CHECK((sparse.backprop_data() - dense.backprop_data()).cwiseAbs().maxCoeff() <= TOLERANCE);
+
+            const std::vector<double> parameters = sparse.get_parameters();
+            const std::vector<double> sparse_derivatives = sparse.get_derivatives();
+            const std::vector<double> dense_derivatives = dense.get_derivatives();
+            CHECK(sparse_derivatives.size() == dense_derivatives.size());
+            for (std::size_t k = 0; k < parameters.size(); k++) {
+                const bool pruned = int(k) < INPUTS * HIDDEN && parameters[k] == 0;
+                const double expected = pruned ? 0 : dense_derivatives[k];
+                CHECK(std::abs(sparse_derivatives[k] - expected) <= TOLERANCE);
+            }
+        }
+
+        /**
+         * The pruner rejects invalid sparsities and non-empty destinations.
+         */
+        void invalid_pruning() {
+            Network network;
+            build(network);
+            MiniDNN::Pruner<double> pruner(network);
+            int thrown = 0;
+
+            for (double sparsity : {-0.1, 1.5}) {
+                Network pruned;
+                try {
+                    pruner.prune(pruned, sparsity);
+                } catch (const std::invalid_argument&) {
+                    thrown++;
+                }
+            }
+            try {
+                Network pruned;
+                pruner.prune(pruned, std::vector<double>(1, SPARSITY));
+            } catch (const std::invalid_argument&) {
+                thrown++;
+            }
+            try {
+                pruner.prune(network, SPARSITY);
+            } catch (const std::invalid_argument&) {
+                thrown++;
+            }
+            CHECK(thrown == 4);
+        }
+
+        void run() {
+            pruned_network();
+            masks_survive_training();
+            layer_pruning();
+            sparse_gradient();
+            invalid_pruning();
+        }
+    }
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <MiniDNN.h>
+#include "check.hpp"
+
+namespace NeuralTest {
+    namespace Quantization {
+        constexpr int IMAGE_SIZE = 8;
+        constexpr int CHANNELS = 4;
+        constexpr int OUTPUTS = 5;
+        constexpr int OBSERVATIONS = 200;
+        // Bounds of the errors of 8-bit quantization on this network
+        constexpr double MAX_RELATIVE_ERROR = 0.05;
+        constexpr double MIN_AGREEMENT = 0.9;
+        constexpr int SEED = 43;
+
+        using Network = MiniDNN::Network<double>;
+        using Quantizer = MiniDNN::Quantizer<double>;
+
+        void build(Network& network) {
+            network.add_layer(new MiniDNN::Convolutional<MiniDNN::ReLU, double>(
+                IMAGE_SIZE, IMAGE_SIZE, 1, CHANNELS, 3, 3, 1, 1, 1, 1));
+            network.add_layer(new MiniDNN::MaxPooling<MiniDNN::Identity, double>(
+                IMAGE_SIZE, IMAGE_SIZE, CHANNELS, 2, 2));
+            network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Tanh, double>(
+                IMAGE_SIZE * IMAGE_SIZE * CHANNELS / 4, 16));
+            network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Softmax, double>(16, OUTPUTS));
+            network.set_output(new MiniDNN::MultiClassEntropy<double>());
+            network.init(0, 0.3, SEED);
+        }
+
+        /**
+         * The report of a network compared with itself has no error.
+         */
+        void identical_report() {
+            Network network;
+            build(network);
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Random(IMAGE_SIZE * IMAGE_SIZE, OBSERVATIONS);
+            const MiniDNN::QuantizationReport report = Quantizer::compare(network, network, x);
+
+            CHECK(report.nobs == OBSERVATIONS);
+            CHECK(report.max_abs_error == 0 && report.mean_abs_error == 0 && report.relative_error == 0);
+            CHECK(report.agreement == 1);
+        }
+
+        /**
+         * The quantized network is close to the original one, and the report describes
+         * the differences of their predictions.
+         */
+        void quantized_accuracy() {
+            Network network;
+            build(network);
+            std::srand(SEED);
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Random(IMAGE_SIZE * IMAGE_SIZE, OBSERVATIONS);
+
+            Quantizer quantizer(network);
+            quantizer.calibrate(x.leftCols(OBSERVATIONS / 2));
+            quantizer.calibrate(x.rightCols(OBSERVATIONS / 2));
+            CHECK(quantizer.num_calibration_obs() == OBSERVATIONS);
+            CHECK(quantizer.input_ranges()[0] == x.cwiseAbs().maxCoeff());
+            Network quantized;
+            quantizer.quantize(quantized);
+            CHECK(quantized.num_layers() == network.num_layers());
+
+            const MiniDNN::QuantizationReport report = Quantizer::compare(network, quantized, x);
+            CHECK(report.nobs == OBSERVATIONS);
+            CHECK(report.relative_error > 0 && report.relative_error <= MAX_RELATIVE_ERROR);
+            CHECK(report.agreement >= MIN_AGREEMENT && report.agreement <= 1);
+
+            const Eigen::MatrixXd difference = quantized.predict(x) - network.predict(x);
+            CHECK(std::abs(report.max_abs_error - difference.cwiseAbs().maxCoeff()) <= 1e-12);
+            CHECK(std::abs(report.mean_abs_error - difference.cwiseAbs().mean()) <= 1e-12);
+            CHECK(report.mean_abs_error <= report.max_abs_error);
+        }
+
+        /**
+         * A quantized network gives the same predictions after being exported and
+         * read back.
+         */
+        void export_quantized() {
+            Network network;
+            build(network);
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Random(IMAGE_SIZE * IMAGE_SIZE, OBSERVATIONS);
+            Quantizer quantizer(network);
+            quantizer.calibrate(x);
+            Network quantized;
+            quantizer.quantize(quantized);
+
+            const std::filesystem::path folder = std::filesystem::temp_directory_path() / "minidnn_test_quantized";
+            quantized.export_net(folder.string(), "network");
+            Network imported;
+            imported.read_net(folder.string(), "network");
+            std::filesystem::remove_all(folder);
+
+            CHECK(imported.predict(x) == quantized.predict(x));
+        }
+
+        /**
+         * The quantizer must be calibrated, and the destination network must be empty.
+         */
+        void invalid_quantization() {
+            Network network;
+            build(network);
+            Quantizer quantizer(network);
+            Network quantized;
+            int thrown = 0;
+
+            try {
+                quantizer.quantize(quantized);
+            } catch (const std::logic_error&) {
+                thrown++;
+            }
+            quantizer.calibrate(Eigen::MatrixXd::Random(IMAGE_SIZE * IMAGE_SIZE, 1));
+            try {
+                quantizer.quantize(network);
+            } catch (const std::invalid_argument&) {
+                thrown++;
+            }
+            CHECK(thrown == 2);
+        }
+
+        void run() {
+            identical_report();
+            quantized_accuracy();
+            export_quantized();
+            invalid_quantization();
+        }
+    }
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <filesystem>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <MiniDNN.h>
+#include "check.hpp"
+
+namespace NeuralTest {
+    namespace Serving {
+        constexpr int INPUTS = 6;
+        constexpr int OUTPUTS = 3;
+        constexpr int OBSERVATIONS = 30;
+        constexpr int MAX_BATCH = 8;
+        // Long enough for the requests submitted together to be batched together
+        constexpr int MAX_DELAY_US = 200000;
+        constexpr int WORKERS = 2;
+        constexpr int CLIENTS = 3;
+        constexpr int CAPACITY = 10;
+        constexpr double TOLERANCE = 1e-12;
+        constexpr int SEED = 41;
+
+        using Network = MiniDNN::Network<double>;
+        using Batcher = MiniDNN::RequestBatcher<double>;
+
+        void build(Network& network) {
+            network.add_layer(new MiniDNN::FullyConnected<MiniDNN::ReLU, double>(INPUTS, 12));
+            network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Softmax, double>(12, OUTPUTS));
+            network.set_output(new MiniDNN::MultiClassEntropy<double>());
+            network.init(0, 0.1, SEED);
+        }
+
+        /**
+         * Whether the predictions match those of the network, which may group the
+         * observations differently.
+         */
+        bool matches(const Eigen::MatrixXd& prediction, const Eigen::MatrixXd& expected) {
+            return prediction.rows() == expected.rows() && prediction.cols() == expected.cols() &&
+                   (prediction - expected).cwiseAbs().maxCoeff() <= TOLERANCE;
+        }
+
+        /**
+         * Requests submitted together are served by shared batches, each receiving the
+         * predictions of its own observations.
+         */
+        void batched_requests() {
+            Network network;
+            build(network);
+            std::srand(SEED);
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Random(INPUTS, OBSERVATIONS);
+            const Eigen::MatrixXd expected = network.predict(x);
+
+            Batcher batcher(network, MAX_BATCH, MAX_DELAY_US, WORKERS);
+            CHECK(batcher.in_size() == INPUTS && batcher.out_size() == OUTPUTS);
+            Eigen::MatrixXd prediction(OUTPUTS, OBSERVATIONS);
+            std::vector<std::future<void>> requests;
+            for (int j = 0; j < OBSERVATIONS; j++) {
+                requests.push_back(batcher.submit(x.col(j).data(), 1, prediction.col(j).data()));
+            }
+            for (std::size_t i = 0; i < requests.size(); i++) {
+                requests[i].get();
+            }
+
+            CHECK(matches(prediction, expected));
+            CHECK(batcher.average_batch_size() > 1);
+
+            // Larger predictions are split into several requests
+            CHECK(matches(batcher.predict(x), expected));
+        }
+
+        /**
+         * Requests from several threads are served concurrently.
+         */
+        void concurrent_requests() {
+            Network network;
+            build(network);
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Random(INPUTS, OBSERVATIONS);
+            const Eigen::MatrixXd expected = network.predict(x);
+            Batcher batcher(network, MAX_BATCH, 1000, WORKERS);
+
+            std::vector<int> failures(CLIENTS, 0);
+            std::vector<std::thread> threads;
+            for (int t = 0; t < CLIENTS; t++) {
+                threads.push_back(std::thread([&, t] {
+                    for (int n = 1 + t; n <= OBSERVATIONS; n += CLIENTS) {
+                        if (!matches(batcher.predict(x.leftCols(n)), expected.leftCols(n))) {
+                            failures[t]++;
+                        }
+                    }
+                }));
+            }
+            for (std::size_t t = 0; t < threads.size(); t++) {
+                threads[t].join();
+            }
+            for (int t = 0; t < CLIENTS; t++) {
+                CHECK(failures[t] == 0);
+            }
+        }
+
+        /**
+         * The batcher rejects invalid parameters and requests.
+         */
+        void invalid_requests() {
+            Network network;
+            build(network);
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Zero(INPUTS, MAX_BATCH + 1);
+            Eigen::MatrixXd prediction(OUTPUTS, MAX_BATCH + 1);
+            Batcher batcher(network, MAX_BATCH, 0);
+            int thrown = 0;
+
+            try {
+                Batcher invalid(network, 0, 0);
+            } catch (const std::invalid_argument&) {
+                thrown++;
+            }
+            try {
+                batcher.submit(x.data(), 0, prediction.data());
+            } catch (const std::invalid_argument&) {
+                thrown++;
+            }
+            try {
+                batcher.submit(x.data(), MAX_BATCH + 1, prediction.data());
+            } catch (const std::invalid_argument&) {
+                thrown++;
+            }
+            try {
+                batcher.predict(Eigen::MatrixXd::Zero(INPUTS + 1, 1));
+            } catch (const std::invalid_argument&) {
+                thrown++;
+            }
+            CHECK(thrown == 4);
+        }
+
+        /**
+         * Clients on several threads get the predictions of the network through the
+         * server, and cannot exceed the capacity of their shared memory.
+         */
+        void socket_server() {
+            Network network;
+            build(network);
+            const Eigen::MatrixXd x = Eigen::MatrixXd::Random(INPUTS, CAPACITY);
+            const Eigen::MatrixXd expected = network.predict(x);
+            const std::string path = (std::filesystem::temp_directory_path() / "minidnn_test_serving.sock").string();
+
+            Batcher batcher(network, MAX_BATCH, 1000, WORKERS);
+            MiniDNN::InferenceServer<double> server(batcher, path);
+
+            std::vector<int> failures(CLIENTS, 0);
+            std::vector<std::thread> threads;
+            for (int t = 0; t < CLIENTS; t++) {
+                threads.push_back(std::thread([&, t] {
+                    MiniDNN::InferenceClient<double> client(path, CAPACITY);
+                    if (client.in_size() != INPUTS || client.out_size() != OUTPUTS) {
+                        failures[t]++;
+                    }
+                    for (int n = 1 + t; n <= CAPACITY; n++) {
+                        if (!matches(client.predict(x.leftCols(n)), expected.leftCols(n))) {
+                            failures[t]++;
+                        }
+                    }
+                }));
+            }
+            for (std::size_t t = 0; t < threads.size(); t++) {
+                threads[t].join();
+            }
+            for (int t = 0; t < CLIENTS; t++) {
+                CHECK(failures[t] == 0);
+            }
+
+            MiniDNN::InferenceClient<double> client(path, CAPACITY);
+            bool thrown = false;
+            try {
+                client.run(CAPACITY + 1);
+            } catch (const std::invalid_argument&) {
+                thrown = true;
+            }
+            CHECK(thrown);
+            server.stop();
+        }
+
+        void run() {
+            batched_requests();
+            concurrent_requests();
+            invalid_requests();
+            socket_server();
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+#include <MiniDNN.h>
+#include "check.hpp"
+
+namespace NeuralTest {
+    namespace Transforms {
+        constexpr int IMAGE_SIZE = 10;
+        constexpr int CHANNELS = 32;
+        constexpr int OUTPUTS = 3;
+        constexpr int BATCH_SIZE = 16;
+        constexpr int SEED = 7;
+
+        using Network = MiniDNN::Network<double>;
+        using Convolution = MiniDNN::Convolutional<MiniDNN::ReLU, double>;
+        using Parameters = std::vector<std::vector<double>>;
+
+        /**
+         * Builds a network whose first layer uses the Winograd algorithm, and returns that layer.
+         */
+        Convolution* build(Network& network) {
+            Convolution* convolution = new Convolution(IMAGE_SIZE, IMAGE_SIZE, CHANNELS, CHANNELS, 3, 3, 1, 1, 1, 1);
+            convolution->use_winograd(true);
+            network.add_layer(convolution);
+            network.add_layer(new MiniDNN::FullyConnected<MiniDNN::Identity, double>(convolution->out_size(), OUTPUTS));
+            network.set_output(new MiniDNN::RegressionMSE<double>());
+            network.init(0, 0.01, SEED);
+            return convolution;
+        }
+
+        /**
+         * The filters are transformed once for each change of the parameters, and
+         * predictions reuse them until the next change.
+         */
+        void predict_reuses_transforms() {
+            Network network;
+            Convolution* convolution = build(network);
+            Eigen::MatrixXd x = Eigen::MatrixXd::Random(convolution->in_size(), BATCH_SIZE);
+            Eigen::MatrixXd y = Eigen::MatrixXd::Random(OUTPUTS, BATCH_SIZE);
+
+            MiniDNN::SGD<double> optimizer(0.01);
+            network.set_num_threads(2);
+            network.fit(optimizer, x, y, BATCH_SIZE / 2, 2, SEED);
+            int count = convolution->num_transforms();
+            Eigen::MatrixXd first = network.predict(x);
+            Eigen::MatrixXd second = network.predict(x);
+            CHECK(convolution->num_transforms() == count);
+            CHECK(first == second);
+            MiniDNN::InferenceSession<double> session(network);
+            CHECK(session.predict(x) == first);
+
+            // Parameters written through the views are transformed once the network is notified
+            std::vector<std::vector<Eigen::Map<Eigen::VectorXd, Eigen::Aligned>>> views = network.get_parameters_view();
+            views[0][0] *= 2.0;
+            network.parameters_changed();
+            CHECK(convolution->num_transforms() == count + 1);
+            Eigen::MatrixXd changed = network.predict(x);
+            network.predict(x);
+            CHECK(convolution->num_transforms() == count + 1);
+
+            Network reference;
+            build(reference);
+            reference.set_parameters(network.get_parameters());
+            CHECK((changed - reference.predict(x)).cwiseAbs().maxCoeff() < 1e-12);
+            CHECK((changed - first).cwiseAbs().maxCoeff() > 1e-6);
+        }
+
+        void run() {
+            predict_reuses_transforms();
+        }
+    }
+}